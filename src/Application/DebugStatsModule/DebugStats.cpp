@@ -11,6 +11,7 @@
 
 #include "DebugStats.h"
 #include "TimeProfilerWindow.h"
+#include "TelemetryExporter.h"
 
 #include "Framework.h"
 #include "UiAPI.h"
@@ -37,13 +38,15 @@ using namespace std;
 
 DebugStatsModule::DebugStatsModule() :
     IModule("DebugStats"),
-    profilerWindow_(0)
+    profilerWindow_(0),
+    telemetry_(0)
 {
 }
 
 DebugStatsModule::~DebugStatsModule()
 {
     SAFE_DELETE(profilerWindow_);
+    SAFE_DELETE(telemetry_);
 }
 
 void DebugStatsModule::Initialize()
@@ -61,6 +64,16 @@ void DebugStatsModule::Initialize()
 
     inputContext = framework_->Input()->RegisterInputContext("DebugStatsInput", 90);
     connect(inputContext.get(), SIGNAL(KeyPressed(KeyEvent *)), this, SLOT(HandleKeyPressed(KeyEvent *)));
+
+    QStringList telemetryFile = framework_->CommandLineParameters("--telemetry");
+    if (!telemetryFile.isEmpty())
+    {
+        float interval = 10.f;
+        QStringList telemetryInterval = framework_->CommandLineParameters("--telemetryinterval");
+        if (!telemetryInterval.isEmpty() && telemetryInterval.first().toFloat() > 0.f)
+            interval = telemetryInterval.first().toFloat();
+        telemetry_ = new TelemetryExporter(framework_, telemetryFile.first(), interval);
+    }
 }
 
 void DebugStatsModule::HandleKeyPressed(KeyEvent *e)
@@ -107,6 +120,9 @@ void DebugStatsModule::DumpInputContexts()
 
 void DebugStatsModule::Update(f64 frametime)
 {
+    if (telemetry_)
+        telemetry_->Update(frametime);
+
 #ifdef _WINDOWS
     LARGE_INTEGER now;
     QueryPerformanceCounter(&now);
@@ -21,6 +21,7 @@
 #endif
 
 class TimeProfilerWindow;
+class TelemetryExporter;
 
 class DEBUGSTATS_MODULE_API DebugStatsModule : public IModule
 {
@@ -53,6 +54,7 @@ private:
 
     std::vector<std::pair<u64, double> > frameTimes; ///< A history of estimated frame times.
     QPointer<TimeProfilerWindow> profilerWindow_; /// Profiler window
+    TelemetryExporter *telemetry_; ///< Writes the headless telemetry file, null if not enabled.
     boost::shared_ptr<InputContext> inputContext; ///< InputContext for Shift-P - Profiler window shortcut.
 #ifdef _WINDOWS
     LARGE_INTEGER lastCallTime; ///< Last call time of Update() function
@@ -0,0 +1,336 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TelemetryExporter.h"
+#include "Framework.h"
+#include "Profiler.h"
+#include "AssetAPI.h"
+#include "SceneAPI.h"
+#include "Scene.h"
+#include "PhysicsWorld.h"
+#include "TundraLogicModule.h"
+#include "KristalliProtocolModule.h"
+#include "SyncState.h"
+#include "UserConnection.h"
+#include "LoggingFunctions.h"
+
+#include <QFile>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+TelemetryHistogram::TelemetryHistogram(const std::vector<double> &bounds) :
+    bounds_(bounds),
+    counts_(bounds.size() + 1, 0),
+    intervalCounts_(bounds.size() + 1, 0),
+    count_(0),
+    sum_(0.0),
+    intervalCount_(0),
+    intervalMax_(0.0)
+{
+}
+
+void TelemetryHistogram::Observe(double value)
+{
+    size_t bucket = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+    ++counts_[bucket];
+    ++intervalCounts_[bucket];
+    ++count_;
+    sum_ += value;
+    ++intervalCount_;
+    intervalMax_ = std::max(intervalMax_, value);
+}
+
+double TelemetryHistogram::IntervalQuantile(double q) const
+{
+    if (intervalCount_ == 0)
+        return 0.0;
+
+    u64 rank = (u64)(q * intervalCount_ + 0.5);
+    u64 cumulative = 0;
+    for(size_t i = 0; i < bounds_.size(); ++i)
+    {
+        cumulative += intervalCounts_[i];
+        if (cumulative >= rank)
+            return std::min(bounds_[i], intervalMax_);
+    }
+    return intervalMax_; // The quantile is in the +Inf bucket.
+}
+
+void TelemetryHistogram::ResetInterval()
+{
+    std::fill(intervalCounts_.begin(), intervalCounts_.end(), 0);
+    intervalCount_ = 0;
+    intervalMax_ = 0.0;
+}
+
+void TelemetryHistogram::WriteSamples(QTextStream &out, const QString &name, const QString &labels) const
+{
+    const QString separator = labels.isEmpty() ? "" : ",";
+    u64 cumulative = 0;
+    for(size_t i = 0; i < bounds_.size(); ++i)
+    {
+        cumulative += counts_[i];
+        out << name << "_bucket{" << labels << separator << "le=\"" << bounds_[i] << "\"} " << cumulative << "\n";
+    }
+    out << name << "_bucket{" << labels << separator << "le=\"+Inf\"} " << count_ << "\n";
+
+    const QString braced = labels.isEmpty() ? "" : "{" + labels + "}";
+    out << name << "_sum" << braced << " " << sum_ << "\n";
+    out << name << "_count" << braced << " " << count_ << "\n";
+}
+
+TelemetryExporter::TelemetryExporter(Framework *framework, const QString &filename, float interval) :
+    framework_(framework),
+    filename_(filename),
+    interval_(interval),
+    timeSinceWrite_(0.f),
+    numPrunedThreads_(0),
+    frameTime_(DurationBuckets()),
+    physicsStep_(DurationBuckets())
+{
+    LogInfo("TelemetryExporter: Writing telemetry to " + filename_ + " every " + QString::number(interval_) + " seconds.");
+}
+
+TelemetryExporter::~TelemetryExporter()
+{
+}
+
+std::vector<double> TelemetryExporter::DurationBuckets()
+{
+    const double bounds[] = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.016, 0.025, 0.033, 0.05, 0.1, 0.25, 0.5, 1.0 };
+    return std::vector<double>(bounds, bounds + sizeof(bounds) / sizeof(bounds[0]));
+}
+
+void TelemetryExporter::Update(f64 frametime)
+{
+    frameTime_.Observe(frametime);
+
+    Profiler *profiler = framework_->GetProfiler();
+    if (profiler)
+    {
+        // The lock keeps the nodes of the exited threads from being freed while the nodes are read.
+        profiler->Lock();
+        if (profiler->NumPrunedThreads() != numPrunedThreads_)
+        {
+            // The physics step node may have been in a thread that has exited. It is looked up again on the next write.
+            numPrunedThreads_ = profiler->NumPrunedThreads();
+            physicsStepSampler_ = BlockSampler();
+        }
+
+        // In threaded mode the physics step node is written by the worker thread without the profiler lock,
+        // so it is read only when no step is running. A step that is still running is sampled on a later frame.
+        ScenePtr scene = framework_->Scene()->GetDefaultScene();
+        boost::shared_ptr<Physics::PhysicsWorld> physics = scene ? scene->GetWorld<Physics::PhysicsWorld>() : boost::shared_ptr<Physics::PhysicsWorld>();
+        if (!physics || !physics->IsSimulating())
+            Sample(physicsStepSampler_, physicsStep_);
+        for(std::map<std::string, std::pair<BlockSampler, TelemetryHistogram> >::iterator iter = modules_.begin(); iter != modules_.end(); ++iter)
+            Sample(iter->second.first, iter->second.second);
+        profiler->Release();
+    }
+
+    timeSinceWrite_ += (float)frametime;
+    if (timeSinceWrite_ >= interval_)
+    {
+        timeSinceWrite_ = 0.f;
+        Write();
+    }
+}
+
+void TelemetryExporter::Sample(BlockSampler &sampler, TelemetryHistogram &histogram)
+{
+    if (!sampler.node)
+        return;
+
+    // The profiler only accumulates the totals, so the time of this frame is the difference to the previous frame.
+    unsigned long calls = sampler.node->num_called_total_;
+    double total = sampler.node->total_;
+    if (calls != sampler.lastCalls)
+        histogram.Observe(std::max(total - sampler.lastTotal, 0.0));
+    sampler.lastCalls = calls;
+    sampler.lastTotal = total;
+}
+
+namespace
+{
+    /// Collects the profiling nodes below the given node that match the given name, or all Module_<name>_Update nodes if the name is empty.
+    void CollectProfilerNodes(ProfilerNodeTree *parent, const std::string &name, std::vector<ProfilerNode *> &dst)
+    {
+        const ProfilerNodeTree::NodeList &children = parent->GetChildren();
+        for(ProfilerNodeTree::NodeList::const_iterator iter = children.begin(); iter != children.end(); ++iter)
+        {
+            ProfilerNode *node = dynamic_cast<ProfilerNode *>(iter->get());
+            if (node)
+            {
+                const std::string &nodeName = node->Name();
+                if (name.empty() ? (nodeName.find("Module_") == 0 && nodeName.length() > 14 && nodeName.rfind("_Update") == nodeName.length() - 7)
+                    : nodeName == name)
+                    dst.push_back(node);
+            }
+            CollectProfilerNodes(iter->get(), name, dst);
+        }
+    }
+}
+
+void TelemetryExporter::FindProfilerBlocks()
+{
+#ifdef PROFILING
+    Profiler *profiler = framework_->GetProfiler();
+    if (!profiler)
+        return;
+
+    // The profiler lock keeps the other threads from adding nodes while the trees are traversed.
+    ProfilerNodeTree *root = profiler->Lock();
+    if (profiler->NumPrunedThreads() != numPrunedThreads_)
+    {
+        numPrunedThreads_ = profiler->NumPrunedThreads();
+        physicsStepSampler_ = BlockSampler();
+    }
+    if (!physicsStepSampler_.node)
+    {
+        // The simulation step is run in a worker thread if threaded physics is enabled, so look in all threads.
+        std::vector<ProfilerNode *> nodes;
+        CollectProfilerNodes(root, "PhysicsWorld_StepSimulation", nodes);
+        if (!nodes.empty())
+        {
+            physicsStepSampler_.node = nodes.front();
+            physicsStepSampler_.lastCalls = nodes.front()->num_called_total_;
+            physicsStepSampler_.lastTotal = nodes.front()->total_;
+        }
+    }
+
+    // The modules are updated in the main thread, which is the calling thread.
+    ProfilerNodeTree *threadRoot = profiler->GetThreadRootBlock();
+    if (threadRoot)
+    {
+        std::vector<ProfilerNode *> nodes;
+        CollectProfilerNodes(threadRoot, std::string(), nodes);
+        for(size_t i = 0; i < nodes.size(); ++i)
+        {
+            const std::string &nodeName = nodes[i]->Name();
+            std::string moduleName = nodeName.substr(7, nodeName.length() - 14);
+            if (modules_.find(moduleName) != modules_.end())
+                continue;
+
+            BlockSampler sampler;
+            sampler.node = nodes[i];
+            sampler.lastCalls = nodes[i]->num_called_total_;
+            sampler.lastTotal = nodes[i]->total_;
+            modules_.insert(std::make_pair(moduleName, std::make_pair(sampler, TelemetryHistogram(DurationBuckets()))));
+        }
+    }
+    profiler->Release();
+#endif
+}
+
+void TelemetryExporter::WriteHistogram(QTextStream &out, const QString &name, const QString &help, const HistogramSeries &series)
+{
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " histogram\n";
+    for(size_t i = 0; i < series.size(); ++i)
+        series[i].second->WriteSamples(out, name, series[i].first);
+
+    const char *suffixes[] = { "_p50", "_p99", "_max" };
+    for(int s = 0; s < 3; ++s)
+    {
+        out << "# TYPE " << name << suffixes[s] << " gauge\n";
+        for(size_t i = 0; i < series.size(); ++i)
+        {
+            const TelemetryHistogram *histogram = series[i].second;
+            double value = (s == 0) ? histogram->IntervalQuantile(0.5) : (s == 1) ? histogram->IntervalQuantile(0.99) : histogram->IntervalMax();
+            out << name << suffixes[s] << (series[i].first.isEmpty() ? QString() : "{" + series[i].first + "}") << " " << value << "\n";
+        }
+    }
+}
+
+void TelemetryExporter::WriteSyncTraffic(QTextStream &out)
+{
+    TundraLogic::TundraLogicModule *tundra = framework_->GetModule<TundraLogic::TundraLogicModule>();
+    if (!tundra || !tundra->IsServer() || !tundra->GetKristalliModule())
+        return;
+
+    std::vector<std::pair<int, TundraLogic::SceneSyncState *> > states;
+    UserConnectionList &users = tundra->GetKristalliModule()->GetUserConnections();
+    for(UserConnectionList::iterator iter = users.begin(); iter != users.end(); ++iter)
+    {
+        TundraLogic::SceneSyncState *state = dynamic_cast<TundraLogic::SceneSyncState *>((*iter)->syncState.get());
+        if (state)
+            states.push_back(std::make_pair((*iter)->GetConnectionID(), state));
+    }
+
+    out << "# HELP tundra_connected_users Number of users connected to the server.\n";
+    out << "# TYPE tundra_connected_users gauge\n";
+    out << "tundra_connected_users " << users.size() << "\n";
+
+    const char *names[] = { "tundra_sync_sent_bytes_total", "tundra_sync_sent_messages_total", "tundra_sync_received_bytes_total", "tundra_sync_received_messages_total" };
+    const char *helps[] = { "Scene replication bytes sent to the user.", "Scene replication messages sent to the user.",
+        "Scene replication bytes received from the user.", "Scene replication messages received from the user." };
+    for(int m = 0; m < 4; ++m)
+    {
+        out << "# HELP " << names[m] << " " << helps[m] << "\n";
+        out << "# TYPE " << names[m] << " counter\n";
+        for(size_t i = 0; i < states.size(); ++i)
+        {
+            const TundraLogic::SceneSyncState *state = states[i].second;
+            u64 value = (m == 0) ? state->bytes_sent_ : (m == 1) ? state->messages_sent_ : (m == 2) ? state->bytes_received_ : state->messages_received_;
+            out << names[m] << "{user=\"" << states[i].first << "\"} " << value << "\n";
+        }
+    }
+}
+
+void TelemetryExporter::Write()
+{
+    PROFILE(TelemetryExporter_Write);
+
+    FindProfilerBlocks();
+
+    QString text;
+    QTextStream out(&text);
+
+    HistogramSeries series;
+    series.push_back(std::make_pair(QString(), &frameTime_));
+    WriteHistogram(out, "tundra_frame_time_seconds", "Time between consecutive frames.", series);
+
+    series.clear();
+    for(std::map<std::string, std::pair<BlockSampler, TelemetryHistogram> >::const_iterator iter = modules_.begin(); iter != modules_.end(); ++iter)
+        series.push_back(std::make_pair("module=\"" + QString::fromStdString(iter->first) + "\"", &iter->second.second));
+    if (!series.empty())
+        WriteHistogram(out, "tundra_module_update_seconds", "Time spent in the Update of each module per frame.", series);
+
+    if (physicsStepSampler_.node)
+    {
+        series.clear();
+        series.push_back(std::make_pair(QString(), &physicsStep_));
+        WriteHistogram(out, "tundra_physics_step_seconds", "Time spent in the Bullet simulation step.", series);
+    }
+
+    out << "# HELP tundra_asset_pending_transfers Number of asset transfers in progress.\n";
+    out << "# TYPE tundra_asset_pending_transfers gauge\n";
+    out << "tundra_asset_pending_transfers " << framework_->Asset()->PendingTransfers().size() << "\n";
+
+    WriteSyncTraffic(out);
+    out.flush();
+
+    frameTime_.ResetInterval();
+    physicsStep_.ResetInterval();
+    for(std::map<std::string, std::pair<BlockSampler, TelemetryHistogram> >::iterator iter = modules_.begin(); iter != modules_.end(); ++iter)
+        iter->second.second.ResetInterval();
+
+    // Write to a temporary file and replace the old file with it, so that a scraper never sees a partially written file.
+    QString tempFilename = filename_ + ".tmp";
+    QFile file(tempFilename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LogError("TelemetryExporter::Write: Failed to open " + tempFilename + " for writing.");
+        return;
+    }
+    file.write(text.toUtf8());
+    file.close();
+
+    QFile::remove(filename_);
+    if (!QFile::rename(tempFilename, filename_))
+        LogError("TelemetryExporter::Write: Failed to rename " + tempFilename + " to " + filename_ + ".");
+}
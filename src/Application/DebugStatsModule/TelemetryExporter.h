@@ -0,0 +1,112 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+
+#include <QString>
+#include <QTextStream>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class Framework;
+class ProfilerNode;
+
+/// Fixed-bucket histogram of non-negative values, such as durations in seconds.
+/** Keeps cumulative bucket counts for the lifetime of the histogram, and separate counts for the current reporting interval,
+    from which the percentiles and the maximum of the interval are estimated. */
+class TelemetryHistogram
+{
+public:
+    /// @param bounds The upper bounds of the buckets in ascending order. Values above the last bound go to an implicit +Inf bucket.
+    explicit TelemetryHistogram(const std::vector<double> &bounds);
+
+    /// Adds a value to the histogram.
+    void Observe(double value);
+
+    /// Returns the upper bound of the bucket the given quantile of the values of the current interval falls in, clamped to the maximum of the interval.
+    double IntervalQuantile(double q) const;
+
+    /// Returns the largest value of the current interval, or 0 if there were no values.
+    double IntervalMax() const { return intervalMax_; }
+
+    /// Starts a new reporting interval.
+    void ResetInterval();
+
+    /// Writes the bucket, sum and count samples of the histogram in the Prometheus text format.
+    /** @param name Metric name.
+        @param labels Label pairs without braces, f.ex. module="Foo", or empty. */
+    void WriteSamples(QTextStream &out, const QString &name, const QString &labels) const;
+
+private:
+    std::vector<double> bounds_;
+    std::vector<u64> counts_; ///< Lifetime count of each bucket, including the +Inf bucket.
+    std::vector<u64> intervalCounts_; ///< Count of each bucket during the current interval.
+    u64 count_;
+    double sum_;
+    u64 intervalCount_;
+    double intervalMax_;
+};
+
+/// Periodically writes server health metrics to a file in the Prometheus text exposition format.
+/** Intended for headless servers, where the profiler window is not available. The file is replaced atomically, so it can be
+    scraped f.ex. with the textfile collector of the Prometheus node exporter. Enabled with the --telemetry <filename> command line
+    parameter, and the interval in seconds can be set with --telemetryinterval <seconds> (default 10).
+
+    The exported metrics are the frame time, the update time of each module from the Module_<name>_Update profiling blocks,
+    the Bullet simulation step time, the number of pending asset transfers, and the scene replication traffic of each user. */
+class TelemetryExporter
+{
+public:
+    TelemetryExporter(Framework *framework, const QString &filename, float interval);
+    ~TelemetryExporter();
+
+    /// Samples the per-frame metrics, and writes the file when the interval has elapsed.
+    void Update(f64 frametime);
+
+    /// Writes the metrics to the file now.
+    void Write();
+
+private:
+    /// Tracks the deltas of the cumulative timings of a profiling block between frames.
+    struct BlockSampler
+    {
+        BlockSampler() : node(0), lastCalls(0), lastTotal(0.0) {}
+        const ProfilerNode *node;
+        unsigned long lastCalls;
+        double lastTotal;
+    };
+
+    /// Finds the profiling blocks of the module updates and the physics step that have appeared since the last call.
+    void FindProfilerBlocks();
+
+    /// Adds the time spent in the block since the last sample to the histogram, if the block was entered. Call with the profiler locked.
+    static void Sample(BlockSampler &sampler, TelemetryHistogram &histogram);
+
+    /// The label pairs and the histogram of each series of a metric.
+    typedef std::vector<std::pair<QString, const TelemetryHistogram *> > HistogramSeries;
+
+    /// Writes a histogram metric with all its series, followed by the p50, p99 and max gauges of the current interval.
+    static void WriteHistogram(QTextStream &out, const QString &name, const QString &help, const HistogramSeries &series);
+
+    /// Writes the replication traffic counters of the connected users.
+    void WriteSyncTraffic(QTextStream &out);
+
+    /// Returns the bucket bounds used for durations, in seconds.
+    static std::vector<double> DurationBuckets();
+
+    Framework *framework_;
+    QString filename_;
+    float interval_;
+    float timeSinceWrite_;
+    /// Profiler::NumPrunedThreads() when the nodes were last sampled.
+    unsigned int numPrunedThreads_;
+
+    TelemetryHistogram frameTime_;
+    TelemetryHistogram physicsStep_;
+    BlockSampler physicsStepSampler_;
+    /// Module update time histograms and their samplers, by module name.
+    std::map<std::string, std::pair<BlockSampler, TelemetryHistogram> > modules_;
+};
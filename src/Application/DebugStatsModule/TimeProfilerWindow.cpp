@@ -20,6 +20,8 @@
 #include "Entity.h"
 #include "Renderer.h"
 #include "OgreWorld.h"
+#include "TextureAsset.h"
+#include "TextureStreamer.h"
 
 #include <utility>
 
@@ -96,6 +98,9 @@ TimeProfilerWindow::TimeProfilerWindow(Framework *fw) : framework_(fw)
 
     connect(tab_widget_, SIGNAL(currentChanged(int)), this, SLOT(OnProfilerWindowTabChanged(int)));
 
+    texture_refresh_timer_.setInterval(1000);
+    connect(&texture_refresh_timer_, SIGNAL(timeout()), this, SLOT(RefreshTextureProfilingData()));
+
     show_profiler_tree_ = false;
     show_unused_ = false;
 
@@ -425,6 +430,9 @@ void TimeProfilerWindow::OnProfilerWindowTabChanged(int newPage)
     if (newPage == -1)
         newPage = tab_widget_->currentIndex();
 
+    if (newPage != 6)
+        texture_refresh_timer_.stop();
+
     switch(newPage)
     {
     case 0:
@@ -444,6 +452,8 @@ void TimeProfilerWindow::OnProfilerWindowTabChanged(int newPage)
         break;
     case 6: // Textures
         RefreshAssetData(Ogre::TextureManager::getSingleton(), tree_texture_assets_, "texture");
+        // Keep the residency of the streamed textures up to date while the tab is visible.
+        texture_refresh_timer_.start();
         break;
     case 7: // Meshes
         RefreshAssetData(Ogre::MeshManager::getSingleton(), tree_mesh_assets_, "mesh");
@@ -512,7 +522,7 @@ void TimeProfilerWindow::FillProfileTimingWindow(QTreeWidgetItem *qtNode, const
         ProfilerNodeTree *node = iter->get();
 
         const ProfilerNode *timings_node = dynamic_cast<const ProfilerNode*>(node);
-        if (timings_node && timings_node->num_called_ == 0 && !show_unused_)
+        if (timings_node && timings_node->num_called_ == 0 && timings_node->num_samples_ == 0 && !show_unused_)
             continue;
 
 //        QTreeWidgetItem *item = new QTreeWidgetItem((QTreeWidget*)0, QStringList(QString(node->Name().c_str())));
@@ -549,8 +559,9 @@ void TimeProfilerWindow::FillProfileTimingWindow(QTreeWidgetItem *qtNode, const
             }
             else
             {
+                // The blocks of the sampling profilers are credited with time without being called.
                 item->setText(4, "-");
-                item->setText(5, "-");
+                item->setText(5, timings_node->total_custom_ > 0.0 ? QString::number(timings_node->total_custom_*1000.f / numFrames, 'f', 2) + "ms" : QString("-"));
                 item->setText(6, "-");
             }
 
@@ -1171,7 +1182,7 @@ void TimeProfilerWindow::RefreshProfilingDataTree()
         node = iter->get();
 
         const ProfilerNode *timings_node = dynamic_cast<const ProfilerNode*>(node);
-        if (timings_node && timings_node->num_called_ == 0 && !show_unused_)
+        if (timings_node && timings_node->num_called_ == 0 && timings_node->num_samples_ == 0 && !show_unused_)
             continue;
 
         QTreeWidgetItem *item = FindItemByName(tree_profiling_data_, node->Name().c_str());
@@ -1206,8 +1217,9 @@ void TimeProfilerWindow::RefreshProfilingDataTree()
             }
             else
             {
+                // The blocks of the sampling profilers are credited with time without being called.
                 item->setText(4, "-");
-                item->setText(5, "-");
+                item->setText(5, timings_node->total_custom_ > 0.0 ? QString::number(timings_node->total_custom_*1000.f / numFrames, 'f', 2) + "ms" : QString("-"));
                 item->setText(6, "-");
             }
 
@@ -1516,10 +1528,10 @@ void TimeProfilerWindow::RefreshSceneComplexityProfilingData()
         // Get Ogre meshes from terrain EC
         else if (terrain)
         {
-            for(int y = 0; y < terrain->PatchHeight(); ++y)
-                for(int x = 0; x < terrain->PatchWidth(); ++x)
+            for(int y = 0; y < terrain->ChunkHeight(); ++y)
+                for(int x = 0; x < terrain->ChunkWidth(); ++x)
                 {
-                    Ogre::SceneNode *node = terrain->GetPatch(x, y).node;
+                    Ogre::SceneNode *node = terrain->GetChunk(x, y).node;
                     if (!node)
                         continue;
                     if (!node->numAttachedObjects())
@@ -2063,13 +2075,13 @@ void TimeProfilerWindow::PopulateOgreSceneTree()
 void TimeProfilerWindow::PopulateBulletStats()
 {
     boost::shared_ptr<Physics::PhysicsWorld> physics = framework_->Scene()->GetDefaultScene()->GetWorld<Physics::PhysicsWorld>();
-    const std::set<std::pair<btCollisionObject*, btCollisionObject*> > &collisions = physics->PreviousFrameCollisions();
+    const std::vector<Physics::CollisionPair> &collisions = physics->PreviousFrameCollisions();
 
     treeBulletStats->clear();
-    for(std::set<std::pair<btCollisionObject*, btCollisionObject*> >::const_iterator iter = collisions.begin(); iter != collisions.end(); ++iter)
+    for(std::vector<Physics::CollisionPair>::const_iterator iter = collisions.begin(); iter != collisions.end(); ++iter)
     {
-        btCollisionObject* objectA = iter->first;
-        btCollisionObject* objectB = iter->second;
+        btCollisionObject* objectA = iter->objectA;
+        btCollisionObject* objectB = iter->objectB;
         EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objectA->getUserPointer());
         EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objectB->getUserPointer());
         if (!bodyA || !bodyB)
@@ -2148,7 +2160,16 @@ void TimeProfilerWindow::RefreshRenderTargetProfilingData()
 void TimeProfilerWindow::RefreshTextureProfilingData()
 {
     if (!visibility_ || !tab_widget_ || tab_widget_->currentIndex() != 6)
+    {
+        texture_refresh_timer_.stop();
         return;
+    }
+
+    QLabel *label = findChild<QLabel*>("texture_label");
+    TextureStreamer *streamer = framework_->GetModule<OgreRenderer::OgreRenderingModule>()->GetRenderer()->GetTextureStreamer();
+    if (label && streamer)
+        label->setText(QString("Texture data - %1 streamed textures, %2 MB resident of %3 MB budget").arg(streamer->NumTextures())
+            .arg(streamer->ResidentMemory() / (1024.0 * 1024.0), 0, 'f', 1).arg(streamer->Budget() / (1024.0 * 1024.0), 0, 'f', 1));
 
     Ogre::ResourceManager::ResourceMapIterator iter = Ogre::TextureManager::getSingleton().getResourceIterator();
 
@@ -2203,8 +2224,8 @@ public:
         case 2: // Width
         case 3: // Height
         case 5: // # mips
-        case 14: // 'Loading State'
-        case 15: // 'State Count'
+        case 15: // 'Loading State'
+        case 16: // 'State Count'
             return this->text(treeWidget()->sortColumn()).toInt() > rhs.text(treeWidget()->sortColumn()).toInt();
         default: // Others as text.
             return this->text(treeWidget()->sortColumn()) < rhs.text(treeWidget()->sortColumn());
@@ -2395,13 +2416,22 @@ void TimeProfilerWindow::FillItem(QTreeWidgetItem* item, const Ogre::ResourcePtr
     int i = 2;
     if (viewType == "texture")
     {
-        i = 6;
+        i = 7;
         Ogre::TexturePtr tex = Ogre::TexturePtr(resource);
         
         item->setText(2, QString::number(tex->getWidth()));
         item->setText(3, QString::number(tex->getHeight()));
         item->setText(4, OgrePixelFormatToString(tex->getFormat()));
         item->setText(5, QString::number(tex->getNumMipmaps()));
+
+        // For streamed textures, show which mipmaps of the full texture are resident on the GPU.
+        TextureStreamer *streamer = framework_->GetModule<OgreRenderer::OgreRenderingModule>()->GetRenderer()->GetTextureStreamer();
+        TextureAsset *streamed = streamer ? streamer->GetTexture(resource->getName()) : 0;
+        if (streamed)
+            item->setText(6, QString("Mip %1 of %2x%3, demand %4 px").arg(streamed->ResidentMip()).arg(streamed->FullWidth())
+                .arg(streamed->FullHeight()).arg((int)std::min(streamer->Demand(resource->getName()), 1e6f)));
+        else
+            item->setText(6, "Full");
     }
     else if (viewType == "mesh")
     {
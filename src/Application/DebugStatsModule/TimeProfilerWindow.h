@@ -103,6 +103,8 @@ private:
     bool show_unused_;
     bool visibility_;
     QTimer profiler_update_timer_;
+    /// Refreshes the texture tab while it is the current tab.
+    QTimer texture_refresh_timer_;
     float logThreshold_;
     /// Directory.for log files.
     QDir logDirectory_;
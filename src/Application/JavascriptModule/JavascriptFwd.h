@@ -13,6 +13,7 @@ class EC_Script;
 
 class JavascriptModule;
 class JavascriptInstance;
+class ScriptEnginePool;
 class ScriptAsset;
 
 typedef boost::shared_ptr<ScriptAsset> ScriptAssetPtr;
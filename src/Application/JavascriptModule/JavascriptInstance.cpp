@@ -18,6 +18,13 @@
 #include "AssetAPI.h"
 #include "IAssetStorage.h"
 #include "LoggingFunctions.h"
+#include "ScriptEnginePool.h"
+#include "ScriptProgramCache.h"
+#include "ScriptSamplingProfiler.h"
+#include "Profiler.h"
+#include "IComponent.h"
+#include "IAttribute.h"
+#include "Entity.h"
 
 #include <QFile>
 #include <sstream>
@@ -33,9 +40,12 @@ Q_DECLARE_METATYPE(QScriptClass*)
 
 JavascriptInstance::JavascriptInstance(const QString &fileName, JavascriptModule *module) :
     engine_(0),
+    sharedEngine_(false),
     sourceFile(fileName),
     module_(module),
-    evaluated(false)
+    evaluated(false),
+    profilingEnabled_(false),
+    frameEventsEveryFrame_(false)
 {
     CreateEngine();
     Load();
@@ -43,8 +53,11 @@ JavascriptInstance::JavascriptInstance(const QString &fileName, JavascriptModule
 
 JavascriptInstance::JavascriptInstance(ScriptAssetPtr scriptRef, JavascriptModule *module) :
     engine_(0),
+    sharedEngine_(false),
     module_(module),
-    evaluated(false)
+    evaluated(false),
+    profilingEnabled_(false),
+    frameEventsEveryFrame_(false)
 {
     // Make sure we do not push null or empty script assets as sources
     if (scriptRef && !scriptRef->scriptContent.isEmpty())
@@ -54,10 +67,13 @@ JavascriptInstance::JavascriptInstance(ScriptAssetPtr scriptRef, JavascriptModul
     Load();
 }
 
-JavascriptInstance::JavascriptInstance(const std::vector<ScriptAssetPtr>& scriptRefs, JavascriptModule *module) :
+JavascriptInstance::JavascriptInstance(const std::vector<ScriptAssetPtr>& scriptRefs, JavascriptModule *module, bool sharedEngine) :
     engine_(0),
+    sharedEngine_(sharedEngine),
     module_(module),
-    evaluated(false)
+    evaluated(false),
+    profilingEnabled_(false),
+    frameEventsEveryFrame_(false)
 {
     // Make sure we do not push null or empty script assets as sources
     for (unsigned i = 0; i < scriptRefs.size(); ++i)
@@ -93,37 +109,31 @@ void JavascriptInstance::Load()
     bool useAssetAPI = !scriptRefs_.empty();
     unsigned numScripts = useAssetAPI ? scriptRefs_.size() : 1;
 
-    // Determine based on code origin whether it can be trusted with system access or not
     if (useAssetAPI)
     {
-        trusted_ = true;
         for(unsigned i = 0; i < scriptRefs_.size(); ++i)
-        {
-            AssetStoragePtr storage = scriptRefs_[i]->GetAssetStorage();
-            if (!storage)
+            if (!scriptRefs_[i]->GetAssetStorage())
                 LogError("JavascriptInstance: Script asset \"" + scriptRefs_[i]->Name() + "\" does not have a source asset storage!");
-            trusted_ = trusted_ && storage && storage->Trusted();
-        }
     }
-    else // Local file: always trusted.
+    else
     {
         program_ = LoadScript(sourceFile);
-        trusted_ = true; // This is a file on the local filesystem. We are making an assumption nobody can inject untrusted code here.
-        // Actually, we are assuming the attacker does not know the absolute location of the asset cache locally here, since if he makes
-        // the client to load a script into local cache, he could use this code path to automatically load that unsafe script from cache, and make it trusted. -jj.
+        programHash_ = ScriptProgramCache::ContentHash(program_);
     }
+    trusted_ = SourcesTrusted();
 
-    // Check the validity of the syntax in the input.
+    // Check the validity of the syntax in the input. The result is cached along with the parsed program, so the same content is checked only once.
     for (unsigned i = 0; i < numScripts; ++i)
     {
         QString scriptSourceFilename = (useAssetAPI ? scriptRefs_[i]->Name() : sourceFile);
         QString &scriptContent = (useAssetAPI ? scriptRefs_[i]->scriptContent : program_);
 
-        QScriptSyntaxCheckResult syntaxResult = engine_->checkSyntax(scriptContent);
-        if (syntaxResult.state() != QScriptSyntaxCheckResult::Valid)
+        const ScriptProgramCache::Program program = module_->ProgramCache()->Get(scriptSourceFilename, scriptContent,
+            useAssetAPI ? scriptRefs_[i]->contentHash : programHash_);
+        if (!program.valid)
         {
-            LogError("Syntax error in script " + scriptSourceFilename + "," + QString::number(syntaxResult.errorLineNumber()) +
-                ": " + syntaxResult.errorMessage());
+            LogError("Syntax error in script " + scriptSourceFilename + "," + QString::number(program.errorLine) +
+                ": " + program.errorMessage);
 
             // Delete our loaded script content (if any exists).
             program_ == "";
@@ -131,6 +141,26 @@ void JavascriptInstance::Load()
     }
 }
 
+bool JavascriptInstance::SourcesTrusted() const
+{
+    // Determine based on code origin whether it can be trusted with system access or not
+    if (scriptRefs_.empty())
+    {
+        // Local file: always trusted. This is a file on the local filesystem. We are making an assumption nobody can inject untrusted code here.
+        // Actually, we are assuming the attacker does not know the absolute location of the asset cache locally here, since if he makes
+        // the client to load a script into local cache, he could use this code path to automatically load that unsafe script from cache, and make it trusted. -jj.
+        return true;
+    }
+
+    for(unsigned i = 0; i < scriptRefs_.size(); ++i)
+    {
+        AssetStoragePtr storage = scriptRefs_[i]->GetAssetStorage();
+        if (!storage || !storage->Trusted())
+            return false;
+    }
+    return true;
+}
+
 QString JavascriptInstance::LoadScript(const QString &fileName)
 {
     QString filename = fileName.trimmed();
@@ -203,16 +233,34 @@ void JavascriptInstance::Run()
     bool useAssets = !scriptRefs_.empty();
     unsigned numScripts = useAssets ? scriptRefs_.size() : 1;
     includedFiles.clear();
-    
+
+    // In a shared engine, evaluate in a context whose activation object is the global object of this instance,
+    // so that the top-level declarations of the scripts do not leak to the other instances.
+    if (HasSharedEngine())
+    {
+        if (!trusted_)
+            HideUntrustedClasses();
+        QScriptContext *context = engine_->pushContext();
+        context->setActivationObject(globalObject_);
+        context->setThisObject(globalObject_);
+    }
+
     for (unsigned i = 0; i < numScripts; ++i)
     {
         QString scriptSourceFilename = (useAssets ? scriptRefs_[i]->Name() : sourceFile);
         QString &scriptContent = (useAssets ? scriptRefs_[i]->scriptContent : program_);
 
-        QScriptValue result = engine_->evaluate(scriptContent, scriptSourceFilename);
+        // Evaluate the cached program, or the source if it has syntax errors, so that the error is reported as an exception.
+        // The program is copied, as the script may include or load other scripts, which modifies the cache during the evaluation.
+        const ScriptProgramCache::Program program = module_->ProgramCache()->Get(scriptSourceFilename, scriptContent,
+            useAssets ? scriptRefs_[i]->contentHash : programHash_);
+        QScriptValue result = program.valid ? engine_->evaluate(program.program) : engine_->evaluate(scriptContent, scriptSourceFilename);
         CheckAndPrintException("In run/evaluate: ", result);
     }
-    
+
+    if (HasSharedEngine())
+        engine_->popContext();
+
     evaluated = true;
     emit ScriptEvaluated();
 }
@@ -231,7 +279,14 @@ void JavascriptInstance::RegisterService(QObject *serviceObject, const QString &
     }
 
     QScriptValue scriptValue = engine_->newQObject(serviceObject);
-    engine_->globalObject().setProperty(name, scriptValue);
+    GlobalObject().setProperty(name, scriptValue);
+}
+
+QScriptValue JavascriptInstance::GlobalObject() const
+{
+    if (globalObject_.isValid())
+        return globalObject_;
+    return engine_ ? engine_->globalObject() : QScriptValue();
 }
 
 void JavascriptInstance::IncludeFile(const QString &path)
@@ -289,11 +344,28 @@ void JavascriptInstance::ImportExtension(const QString &scriptExtensionName)
     }
 
     QStringList qt_extension_whitelist;
-    QStringList qt_class_blacklist;
 
     /// Allowed extension imports
     qt_extension_whitelist << "qt.core" << "qt.gui" << "qt.xml" << "qt.xmlpatterns" << "qt.opengl" << "qt.webkit";
 
+    if (!trusted_ && !qt_extension_whitelist.contains(scriptExtensionName, Qt::CaseInsensitive))
+    {
+        LogWarning("JavascriptInstance::ImportExtension: refusing to load a QtScript plugin for an untrusted instance: " + scriptExtensionName);
+        return;
+    }
+
+    QScriptValue success = engine_->importExtension(scriptExtensionName);
+    if (!success.isUndefined()) // Yes, importExtension returns undefinedValue if the import succeeds. http://doc.qt.nokia.com/4.7/qscriptengine.html#importExtension
+        LogWarning("JavascriptInstance::ImportExtension: Failed to load " + scriptExtensionName + " plugin for QtScript!");
+    
+    if (!trusted_)
+        HideUntrustedClasses();
+}
+
+QStringList JavascriptInstance::UntrustedClassBlacklist()
+{
+    QStringList qt_class_blacklist;
+
     /// qt.core and qt.gui: Classes that may be harmful to your system from untrusted scripts
     qt_class_blacklist << "QLibrary" << "QPluginLoader" << "QProcess"               // process and library access
                        << "QFile" << "QDir" << "QFileSystemModel" << "QDirModel"    // file system access
@@ -305,28 +377,23 @@ void JavascriptInstance::ImportExtension(const QString &scriptExtensionName)
     /// Availble classes: QWebView, QGraphicsWebView, QWebPage, QWebFrame
     qt_class_blacklist << "QWebDatabase" << "QWebElement" << "QWebElementCollection" << "QWebHistory" << "QWebHistoryInterface" << "QWebHistoryItem"
                        << "QWebHitTestResult" << "QWebInspector" << "QWebPluginFactory" << "QWebSecurityOrigin" << "QWebSettings"; 
+    return qt_class_blacklist;
+}
 
-    if (!trusted_ && !qt_extension_whitelist.contains(scriptExtensionName, Qt::CaseInsensitive))
-    {
-        LogWarning("JavascriptInstance::ImportExtension: refusing to load a QtScript plugin for an untrusted instance: " + scriptExtensionName);
-        return;
-    }
-
-    QScriptValue success = engine_->importExtension(scriptExtensionName);
-    if (!success.isUndefined()) // Yes, importExtension returns undefinedValue if the import succeeds. http://doc.qt.nokia.com/4.7/qscriptengine.html#importExtension
-        LogWarning("JavascriptInstance::ImportExtension: Failed to load " + scriptExtensionName + " plugin for QtScript!");
-    
-    if (!trusted_)
+void JavascriptInstance::HideUntrustedClasses()
+{
+    // Remove the classes from the global object of the engine also when it is shared, as the global object of a shared instance
+    // has the engine global object as its prototype, through which shadowed classes would still be reachable. Only untrusted
+    // instances share an untrusted engine, so none of them can need the classes.
+    QScriptValue engineGlobal = engine_->globalObject();
+    QScriptValue exposed;
+    foreach (const QString &blacktype, UntrustedClassBlacklist())
     {
-        QScriptValue exposed;
-        foreach (const QString &blacktype, qt_class_blacklist)
+        exposed = engineGlobal.property(blacktype);
+        if (exposed.isValid() && !exposed.isUndefined())
         {
-            exposed = engine_->globalObject().property(blacktype);
-            if (exposed.isValid())
-            {
-                engine_->globalObject().setProperty(blacktype, QScriptValue()); //passing an invalid val removes the property, http://doc.qt.nokia.com/4.6/qscriptvalue.html#setProperty
-                //LogInfo("JavascriptInstance::ImportExtension: removed a type from the untrusted context: " + blacktype);
-            }
+            engineGlobal.setProperty(blacktype, QScriptValue()); //passing an invalid val removes the property, http://doc.qt.nokia.com/4.6/qscriptvalue.html#setProperty
+            //LogInfo("JavascriptInstance::ImportExtension: removed a type from the untrusted context: " + blacktype);
         }
     }
 }
@@ -349,21 +416,36 @@ void JavascriptInstance::CreateEngine()
 {
     if (engine_)
         DeleteEngine();
-    engine_ = new QScriptEngine;
-    connect(engine_, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSignalHandlerException(const QScriptValue &)));
+
+    ScriptEnginePool *pool = sharedEngine_ ? module_->EnginePool() : 0;
+    if (pool)
+    {
+        // The types and the framework services have been exposed to the shared engine when it was created.
+        engine_ = pool->Acquire(SourcesTrusted());
+        globalObject_ = engine_->newObject();
+        globalObject_.setPrototype(engine_->globalObject());
+    }
+    else
+    {
+        engine_ = new QScriptEngine;
+        connect(engine_, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSignalHandlerException(const QScriptValue &)));
 //#ifndef QT_NO_SCRIPTTOOLS
 //    debugger_ = new QScriptEngineDebugger();
 //    debugger.attachTo(engine_);
 ////  debugger_->action(QScriptEngineDebugger::InterruptAction)->trigger();
 //#endif
 
-    ExposeQtMetaTypes(engine_);
-    ExposeCoreTypes(engine_);
-    ExposeCoreApiMetaTypes(engine_);
+        ExposeQtMetaTypes(engine_);
+        ExposeCoreTypes(engine_);
+        ExposeCoreApiMetaTypes(engine_);
+    }
 
     EC_Script *ec = dynamic_cast<EC_Script *>(owner_.lock().get());
     module_->PrepareScriptInstance(this, ec);
     evaluated = false;
+
+    if (profilingEnabled_)
+        AttachProfiler();
 }
 
 void JavascriptInstance::DeleteEngine()
@@ -372,7 +454,9 @@ void JavascriptInstance::DeleteEngine()
         return;
 
     program_ = "";
-    engine_->abortEvaluation();
+    // A shared engine may be evaluating the scripts of another instance.
+    if (!HasSharedEngine())
+        engine_->abortEvaluation();
 
     // As a convention, we call a function 'OnScriptDestroyed' for each JS script
     // so that they can clean up their data before the script is removed from the object,
@@ -380,17 +464,187 @@ void JavascriptInstance::DeleteEngine()
     
     emit ScriptUnloading();
     
-    QScriptValue destructor = engine_->globalObject().property("OnScriptDestroyed");
+    QScriptValue destructor = GlobalObject().property("OnScriptDestroyed");
     if (!destructor.isUndefined())
     {
-        QScriptValue result = destructor.call();
+        QScriptValue result = destructor.call(GlobalObject());
         CheckAndPrintException("In script destructor: ", result);
     }
     
-    SAFE_DELETE(engine_);
+    ClearEventBatching();
+
+    if (profilingEnabled_)
+        DetachProfiler();
+
+    if (HasSharedEngine())
+    {
+        globalObject_ = QScriptValue();
+        module_->EnginePool()->Release(engine_);
+        engine_ = 0;
+    }
+    else
+        SAFE_DELETE(engine_);
     //SAFE_DELETE(debugger_);
 }
 
+void JavascriptInstance::SetProfilingEnabled(bool enabled)
+{
+#ifdef PROFILING
+    if (enabled == profilingEnabled_)
+        return;
+    profilingEnabled_ = enabled;
+    if (!engine_)
+        return;
+    if (enabled)
+        AttachProfiler();
+    else
+        DetachProfiler();
+#else
+    if (enabled)
+        LogWarning("JavascriptInstance::SetProfilingEnabled: Profiling is not enabled in this build.");
+#endif
+}
+
+QStringList JavascriptInstance::ScriptNames() const
+{
+    QStringList names;
+    if (!sourceFile.isEmpty())
+        names << sourceFile;
+    for(size_t i = 0; i < scriptRefs_.size(); ++i)
+        names << scriptRefs_[i]->Name();
+    return names;
+}
+
+void JavascriptInstance::AttachProfiler()
+{
+#ifdef PROFILING
+    ScriptSamplingProfiler *profiler = ScriptSamplingProfiler::Attached(engine_);
+    if (!profiler)
+    {
+        if (engine_->agent())
+        {
+            LogWarning("JavascriptInstance::AttachProfiler: The script engine already has an agent, cannot profile " + ScriptNames().join(", ") + ".");
+            return;
+        }
+        profiler = new ScriptSamplingProfiler(engine_, module_->GetFramework()->GetProfiler());
+    }
+    profiler->AddUser();
+#endif
+}
+
+void JavascriptInstance::DetachProfiler()
+{
+    ScriptSamplingProfiler *profiler = ScriptSamplingProfiler::Attached(engine_);
+    if (profiler && profiler->RemoveUser() <= 0)
+    {
+        engine_->setAgent(0);
+        delete profiler;
+    }
+}
+
+void JavascriptInstance::SetFrameEventHandler(const QScriptValue &handler, bool everyFrame)
+{
+    if (!handler.isFunction())
+    {
+        frameEventHandler_ = QScriptValue();
+        eventBatch_.Clear();
+        module_->UnregisterFrameEvents(this);
+        return;
+    }
+
+    frameEventHandler_ = handler;
+    frameEventsEveryFrame_ = everyFrame;
+    module_->RegisterFrameEvents(this);
+}
+
+void JavascriptInstance::BatchAttributeChanges(IComponent *component)
+{
+    if (!component)
+    {
+        LogError("JavascriptInstance::BatchAttributeChanges: Null component given.");
+        return;
+    }
+    connect(component, SIGNAL(AttributeChanged(IAttribute *, AttributeChange::Type)),
+        SLOT(OnBatchedAttributeChanged(IAttribute *, AttributeChange::Type)), Qt::UniqueConnection);
+    if (!batchedComponents_.contains(component))
+        batchedComponents_.append(component);
+}
+
+void JavascriptInstance::BatchCollisions(IComponent *rigidBody)
+{
+    if (!rigidBody)
+    {
+        LogError("JavascriptInstance::BatchCollisions: Null component given.");
+        return;
+    }
+    // Connected by name, as the physics module is not a dependency of the script module.
+    if (!connect(rigidBody, SIGNAL(PhysicsCollision(Entity *, const float3 &, const float3 &, float, float, bool)),
+        SLOT(OnBatchedPhysicsCollision(Entity *, const float3 &, const float3 &, float, float, bool)), Qt::UniqueConnection) &&
+        rigidBody->metaObject()->indexOfSignal("PhysicsCollision(Entity*,float3,float3,float,float,bool)") == -1)
+    {
+        LogError("JavascriptInstance::BatchCollisions: Component " + rigidBody->TypeName() + " does not have a PhysicsCollision signal.");
+        return;
+    }
+    if (!batchedComponents_.contains(rigidBody))
+        batchedComponents_.append(rigidBody);
+}
+
+void JavascriptInstance::StopBatching(IComponent *component)
+{
+    if (!component)
+        return;
+    disconnect(component, SIGNAL(AttributeChanged(IAttribute *, AttributeChange::Type)),
+        this, SLOT(OnBatchedAttributeChanged(IAttribute *, AttributeChange::Type)));
+    disconnect(component, 0, this, SLOT(OnBatchedPhysicsCollision(Entity *, const float3 &, const float3 &, float, float, bool)));
+    batchedComponents_.removeAll(component);
+}
+
+void JavascriptInstance::ClearEventBatching()
+{
+    foreach(const QPointer<QObject> &component, batchedComponents_)
+        if (component)
+        {
+            disconnect(component, SIGNAL(AttributeChanged(IAttribute *, AttributeChange::Type)),
+                this, SLOT(OnBatchedAttributeChanged(IAttribute *, AttributeChange::Type)));
+            disconnect(component, 0, this, SLOT(OnBatchedPhysicsCollision(Entity *, const float3 &, const float3 &, float, float, bool)));
+        }
+    batchedComponents_.clear();
+    eventBatch_.Clear();
+    if (frameEventHandler_.isValid())
+    {
+        frameEventHandler_ = QScriptValue();
+        module_->UnregisterFrameEvents(this);
+    }
+}
+
+void JavascriptInstance::DispatchFrameEvents(float frametime)
+{
+    if (!engine_ || !frameEventHandler_.isFunction())
+        return;
+    if (eventBatch_.IsEmpty() && !frameEventsEveryFrame_)
+        return;
+
+    PROFILE(JavascriptInstance_DispatchFrameEvents);
+    QScriptValueList args;
+    args << QScriptValue(engine_, frametime) << eventBatch_.TakeEvents(engine_);
+    QScriptValue result = frameEventHandler_.call(GlobalObject(), args);
+    CheckAndPrintException("In frame event handler: ", result);
+}
+
+void JavascriptInstance::OnBatchedAttributeChanged(IAttribute *attribute, AttributeChange::Type change)
+{
+    IComponent *component = dynamic_cast<IComponent *>(sender());
+    if (component && attribute && frameEventHandler_.isValid())
+        eventBatch_.AddAttributeChange(component, attribute->Name(), change);
+}
+
+void JavascriptInstance::OnBatchedPhysicsCollision(Entity *otherEntity, const float3 &position, const float3 &normal, float distance, float impulse, bool newCollision)
+{
+    IComponent *component = dynamic_cast<IComponent *>(sender());
+    if (component && frameEventHandler_.isValid())
+        eventBatch_.AddCollision(component, otherEntity, position, normal, distance, impulse, newCollision);
+}
+
 void JavascriptInstance::OnSignalHandlerException(const QScriptValue& exception)
 {
     LogError(exception.toString());
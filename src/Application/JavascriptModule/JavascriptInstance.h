@@ -11,6 +11,12 @@
 #include "SceneFwd.h"
 #include "AssetFwd.h"
 #include "JavascriptFwd.h"
+#include "ScriptEventBatch.h"
+
+#include <QScriptValue>
+#include <QStringList>
+#include <QPointer>
+#include <QList>
 
 //#include <QtScript>
 //#ifndef QT_NO_SCRIPTTOOLS
@@ -20,6 +26,12 @@
 class JavascriptModule;
 
 /// Javascript script instance used wit EC_Script.
+/** By default each instance has a dedicated script engine. An instance can instead use a shared engine of the ScriptEnginePool
+    of the JavascriptModule, in which case the scripts are evaluated with an activation object of their own, which has the global
+    object of the engine as its prototype. The top-level variables and functions of the scripts and the instance-specific services
+    are then kept in the global object of the instance, see GlobalObject(), while the types and the framework services are shared.
+    Scripts that assign to undeclared variables still write to the global object of the engine, and the signal connections
+    of a script in a shared engine persist until the engine is deleted, so such scripts should disconnect their handlers in OnScriptDestroyed(). */
 class JavascriptInstance : public IScriptInstance
 {
     Q_OBJECT
@@ -37,8 +49,9 @@ public:
 
     /// Creates script engine for this script instance and loads the script but doesn't run it yet.
     /** @param scriptRefs Script asset references.
-        @param module Javascript module. */
-    JavascriptInstance(const std::vector<ScriptAssetPtr>& scriptRefs, JavascriptModule *module);
+        @param module Javascript module.
+        @param sharedEngine If true, uses a shared engine of the script engine pool of the module. */
+    JavascriptInstance(const std::vector<ScriptAssetPtr>& scriptRefs, JavascriptModule *module, bool sharedEngine = false);
 
     /// Destroys script engine created for this script instance.
     virtual ~JavascriptInstance();
@@ -58,6 +71,13 @@ public:
     //void SetPrototype(QScriptable *prototype, );
     QScriptEngine* Engine() const { return engine_; }
 
+    /// Returns the object that holds the global variables and the services of this instance.
+    /** This is the global object of the engine, unless the engine is shared with other instances. */
+    QScriptValue GlobalObject() const;
+
+    /// Returns true if the script engine of this instance is shared with other instances.
+    bool HasSharedEngine() const { return globalObject_.isValid(); }
+
     /// Sets owner (EC_Script) component.
     /** @param owner Owner component. */
     void SetOwner(const ComponentPtr &owner) { owner_ = owner; }
@@ -65,6 +85,20 @@ public:
     /// Return owner component
     ComponentWeakPtr Owner() const { return owner_; }
 
+    /// Enables or disables sampling the script call stacks of this instance into the profiler, see ScriptSamplingProfiler.
+    /** The setting persists when the engine is recreated. If the engine is shared, the scripts of all the instances
+        using the engine are sampled as long as any of them has profiling enabled. */
+    void SetProfilingEnabled(bool enabled);
+
+    /// Returns true if the script call stacks of this instance are sampled into the profiler.
+    bool IsProfilingEnabled() const { return profilingEnabled_; }
+
+    /// Returns the names of the script files of this instance.
+    QStringList ScriptNames() const;
+
+    /// Calls the frame event handler with the events gathered during the frame. Called by JavascriptModule on each frame.
+    void DispatchFrameEvents(float frametime);
+
 public slots:
     /// Loads a given script in engine. This function can be used to create a property as you could include js-files.
     /** Multiple inclusion of same file is prevented. (by using simple string compare)
@@ -80,6 +114,22 @@ public slots:
     /// Check and print error if the engine has an uncaught exception
     bool CheckAndPrintException(const QString& message, const QScriptValue& result);
 
+    /// Sets the function that receives the batched events of this instance once per frame.
+    /** The handler is called as handler(frametime, events) when the frame is updated, with the events of the frame
+        in one array, see ScriptEventBatch::TakeEvents(). Events are gathered only while a handler is set, and passing
+        something else than a function stops the delivery. The signal handlers connected the usual way keep working.
+        @param everyFrame If true, the handler is called on every frame even if there are no events, so that it can replace a frame.Updated handler. */
+    void SetFrameEventHandler(const QScriptValue &handler, bool everyFrame = false);
+
+    /// Gathers the AttributeChanged signals of the component to the batched events instead of calling a handler for each.
+    void BatchAttributeChanges(IComponent *component);
+
+    /// Gathers the PhysicsCollision signals of the rigid body component to the batched events instead of calling a handler for each.
+    void BatchCollisions(IComponent *rigidBody);
+
+    /// Stops gathering the signals of the component to the batched events.
+    void StopBatching(IComponent *component);
+
 signals:
     /// The scripts have been run. This is the trigger to create script objects as necessary
     void ScriptEvaluated();
@@ -96,7 +146,24 @@ private:
 
     QString LoadScript(const QString &fileName);
 
+    /// Returns true if all the scripts of this instance come from trusted sources: local files or trusted asset storages.
+    bool SourcesTrusted() const;
+
+    /// Returns the names of the Qt classes that untrusted scripts are not allowed to use.
+    static QStringList UntrustedClassBlacklist();
+
+    /// Removes the blacklisted Qt classes from the engine of this untrusted instance.
+    void HideUntrustedClasses();
+
+    /// Attaches the sampling profiler to the engine, or adds this instance as a user of the profiler already attached.
+    void AttachProfiler();
+
+    /// Removes this instance as a user of the sampling profiler of the engine, and detaches the profiler if it has no users left.
+    void DetachProfiler();
+
     QScriptEngine *engine_; ///< Qt script engine.
+    bool sharedEngine_; ///< Use a shared engine of the script engine pool.
+    QScriptValue globalObject_; ///< The global object of this instance, if the engine is shared.
 
     // The script content for a JavascriptInstance is loaded either using the Asset API or 
     // using an absolute path name from the local file system.
@@ -106,6 +173,9 @@ private:
 
     /// If the script content is loaded directly from local file, this points to the actual script content.  
     QString program_;
+
+    /// Hash of program_, identifies the content in the program cache of the module.
+    QByteArray programHash_;
     
     /// Specifies the absolute path of the source file where the script is loaded from, if the content is directly loaded from file.
     QString sourceFile;
@@ -116,12 +186,23 @@ private:
     ComponentWeakPtr owner_; ///< Owner (EC_Script) component, if existing.
     JavascriptModule *module_; ///< Javascript module.
     bool evaluated; ///< Has the script program been evaluated.
+    bool profilingEnabled_; ///< Are the script call stacks sampled into the profiler.
     //QScriptEngineDebugger *debugger_;
 
     /// Already included files for preventing multi-inclusion
     std::vector<QString> includedFiles;
 
+    QScriptValue frameEventHandler_; ///< Receives the batched events, if set.
+    bool frameEventsEveryFrame_; ///< Call the frame event handler even if there are no events.
+    ScriptEventBatch eventBatch_; ///< The batched events of the current frame.
+    QList<QPointer<QObject> > batchedComponents_; ///< The components whose signals are batched.
+
+    /// Stops delivering the batched events and disconnects from the batched components.
+    void ClearEventBatching();
+
 private slots:
     void OnSignalHandlerException(const QScriptValue& exception);
+    void OnBatchedAttributeChanged(IAttribute *attribute, AttributeChange::Type change);
+    void OnBatchedPhysicsCollision(Entity *otherEntity, const float3 &position, const float3 &normal, float distance, float impulse, bool newCollision);
 };
 
@@ -11,6 +11,7 @@
 #include "JavascriptModule.h"
 #include "ScriptMetaTypeDefines.h"
 #include "JavascriptInstance.h"
+#include "ScriptEnginePool.h"
 #include "ScriptCoreTypeDefines.h"
 #include "Profiler.h"
 #include "Application.h"
@@ -36,17 +37,23 @@
 #include <QtScript>
 #include <QDomElement>
 
+#include <algorithm>
+
 #include "LoggingFunctions.h"
 #include "MemoryLeakCheck.h"
 
 JavascriptModule::JavascriptModule() :
     IModule("Javascript"),
-    engine(new QScriptEngine(this))
+    engine(new QScriptEngine(this)),
+    enginePool_(0),
+    dispatchingFrameEvents_(false)
 {
 }
 
 JavascriptModule::~JavascriptModule()
 {
+    // The script instances release their shared engines when the scenes are destroyed, which happens after Uninitialize().
+    SAFE_DELETE(enginePool_);
 }
 
 void JavascriptModule::Load()
@@ -60,10 +67,14 @@ void JavascriptModule::Load()
 void JavascriptModule::Initialize()
 {
     connect(GetFramework()->Scene(), SIGNAL(SceneAdded(const QString&)), this, SLOT(SceneAdded(const QString&)));
+    connect(GetFramework()->Asset(), SIGNAL(AssetAboutToBeRemoved(AssetPtr)), this, SLOT(OnAssetAboutToBeRemoved(AssetPtr)));
+    connect(GetFramework()->Frame(), SIGNAL(Updated(float)), this, SLOT(DispatchFrameEvents(float)));
     engine->globalObject().setProperty("print", engine->newFunction(Print));
 
     RegisterCoreMetaTypes();
 
+    enginePool_ = new ScriptEnginePool(this);
+
     framework_->Console()->RegisterCommand(
         "JsExec", "Execute given code in the embedded Javascript interpreter. Usage: JsExec(mycodestring)", 
         this, SLOT(ConsoleRunString()));
@@ -76,6 +87,11 @@ void JavascriptModule::Initialize()
         "JsReloadScripts", "Reloads and re-executes startup scripts.",
         this, SLOT(ConsoleReloadScripts()));
 
+    framework_->Console()->RegisterCommand(
+        "JsProfile", "Starts or stops sampling the script call stacks of the script instances into the profiler. "
+        "Affects the instances whose script name contains the given string, or all instances if the name is *. Usage: JsProfile(on|off,scriptname)",
+        this, SLOT(ConsoleProfile(const QString &, const QString &)));
+
     // Initialize startup scripts
     LoadStartupScripts();
 
@@ -83,7 +99,6 @@ void JavascriptModule::Initialize()
     {
         ///\todo Using just the first one, could possibly use multiple?
         JavascriptInstance *jsInstance = new JavascriptInstance(script, this);
-        PrepareScriptInstance(jsInstance);
         startupScripts_.push_back(jsInstance);
         jsInstance->Run();
     }
@@ -148,7 +163,7 @@ void JavascriptModule::ScriptAssetsChanged(const std::vector<ScriptAssetPtr>& ne
 
     if (newScripts[0]->Name().endsWith(".js")) // We're positively using QtScript.
     {
-        JavascriptInstance *jsInstance = new JavascriptInstance(newScripts, this);
+        JavascriptInstance *jsInstance = new JavascriptInstance(newScripts, this, sender->sharedEngine.Get());
         ComponentPtr comp;
         try
         {
@@ -332,7 +347,7 @@ void JavascriptModule::CreateScriptObject(EC_Script* app, EC_Script* instance, c
         return;
     
     QScriptEngine* appEngine = jsInstance->Engine();
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalObject();
    
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -346,7 +361,7 @@ void JavascriptModule::CreateScriptObject(EC_Script* app, EC_Script* instance, c
         return;
     
     const QString& appAndClassName = instance->className.Get();
-    QScriptValue constructor = appEngine->globalObject().property(className);
+    QScriptValue constructor = globalObject.property(className);
     QScriptValue object;
     if (constructor.isFunction())
     {
@@ -386,8 +401,7 @@ void JavascriptModule::RemoveScriptObject(EC_Script* instance)
     if (!jsInstance || !jsInstance->IsEvaluated())
         return;
     
-    QScriptEngine* appEngine = jsInstance->Engine();
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalObject();
    
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -459,11 +473,10 @@ void JavascriptModule::CreateScriptObjects(EC_Script* app)
 
 void JavascriptModule::RemoveScriptObjects(JavascriptInstance* jsInstance)
 {
-    QScriptEngine* appEngine = jsInstance->Engine();
-    if (!appEngine)
+    if (!jsInstance->Engine())
         return;
     
-    QScriptValue globalObject = appEngine->globalObject();
+    QScriptValue globalObject = jsInstance->GlobalObject();
     
     // Get the object container that holds the created script class instances from this application
     QScriptValue objectContainer = globalObject.property("scriptObjects");
@@ -567,7 +580,6 @@ void JavascriptModule::LoadStartupScripts()
         {
             LogInfo(Name() + ": ** " + baseName.toStdString());
             JavascriptInstance* jsInstance = new JavascriptInstance(startupScript, this);
-            PrepareScriptInstance(jsInstance);
             startupScripts_.push_back(jsInstance);
             jsInstance->Run();
 
@@ -598,7 +610,6 @@ void JavascriptModule::LoadStartupScripts()
 
         LogInfo(Name() + ": ** " + startupScript.toStdString());
         JavascriptInstance* jsInstance = new JavascriptInstance(pathToFile, this);
-        PrepareScriptInstance(jsInstance);
         startupScripts_.push_back(jsInstance);
         jsInstance->Run();
     }
@@ -615,6 +626,37 @@ void JavascriptModule::UnloadStartupScripts()
 }
 
 void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Script *comp)
+{
+    // The framework services of a shared engine have been registered when the engine was created.
+    if (!instance->HasSharedEngine())
+        RegisterFrameworkServices(instance->Engine());
+
+    instance->RegisterService(instance, "engine");
+
+    if (comp)
+    {
+        // Set entity and scene that own the EC_Script component.
+        instance->RegisterService(comp->ParentEntity(), "me");
+        instance->RegisterService(comp->ParentEntity()->ParentScene(), "scene");
+    }
+
+    if (!instance->HasSharedEngine())
+        emit ScriptEngineCreated(instance->Engine());
+}
+
+void JavascriptModule::PrepareSharedEngine(QScriptEngine *sharedEngine)
+{
+    connect(sharedEngine, SIGNAL(signalHandlerException(const QScriptValue &)), SLOT(OnSharedEngineException(const QScriptValue &)));
+
+    ExposeQtMetaTypes(sharedEngine);
+    ExposeCoreTypes(sharedEngine);
+    ExposeCoreApiMetaTypes(sharedEngine);
+    RegisterFrameworkServices(sharedEngine);
+
+    emit ScriptEngineCreated(sharedEngine);
+}
+
+void JavascriptModule::RegisterFrameworkServices(QScriptEngine *scriptEngine)
 {
     static std::set<QObject*> checked;
     
@@ -624,7 +666,7 @@ void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Sc
     {
         QString name = properties[i];
         QObject* serviceobject = framework_->property(name.toStdString().c_str()).value<QObject*>();
-        instance->RegisterService(serviceobject, name);
+        scriptEngine->globalObject().setProperty(name, scriptEngine->newQObject(serviceobject));
         
         if (checked.find(serviceobject) == checked.end())
         {
@@ -637,20 +679,57 @@ void JavascriptModule::PrepareScriptInstance(JavascriptInstance* instance, EC_Sc
         }
     }
 
-    instance->RegisterService(framework_, "framework");
-    instance->RegisterService(instance, "engine");
-    
-    for(uint i = 0; i < (uint)properties.size(); ++i)
-        instance->RegisterService(framework_->property(properties[i]).value<QObject*>(), properties[i]);
+    scriptEngine->globalObject().setProperty("framework", scriptEngine->newQObject(framework_));
+}
 
-    if (comp)
-    {
-        // Set entity and scene that own the EC_Script component.
-        instance->RegisterService(comp->ParentEntity(), "me");
-        instance->RegisterService(comp->ParentEntity()->ParentScene(), "scene");
-    }
+void JavascriptModule::OnAssetAboutToBeRemoved(AssetPtr asset)
+{
+    if (boost::dynamic_pointer_cast<ScriptAsset>(asset))
+        programCache_.Remove(asset->Name());
+}
 
-    emit ScriptEngineCreated(instance->Engine());
+void JavascriptModule::RegisterFrameEvents(JavascriptInstance *instance)
+{
+    if (std::find(frameEventInstances_.begin(), frameEventInstances_.end(), instance) == frameEventInstances_.end())
+        frameEventInstances_.push_back(instance);
+}
+
+void JavascriptModule::UnregisterFrameEvents(JavascriptInstance *instance)
+{
+    std::vector<JavascriptInstance *>::iterator iter = std::find(frameEventInstances_.begin(), frameEventInstances_.end(), instance);
+    if (iter == frameEventInstances_.end())
+        return;
+    // The handlers may delete script instances while the events are dispatched, so only clear the entry then.
+    if (dispatchingFrameEvents_)
+        *iter = 0;
+    else
+        frameEventInstances_.erase(iter);
+}
+
+void JavascriptModule::DispatchFrameEvents(float frametime)
+{
+    if (frameEventInstances_.empty())
+        return;
+
+    PROFILE(JSModule_DispatchFrameEvents);
+    dispatchingFrameEvents_ = true;
+    for(size_t i = 0; i < frameEventInstances_.size(); ++i)
+        if (frameEventInstances_[i])
+            frameEventInstances_[i]->DispatchFrameEvents(frametime);
+    dispatchingFrameEvents_ = false;
+
+    frameEventInstances_.erase(std::remove(frameEventInstances_.begin(), frameEventInstances_.end(), (JavascriptInstance *)0), frameEventInstances_.end());
+}
+
+void JavascriptModule::OnSharedEngineException(const QScriptValue &exception)
+{
+    QScriptEngine *scriptEngine = exception.engine();
+    LogError(exception.toString());
+    if (!scriptEngine)
+        return;
+    foreach(const QString &error, scriptEngine->uncaughtExceptionBacktrace())
+        LogError(error);
+    LogError("Line " + QString::number(scriptEngine->uncaughtExceptionLineNumber()) + ".");
 }
 
 void JavascriptModule::ConsoleRunString(const QStringList &params)
@@ -680,6 +759,53 @@ void JavascriptModule::ConsoleReloadScripts()
     LoadStartupScripts();
 }
 
+void JavascriptModule::ConsoleProfile(const QString &enable, const QString &scriptName)
+{
+    if (enable.trimmed() != "on" && enable.trimmed() != "off")
+    {
+        LogError("Usage: JsProfile(on|off,scriptname)");
+        return;
+    }
+
+    const bool on = enable.trimmed() == "on";
+    const QString filter = scriptName.trimmed() == "*" ? QString() : scriptName.trimmed();
+    int count = 0;
+    std::vector<JavascriptInstance *> instances = ScriptInstances();
+    for(size_t i = 0; i < instances.size(); ++i)
+    {
+        QStringList names = instances[i]->ScriptNames();
+        if (!filter.isEmpty() && names.filter(filter, Qt::CaseInsensitive).isEmpty())
+            continue;
+        instances[i]->SetProfilingEnabled(on);
+        LogInfo("JsProfile: " + QString(on ? "Profiling " : "Stopped profiling ") + names.join(", "));
+        ++count;
+    }
+    if (count == 0)
+        LogWarning("JsProfile: No script instances matching \"" + filter + "\".");
+}
+
+std::vector<JavascriptInstance *> JavascriptModule::ScriptInstances() const
+{
+    std::vector<JavascriptInstance *> instances = startupScripts_;
+    const SceneMap &scenes = framework_->Scene()->Scenes();
+    for(SceneMap::const_iterator iter = scenes.begin(); iter != scenes.end(); ++iter)
+    {
+        EntityList entities = iter->second->GetEntitiesWithComponent(EC_Script::TypeNameStatic());
+        for(EntityList::iterator i = entities.begin(); i != entities.end(); ++i)
+        {
+            Entity::ComponentVector comps = (*i)->GetComponents(EC_Script::TypeNameStatic());
+            for(size_t j = 0; j < comps.size(); ++j)
+            {
+                EC_Script *script = checked_static_cast<EC_Script *>(comps[j].get());
+                JavascriptInstance *jsInstance = dynamic_cast<JavascriptInstance *>(script->GetScriptInstance());
+                if (jsInstance)
+                    instances.push_back(jsInstance);
+            }
+        }
+    }
+    return instances;
+}
+
 QScriptValue Print(QScriptContext *context, QScriptEngine *engine)
 {
     LogInfo("{QtScript} " + context->argument(0).toString());
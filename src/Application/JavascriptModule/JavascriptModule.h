@@ -14,6 +14,7 @@
 #include "AssetFwd.h"
 #include "SceneFwd.h"
 #include "JavascriptFwd.h"
+#include "ScriptProgramCache.h"
 
 #include <QObject>
 #include <QString>
@@ -44,6 +45,21 @@ public:
         @param comp Script component, null by default. */
     void PrepareScriptInstance(JavascriptInstance* instance, EC_Script *comp = 0);
 
+    /// Exposes the types and registers the framework services to a new engine of the script engine pool.
+    void PrepareSharedEngine(QScriptEngine *engine);
+
+    /// Returns the pool of the script engines shared by the EC_Script components that have the sharedEngine attribute set.
+    ScriptEnginePool *EnginePool() const { return enginePool_; }
+
+    /// Returns the cache of the parsed script programs.
+    ScriptProgramCache *ProgramCache() { return &programCache_; }
+
+    /// Starts delivering the batched events of the script instance on each frame, see JavascriptInstance::SetFrameEventHandler().
+    void RegisterFrameEvents(JavascriptInstance *instance);
+
+    /// Stops delivering the batched events of the script instance.
+    void UnregisterFrameEvents(JavascriptInstance *instance);
+
 public slots:
     /// New scene has been added to foundation.
     void SceneAdded(const QString &name);
@@ -90,22 +106,44 @@ private:
     /// Remove script class instances for all EC_Scripts depending on this script application
     void RemoveScriptObjects(JavascriptInstance* jsInstance);
 
+    /// Registers the framework and its dynamic objects (the core APIs) to the global object of the engine.
+    void RegisterFrameworkServices(QScriptEngine *engine);
+
+    /// Returns the startup script instances and the script instances of the EC_Script components of all scenes.
+    std::vector<JavascriptInstance *> ScriptInstances() const;
+
     /// Default engine for console & commandline script execution
     QScriptEngine *engine;
 
+    /// Shared engines for the instances of EC_Script components.
+    ScriptEnginePool *enginePool_;
+
+    /// Parsed programs of the scripts, shared by all the script instances.
+    ScriptProgramCache programCache_;
+
     /// Engines for executing startup (possibly persistent) scripts
     std::vector<JavascriptInstance *> startupScripts_;
 
+    /// Script instances that receive their events batched once per frame.
+    std::vector<JavascriptInstance *> frameEventInstances_;
+
+    /// True while the batched events are being dispatched.
+    bool dispatchingFrameEvents_;
+
 private slots:
     void ConsoleRunString(const QStringList &params);
     void ConsoleRunFile(const QStringList &params);
     void ConsoleReloadScripts();
+    void ConsoleProfile(const QString &enable, const QString &scriptName);
     
     void ScriptAssetsChanged(const std::vector<ScriptAssetPtr>& newScripts);
     void ScriptAppNameChanged(const QString& newAppName);
     void ScriptClassNameChanged(const QString& newClassName);
     void ScriptEvaluated();
     void ScriptUnloading();
+    void OnSharedEngineException(const QScriptValue &exception);
+    void OnAssetAboutToBeRemoved(AssetPtr asset);
+    void DispatchFrameEvents(float frametime);
 };
 
 // API things
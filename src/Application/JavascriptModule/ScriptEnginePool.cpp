@@ -0,0 +1,76 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ScriptEnginePool.cpp
+ *  @brief  Pool of script engines shared by multiple script instances.
+ */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptEnginePool.h"
+#include "JavascriptModule.h"
+#include "LoggingFunctions.h"
+
+#include <QtScript>
+
+#include "MemoryLeakCheck.h"
+
+ScriptEnginePool::ScriptEnginePool(JavascriptModule *module, int maxEngines) :
+    module_(module),
+    maxEngines_(maxEngines < 1 ? 1 : maxEngines)
+{
+}
+
+ScriptEnginePool::~ScriptEnginePool()
+{
+    for(size_t i = 0; i < engines_.size(); ++i)
+    {
+        LogWarning("ScriptEnginePool: Deleting a shared script engine that still has " + QString::number(engines_[i].users) + " users.");
+        delete engines_[i].engine;
+    }
+}
+
+QScriptEngine *ScriptEnginePool::Acquire(bool trusted)
+{
+    size_t best = engines_.size();
+    int numEngines = 0;
+    for(size_t i = 0; i < engines_.size(); ++i)
+        if (engines_[i].trusted == trusted)
+        {
+            ++numEngines;
+            if (best == engines_.size() || engines_[i].users < engines_[best].users)
+                best = i;
+        }
+
+    // Prefer creating a new engine over adding users to an engine that already has some.
+    if (best == engines_.size() || (engines_[best].users > 0 && numEngines < maxEngines_))
+    {
+        PooledEngine pooled;
+        pooled.engine = new QScriptEngine;
+        pooled.trusted = trusted;
+        module_->PrepareSharedEngine(pooled.engine);
+        engines_.push_back(pooled);
+        best = engines_.size() - 1;
+    }
+
+    ++engines_[best].users;
+    return engines_[best].engine;
+}
+
+void ScriptEnginePool::Release(QScriptEngine *engine)
+{
+    for(size_t i = 0; i < engines_.size(); ++i)
+        if (engines_[i].engine == engine)
+        {
+            // Deleting the engine also drops the signal connections the scripts have made.
+            if (--engines_[i].users <= 0)
+            {
+                delete engines_[i].engine;
+                engines_.erase(engines_.begin() + i);
+            }
+            return;
+        }
+
+    LogError("ScriptEnginePool::Release: The engine is not in the pool.");
+}
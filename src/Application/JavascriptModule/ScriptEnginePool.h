@@ -0,0 +1,54 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ScriptEnginePool.h
+ *  @brief  Pool of script engines shared by multiple script instances.
+ */
+
+#pragma once
+
+#include "JavascriptFwd.h"
+
+#include <vector>
+
+/// Pool of script engines shared by multiple script instances.
+/** Creating a QScriptEngine and exposing the Qt, core and core API types to it is expensive, both in time and memory,
+    so instead of a dedicated engine each, the script instances of EC_Script components can share the engines of this pool.
+    The types and the framework services are exposed once per engine, and each instance that uses a shared engine gets its
+    own global object, see JavascriptInstance. An engine is deleted when the last instance using it releases it.
+
+    The trusted and the untrusted instances never share an engine, so that the extensions imported by a trusted script
+    and the global variables it leaks are not visible to the untrusted scripts. An EC_Script component opts in to
+    a shared engine with its sharedEngine attribute. */
+class ScriptEnginePool
+{
+public:
+    /// Default number of engines of each trust level.
+    static const int cDefaultMaxEngines = 4;
+
+    /// @param maxEngines The number of engines of each trust level the instances are spread over.
+    ScriptEnginePool(JavascriptModule *module, int maxEngines = cDefaultMaxEngines);
+    ~ScriptEnginePool();
+
+    /// Returns the engine of the given trust level with the fewest users, creating a new engine if there are fewer than the maximum.
+    QScriptEngine *Acquire(bool trusted);
+
+    /// Tells that an instance does not use the given engine anymore. Deletes the engine if it has no users left.
+    void Release(QScriptEngine *engine);
+
+    /// Returns the number of engines alive.
+    size_t NumEngines() const { return engines_.size(); }
+
+private:
+    struct PooledEngine
+    {
+        PooledEngine() : engine(0), users(0), trusted(false) {}
+        QScriptEngine *engine;
+        int users;
+        bool trusted; ///< If true, the engine is used only by trusted instances, otherwise only by untrusted ones.
+    };
+
+    JavascriptModule *module_;
+    int maxEngines_;
+    std::vector<PooledEngine> engines_;
+};
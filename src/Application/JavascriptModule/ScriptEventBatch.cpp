@@ -0,0 +1,102 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ScriptEventBatch.cpp
+ *  @brief  Events gathered during a frame for a script instance, delivered to the script in one call.
+ */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptEventBatch.h"
+#include "IComponent.h"
+#include "Entity.h"
+
+#include <QtScript>
+
+#include "MemoryLeakCheck.h"
+
+void ScriptEventBatch::AddAttributeChange(IComponent *component, const QString &attributeName, AttributeChange::Type change)
+{
+    QPair<QObject *, QString> key(component, attributeName);
+    QHash<QPair<QObject *, QString>, size_t>::const_iterator iter = attributeEvents_.constFind(key);
+    bool coalesced = iter != attributeEvents_.constEnd();
+    if (!coalesced)
+    {
+        attributeEvents_[key] = events_.size();
+        events_.push_back(Event());
+    }
+    Event &event = events_[coalesced ? iter.value() : events_.size() - 1];
+    event.type = AttributeChangedEvent;
+    event.source = component;
+    event.attributeName = attributeName;
+    event.change = change;
+}
+
+void ScriptEventBatch::AddCollision(IComponent *rigidBody, Entity *otherEntity, const float3 &position, const float3 &normal,
+    float distance, float impulse, bool newCollision)
+{
+    QPair<QObject *, QObject *> key(rigidBody, otherEntity);
+    QHash<QPair<QObject *, QObject *>, size_t>::const_iterator iter = collisionEvents_.constFind(key);
+    bool coalesced = iter != collisionEvents_.constEnd();
+    if (!coalesced)
+    {
+        collisionEvents_[key] = events_.size();
+        events_.push_back(Event());
+    }
+    Event &event = events_[coalesced ? iter.value() : events_.size() - 1];
+    event.type = PhysicsCollisionEvent;
+    event.source = rigidBody;
+    event.other = otherEntity;
+    event.position = position;
+    event.normal = normal;
+    event.distance = distance;
+    event.impulse = impulse;
+    event.newCollision = newCollision || (coalesced && event.newCollision);
+}
+
+void ScriptEventBatch::Clear()
+{
+    events_.clear();
+    attributeEvents_.clear();
+    collisionEvents_.clear();
+}
+
+QScriptValue ScriptEventBatch::TakeEvents(QScriptEngine *engine)
+{
+    QScriptValue events = engine->newArray();
+    QScriptValue attributeChanged(engine, "AttributeChanged");
+    QScriptValue physicsCollision(engine, "PhysicsCollision");
+
+    quint32 numEvents = 0;
+    for(size_t i = 0; i < events_.size(); ++i)
+    {
+        const Event &e = events_[i];
+        if (!e.source)
+            continue;
+
+        QScriptValue event = engine->newArray();
+        if (e.type == AttributeChangedEvent)
+        {
+            event.setProperty(0, attributeChanged);
+            event.setProperty(1, engine->newQObject(e.source));
+            event.setProperty(2, QScriptValue(engine, e.attributeName));
+            event.setProperty(3, QScriptValue(engine, (int)e.change));
+        }
+        else
+        {
+            event.setProperty(0, physicsCollision);
+            event.setProperty(1, engine->newQObject(e.source));
+            event.setProperty(2, e.other ? engine->newQObject(e.other) : engine->nullValue());
+            event.setProperty(3, engine->toScriptValue(e.position));
+            event.setProperty(4, engine->toScriptValue(e.normal));
+            event.setProperty(5, QScriptValue(engine, e.distance));
+            event.setProperty(6, QScriptValue(engine, e.impulse));
+            event.setProperty(7, QScriptValue(engine, e.newCollision));
+        }
+        events.setProperty(numEvents++, event);
+    }
+
+    Clear();
+    return events;
+}
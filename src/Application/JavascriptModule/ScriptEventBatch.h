@@ -0,0 +1,80 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ScriptEventBatch.h
+ *  @brief  Events gathered during a frame for a script instance, delivered to the script in one call.
+ */
+
+#pragma once
+
+#include "AttributeChangeType.h"
+#include "SceneFwd.h"
+#include "Math/float3.h"
+
+#include <QHash>
+#include <QPair>
+#include <QPointer>
+#include <QString>
+
+#include <vector>
+
+class QScriptEngine;
+class QScriptValue;
+
+/// Events gathered during a frame for a script instance, delivered to the script in one call.
+/** Calling into a script for every emission of a frequent signal converts the arguments and enters the engine each time.
+    Instead, the events of the signals a script has batched are stored here during the frame, coalesced so that
+    an attribute that changes several times in a frame, or a pair of bodies that stays in contact over several physics steps,
+    gives one event, and are converted to a script array once per frame. See JavascriptInstance::SetFrameEventHandler(). */
+class ScriptEventBatch
+{
+public:
+    ScriptEventBatch() {}
+
+    /// Stores a change of an attribute of a component, replacing an earlier change of the same attribute in this frame.
+    void AddAttributeChange(IComponent *component, const QString &attributeName, AttributeChange::Type change);
+
+    /// Stores a collision of a rigid body, replacing an earlier collision of the same bodies in this frame.
+    /** The collision is reported as new if any of the coalesced collisions was. */
+    void AddCollision(IComponent *rigidBody, Entity *otherEntity, const float3 &position, const float3 &normal,
+        float distance, float impulse, bool newCollision);
+
+    /// Returns true if no events have been stored since the previous TakeEvents() or Clear().
+    bool IsEmpty() const { return events_.empty(); }
+
+    /// Removes the stored events.
+    void Clear();
+
+    /// Converts the stored events to a script array, and removes them.
+    /** Each event is an array whose first element is the name of the signal:
+        - ["AttributeChanged", component, attributeName, changeType]
+        - ["PhysicsCollision", rigidBody, otherEntity, position, normal, distance, impulse, newCollision]
+        The events of components that have been deleted during the frame are left out. */
+    QScriptValue TakeEvents(QScriptEngine *engine);
+
+private:
+    enum EventType
+    {
+        AttributeChangedEvent,
+        PhysicsCollisionEvent
+    };
+
+    struct Event
+    {
+        EventType type;
+        QPointer<QObject> source; ///< The component that emitted the signal.
+        QPointer<QObject> other; ///< The other entity of a collision.
+        QString attributeName;
+        AttributeChange::Type change;
+        float3 position;
+        float3 normal;
+        float distance;
+        float impulse;
+        bool newCollision;
+    };
+
+    std::vector<Event> events_;
+    /// Indices of the events in events_ by the component and the attribute name, or the bodies of the collision.
+    QHash<QPair<QObject *, QString>, size_t> attributeEvents_;
+    QHash<QPair<QObject *, QObject *>, size_t> collisionEvents_;
+};
@@ -0,0 +1,46 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ScriptProgramCache.cpp
+ *  @brief  Cache of the parsed script programs shared by the script instances.
+ */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptProgramCache.h"
+#include "ScriptAsset.h"
+#include "Profiler.h"
+
+#include <QScriptEngine>
+
+#include "MemoryLeakCheck.h"
+
+const ScriptProgramCache::Program &ScriptProgramCache::Get(const QString &fileName, const QString &content, const QByteArray &contentHash)
+{
+    const QByteArray hash = contentHash.isEmpty() ? ContentHash(content) : contentHash;
+    QHash<QString, Program>::iterator iter = programs_.find(fileName);
+    if (iter != programs_.end() && iter->contentHash == hash)
+        return iter.value();
+
+    PROFILE(ScriptProgramCache_Parse);
+
+    Program program;
+    program.contentHash = hash;
+    QScriptSyntaxCheckResult syntaxResult = QScriptEngine::checkSyntax(content);
+    program.valid = syntaxResult.state() == QScriptSyntaxCheckResult::Valid;
+    if (program.valid)
+        program.program = QScriptProgram(content, fileName);
+    else
+    {
+        program.errorMessage = syntaxResult.errorMessage();
+        program.errorLine = syntaxResult.errorLineNumber();
+    }
+
+    return programs_[fileName] = program;
+}
+
+QByteArray ScriptProgramCache::ContentHash(const QString &content)
+{
+    return ScriptAsset::ContentHash(content);
+}
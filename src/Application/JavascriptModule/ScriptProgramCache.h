@@ -0,0 +1,52 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ScriptProgramCache.h
+ *  @brief  Cache of the parsed script programs shared by the script instances.
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QByteArray>
+#include <QScriptProgram>
+
+/// Cache of the parsed script programs shared by the script instances.
+/** Checking the syntax of a script and parsing it for evaluation is done once per script source and content, instead of
+    once per script instance. The programs are keyed by the name of the source, f.ex. the asset reference of the ScriptAsset,
+    and validated with a hash of the content, so a reloaded script with changed content replaces the outdated program. */
+class ScriptProgramCache
+{
+public:
+    /// A parsed script program and the result of its syntax check.
+    struct Program
+    {
+        Program() : valid(false), errorLine(0) {}
+
+        QScriptProgram program;
+        QByteArray contentHash;
+        bool valid; ///< True if the syntax of the program is valid.
+        QString errorMessage; ///< The syntax error, if the program is not valid.
+        int errorLine;
+    };
+
+    /// Returns the program of the given source, parsing it if it is not cached or its content has changed.
+    /** @param fileName The name of the source, used as the file name of the program in the script error messages.
+        @param content The source code.
+        @param contentHash Hash of the content. If empty, the hash is computed from the content.
+        @note The returned reference is invalidated by the next call to Get() or Remove(), so copy the program before evaluating it. */
+    const Program &Get(const QString &fileName, const QString &content, const QByteArray &contentHash = QByteArray());
+
+    /// Removes the program of the given source from the cache.
+    void Remove(const QString &fileName) { programs_.remove(fileName); }
+
+    /// Removes all programs from the cache.
+    void Clear() { programs_.clear(); }
+
+    /// Returns the hash that identifies the given content. The same hash as ScriptAsset::contentHash, so the hashes of the assets can be passed to Get().
+    static QByteArray ContentHash(const QString &content);
+
+private:
+    QHash<QString, Program> programs_; ///< By source name.
+};
@@ -0,0 +1,134 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ScriptSamplingProfiler.cpp
+ *  @brief  Samples the call stacks of a script engine into the profiler of the framework.
+ */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "ScriptSamplingProfiler.h"
+#include "Profiler.h"
+
+#include <QScriptEngine>
+#include <QScriptContext>
+#include <QScriptContextInfo>
+#include <QFileInfo>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+const double ScriptSamplingProfiler::cDefaultInterval = 0.001;
+
+ScriptSamplingProfiler::ScriptSamplingProfiler(QScriptEngine *engine, Profiler *profiler, double interval) :
+    QScriptEngineAgent(engine),
+    profiler_(profiler),
+    interval_((tick_t)(interval * GetCurrentClockFreq())),
+    users_(0),
+    depth_(0),
+    lastSample_(0)
+{
+    engine->setAgent(this);
+}
+
+ScriptSamplingProfiler *ScriptSamplingProfiler::Attached(QScriptEngine *engine)
+{
+    return engine ? dynamic_cast<ScriptSamplingProfiler *>(engine->agent()) : 0;
+}
+
+void ScriptSamplingProfiler::functionEntry(qint64 scriptId)
+{
+    const tick_t now = GetCurrentClockTime();
+    // The time between the outermost calls is spent outside the engine.
+    if (depth_++ == 0)
+        lastSample_ = now;
+    else if (now - lastSample_ >= interval_)
+        TakeSample(now);
+}
+
+void ScriptSamplingProfiler::functionExit(qint64 scriptId, const QScriptValue &returnValue)
+{
+    const tick_t now = GetCurrentClockTime();
+    if (depth_ <= 0)
+        return;
+
+    // When the outermost call returns, credit the rest of its time to the stack and end the trace events.
+    if (depth_ == 1)
+    {
+        if (now != lastSample_)
+            TakeSample(now);
+        EndFrames(0, now);
+    }
+    else if (now - lastSample_ >= interval_)
+        TakeSample(now);
+    --depth_;
+}
+
+void ScriptSamplingProfiler::TakeSample(tick_t now)
+{
+    sample_.clear();
+    for(QScriptContext *context = engine()->currentContext(); context; context = context->parentContext())
+    {
+        int id = BlockId(context);
+        if (id >= 0)
+            sample_.push_back(id);
+    }
+    std::reverse(sample_.begin(), sample_.end());
+
+    profiler_->AddSample(sample_.empty() ? 0 : &sample_[0], sample_.size(),
+        (double)(now - lastSample_) / GetCurrentClockFreq());
+
+    // The frames that differ from the previous sample are taken to have changed at the previous sample.
+    if (profiler_->IsTraceEnabled())
+    {
+        size_t common = 0;
+        while(common < stack_.size() && common < sample_.size() && stack_[common] == sample_[common])
+            ++common;
+        EndFrames(common, lastSample_);
+        for(size_t i = common; i < sample_.size(); ++i)
+        {
+            stack_.push_back(sample_[i]);
+            stackStart_.push_back(lastSample_);
+        }
+    }
+    else
+    {
+        stack_.clear();
+        stackStart_.clear();
+    }
+
+    lastSample_ = now;
+}
+
+void ScriptSamplingProfiler::EndFrames(size_t depth, tick_t end)
+{
+    // Innermost first, so that the trace events end in the order they were nested.
+    while(stack_.size() > depth)
+    {
+        profiler_->AddTraceEvent(stack_.back(), stackStart_.back(), end);
+        stack_.pop_back();
+        stackStart_.pop_back();
+    }
+}
+
+int ScriptSamplingProfiler::BlockId(QScriptContext *context)
+{
+    QScriptContextInfo info(context);
+    if (info.functionType() != QScriptContextInfo::ScriptFunction || info.scriptId() == -1)
+        return -1;
+
+    QPair<qint64, int> key(info.scriptId(), info.functionStartLineNumber());
+    QHash<QPair<qint64, int>, int>::const_iterator iter = blockIds_.constFind(key);
+    if (iter != blockIds_.constEnd())
+        return iter.value();
+
+    QString function = info.functionName().isEmpty() ? (info.functionStartLineNumber() < 0 ? "global" : "anonymous") : info.functionName();
+    QString location = QFileInfo(info.fileName()).fileName();
+    if (info.functionStartLineNumber() >= 0)
+        location += ":" + QString::number(info.functionStartLineNumber());
+    int id = profiler_->InternBlock(("JS_" + function + " (" + location + ")").toStdString());
+    blockIds_[key] = id;
+    return id;
+}
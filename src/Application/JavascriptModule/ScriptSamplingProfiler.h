@@ -0,0 +1,79 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ScriptSamplingProfiler.h
+ *  @brief  Samples the call stacks of a script engine into the profiler of the framework.
+ */
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "HighPerfClock.h"
+
+#include <QScriptEngineAgent>
+#include <QHash>
+#include <QPair>
+
+#include <vector>
+
+class Profiler;
+
+/// Samples the call stacks of a script engine into the profiler of the framework.
+/** The agent reads the clock whenever a script or native function is entered or exits, and walks the script call stack
+    once per sampling interval. Each sampled stack is credited with the time elapsed since
+    the previous sample, so the script functions show up in the profiling tree under the C++ block that called the script,
+    and in the timeline trace of Profiler::SaveTrace(). The blocks are named "JS_<function> (<file>:<line>)".
+
+    The stacks are sampled at the function boundaries only, so the time of a long loop that calls no functions is credited
+    to the stack sampled when the loop ends. Attaching an agent makes QtScript run the scripts of the engine with debugging
+    hooks, so the profiler is meant to be enabled only for the script instances under investigation, see
+    JavascriptInstance::SetProfilingEnabled(). An engine has only one agent, which profiles all the instances sharing the engine. */
+class ScriptSamplingProfiler : public QScriptEngineAgent
+{
+public:
+    /// Default sampling interval in seconds.
+    static const double cDefaultInterval;
+
+    /// Attaches the profiler to the engine, which takes ownership of it.
+    ScriptSamplingProfiler(QScriptEngine *engine, Profiler *profiler, double interval = cDefaultInterval);
+
+    /// Returns the sampling profiler attached to the engine, or null if none.
+    static ScriptSamplingProfiler *Attached(QScriptEngine *engine);
+
+    /// Adds a script instance that uses this profiler.
+    void AddUser() { ++users_; }
+
+    /// Removes a script instance that uses this profiler. Returns the number of users left.
+    int RemoveUser() { return --users_; }
+
+    /// QScriptEngineAgent override.
+    void functionEntry(qint64 scriptId);
+
+    /// QScriptEngineAgent override.
+    void functionExit(qint64 scriptId, const QScriptValue &returnValue);
+
+private:
+    /// Credits the time since the previous sample to the current call stack.
+    void TakeSample(tick_t now);
+
+    /// Records the trace events of the stack frames from the given depth upwards as ending at the given time.
+    void EndFrames(size_t depth, tick_t end);
+
+    /// Returns the profiling block ID of the function of the script context.
+    int BlockId(QScriptContext *context);
+
+    Profiler *profiler_;
+    tick_t interval_; ///< Sampling interval in clock ticks.
+    int users_; ///< The number of script instances that have enabled the profiler.
+    int depth_; ///< Depth of the function calls in the engine, including the native functions.
+    tick_t lastSample_; ///< Clock time of the previous sample, or of the start of the outermost call.
+
+    /// Block IDs of the previous sampled stack, outermost first, and the clock times the frames were first sampled at.
+    std::vector<int> stack_;
+    std::vector<tick_t> stackStart_;
+    /// Block IDs of the current sample, kept to avoid allocating on every sample.
+    std::vector<int> sample_;
+
+    /// Block IDs of the script functions by the script ID and the start line of the function.
+    QHash<QPair<qint64, int>, int> blockIds_;
+};
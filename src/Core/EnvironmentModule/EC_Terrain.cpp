@@ -25,7 +25,15 @@
 #include "Profiler.h"
 #include "OgreRenderingModule.h"
 #include "OgreWorld.h"
+#include "EC_Camera.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "ConfigAPI.h"
 #include <Ogre.h>
+#include <QtConcurrentRun>
+#include <QFile>
+#include <QTemporaryFile>
+#include <algorithm>
 #include <utility>
 
 #include "MemoryLeakCheck.h"
@@ -33,6 +41,80 @@
 using namespace std;
 using namespace OgreRenderer;
 
+namespace
+{
+    /// Identifies a tiled height map file. The legacy .ntf files start with the patch count instead, which can never match this.
+    const char cTiledHeightMapMagic[4] = { 'N', 'T', 'F', 'T' };
+
+    const u32 cTiledHeightMapVersion = 2;
+
+    /// The offset of the first tile from the beginning of the file, when saving. Keeps the tiles aligned in the mapped file.
+    const u32 cTiledHeightMapDataOffset = 64;
+
+    /// The storage format of the height values of a tiled height map file.
+    enum TiledHeightFormat
+    {
+        TiledHeightsFloat32 = 0,
+        TiledHeightsUInt16 = 1 ///< Quantized, height = offset + scale * value.
+    };
+
+    /// The header of a tiled height map file. It is followed by the patches row by row, each stored as a tile of cPatchSize x cPatchSize
+    /// height values. Like in the legacy format, all values are stored in the byte order of the machine that saved the file.
+    struct TiledHeightMapHeader
+    {
+        char magic[4];
+        u32 version;
+        u32 xPatches;
+        u32 yPatches;
+        u32 tileSize; ///< The number of height values per tile side. Always EC_Terrain::cPatchSize.
+        u32 format; ///< One of TiledHeightFormat.
+        float scale;
+        float offset;
+        u32 dataOffset; ///< The offset of the first tile from the beginning of the file.
+        /// The height range of the terrain, so that the physics do not need to read all the heights.
+        float minHeight;
+        float maxHeight;
+    };
+
+    bool IsTiledHeightMap(const char *data, size_t numBytes)
+    {
+        return numBytes >= sizeof(cTiledHeightMapMagic) && memcmp(data, cTiledHeightMapMagic, sizeof(cTiledHeightMapMagic)) == 0;
+    }
+
+    /// Reads the header of a tiled height map file, and checks that the file contains all the tiles it declares.
+    bool ReadTiledHeightMapHeader(const char *data, size_t numBytes, TiledHeightMapHeader &header)
+    {
+        if (!IsTiledHeightMap(data, numBytes) || numBytes < sizeof(header))
+        {
+            LogError("Not a tiled terrain height map file.");
+            return false;
+        }
+        memcpy(&header, data, sizeof(header));
+
+        if (header.version != cTiledHeightMapVersion)
+        {
+            LogError("Unsupported tiled terrain height map version " + QString::number(header.version) + ".");
+            return false;
+        }
+        if (header.tileSize != (u32)EC_Terrain::cPatchSize || header.xPatches == 0 || header.yPatches == 0 ||
+            (header.format != TiledHeightsFloat32 && header.format != TiledHeightsUInt16) ||
+            header.dataOffset < sizeof(header) || header.dataOffset % sizeof(float) != 0)
+        {
+            LogError("Invalid tiled terrain height map header.");
+            return false;
+        }
+
+        const u64 sampleSize = (header.format == TiledHeightsUInt16) ? sizeof(u16) : sizeof(float);
+        const u64 dataSize = (u64)header.xPatches * header.yPatches * EC_Terrain::cPatchSize * EC_Terrain::cPatchSize * sampleSize;
+        if (header.dataOffset + dataSize > numBytes)
+        {
+            LogError("Not enough bytes in the tiled terrain height map file!");
+            return false;
+        }
+        return true;
+    }
+}
+
 EC_Terrain::EC_Terrain(Scene* scene) :
     IComponent(scene),
     nodeTransformation(this, "Transform"),
@@ -49,16 +131,33 @@ EC_Terrain::EC_Terrain(Scene* scene) :
     vScale(this, "Tex. V scale"),
     patchWidth(1),
     patchHeight(1),
-    rootNode(0)
+    chunkWidth(1),
+    chunkHeight(1),
+    rootNode(0),
+    chunkGridGeneration(0),
+    lodEnabled(true),
+    lodDistance(64.f),
+    pagingDistance(0.f),
+    heightField(new TerrainHeightField(cPatchSize, cPatchSize))
 {
     if (scene)
         world_ = scene->GetWorld<OgreWorld>();
 
     connect(this, SIGNAL(ParentEntitySet()), this, SLOT(UpdateSignals()));
 
+    if (framework)
+    {
+        ConfigAPI *config = framework->Config();
+        lodEnabled = config->Get(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "terrain lod", true).toBool();
+        SetLodDistance(config->Get(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "terrain lod distance", 64.0).toFloat());
+        pagingDistance = max(0.f, config->Get(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "terrain paging distance", 0.0).toFloat());
+        connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(OnFrameUpdated(float)));
+    }
+
     xPatches.Set(1, AttributeChange::Disconnected);
     yPatches.Set(1, AttributeChange::Disconnected);
     patches.resize(1);
+    chunks.resize(1);
     MakePatchFlat(0, 0, 0.f);
     uScale.Set(0.13f, AttributeChange::Disconnected);
     vScale.Set(0.13f, AttributeChange::Disconnected);
@@ -96,10 +195,12 @@ void EC_Terrain::UpdateSignals()
 
 void EC_Terrain::MakePatchFlat(int x, int y, float heightValue)
 {
-    Patch &patch = GetPatch(x, y);
-    patch.heightData.clear();
-    patch.heightData.insert(patch.heightData.end(), cPatchSize*cPatchSize, heightValue);
-    patch.patch_geometry_dirty = true;
+    BeginHeightEdit();
+    MakeHeightsResident();
+    for(int j = 0; j < cPatchSize; ++j)
+        std::fill_n(&heightField->At(x * cPatchSize, y * cPatchSize + j), cPatchSize, heightValue);
+    dirtyHeights |= QRect(x * cPatchSize, y * cPatchSize, cPatchSize, cPatchSize);
+    GetPatch(x, y).patch_geometry_dirty = true;
 }
 
 void EC_Terrain::MakeTerrainFlat(float heightValue)
@@ -113,61 +214,32 @@ void EC_Terrain::ResizeTerrain(int newPatchWidth, int newPatchHeight)
 {
     PROFILE(EC_Terrain_ResizeTerrain);
 
-    const int maxPatchSize = 32;
-    // Do an artificial limit to a preset N patches per side. (This limit is way too large already for the current terrain vertex LOD management.)
-    newPatchWidth = max(1, min(maxPatchSize, newPatchWidth));
-    newPatchHeight = max(1, min(maxPatchSize, newPatchHeight));
+    const int maxPatchSize = 256;
+    // Do an artificial limit to a preset N patches per side. The chunked LOD keeps even the largest terrains at a few thousand draw calls at most.
+    // Terrains loaded from a file may be larger, and are kept at their size.
+    newPatchWidth = max(1, min(max(maxPatchSize, patchWidth), newPatchWidth));
+    newPatchHeight = max(1, min(max(maxPatchSize, patchHeight), newPatchHeight));
 
     if (newPatchWidth == patchWidth && newPatchHeight == patchHeight)
         return;
 
-    // If the width changes, we need to also regenerate the old right-most column to generate the new seams. (If we are shrinking, this is not necessary)
-    if (patchWidth < newPatchWidth)
-        for(int y = 0; y < patchHeight; ++y)
-            GetPatch(patchWidth-1, y).patch_geometry_dirty = true;
-
-    // If the height changes, we need to also regenerate the old top-most row to generate the new seams. (If we are shrinking, this is not necessary)
-    if (patchHeight < newPatchHeight)
-        for(int x = 0; x < patchWidth; ++x)
-            GetPatch(x, patchHeight-1).patch_geometry_dirty = true;
+    // Now create the new height value store and copy the old height values over. Any new patches are initialized
+    // to flat planes with the given fixed height. The store is replaced instead of resized, since the physics may still be reading the old one.
+    const float initialPatchHeight = 0.f;
+    TerrainHeightFieldPtr newHeightField(new TerrainHeightField(newPatchWidth * cPatchSize, newPatchHeight * cPatchSize, initialPatchHeight));
+    for(int y = 0; y < min(VerticesHeight(), newHeightField->height); ++y)
+        for(int x = 0; x < min(VerticesWidth(), newHeightField->width); ++x)
+            newHeightField->At(x, y) = HeightAt(x, y);
+    heightField = newHeightField;
+    dirtyHeights = QRect();
 
-    // First delete all the patches that will not be part of the newly-sized terrain (user shrinked the terrain in one or two dimensions)
-    for(int y = newPatchHeight; y < patchHeight; ++y)
-        for(int x = 0; x < patchWidth; ++x)
-            DestroyPatch(x, y);
-    for(int x = newPatchWidth; x < patchWidth; ++x) // We hav esome overlap here with above, but it's ok since DestroyPatch is benign.
-        for(int y = 0; y < patchHeight; ++y)
-            DestroyPatch(x, y);
-
-    // Now create the new terrain patch storage and copy the old height values over.
-    std::vector<Patch> newPatches(newPatchWidth * newPatchHeight);
-    for(int y = 0; y < min(patchHeight, newPatchHeight); ++y)
-        for(int x = 0; x < min(patchWidth, newPatchWidth); ++x)
-            newPatches[y * newPatchWidth + x] = GetPatch(x, y);
-    patches = newPatches;
-    int oldPatchWidth = patchWidth;
-    int oldPatchHeight = patchHeight;
     patchWidth = newPatchWidth;
     patchHeight = newPatchHeight;
+    ResizePatches();
 
-    // Init any new patches to flat planes with the given fixed height.
-
-    const float initialPatchHeight = 0.f;
-
-    for(int y = oldPatchHeight; y < newPatchHeight; ++y)
-        for(int x = 0; x < patchWidth; ++x)
-            MakePatchFlat(x, y, initialPatchHeight);
-    for(int x = oldPatchWidth; x < newPatchWidth; ++x) // We have some overlap here with above, but it's ok since DestroyPatch is benign.
-        for(int y = 0; y < patchHeight; ++y)
-            MakePatchFlat(x, y, initialPatchHeight);
-
-    // Tell each patch which coordinate in the grid they lie in.
-    for(int y = 0; y < patchHeight; ++y)
-        for(int x = 0; x < patchWidth; ++x)
-        {
-            GetPatch(x,y).x = x;
-            GetPatch(x,y).y = y;
-        }
+    // The size of the chunks at the old terrain edge changes, so the chunk grid is rebuilt from scratch.
+    ResizeChunks();
+    DirtyAllTerrainPatches();
 }
 
 void EC_Terrain::OnAttributeUpdated(IAttribute *attribute)
@@ -250,10 +322,10 @@ void EC_Terrain::MaterialAssetLoaded(AssetPtr asset_)
 
     currentMaterial = material->getName().c_str();
 
-    // Also, we need to update each geometry patch to use the new material.
-    for(int y = 0; y < patchHeight; ++y)
-        for(int x = 0; x < patchWidth; ++x)
-            UpdateTerrainPatchMaterial(x, y);
+    // Also, we need to update each geometry chunk to use the new material.
+    for(int y = 0; y < chunkHeight; ++y)
+        for(int x = 0; x < chunkWidth; ++x)
+            UpdateTerrainChunkMaterial(x, y);
 /*
     // The material of the terrain has changed. Since we specify the textures of that material as attributes,
     // we need to re-apply the textures from the attributes to the new material we set.
@@ -288,6 +360,17 @@ void EC_Terrain::TerrainAssetLoaded(AssetPtr asset_)
     if (!assetData.get() || assetData->data.size() == 0)
         return;
 
+    // Tiled height maps are memory-mapped instead of decoding all the patches from the downloaded data. The data is mapped
+    // from a private temporary copy, so that the asset cache file is not kept open and locked while the terrain exists.
+    if (IsTiledHeightMap((const char*)&assetData->data[0], assetData->data.size()))
+    {
+        boost::shared_ptr<QTemporaryFile> copy(new QTemporaryFile);
+        if (copy->open() && copy->write((const char*)&assetData->data[0], assetData->data.size()) == (qint64)assetData->data.size() &&
+            copy->flush() && MapHeightFile(copy, asset_->Name()))
+            return;
+        LogWarning("EC_Terrain: Could not write a temporary copy of the tiled height map " + asset_->Name().toStdString() + ", reading it into memory instead.");
+    }
+
     LoadFromDataInMemory((const char*)&assetData->data[0], assetData->data.size());
 }
 
@@ -297,6 +380,14 @@ void EC_Terrain::DestroyPatch(int x, int y)
     if (x >= patchWidth || y >= patchHeight || x < 0 || y < 0)
         return;
 
+    DestroyChunk(x / cChunkPatches, y / cChunkPatches);
+}
+
+void EC_Terrain::DestroyChunk(int x, int y)
+{
+    if (x >= chunkWidth || y >= chunkHeight || x < 0 || y < 0)
+        return;
+
     assert(GetFramework());
     if (!GetFramework())
         return;
@@ -305,38 +396,70 @@ void EC_Terrain::DestroyPatch(int x, int y)
         return;
     Ogre::SceneManager *sceneMgr = world_.lock()->GetSceneManager();
     
-    EC_Terrain::Patch &patch = GetPatch(x, y);
+    EC_Terrain::Chunk &chunk = GetChunk(x, y);
 
-    if (patch.node)
+    if (chunk.node)
     {
-        sceneMgr->getRootSceneNode()->removeChild(patch.node);
-        patch.node->detachAllObjects();
-        sceneMgr->destroySceneNode(patch.node);
-        patch.node = 0;
+        if (chunk.node->getParentSceneNode())
+            chunk.node->getParentSceneNode()->removeChild(chunk.node);
+        chunk.node->detachAllObjects();
+        sceneMgr->destroySceneNode(chunk.node);
+        chunk.node = 0;
     }
-    if (patch.entity)
+    if (chunk.entity)
     {
-        sceneMgr->destroyEntity(patch.entity);
-        patch.entity = 0;
+        sceneMgr->destroyEntity(chunk.entity);
+        chunk.entity = 0;
     }
 
     // If there exists a previously generated GPU Mesh resource, delete it before creating a new one.
-    if (patch.meshGeometryName.length() > 0)
+    if (chunk.meshGeometryName.length() > 0)
     {
         try
         {
-            Ogre::MeshManager::getSingleton().remove(patch.meshGeometryName);
+            Ogre::MeshManager::getSingleton().remove(chunk.meshGeometryName);
         }
         catch(...) {}
-        patch.meshGeometryName = "";
+        chunk.meshGeometryName = "";
     }
+
+    chunk.numLodLevels = 0;
+    chunk.chunk_geometry_dirty = true;
+    ++chunk.buildGeneration; // Drop the result of any build in progress.
+}
+
+void EC_Terrain::ResizeChunks()
+{
+    for(int y = 0; y < chunkHeight; ++y)
+        for(int x = 0; x < chunkWidth; ++x)
+            DestroyChunk(x, y);
+
+    ++chunkGridGeneration;
+    chunkWidth = (patchWidth + cChunkPatches - 1) / cChunkPatches;
+    chunkHeight = (patchHeight + cChunkPatches - 1) / cChunkPatches;
+
+    chunks.clear();
+    chunks.resize(chunkWidth * chunkHeight);
+    for(int y = 0; y < chunkHeight; ++y)
+        for(int x = 0; x < chunkWidth; ++x)
+        {
+            GetChunk(x,y).x = x;
+            GetChunk(x,y).y = y;
+            // With paging enabled, UpdateChunkPaging() brings in the chunks around the camera.
+            GetChunk(x,y).inRange = (pagingDistance <= 0.f);
+        }
 }
 
 void EC_Terrain::Destroy()
 {
-    for(int y = 0; y < patchHeight; ++y)
-        for(int x = 0; x < patchWidth; ++x)
-            DestroyPatch(x, y);
+    for(int y = 0; y < chunkHeight; ++y)
+        for(int x = 0; x < chunkWidth; ++x)
+            DestroyChunk(x, y);
+
+    lodIndexBuffers.clear();
+
+    // The builds in progress only access their own job data, so they can be left to finish in the background.
+    pendingChunkBuilds.clear();
 
     if (!GetFramework())
         return;
@@ -365,15 +488,82 @@ float EC_Terrain::GetPoint(int x, int y) const
     if (y >= cPatchSize * patchHeight)
         y = cPatchSize * patchHeight - 1;
 
-    return GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)];
+    return HeightAt(x, y);
+}
+
+float TerrainHeightField::MappedHeight(int x, int y) const
+{
+    const int cPatchSize = EC_Terrain::cPatchSize;
+    const int patchX = x / cPatchSize;
+    const int patchY = y / cPatchSize;
+    if (!mappedHeights || patchX >= mappedPatchWidth || patchY >= mappedPatchHeight)
+        return 0.f;
+
+    // The file stores the patches as tiles, one after another.
+    const size_t sample = (size_t)(patchY * mappedPatchWidth + patchX) * cPatchSize * cPatchSize + (y % cPatchSize) * cPatchSize + (x % cPatchSize);
+    if (mappedQuantized)
+        return mappedOffset + mappedScale * ((const u16*)mappedHeights)[sample];
+    else
+        return ((const float*)mappedHeights)[sample];
+}
+
+void TerrainHeightField::MakeResident()
+{
+    if (!heights.empty())
+        return;
+
+    heights.resize(width * height);
+    for(int y = 0; y < height; ++y)
+        for(int x = 0; x < width; ++x)
+            At(x, y) = MappedHeight(x, y);
+
+    if (mappedFile)
+    {
+        mappedFile->close(); // Closing also unmaps the file, and removes it if it is a temporary copy.
+        mappedFile.reset();
+    }
+    mappedHeights = 0;
+    mappedPatchWidth = 0;
+    mappedPatchHeight = 0;
+}
+
+void EC_Terrain::MakeHeightsResident()
+{
+    if (!heightField->heights.empty())
+        return;
+
+    PROFILE(EC_Terrain_MakeHeightsResident);
+
+    // The store is filled in place. The physics shape reads the mapped heights through the same store, so the edit
+    // that calls this has already waited for the physics with BeginHeightEdit().
+    heightField->MakeResident();
+}
+
+TerrainHeightFieldPtr EC_Terrain::HeightField()
+{
+    return heightField;
 }
 
 void EC_Terrain::SetPointHeight(int x, int y, float height)
+{
+    BeginHeightEdit();
+    WriteHeight(x, y, height);
+}
+
+void EC_Terrain::BeginHeightEdit()
+{
+    emit HeightFieldAboutToChange();
+}
+
+void EC_Terrain::WriteHeight(int x, int y, float height)
 {
     if (x < 0 || y < 0 || x >= cPatchSize * patchWidth || y >= cPatchSize * patchHeight)
         return; // Out of bounds signals are silently ignored.
 
-    GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
+    MakeHeightsResident();
+    heightField->At(x, y) = height;
+    dirtyHeights |= QRect(x, y, 1, 1);
+    GetPatch(x / cPatchSize, y / cPatchSize).patch_geometry_dirty = true;
 }
 
 namespace
@@ -395,14 +585,22 @@ namespace
     }
 }
 
+Ogre::Matrix4 EC_Terrain::WorldTransform() const
+{
+    if (rootNode)
+        return GetWorldTransform(rootNode);
+
+    // Without a view there is no root node, so compose the transform from the attributes the same way UpdateRootNodeTransform() does.
+    const Transform &tm = nodeTransformation.Get();
+    float3x4 localToParent = float3x4::Translate(tm.pos) * float3x4::FromEulerXYZ(DegToRad(tm.rot.x), DegToRad(tm.rot.y), DegToRad(tm.rot.z)) * float3x4::Scale(tm.scale);
+    Entity *entity = ParentEntity();
+    EC_Placeable *placeable = entity ? entity->GetComponent<EC_Placeable>().get() : 0;
+    return float4x4(placeable ? placeable->LocalToWorld() * localToParent : localToParent);
+}
+
 float3 EC_Terrain::GetPointOnMap(const float3 &point) const 
 {
-    if (!rootNode)
-    {
-        LogError("GetPointOnMap called before rootNode initialized, returning zeros");
-        return float3(0, 0, 0);
-    }
-    Ogre::Matrix4 worldTM = GetWorldTransform(rootNode);
+    Ogre::Matrix4 worldTM = WorldTransform();
 
     // Note: heightmap X & Y correspond to X & Z world axes, while height is world Y
     Ogre::Matrix4 inv = worldTM.inverse(); // world->local
@@ -414,12 +612,7 @@ float3 EC_Terrain::GetPointOnMap(const float3 &point) const
 
 float3 EC_Terrain::GetPointOnMapLocal(const float3 &point) const
 {
-    if (!rootNode)
-    {
-        LogError("GetPointOnMapLocal called before rootNode initialized, returning zeros");
-        return float3(0, 0, 0);
-    }
-    Ogre::Matrix4 worldTM = GetWorldTransform(rootNode);
+    Ogre::Matrix4 worldTM = WorldTransform();
 
     // Note: heightmap X & Y correspond to X & Z world axes, while height is world Y
     Ogre::Matrix4 inv = worldTM.inverse(); // world->local
@@ -479,11 +672,6 @@ float3 EC_Terrain::GetTerrainRotationAngles(float x, float y, float z, const flo
     /// at the given point.
     ///\bug Whether this is actually working at all is a result of random tweaking.
 
-    if (!rootNode)
-    {
-        LogError("GetTerrainRotationAngles called before rootNode initialized, returning zeros");
-        return float3(0, 0, 0);
-    }
     float3 worldPos(x,y,z);
     float3 local = GetPointOnMapLocal(worldPos);
     // Get terrain normal.
@@ -604,7 +792,7 @@ float3 EC_Terrain::GetPlaneNormal(float x, float y) const
     // h1 to h3 are the three terrain height points in local coordinate space.
     float3 normal = (h3-h2).Cross(h3-h1);
 
-    float4x4 worldTM = GetWorldTransform(rootNode);
+    float4x4 worldTM = WorldTransform();
     return worldTM.MulDir(normal).Normalized();
 }
 
@@ -617,7 +805,7 @@ float3 EC_Terrain::GetInterpolatedNormal(float x, float y) const
     // h1 to h3 are the three terrain height points in local coordinate space.
     float3 normal = (1.f - u - v) * n1 + u * n2 + v * n3;
 
-    float4x4 worldTM = GetWorldTransform(rootNode);
+    float4x4 worldTM = WorldTransform();
     return worldTM.MulDir(normal).Normalized();
 }
 
@@ -664,12 +852,13 @@ bool EC_Terrain::SaveToFile(QString filename)
 
     assert(sizeof(float) == 4);
 
+    std::vector<float> heights(cPatchSize*cPatchSize);
     for(u32 i = 0; i < xPatches*yPatches; ++i)
     {
-        if (patches[i].heightData.size() < cPatchSize*cPatchSize)
-            patches[i].heightData.resize(cPatchSize*cPatchSize);
+        for(int j = 0; j < cPatchSize*cPatchSize; ++j)
+            heights[j] = HeightAt(patches[i].x * cPatchSize + j % cPatchSize, patches[i].y * cPatchSize + j / cPatchSize);
 
-        fwrite(&patches[i].heightData[0], sizeof(float), cPatchSize*cPatchSize, handle); ///< \todo Check read error.
+        fwrite(&heights[0], sizeof(float), cPatchSize*cPatchSize, handle); ///< \todo Check read error.
     }
     fflush(handle);
     if (ferror(handle))
@@ -679,6 +868,68 @@ bool EC_Terrain::SaveToFile(QString filename)
     return true;
 }
 
+bool EC_Terrain::SaveToTiledFile(QString filename, bool quantize)
+{
+    if (patchWidth * patchHeight != (int)patches.size())
+    {
+        LogError("The EC_Terrain is in inconsistent state. Cannot save.");
+        return false;
+    }
+
+    FILE *handle = fopen(filename.toStdString().c_str(), "wb");
+    if (!handle)
+    {
+        LogError("Could not open file " + filename.toStdString() + ".");
+        return false;
+    }
+
+    TiledHeightMapHeader header;
+    memcpy(header.magic, cTiledHeightMapMagic, sizeof(header.magic));
+    header.version = cTiledHeightMapVersion;
+    header.xPatches = patchWidth;
+    header.yPatches = patchHeight;
+    header.tileSize = cPatchSize;
+    header.format = quantize ? TiledHeightsUInt16 : TiledHeightsFloat32;
+    header.scale = 1.f;
+    header.offset = 0.f;
+    header.dataOffset = cTiledHeightMapDataOffset;
+    GetTerrainHeightRange(header.minHeight, header.maxHeight);
+    if (quantize)
+    {
+        header.offset = header.minHeight;
+        header.scale = (header.maxHeight > header.minHeight) ? (header.maxHeight - header.minHeight) / 65535.f : 0.f;
+    }
+
+    // The header is padded so that the tiles are aligned in the mapped file.
+    std::vector<u8> headerData(cTiledHeightMapDataOffset, 0);
+    memcpy(&headerData[0], &header, sizeof(header));
+    fwrite(&headerData[0], 1, headerData.size(), handle);
+
+    std::vector<float> heights(cPatchSize*cPatchSize);
+    std::vector<u16> quantized(cPatchSize*cPatchSize);
+    for(size_t i = 0; i < patches.size(); ++i)
+    {
+        for(int j = 0; j < cPatchSize*cPatchSize; ++j)
+            heights[j] = HeightAt(patches[i].x * cPatchSize + j % cPatchSize, patches[i].y * cPatchSize + j / cPatchSize);
+
+        if (quantize)
+        {
+            for(int j = 0; j < cPatchSize*cPatchSize; ++j)
+                quantized[j] = (header.scale > 0.f) ? (u16)clamp((int)((heights[j] - header.offset) / header.scale + 0.5f), 0, 65535) : 0;
+            fwrite(&quantized[0], sizeof(u16), cPatchSize*cPatchSize, handle);
+        }
+        else
+            fwrite(&heights[0], sizeof(float), cPatchSize*cPatchSize, handle);
+    }
+    fflush(handle);
+    bool success = !ferror(handle);
+    if (!success)
+        LogError("Write error in SaveToTiledFile");
+    fclose(handle);
+
+    return success;
+}
+
 u32 ReadU32(const char *dataPtr, size_t numBytes, int &offset)
 {
     if (offset + 4 > (int)numBytes)
@@ -692,6 +943,16 @@ bool EC_Terrain::LoadFromFile(QString filename)
 {
     filename = filename.trimmed();
 
+    // Tiled height map files are memory-mapped, and the heights are read straight from the mapping until they are edited.
+    boost::shared_ptr<QFile> mappedFile(new QFile(filename));
+    if (mappedFile->open(QIODevice::ReadOnly))
+    {
+        QByteArray magic = mappedFile->peek(sizeof(TiledHeightMapHeader));
+        if (IsTiledHeightMap(magic.constData(), magic.size()))
+            return MapHeightFile(mappedFile, filename);
+        mappedFile->close();
+    }
+
     std::vector<u8> file;
     LoadFileToVector(filename.toStdString().c_str(), file);
 
@@ -707,42 +968,70 @@ bool EC_Terrain::LoadFromFile(QString filename)
 
 bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
 {
+    if (IsTiledHeightMap(data, numBytes))
+    {
+        TiledHeightMapHeader header;
+        if (!ReadTiledHeightMapHeader(data, numBytes, header))
+            return false;
+
+        TerrainHeightFieldPtr newHeightField(new TerrainHeightField(header.xPatches * cPatchSize, header.yPatches * cPatchSize));
+        const float *floatHeights = (const float*)(data + header.dataOffset);
+        const u16 *quantizedHeights = (const u16*)(data + header.dataOffset);
+        for(u32 i = 0; i < header.xPatches * header.yPatches; ++i)
+        {
+            const int originX = (i % header.xPatches) * cPatchSize;
+            const int originY = (i / header.xPatches) * cPatchSize;
+            for(int j = 0; j < cPatchSize*cPatchSize; ++j)
+            {
+                const size_t sample = i * cPatchSize * cPatchSize + j;
+                newHeightField->At(originX + j % cPatchSize, originY + j / cPatchSize) =
+                    (header.format == TiledHeightsUInt16) ? header.offset + header.scale * quantizedHeights[sample] : floatHeights[sample];
+            }
+        }
+
+        SetLoadedHeightField(newHeightField, header.xPatches, header.yPatches);
+        return true;
+    }
+
     int offset = 0;
     u32 xPatches = ReadU32(data, numBytes, offset);
     u32 yPatches = ReadU32(data, numBytes, offset);
 
     // Load all the data from the file to an intermediate buffer first, so that we can first see
     // if the file is not broken, and reject it without losing the old terrain.
-    std::vector<Patch> newPatches(xPatches*yPatches);
-
-    // Initialize the new height data structure.
-    for(u32 y = 0; y < yPatches; ++y)
-        for(u32 x = 0; x < xPatches; ++x)
-        {
-            newPatches[y*xPatches+x].x = x;
-            newPatches[y*xPatches+x].y = y;
-        }
+    if ((size_t)xPatches * yPatches * cPatchSize * cPatchSize * sizeof(float) > numBytes - offset)
+        throw Exception("Not enough bytes to deserialize!");
+    TerrainHeightFieldPtr newHeightField(new TerrainHeightField(xPatches * cPatchSize, yPatches * cPatchSize));
 
     assert(sizeof(float) == 4);
 
-    // Load the new data.
-    for(size_t i = 0; i < newPatches.size(); ++i)
+    // Load the new data. The file stores the patches one after another, so each patch row is copied separately.
+    for(u32 i = 0; i < xPatches*yPatches; ++i)
     {
-        newPatches[i].heightData.resize(cPatchSize*cPatchSize);
-        newPatches[i].patch_geometry_dirty = true;
-        if (offset+cPatchSize*cPatchSize*sizeof(float) > numBytes)
-            throw Exception("Not enough bytes to deserialize!");
-
-        memcpy(&newPatches[i].heightData[0], data + offset, cPatchSize*cPatchSize*sizeof(float));
-        offset += cPatchSize*cPatchSize*sizeof(float);
+        const int originX = (i % xPatches) * cPatchSize;
+        const int originY = (i / xPatches) * cPatchSize;
+        for(int j = 0; j < cPatchSize; ++j)
+        {
+            memcpy(&newHeightField->At(originX, originY + j), data + offset, cPatchSize*sizeof(float));
+            offset += cPatchSize*sizeof(float);
+        }
     }
 
     // The terrain asset loaded ok. We are good to set that terrain as the active terrain.
+    SetLoadedHeightField(newHeightField, xPatches, yPatches);
+    return true;
+}
+
+void EC_Terrain::SetLoadedHeightField(const TerrainHeightFieldPtr &newHeightField, int newPatchWidth, int newPatchHeight)
+{
     Destroy();
 
-    patches = newPatches;
-    patchWidth = xPatches;
-    patchHeight = yPatches;
+    heightField = newHeightField;
+    dirtyHeights = QRect();
+    patchWidth = newPatchWidth;
+    patchHeight = newPatchHeight;
+    ResizePatches();
+    ResizeChunks();
 
     // Re-do all the geometry on the GPU.
     RegenerateDirtyTerrainPatches();
@@ -755,7 +1044,48 @@ bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
 
     this->xPatches.Changed(AttributeChange::LocalOnly);
     this->yPatches.Changed(AttributeChange::LocalOnly);
+}
+
+void EC_Terrain::ResizePatches()
+{
+    patches.clear();
+    patches.resize(patchWidth * patchHeight);
+    for(int y = 0; y < patchHeight; ++y)
+        for(int x = 0; x < patchWidth; ++x)
+        {
+            GetPatch(x,y).x = x;
+            GetPatch(x,y).y = y;
+        }
+}
 
+bool EC_Terrain::MapHeightFile(const boost::shared_ptr<QFile> &file, const QString &source)
+{
+    const uchar *data = file->map(0, file->size());
+    if (!data)
+    {
+        LogError("Could not memory-map terrain file " + source.toStdString() + ".");
+        return false;
+    }
+    TiledHeightMapHeader header;
+    if (!ReadTiledHeightMapHeader((const char*)data, (size_t)file->size(), header))
+        return false;
+
+    // The store is left empty, so that the heights are read from the mapped file. The file is closed when the store is released.
+    TerrainHeightFieldPtr newHeightField(new TerrainHeightField);
+    newHeightField->width = header.xPatches * cPatchSize;
+    newHeightField->height = header.yPatches * cPatchSize;
+    newHeightField->mappedFile = file;
+    newHeightField->mappedHeights = data + header.dataOffset;
+    newHeightField->mappedPatchWidth = header.xPatches;
+    newHeightField->mappedPatchHeight = header.yPatches;
+    newHeightField->mappedQuantized = (header.format == TiledHeightsUInt16);
+    newHeightField->mappedScale = header.scale;
+    newHeightField->mappedOffset = header.offset;
+    newHeightField->mappedMinHeight = header.minHeight;
+    newHeightField->mappedMaxHeight = header.maxHeight;
+
+    SetLoadedHeightField(newHeightField, header.xPatches, header.yPatches);
+    currentHeightmapAssetSource = source;
     return true;
 }
 
@@ -827,12 +1157,13 @@ bool EC_Terrain::LoadFromImageFile(QString filename, float offset, float scale)
     yPatches.Set(image.getHeight() / cPatchSize, AttributeChange::Disconnected);
     ResizeTerrain(xPatches.Get(), yPatches.Get());
 
+    BeginHeightEdit();
     for(int y = 0; y < yPatches.Get() * cPatchSize; ++y)
         for(int x = 0; x < xPatches.Get() * cPatchSize; ++x)
         {
             Ogre::ColourValue c = image.getColourAt(x, y, 0);
             float height = offset + scale * (c.r + c.g + c.b) / 3.f; // Treat the image as a grayscale heightmap field with the color in range [0,1].
-            SetPointHeight(x, y, height);
+            WriteHeight(x, y, height);
         }
 
     heightMap.Set(AssetReference(""/*,""*/), AttributeChange::Disconnected);
@@ -1120,6 +1451,7 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
 
     const float raycastHeight = maxExtents.y + 100.f;
 
+    BeginHeightEdit();
     for(int y = 0; y < yVertices; ++y)
         for(int x = 0; x < xVertices; ++x)
         {
@@ -1128,7 +1460,7 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
             if (height < 1e8f)
             {
                 height = raycastHeight - height;
-                SetPointHeight(x, y, height);
+                WriteHeight(x, y, height);
                 minHeight = min(minHeight, height);
                 maxHeight = max(maxHeight, height);
             }
@@ -1137,7 +1469,7 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
     for(int y = 0; y < yVertices; ++y)
         for(int x = 0; x < xVertices; ++x)
             if (GetPoint(x, y) >= 1e8f)
-                SetPointHeight(x, y, minHeight);
+                WriteHeight(x, y, minHeight);
 
     // Adjust offset so that we always have the lowest point of the terrain at height 0.
     RemapHeightValues(0.f, maxHeight - minHeight);
@@ -1154,9 +1486,10 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
 
 void EC_Terrain::AffineTransform(float scale, float offset)
 {
+    BeginHeightEdit();
     for(int y = 0; y < yPatches.Get() * cPatchSize; ++y)
         for(int x = 0; x < xPatches.Get() * cPatchSize; ++x)
-            SetPointHeight(x, y, GetPoint(x, y) * scale + offset);
+            WriteHeight(x, y, GetPoint(x, y) * scale + offset);
 }
 
 void EC_Terrain::RemapHeightValues(float minHeight, float maxHeight)
@@ -1205,16 +1538,16 @@ void EC_Terrain::SetTerrainMaterialTexture(int index, const char *textureName)
 //        LogWarning("Ogre material " + std::string(terrainMaterialName) + " not found!");
 }
 
-void EC_Terrain::UpdateTerrainPatchMaterial(int patchX, int patchY)
+void EC_Terrain::UpdateTerrainChunkMaterial(int chunkX, int chunkY)
 {
-    Patch &patch = GetPatch(patchX, patchY);
+    Chunk &chunk = GetChunk(chunkX, chunkY);
 
-    if (!patch.entity)
+    if (!chunk.entity)
         return;
 
-    for(size_t i = 0; i < patch.entity->getNumSubEntities(); ++i)
+    for(size_t i = 0; i < chunk.entity->getNumSubEntities(); ++i)
     {
-        Ogre::SubEntity *sub = patch.entity->getSubEntity(i);
+        Ogre::SubEntity *sub = chunk.entity->getSubEntity(i);
         if (sub)
             sub->setMaterialName(currentMaterial.toStdString().c_str());
     }
@@ -1240,6 +1573,8 @@ void EC_Terrain::AttachTerrainRootNode()
 {
     if (!rootNode)
         CreateRootNode();
+    if (!rootNode)
+        return;
 
     if (world_.expired()) 
         return;
@@ -1251,7 +1586,7 @@ void EC_Terrain::AttachTerrainRootNode()
 
     // If this entity has an EC_Placeable, make sure it is the parent of this terrain component.
     boost::shared_ptr<EC_Placeable> pos = ParentEntity()->GetComponent<EC_Placeable>();
-    if (pos)
+    if (pos && pos->GetSceneNode())
     {
         Ogre::SceneNode *parent = pos->GetSceneNode();
         parent->addChild(rootNode);
@@ -1264,168 +1599,600 @@ void EC_Terrain::AttachTerrainRootNode()
     }
 }
 
-/// Creates Ogre geometry data for the single given patch, or updates the geometry for an existing
-/// patch if the associated Ogre resources already exist.
-void EC_Terrain::GenerateTerrainGeometryForOnePatch(int patchX, int patchY)
+namespace
 {
-    PROFILE(EC_Terrain_GenerateTerrainGeometryForOnePatch);
+    /// The number of floats per terrain vertex: position (3), normal (3), UV0 (2), UV1 (2) and the geomorph target heights (4).
+    const int cTerrainVertexSize = 14;
 
-    EC_Terrain::Patch &patch = GetPatch(patchX, patchY);
+    /// The offset of the geomorph target heights in a terrain vertex.
+    const int cMorphOffset = 10;
 
-    if (!ViewEnabled())
-        return;
-    if (world_.expired())
-        return;
-    OgreWorldPtr world = world_.lock();
-    Ogre::SceneManager *sceneMgr = world->GetSceneManager();
+    /// The renderable custom parameter the geomorph weights are passed in. Matches "param_named_auto morphWeights custom 1" in the terrain materials.
+    const size_t cMorphWeightsParam = 1;
 
-    Ogre::SceneNode *node = patch.node;
-    bool firstTimeFill = (node == 0);
-    UNREFERENCED_PARAM(firstTimeFill);
-    if (!node)
+    /// How far below the lowest point of a chunk its skirts extend.
+    const float cSkirtMargin = 1.f;
+
+    /// The edges of a chunk that have a skirt.
+    enum SkirtEdge
+    {
+        SkirtTop = 1, ///< y == 0
+        SkirtBottom = 2, ///< y == vertsY-1
+        SkirtLeft = 4, ///< x == 0
+        SkirtRight = 8 ///< x == vertsX-1
+    };
+
+    /// Returns the grid vertex coordinates used on one axis of a chunk at the given detail level.
+    /** The last vertex is always included, so that chunks at the terrain edge that are not a power of two in size still close up. */
+    void LodAxisVertices(int numVerts, int lod, std::vector<int> &dst)
     {
-        CreateOgreTerrainPatchNode(node, patch.x, patch.y);
-        patch.node = node;
+        const int step = 1 << lod;
+        dst.clear();
+        for(int i = 0; i < numVerts - 1; i += step)
+            dst.push_back(i);
+        dst.push_back(numVerts - 1);
     }
-    assert(node);
 
-    Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
-    if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
-        terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
-
-    Ogre::ManualObject *manual = sceneMgr->createManualObject(world->GetUniqueObjectName("EC_Terrain_manual"));
-    manual->setCastShadows(false);
-
-    manual->clear();
-    manual->estimateVertexCount((cPatchSize+1)*(cPatchSize+1));
-    manual->estimateIndexCount((cPatchSize+1)*(cPatchSize+1)*3*2);
-    manual->begin(terrainMaterial->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
-
-    const float vertexSpacingX = 1.f;
-    const float vertexSpacingY = 1.f;
-    const float patchSpacingX = cPatchSize * vertexSpacingX;
-    const float patchSpacingY = cPatchSize * vertexSpacingY;
-    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, 0.f, patch.y * patchSpacingY);
-// Opensim:    const Ogre::Vector3 patchOrigin(patch.x * patchSpacingX, patch.y * patchSpacingY, 0.f);
-
-    int curIndex = 0;
-
-    const int cPatchVertexWidth = cPatchSize; // The number of vertices in the patch in horizontal direction. We use the fixed value of cPatchSize==16.
-    const int cPatchVertexHeight = cPatchSize; // The number of vertices in the patch in vertical  direction. We use the fixed value of cPatchSize==16.
-    // If we assume each patch is 16x16 vertices, then all the internal patches will get a 17x17 grid, since we need to connect seams.
-    // But, the outermost patch row and column at the terrain edge will not have this, since they do not need to connect to a next patch.
-    // This is the vertex stride for the terrain.
-    const int stride = (patch.x + 1 >= patchWidth) ? cPatchVertexWidth : (cPatchVertexWidth+1);
-
-    const float uScale = this->uScale.Get();
-    const float vScale = this->vScale.Get();
-
-    for(int y = 0; y <= cPatchVertexHeight; ++y)
-        for(int x = 0; x <= cPatchVertexWidth; ++x)
-        {
-            if ((patch.x + 1 >= patchWidth && x == cPatchVertexWidth) ||
-                (patch.y + 1 >= patchHeight && y == cPatchVertexHeight))
-                continue; // We are at the single corner-most vertex of the whole terrain. That is to be skipped.
+    /// Returns the number of detail levels a chunk with the given number of grid vertices has.
+    int NumChunkLodLevels(int vertsX, int vertsY)
+    {
+        int numLevels = 1;
+        while(numLevels < EC_Terrain::cNumLodLevels && (1 << numLevels) < min(vertsX, vertsY) - 1)
+            ++numLevels;
+        return numLevels;
+    }
 
-            // These coordinates are directly generated to our Ogre coordinate system, i.e. are cycled from OpenSim XYZ -> our YZX.
-            // see OpenSimToOgreCoordinateAxes.
-            Ogre::Vector3 pos;
-            pos.x = vertexSpacingX * x;
-            pos.z = vertexSpacingY * y;
-// Opensim:             pos.x = vertexSpacingX * x;
-// Opensim              pos.y = vertexSpacingY * y;
-
-            EC_Terrain::Patch *thisPatch;
-            int X = x;
-            int Y = y;
-            if (x < cPatchVertexWidth && y < cPatchVertexHeight)
+    /// Returns the height of the surface drawn at the given detail level, at the given grid vertex of a chunk.
+    float LodSurfaceHeight(const std::vector<float> &heights, int vertsX, int vertsY, int x, int y, int lod)
+    {
+        const int step = 1 << lod;
+        const int x0 = (x / step) * step;
+        const int y0 = (y / step) * step;
+        const int x1 = min(x0 + step, vertsX - 1);
+        const int y1 = min(y0 + step, vertsY - 1);
+        const float u = (x1 > x0) ? (float)(x - x0) / (x1 - x0) : 0.f;
+        const float v = (y1 > y0) ? (float)(y - y0) / (y1 - y0) : 0.f;
+
+        const float h00 = heights[y0 * vertsX + x0];
+        const float h10 = heights[y0 * vertsX + x1];
+        const float h01 = heights[y1 * vertsX + x0];
+        const float h11 = heights[y1 * vertsX + x1];
+
+        // The quads are split along the same diagonal as in the index buffers.
+        if (u + v <= 1.f)
+            return h00 + u * (h10 - h00) + v * (h01 - h00);
+        else
+            return h11 + (1.f - u) * (h01 - h11) + (1.f - v) * (h10 - h11);
+    }
+}
+
+struct EC_Terrain::LodIndexBuffer
+{
+    Ogre::HardwareIndexBufferSharedPtr buffer;
+    size_t indexStart[cNumLodLevels];
+    size_t indexCount[cNumLodLevels];
+};
+
+EC_Terrain::LodIndexBuffer *EC_Terrain::GetLodIndexBuffer(int vertsX, int vertsY, int numLodLevels, int edgeMask)
+{
+    const int key = (vertsX * 256 + vertsY) * 16 + edgeMask;
+    std::map<int, boost::shared_ptr<LodIndexBuffer> >::iterator iter = lodIndexBuffers.find(key);
+    if (iter != lodIndexBuffers.end())
+        return iter->second.get();
+
+    PROFILE(EC_Terrain_GetLodIndexBuffer);
+
+    boost::shared_ptr<LodIndexBuffer> lodBuffer(new LodIndexBuffer);
+
+    // The skirt vertices follow the grid vertices, one row or column for each edge, in the order of the SkirtEdge bits.
+    const int numGridVertices = vertsX * vertsY;
+    const int skirtTop = numGridVertices;
+    const int skirtBottom = skirtTop + vertsX;
+    const int skirtLeft = skirtBottom + vertsX;
+    const int skirtRight = skirtLeft + vertsY;
+
+    std::vector<u16> indices;
+    std::vector<int> xs;
+    std::vector<int> ys;
+    for(int lod = 0; lod < numLodLevels; ++lod)
+    {
+        lodBuffer->indexStart[lod] = indices.size();
+        LodAxisVertices(vertsX, lod, xs);
+        LodAxisVertices(vertsY, lod, ys);
+
+        for(size_t j = 0; j + 1 < ys.size(); ++j)
+            for(size_t i = 0; i + 1 < xs.size(); ++i)
             {
-                thisPatch = &patch;
-
-                if ((patch.x + 1 < patchWidth || x+1 < cPatchVertexWidth) &&
-                    (patch.y + 1 < patchHeight || y+1 < cPatchVertexHeight))
-                {
-                    // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
-                    manual->index(curIndex+stride);
-                    manual->index(curIndex+1);
-                    manual->index(curIndex);
-
-                    manual->index(curIndex+stride);
-                    manual->index(curIndex+stride+1);
-                    manual->index(curIndex+1);
-                }
+                const u16 a = (u16)(ys[j] * vertsX + xs[i]);
+                const u16 b = (u16)(ys[j] * vertsX + xs[i+1]);
+                const u16 c = (u16)(ys[j+1] * vertsX + xs[i]);
+                const u16 d = (u16)(ys[j+1] * vertsX + xs[i+1]);
+
+                // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
+                indices.push_back(c); indices.push_back(b); indices.push_back(a);
+                indices.push_back(c); indices.push_back(d); indices.push_back(b);
             }
-            else if (x == cPatchVertexWidth && y == cPatchVertexHeight)
+
+        // The skirts face outwards from the chunk.
+        for(size_t i = 0; i + 1 < xs.size(); ++i)
+        {
+            if (edgeMask & SkirtTop)
             {
-                thisPatch = &GetPatch(patch.x + 1, patch.y + 1);
-                X = 0;
-                Y = 0;
+                const u16 ea = (u16)xs[i], eb = (u16)xs[i+1];
+                const u16 sa = (u16)(skirtTop + xs[i]), sb = (u16)(skirtTop + xs[i+1]);
+                indices.push_back(ea); indices.push_back(eb); indices.push_back(sa);
+                indices.push_back(eb); indices.push_back(sb); indices.push_back(sa);
             }
-            else if (x == cPatchVertexWidth)
+            if (edgeMask & SkirtBottom)
             {
-                thisPatch = &GetPatch(patch.x + 1, patch.y);
-                X = 0;
+                const u16 ea = (u16)((vertsY-1) * vertsX + xs[i]), eb = (u16)((vertsY-1) * vertsX + xs[i+1]);
+                const u16 sa = (u16)(skirtBottom + xs[i]), sb = (u16)(skirtBottom + xs[i+1]);
+                indices.push_back(ea); indices.push_back(sa); indices.push_back(eb);
+                indices.push_back(eb); indices.push_back(sa); indices.push_back(sb);
             }
-            else // (y == patchHeight)
+        }
+        for(size_t j = 0; j + 1 < ys.size(); ++j)
+        {
+            if (edgeMask & SkirtLeft)
+            {
+                const u16 ea = (u16)(ys[j] * vertsX), eb = (u16)(ys[j+1] * vertsX);
+                const u16 sa = (u16)(skirtLeft + ys[j]), sb = (u16)(skirtLeft + ys[j+1]);
+                indices.push_back(ea); indices.push_back(sa); indices.push_back(eb);
+                indices.push_back(eb); indices.push_back(sa); indices.push_back(sb);
+            }
+            if (edgeMask & SkirtRight)
             {
-                thisPatch = &GetPatch(patch.x, patch.y + 1);
-                Y = 0;
+                const u16 ea = (u16)(ys[j] * vertsX + vertsX-1), eb = (u16)(ys[j+1] * vertsX + vertsX-1);
+                const u16 sa = (u16)(skirtRight + ys[j]), sb = (u16)(skirtRight + ys[j+1]);
+                indices.push_back(ea); indices.push_back(eb); indices.push_back(sa);
+                indices.push_back(eb); indices.push_back(sb); indices.push_back(sa);
             }
+        }
+
+        lodBuffer->indexCount[lod] = indices.size() - lodBuffer->indexStart[lod];
+    }
+
+    lodBuffer->buffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(Ogre::HardwareIndexBuffer::IT_16BIT,
+        indices.size(), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+    lodBuffer->buffer->writeData(0, indices.size() * sizeof(u16), &indices[0], true);
 
-            pos.y = thisPatch->heightData[Y*cPatchVertexWidth+X];
-// Opensim:            pos.z = thisPatch->heightData[Y*cPatchVertexWidth+X];
+    lodIndexBuffers[key] = lodBuffer;
+    return lodBuffer.get();
+}
 
-            manual->position(pos);
-            manual->normal(CalculateNormal(thisPatch->x, thisPatch->y, X, Y));
+void EC_Terrain::BuildChunkGeometry(ChunkBuildJobPtr job)
+{
+    PROFILE(EC_Terrain_BuildChunkGeometry);
+
+    ChunkGeometry &geometry = job->geometry;
+    const int vertsX = geometry.vertsX;
+    const int vertsY = geometry.vertsY;
+    geometry.numLodLevels = NumChunkLodLevels(vertsX, vertsY);
+
+    // The input heights have a one vertex border, so (x,y) of the chunk grid is at (x+1,y+1).
+    const int inputStride = vertsX + 2;
+    const float *input = &job->heights[inputStride + 1];
+
+    std::vector<float> heights(vertsX * vertsY);
+    geometry.minHeight = std::numeric_limits<float>::max();
+    geometry.maxHeight = -std::numeric_limits<float>::max();
+    for(int y = 0; y < vertsY; ++y)
+        for(int x = 0; x < vertsX; ++x)
+        {
+            const float height = input[y * inputStride + x];
+            heights[y * vertsX + x] = height;
+            geometry.minHeight = min(geometry.minHeight, height);
+            geometry.maxHeight = max(geometry.maxHeight, height);
+        }
+
+    const float blendUScale = 1.f / (job->terrainVertsX - 1);
+    const float blendVScale = 1.f / (job->terrainVertsY - 1);
+
+    geometry.vertices.resize((vertsX * vertsY + 2 * vertsX + 2 * vertsY) * cTerrainVertexSize);
+    float *v = &geometry.vertices[0];
+    for(int y = 0; y < vertsY; ++y)
+        for(int x = 0; x < vertsX; ++x)
+        {
+            const int mapX = job->originX + x;
+            const int mapY = job->originY + y;
+            const float *h = &input[y * inputStride + x];
+            const float height = *h;
+
+            // These coordinates are directly generated to our Ogre coordinate system, i.e. are cycled from OpenSim XYZ -> our YZX.
+            *v++ = (float)x;
+            *v++ = height;
+            *v++ = (float)y;
+
+            // Same as CalculateNormal(). The border values are clamped to the terrain edge the same way GetPoint() does.
+            float x_slope = h[-1] - h[1];
+            if (mapX <= 0)
+                x_slope *= 2;
+            float y_slope = h[-inputStride] - h[inputStride];
+            if (mapY <= 0)
+                y_slope *= 2;
+            const float3 normal = float3(x_slope, 2.0, y_slope).Normalized();
+            *v++ = normal.x;
+            *v++ = normal.y;
+            *v++ = normal.z;
 
             // The UV set 0 contains the diffuse texture UV map. Do a planar mapping with the given specified UV scale.
-            manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.z + pos.z) * vScale);
-// Opensim:             manual->textureCoord((patchOrigin.x + pos.x) * uScale, (patchOrigin.y + pos.y) * vScale);
+            *v++ = mapX * job->uScale;
+            *v++ = mapY * job->vScale;
 
             // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
-            manual->textureCoord((float)(patch.x*cPatchSize + x)/(VerticesWidth()-1), (float)(patch.y*cPatchSize + y)/(VerticesHeight()-1)); 
+            *v++ = mapX * blendUScale;
+            *v++ = mapY * blendVScale;
 
-            ++curIndex;
+            // The UV set 2 contains the height of this vertex on the surface of each coarser level, for geomorphing.
+            for(int lod = 1; lod <= 4; ++lod)
+                *v++ = (lod < geometry.numLodLevels) ? LodSurfaceHeight(heights, vertsX, vertsY, x, y, lod) : height;
         }
 
-    manual->end();
+    // The skirts hang down to below the lowest point of the chunk, which covers the gap to a neighbor drawn at any detail level,
+    // since the heights along the shared edge of both chunks are interpolated from the same edge vertices.
+    const float skirtHeight = geometry.minHeight - cSkirtMargin;
+    for(int edge = 0; edge < 4; ++edge)
+    {
+        const int count = (edge < 2) ? vertsX : vertsY;
+        for(int i = 0; i < count; ++i)
+        {
+            const int x = (edge < 2) ? i : (edge == 2 ? 0 : vertsX - 1);
+            const int y = (edge >= 2) ? i : (edge == 0 ? 0 : vertsY - 1);
+            const float *src = &geometry.vertices[(y * vertsX + x) * cTerrainVertexSize];
+            std::copy(src, src + cTerrainVertexSize, v);
+            v[1] = skirtHeight;
+            for(int j = cMorphOffset; j < cTerrainVertexSize; ++j)
+                v[j] = skirtHeight;
+            v += cTerrainVertexSize;
+        }
+    }
+}
 
-    // If there exists a previously generated GPU Mesh resource, delete it before creating a new one.
-    if (patch.meshGeometryName.length() > 0)
+void EC_Terrain::UploadChunkGeometry(int chunkX, int chunkY, const ChunkGeometry &geometry)
+{
+    PROFILE(EC_Terrain_UploadChunkGeometry);
+
+    if (world_.expired())
+        return;
+    OgreWorldPtr world = world_.lock();
+    Ogre::SceneManager *sceneMgr = world->GetSceneManager();
+
+    EC_Terrain::Chunk &chunk = GetChunk(chunkX, chunkY);
+    if (!chunk.node)
+        CreateOgreTerrainChunkNode(chunk.node, chunkX, chunkY);
+    if (!chunk.node)
+        return;
+
+    const size_t numVertices = geometry.vertices.size() / cTerrainVertexSize;
+    Ogre::MeshPtr mesh;
+
+    if (chunk.entity && chunk.vertsX == geometry.vertsX && chunk.vertsY == geometry.vertsY)
     {
-        try
+        // The chunk layout did not change, so only the contents of the vertex buffer need to be replaced.
+        mesh = chunk.entity->getMesh();
+        Ogre::HardwareVertexBufferSharedPtr vertexBuffer = mesh->getSubMesh(0)->vertexData->vertexBufferBinding->getBuffer(0);
+        vertexBuffer->writeData(0, vertexBuffer->getSizeInBytes(), &geometry.vertices[0], true);
+    }
+    else
+    {
+        // Edges that are shared with a neighboring chunk get a skirt.
+        int edgeMask = 0;
+        if (chunkY > 0)
+            edgeMask |= SkirtTop;
+        if (chunkY + 1 < chunkHeight)
+            edgeMask |= SkirtBottom;
+        if (chunkX > 0)
+            edgeMask |= SkirtLeft;
+        if (chunkX + 1 < chunkWidth)
+            edgeMask |= SkirtRight;
+        LodIndexBuffer *lodBuffer = GetLodIndexBuffer(geometry.vertsX, geometry.vertsY, geometry.numLodLevels, edgeMask);
+
+        if (chunk.entity)
         {
-            Ogre::MeshManager::getSingleton().remove(patch.meshGeometryName);
+            chunk.node->detachObject(chunk.entity);
+            sceneMgr->destroyEntity(chunk.entity);
+            chunk.entity = 0;
         }
-        catch(...) {}
+
+        // If there exists a previously generated GPU Mesh resource, delete it before creating a new one.
+        if (chunk.meshGeometryName.length() > 0)
+        {
+            try
+            {
+                Ogre::MeshManager::getSingleton().remove(chunk.meshGeometryName);
+            }
+            catch(...) {}
+        }
+
+        Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
+        if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
+            terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
+
+        chunk.meshGeometryName = world->GetUniqueObjectName("EC_Terrain_chunkmesh");
+        mesh = Ogre::MeshManager::getSingleton().createManual(chunk.meshGeometryName, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+
+        Ogre::SubMesh *subMesh = mesh->createSubMesh();
+        subMesh->useSharedVertices = false;
+        subMesh->vertexData = new Ogre::VertexData();
+        subMesh->vertexData->vertexStart = 0;
+        subMesh->vertexData->vertexCount = numVertices;
+
+        Ogre::VertexDeclaration *decl = subMesh->vertexData->vertexDeclaration;
+        size_t offset = 0;
+        offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION).getSize();
+        offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL).getSize();
+        offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0).getSize();
+        offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 1).getSize();
+        offset += decl->addElement(0, offset, Ogre::VET_FLOAT4, Ogre::VES_TEXTURE_COORDINATES, 2).getSize();
+        assert(offset == cTerrainVertexSize * sizeof(float));
+
+        Ogre::HardwareVertexBufferSharedPtr vertexBuffer = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+            offset, numVertices, Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+        vertexBuffer->writeData(0, vertexBuffer->getSizeInBytes(), &geometry.vertices[0], true);
+        subMesh->vertexData->vertexBufferBinding->setBinding(0, vertexBuffer);
+
+        subMesh->indexData->indexBuffer = lodBuffer->buffer;
+        subMesh->setMaterialName(terrainMaterial->getName());
+
+        for(int lod = 0; lod < geometry.numLodLevels; ++lod)
+        {
+            chunk.lodIndexStart[lod] = lodBuffer->indexStart[lod];
+            chunk.lodIndexCount[lod] = lodBuffer->indexCount[lod];
+        }
+        chunk.vertsX = geometry.vertsX;
+        chunk.vertsY = geometry.vertsY;
+        chunk.numLodLevels = geometry.numLodLevels;
+        chunk.lod = 0;
+    }
+
+    const float skirtHeight = geometry.minHeight - cSkirtMargin;
+    const Ogre::AxisAlignedBox bounds(0.f, skirtHeight, 0.f, (float)(geometry.vertsX - 1), geometry.maxHeight, (float)(geometry.vertsY - 1));
+    mesh->_setBounds(bounds);
+    mesh->_setBoundingSphereRadius(Ogre::Vector3(bounds.getMaximum().x, max(fabs(skirtHeight), fabs(geometry.maxHeight)), bounds.getMaximum().z).length());
+
+    if (!chunk.entity)
+    {
+        mesh->load();
+
+        chunk.entity = sceneMgr->createEntity(world->GetUniqueObjectName("EC_Terrain_chunkentity"), chunk.meshGeometryName);
+        chunk.entity->setUserAny(Ogre::Any(parentEntity));
+        chunk.entity->setCastShadows(false);
+        // Set UserAny also on subentities
+        for(uint i = 0; i < chunk.entity->getNumSubEntities(); ++i)
+            chunk.entity->getSubEntity(i)->setUserAny(chunk.entity->getUserAny());
+        chunk.node->attachObject(chunk.entity);
     }
+    chunk.node->needUpdate();
 
-    patch.meshGeometryName = world->GetUniqueObjectName("EC_Terrain_patchmesh");
-    Ogre::MeshPtr terrainMesh = manual->convertToMesh(patch.meshGeometryName);
+    const Ogre::Vector3 center = bounds.getCenter();
+    chunk.center = float3(chunk.node->getPosition().x + center.x, center.y, chunk.node->getPosition().z + center.z);
+    chunk.radius = bounds.getHalfSize().length();
 
-    // Odd: destroyManualObject seems to leave behind a memory leak if we don't call manualObject->clear first.
-    manual->clear();
-    sceneMgr->destroyManualObject(manual);
+    SetChunkLod(chunk, chunk.lod, 0.f);
+}
 
-    patch.entity = sceneMgr->createEntity(world->GetUniqueObjectName("EC_Terrain_patchentity"), patch.meshGeometryName);
-    patch.entity->setUserAny(Ogre::Any(parentEntity));
-    patch.entity->setCastShadows(false);
-    // Set UserAny also on subentities
-    for(uint i = 0; i < patch.entity->getNumSubEntities(); ++i)
-        patch.entity->getSubEntity(i)->setUserAny(patch.entity->getUserAny());
+void EC_Terrain::StartChunkBuild(int chunkX, int chunkY)
+{
+    // Without a view, the terrain only exists for the height queries and physics, so no GPU geometry is needed.
+    if (!ViewEnabled())
+        return;
+    if (world_.expired())
+        return;
 
-    // Explicitly destroy all attached MovableObjects previously bound to this terrain node.
-    Ogre::SceneNode::ObjectIterator iter = node->getAttachedObjectIterator();
-    while(iter.hasMoreElements())
+    PROFILE(EC_Terrain_StartChunkBuild);
+
+    ChunkBuildJobPtr job;
+    if (!freeChunkBuildJobs.empty())
     {
-        Ogre::MovableObject *obj = iter.getNext();
-        sceneMgr->destroyMovableObject(obj);
+        job = freeChunkBuildJobs.back();
+        freeChunkBuildJobs.pop_back();
     }
-    node->detachAllObjects();
-    // Now attach the new built terrain mesh.
-    node->attachObject(patch.entity);
+    else
+        job = ChunkBuildJobPtr(new ChunkBuildJob);
+
+    Chunk &chunk = GetChunk(chunkX, chunkY);
+    job->chunkX = chunkX;
+    job->chunkY = chunkY;
+    job->generation = ++chunk.buildGeneration;
+    job->gridGeneration = chunkGridGeneration;
+
+    // Adjacent chunks share the vertices on their common edge. The chunks at the terrain edge do not need to connect to a next chunk.
+    job->originX = chunkX * cChunkPatches * cPatchSize;
+    job->originY = chunkY * cChunkPatches * cPatchSize;
+    job->geometry.vertsX = min(cChunkPatches * cPatchSize + 1, VerticesWidth() - job->originX);
+    job->geometry.vertsY = min(cChunkPatches * cPatchSize + 1, VerticesHeight() - job->originY);
+    job->terrainVertsX = VerticesWidth();
+    job->terrainVertsY = VerticesHeight();
+    job->uScale = uScale.Get();
+    job->vScale = vScale.Get();
+
+    const int inputStride = job->geometry.vertsX + 2;
+    job->heights.resize(inputStride * (job->geometry.vertsY + 2));
+    float *dst = &job->heights[0];
+    for(int y = -1; y <= job->geometry.vertsY; ++y)
+        for(int x = -1; x <= job->geometry.vertsX; ++x)
+            *dst++ = GetPoint(job->originX + x, job->originY + y);
+
+    chunk.chunk_geometry_dirty = false;
+
+    PendingChunkBuild pending;
+    pending.job = job;
+    pending.future = QtConcurrent::run(&EC_Terrain::BuildChunkGeometry, job);
+    pendingChunkBuilds.push_back(pending);
+}
 
-    patch.patch_geometry_dirty = false;
+void EC_Terrain::UploadFinishedChunkBuilds()
+{
+    if (pendingChunkBuilds.empty())
+        return;
+
+    PROFILE(EC_Terrain_UploadFinishedChunkBuilds);
+
+    bool createdNodes = false;
+    for(size_t i = 0; i < pendingChunkBuilds.size();)
+    {
+        if (!pendingChunkBuilds[i].future.isFinished())
+        {
+            ++i;
+            continue;
+        }
+
+        ChunkBuildJobPtr job = pendingChunkBuilds[i].job;
+        pendingChunkBuilds[i] = pendingChunkBuilds.back();
+        pendingChunkBuilds.pop_back();
+
+        // A newer build may have been started for the chunk while this one was running, or the chunk grid may have been reallocated.
+        if (job->gridGeneration == chunkGridGeneration && job->chunkX < chunkWidth && job->chunkY < chunkHeight &&
+            GetChunk(job->chunkX, job->chunkY).buildGeneration == job->generation)
+        {
+            if (!GetChunk(job->chunkX, job->chunkY).node)
+                createdNodes = true;
+            UploadChunkGeometry(job->chunkX, job->chunkY, job->geometry);
+        }
+
+        freeChunkBuildJobs.push_back(job);
+    }
+
+    // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
+    // we need to hide all newly created geometry.
+    if (createdNodes)
+        AttachTerrainRootNode();
+}
+
+void EC_Terrain::OnFrameUpdated(float /*frametime*/)
+{
+    UploadFinishedChunkBuilds();
+    UpdateChunkPaging();
+    UpdateChunkLods();
+}
+
+void EC_Terrain::UpdateChunkPaging()
+{
+    if (pagingDistance <= 0.f || !rootNode || world_.expired() || !ViewEnabled())
+        return;
+
+    OgreRenderer::Renderer *renderer = world_.lock()->GetRenderer();
+    EC_Camera *camera = renderer ? dynamic_cast<EC_Camera*>(renderer->GetActiveCamera()) : 0;
+    if (!camera || !camera->GetCamera())
+        return;
+
+    PROFILE(EC_Terrain_UpdateChunkPaging);
+
+    // The paging is done in the terrain grid space, on the horizontal plane.
+    const Ogre::Vector3 cameraPos = rootNode->_getFullTransform().inverseAffine() * camera->GetCamera()->getDerivedPosition();
+    const float chunkSize = (float)(cChunkPatches * cPatchSize);
+    // Chunks are released a bit further away than where they are brought in, so that a camera moving back and forth
+    // across the boundary does not keep rebuilding them.
+    const float pageOutDistance = pagingDistance * 1.25f;
+
+    for(int y = 0; y < chunkHeight; ++y)
+        for(int x = 0; x < chunkWidth; ++x)
+        {
+            Chunk &chunk = GetChunk(x, y);
+            const float dx = max(0.f, max(x * chunkSize - cameraPos.x, cameraPos.x - (x + 1) * chunkSize));
+            const float dy = max(0.f, max(y * chunkSize - cameraPos.z, cameraPos.z - (y + 1) * chunkSize));
+            const float distance = sqrt(dx*dx + dy*dy);
+
+            if (!chunk.inRange && distance <= pagingDistance)
+            {
+                chunk.inRange = true;
+                if (chunk.chunk_geometry_dirty)
+                    StartChunkBuild(x, y);
+            }
+            else if (chunk.inRange && distance > pageOutDistance)
+            {
+                chunk.inRange = false;
+                DestroyChunk(x, y);
+            }
+        }
+}
+
+void EC_Terrain::SetPagingDistance(float distance)
+{
+    pagingDistance = max(0.f, distance);
+
+    // Without paging, all the chunks are kept loaded.
+    if (pagingDistance <= 0.f)
+    {
+        for(size_t i = 0; i < chunks.size(); ++i)
+            chunks[i].inRange = true;
+        RegenerateDirtyTerrainPatches();
+    }
+}
+
+void EC_Terrain::SetChunkLod(Chunk &chunk, int lod, float morph)
+{
+    if (!chunk.entity || chunk.numLodLevels <= 0)
+        return;
+
+    lod = clamp(lod, 0, chunk.numLodLevels - 1);
+    Ogre::IndexData *indexData = chunk.entity->getMesh()->getSubMesh(0)->indexData;
+    indexData->indexStart = chunk.lodIndexStart[lod];
+    indexData->indexCount = chunk.lodIndexCount[lod];
+    chunk.lod = lod;
+
+    // Only morph towards a level the chunk actually has.
+    Ogre::Vector4 weights(0.f, 0.f, 0.f, 0.f);
+    if (lod + 1 < chunk.numLodLevels)
+        weights[lod] = morph;
+    chunk.entity->getSubEntity(0)->setCustomParameter(cMorphWeightsParam, weights);
+}
+
+void EC_Terrain::UpdateChunkLods()
+{
+    if (!rootNode || world_.expired() || !ViewEnabled())
+        return;
+
+    PROFILE(EC_Terrain_UpdateChunkLods);
+
+    OgreRenderer::Renderer *renderer = world_.lock()->GetRenderer();
+    EC_Camera *camera = renderer ? dynamic_cast<EC_Camera*>(renderer->GetActiveCamera()) : 0;
+    if (!camera || !camera->GetCamera())
+        return;
+
+    const Ogre::Vector3 cameraPos = camera->GetCamera()->getDerivedPosition();
+    const Ogre::Matrix4 &worldTM = rootNode->_getFullTransform();
+    const Ogre::Vector3 scale = rootNode->_getDerivedScale();
+    const float radiusScale = max(fabs(scale.x), max(fabs(scale.y), fabs(scale.z)));
+
+    for(size_t i = 0; i < chunks.size(); ++i)
+    {
+        Chunk &chunk = chunks[i];
+        if (!chunk.entity)
+            continue;
+
+        if (!lodEnabled)
+        {
+            SetChunkLod(chunk, 0, 0.f);
+            continue;
+        }
+
+        const Ogre::Vector3 center = worldTM * Ogre::Vector3(chunk.center.x, chunk.center.y, chunk.center.z);
+        const float distance = max(0.f, center.distance(cameraPos) - chunk.radius * radiusScale);
+
+        // Level n is drawn up to the distance lodDistance * 2^n. Over the last quarter of that range, the vertices morph
+        // towards level n+1 so that there is no visible pop when the level changes.
+        int lod = 0;
+        float levelDistance = lodDistance;
+        while(lod + 1 < chunk.numLodLevels && distance >= levelDistance)
+        {
+            ++lod;
+            levelDistance *= 2.f;
+        }
+        const float morph = clamp((distance / levelDistance - 0.75f) * 4.f, 0.f, 1.f);
+
+        SetChunkLod(chunk, lod, morph);
+    }
+}
+
+void EC_Terrain::SetLodEnabled(bool enabled)
+{
+    lodEnabled = enabled;
+}
+
+void EC_Terrain::SetLodDistance(float distance)
+{
+    lodDistance = max(1e-3f, distance);
 }
 
 void EC_Terrain::CreateRootNode()
@@ -1434,7 +2201,8 @@ void EC_Terrain::CreateRootNode()
     if (rootNode)
         return;
 
-    if (world_.expired())
+    // Without a view the terrain is not rendered, and only the height values are used, e.g. by the physics.
+    if (world_.expired() || !ViewEnabled())
         return;
     OgreWorldPtr world = world_.lock();
     Ogre::SceneManager *sceneMgr = world->GetSceneManager();
@@ -1447,7 +2215,7 @@ void EC_Terrain::CreateRootNode()
     UpdateRootNodeTransform();
 }
 
-void EC_Terrain::CreateOgreTerrainPatchNode(Ogre::SceneNode *&node, int patchX, int patchY)
+void EC_Terrain::CreateOgreTerrainChunkNode(Ogre::SceneNode *&node, int chunkX, int chunkY)
 {
     if (world_.expired())
         return;
@@ -1460,7 +2228,7 @@ void EC_Terrain::CreateOgreTerrainPatchNode(Ogre::SceneNode *&node, int patchX,
     if (!rootNode)
         CreateRootNode();
 
-    QString name = QString("EC_Terrain_Patch_") + QString::number(patchX) + "_" + QString::number(patchY);
+    QString name = QString("EC_Terrain_Chunk_") + QString::number(chunkX) + "_" + QString::number(chunkY);
     node = sceneMgr->createSceneNode(world->GetUniqueObjectName(name.toStdString()));
     if (!node)
         return;
@@ -1470,22 +2238,17 @@ void EC_Terrain::CreateOgreTerrainPatchNode(Ogre::SceneNode *&node, int patchX,
     else // Just as a safety check, if for some odd reason we did not get the root node.
         sceneMgr->getRootSceneNode()->addChild(node);
     
-    const float vertexSpacingX = 1.f;
-    const float vertexSpacingY = 1.f;
-    const float patchSpacingX = 16 * vertexSpacingX;
-    const float patchSpacingY = 16 * vertexSpacingY;
-    const Ogre::Vector3 patchOrigin(patchX * patchSpacingX, 0.f, patchY * patchSpacingY);
-
-    node->setPosition(patchOrigin);
+    const float chunkSpacing = (float)(cChunkPatches * cPatchSize);
+    node->setPosition(Ogre::Vector3(chunkX * chunkSpacing, 0.f, chunkY * chunkSpacing));
 }
 
 float EC_Terrain::GetTerrainMinHeight() const
 {
     float minHeight = std::numeric_limits<float>::max();
 
-    for(size_t i = 0; i < patches.size(); ++i)
-        for(size_t j = 0; j < patches[i].heightData.size(); ++j)
-            minHeight = min(minHeight, patches[i].heightData[j]);
+    for(int y = 0; y < VerticesHeight(); ++y)
+        for(int x = 0; x < VerticesWidth(); ++x)
+            minHeight = min(minHeight, HeightAt(x, y));
 
     return minHeight;
 }
@@ -1494,9 +2257,9 @@ float EC_Terrain::GetTerrainMaxHeight() const
 {
     float maxHeight = -std::numeric_limits<float>::max();
 
-    for(size_t i = 0; i < patches.size(); ++i)
-        for(size_t j = 0; j < patches[i].heightData.size(); ++j)
-            maxHeight = max(maxHeight, patches[i].heightData[j]);
+    for(int y = 0; y < VerticesHeight(); ++y)
+        for(int x = 0; x < VerticesWidth(); ++x)
+            maxHeight = max(maxHeight, HeightAt(x, y));
 
     return maxHeight;
 }
@@ -1517,44 +2280,40 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
 {
     PROFILE(EC_Terrain_RegenerateDirtyTerrainPatches);
 
+    // Without a view, the terrain only exists for the height queries and physics, which read the height value store directly.
+    const bool createGeometry = ViewEnabled();
+
+    // A changed patch affects the chunk it is part of, and the seams and normals of the chunks of its neighbors.
     for(int y = 0; y < patchHeight; ++y)
         for(int x = 0; x < patchWidth; ++x)
         {
             EC_Terrain::Patch &scenePatch = GetPatch(x, y);
-            if (!scenePatch.patch_geometry_dirty || scenePatch.heightData.size() == 0)
+            if (!scenePatch.patch_geometry_dirty)
                 continue;
 
-            bool neighborsLoaded = true;
-
-            const int neighbors[8][2] = 
-            { 
-                { -1, -1 }, { -1, 0 }, { -1, 1 },
-                {  0, -1 },            {  0, 1 },
-                {  1, -1 }, {  1, 0 }, {  1, 1 }
-            };
+            if (createGeometry)
+                for(int nY = max(0, y - 1); nY <= min(patchHeight - 1, y + 1); ++nY)
+                    for(int nX = max(0, x - 1); nX <= min(patchWidth - 1, x + 1); ++nX)
+                        GetChunk(nX / cChunkPatches, nY / cChunkPatches).chunk_geometry_dirty = true;
+            scenePatch.patch_geometry_dirty = false;
+        }
 
-            for(int i = 0; i < 8; ++i)
-            {
-                int nX = x + neighbors[i][0];
-                int nY = y + neighbors[i][1];
-                if (nX >= 0 && nX < patchWidth &&
-                    nY >= 0 && nY < patchHeight &&
-                    GetPatch(nX, nY).heightData.size() == 0)
-                {
-                    neighborsLoaded = false;
-                    break;
-                }
-            }
+    if (createGeometry)
+    {
+        for(int y = 0; y < chunkHeight; ++y)
+            for(int x = 0; x < chunkWidth; ++x)
+                if (GetChunk(x, y).chunk_geometry_dirty && GetChunk(x, y).inRange)
+                    StartChunkBuild(x, y);
 
-            if (neighborsLoaded)
-                GenerateTerrainGeometryForOnePatch(x, y);
-        }
-    
-    // All the new geometry we created will be visible for Ogre by default. If the EC_Placeable's visible attribute is false,
-    // we need to hide all newly created geometry.
-    AttachTerrainRootNode();
+        AttachTerrainRootNode();
+    }
 
-    ///\todo If this terrain only exists for physics heightfield purposes, don't create GPU resources for it at all.
+    if (!dirtyHeights.isEmpty())
+    {
+        const QRect changed = dirtyHeights;
+        dirtyHeights = QRect();
+        emit HeightFieldChanged(changed.x(), changed.y(), changed.width(), changed.height());
+    }
 
     emit TerrainRegenerated();
 }
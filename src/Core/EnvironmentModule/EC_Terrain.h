@@ -11,7 +11,65 @@
 #include "AssetRefListener.h"
 #include "OgreModuleFwd.h"
 
+#include <QFuture>
+#include <QRect>
+
+#include <map>
+
 namespace Ogre { class Matrix4; }
+class QFile;
+
+/// The height values of a whole terrain grid, stored row by row in a single contiguous array, or read from a memory-mapped height map file.
+/** EC_Terrain owns the store, and the physics heightfield shape of EC_RigidBody reads the heights directly from it without copying.
+    While the heights are read from a mapped file, the physics read them through Height() as well, so only the parts of the file
+    that bodies touch are paged in. The first edit copies the heights into the store and closes the file.
+    Edits are done in place, after HeightFieldAboutToChange() has let the shape wait for a physics step running in a worker thread.
+    When the terrain is resized or reloaded, it switches to a new store, and the old one stays alive until the last shape using it
+    has been rebuilt. */
+struct ENVIRONMENT_MODULE_API TerrainHeightField
+{
+    TerrainHeightField(int width_ = 0, int height_ = 0, float value = 0.f) :
+        width(width_), height(height_), heights(width_ * height_, value),
+        mappedHeights(0), mappedPatchWidth(0), mappedPatchHeight(0), mappedQuantized(false), mappedScale(1.f), mappedOffset(0.f),
+        mappedMinHeight(0.f), mappedMaxHeight(0.f)
+    {
+    }
+
+    /// The number of vertices in the local X and Y directions.
+    int width;
+    int height;
+
+    /// width * height height values, or empty if the heights are still read from a memory-mapped height map file.
+    std::vector<float> heights;
+
+    /// The memory-mapped tiled height map file the heights are read from while the store is empty, or null.
+    /// For heightMap assets this is a temporary copy of the downloaded data, so that the asset cache file is not held open.
+    boost::shared_ptr<QFile> mappedFile;
+    /// Points to the first tile in the mapped file, or null if no file is mapped.
+    const uchar *mappedHeights;
+    int mappedPatchWidth;
+    int mappedPatchHeight;
+    /// If true, the mapped heights are 16-bit integers that map to mappedOffset + mappedScale * value. Otherwise they are floats.
+    bool mappedQuantized;
+    float mappedScale;
+    float mappedOffset;
+    /// The range of the heights in the mapped file.
+    float mappedMinHeight;
+    float mappedMaxHeight;
+
+    float &At(int x, int y) { return heights[y * width + x]; }
+    float At(int x, int y) const { return heights[y * width + x]; }
+
+    /// Returns the height value at the given in-bounds grid vertex, from the store or from the mapped file.
+    float Height(int x, int y) const { return heights.empty() ? MappedHeight(x, y) : At(x, y); }
+
+    /// Reads the height value at the given grid vertex from the mapped file. Returns 0 if no file is mapped.
+    float MappedHeight(int x, int y) const;
+
+    /// Copies the heights from the mapped file into the store and closes the file, so that the heights can be edited.
+    void MakeResident();
+};
+typedef boost::shared_ptr<TerrainHeightField> TerrainHeightFieldPtr;
 
 /// Adds a heightmap-based terrain to the scene.
 /**
@@ -21,7 +79,8 @@ namespace Ogre { class Matrix4; }
 <td>
 <h2>Terrain</h2>
 Adds a heightmap-based terrain to the scene. A Terrain is composed of a rectangular grid of adjacent "patches".
-Each patch is a fixed-size 16x16 height map.
+Each patch is a fixed-size 16x16 height map. For rendering, blocks of 4x4 patches are merged into GPU chunks, which are drawn
+at a lower level of detail the further they are from the active camera.
 
 Registered by Environment::EnvironmentModule.
 
@@ -109,15 +168,19 @@ public:
     /// Each patch is a square containing this many vertices per side.
     static const int cPatchSize = 16;
 
+    /// Each GPU chunk merges this many patches per side into a single mesh.
+    static const int cChunkPatches = 4;
+
+    /// The maximum number of detail levels of a chunk. Level n renders every 2^n'th vertex of the chunk grid.
+    static const int cNumLodLevels = 5;
+
     /// Describes a single patch that is present in the scene.
-    /** A patch can be in one of the following three states:
-        - not loaded. The height data nor the GPU data is present, but the Patch struct itself is initialized. heightData.size() == 0, node == entity == 0. meshGeometryName == "".
-        - heightmap data loaded. The heightData vector contains the heightmap data, but the visible GPU vertex data itself has not been generated yet, due to the neighbors
-          of this patch not being present yet. node == entity == 0, meshGeometryName == "". patch_geometry_dirty == true.
-        - fully loaded. The GPU data is also loaded and the node, entity and meshGeometryName fields specify the used GPU resources. */
+    /** The height values of all the patches are kept in the shared TerrainHeightField of the terrain, see HeightField().
+        A patch is either dirty, in which case its heights have changed but the GPU chunk it belongs to has not been
+        (re)generated yet, or up to date. */
     struct Patch
     {
-        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true) {}
+        Patch():x(0),y(0), patch_geometry_dirty(true) {}
 
         /// X-coordinate on the grid of patches. In the range [0, EC_Terrain::PatchWidth()].
         int x;
@@ -125,9 +188,45 @@ public:
         /// Y-coordinate on the grid of patches. In the range [0, EC_Terrain::PatchHeight()].
         int y;
 
-        /// Typically this will be a 16x16 array of height values in world coordinates.
-        /// If the length is zero, this patch hasn't been loaded in yet.
-        std::vector<float> heightData;
+        /// If true, the CPU-side heightmap data has changed, but the chunk containing this patch
+        /// has not yet been marked for regeneration.
+        bool patch_geometry_dirty;
+    };
+
+    /// Describes a block of cChunkPatches x cChunkPatches patches that is rendered as a single GPU mesh.
+    /** The vertex buffer of a chunk holds the patches at full resolution, followed by skirts that hang down from the edges
+        shared with the neighboring chunks to hide the cracks between different detail levels. The index buffer holds the
+        triangle lists of all the detail levels one after another, so changing the level only changes the drawn index range. */
+    struct Chunk
+    {
+        Chunk():x(0),y(0), vertsX(0), vertsY(0), numLodLevels(0), lod(0), buildGeneration(0), radius(0.f), node(0), entity(0), chunk_geometry_dirty(true), inRange(true) {}
+
+        /// X-coordinate on the grid of chunks. In the range [0, EC_Terrain::ChunkWidth()].
+        int x;
+
+        /// Y-coordinate on the grid of chunks. In the range [0, EC_Terrain::ChunkHeight()].
+        int y;
+
+        /// The number of grid vertices in the chunk in the local X and Y directions. Chunks at the terrain edge can be smaller than the others.
+        int vertsX;
+        int vertsY;
+
+        /// The number of detail levels in the index buffer of this chunk, at most cNumLodLevels.
+        int numLodLevels;
+
+        /// The detail level that is currently rendered.
+        int lod;
+
+        /// Incremented each time a geometry build is started for this chunk. Only the result of the latest build is uploaded.
+        u32 buildGeneration;
+
+        /// The index range of each detail level in the index buffer of this chunk.
+        size_t lodIndexStart[cNumLodLevels];
+        size_t lodIndexCount[cNumLodLevels];
+
+        /// Bounding sphere of the chunk geometry in the local space of the terrain, used for choosing the detail level.
+        float3 center;
+        float radius;
 
         /// Ogre -specific: Store a reference to the actual render hierarchy node.
         Ogre::SceneNode *node;
@@ -135,18 +234,16 @@ public:
         /// Ogre -specific: Store a reference to the entity that is attached to the above SceneNode.
         Ogre::Entity *entity;
 
-        /// The name of the Ogre Mesh resource that contains the GPU geometry data for this patch.
+        /// The name of the Ogre Mesh resource that contains the GPU geometry data for this chunk.
         std::string meshGeometryName;
 
-        /// If true, the CPU-side heightmap data has changed, but we haven't yet updated
-        /// the GPU-side geometry resources since the neighboring patches haven't been loaded
-        /// in yet.
-        bool patch_geometry_dirty;
+        /// If true, the height data of some patch in or next to this chunk has changed, and the GPU geometry needs to be regenerated.
+        bool chunk_geometry_dirty;
 
-        /// Call only when you've checked that this patch has been loaded in.
-        float GetHeightValue(int x, int y) const { return heightData[y*cPatchSize+x]; }
+        /// False if the chunk is further than the paging distance from the camera, in which case it has no GPU resources.
+        bool inRange;
     };
-    
+
     /// @return The patch at given (x,y) coordinates. Pass in values in range [0, PatchWidth()/PatchHeight[.
     Patch &GetPatch(int patchX, int patchY)
     {
@@ -167,6 +264,32 @@ public:
         return patches[patchY * patchWidth + patchX];
     }
 
+    /// @return The chunk at given (x,y) coordinates. Pass in values in range [0, ChunkWidth()/ChunkHeight[.
+    Chunk &GetChunk(int chunkX, int chunkY)
+    {
+        assert(chunkX >= 0);
+        assert(chunkY >= 0);
+        assert(chunkX < chunkWidth);
+        assert(chunkY < chunkHeight);
+        return chunks[chunkY * chunkWidth + chunkX];
+    }
+
+    /// @return The chunk at given (x,y) coordinates. Pass in values in range [0, ChunkWidth()/ChunkHeight[. Read only.
+    const Chunk &GetChunk(int chunkX, int chunkY) const
+    {
+        assert(chunkX >= 0);
+        assert(chunkY >= 0);
+        assert(chunkX < chunkWidth);
+        assert(chunkY < chunkHeight);
+        return chunks[chunkY * chunkWidth + chunkX];
+    }
+
+    /// Returns how many GPU chunks there are in the terrain in the x-direction.
+    int ChunkWidth() const { return chunkWidth; }
+
+    /// Returns how many GPU chunks there are in the terrain in the y-direction.
+    int ChunkHeight() const { return chunkHeight; }
+
     /// Calculates and returns the vertex normal for the given terrain vertex.
     /// @param patchX The patch to read from, [0, PatchWidth()[.
     /// @param patchY The patch to read from, [0, PatchHeight()[.
@@ -176,6 +299,12 @@ public:
 
     float3 CalculateNormal(int mapX, int mapY) const { return CalculateNormal( (int) mapX / cPatchSize, (int) mapY / cPatchSize, mapX % cPatchSize, mapY % cPatchSize); }
 
+    /// Returns the height value store of the terrain, for reading the heights in bulk.
+    /** If the heights are still read from a memory-mapped height map file, the store is empty, and the heights are read with
+        TerrainHeightField::Height(). The terrain switches to a new store when it is resized or reloaded, and emits TerrainRegenerated() after that. Edits are done in place,
+        and reported with HeightFieldChanged(). */
+    TerrainHeightFieldPtr HeightField();
+
 public slots:
     /// Returns true if the given patch exists, i.e. whether the given coordinates are within the current terrain patch dimensions.
     /** This function does not tell whether the data for the patch is actually loaded on the CPU or the GPU. */
@@ -184,13 +313,19 @@ public slots:
         return patchX >= 0 && patchY >= 0 && patchX < patchWidth && patchY < patchHeight && patchY * patchWidth + patchX < (int)patches.size();
     }
 
-    /// Returns true if all the patches on the terrain are loaded on the CPU, i.e. if all the terrain height data has been streamed in from the server side.
+    /// Returns true if all the patches on the terrain have their GPU chunks loaded.
+    /** The chunks that are paged out due to their distance from the camera do not count as unloaded. */
     bool AllPatchesLoaded() const
     {
         for(int y = 0; y < patchHeight; ++y)
             for(int x = 0; x < patchWidth; ++x)
-                if (!PatchExists(x,y) || GetPatch(x,y).heightData.size() == 0 || GetPatch(x,y).node == 0)
+            {
+                if (!PatchExists(x,y))
+                    return false;
+                const Chunk &chunk = GetChunk(x / cChunkPatches, y / cChunkPatches);
+                if (chunk.node == 0 && chunk.inRange)
                     return false;
+            }
 
         return true;
     }
@@ -258,7 +393,7 @@ public slots:
     /// Removes all stored terrain patches and the associated Ogre scene nodes.
     void Destroy();
 
-    /// Releases all GPU resources used for the given patch.
+    /// Releases all GPU resources used for the given patch, i.e. the GPU chunk the patch is part of.
     void DestroyPatch(int patchX, int patchY);
 
     /// Makes all the vertices of the given patch flat with the given height value.
@@ -299,8 +434,18 @@ public slots:
     /// @return True if the save succeeded.
     bool SaveToFile(QString filename);
 
+    /// Saves the height map data to a tiled height map file, which can be memory-mapped when loaded.
+    /** The file starts with a versioned header, followed by the patches row by row, each as a 16x16 tile. The files can also be
+        used as the heightMap asset, and loaded with LoadFromFile() and LoadFromDataInMemory(). Use the suffix ".ntf" for these as well.
+        @param quantize If true, the heights are stored as 16-bit integers scaled to the height range of the terrain, which halves
+            the file size at the cost of precision. Otherwise the heights are stored as 32-bit floats.
+        @return True if the save succeeded. */
+    bool SaveToTiledFile(QString filename, bool quantize = false);
+
     /// Loads the terrain height map data from the given binary dump file (.ntf).
-    /** You should prefer using the Attribute heightMap to recreate the terrain from a terrain file instead of calling this function directly,
+    /** Tiled height map files (see SaveToTiledFile()) are memory-mapped instead of being read in, so only the parts of the file
+        that are accessed are ever loaded into memory.
+        You should prefer using the Attribute heightMap to recreate the terrain from a terrain file instead of calling this function directly,
         since this function only performs a local (hidden) change, whereas the heightMap attribute change is visible both
         locally and on the network.
         @note Calling this function will not update the 'heightMap' attribute. If you want to load the terrain from a file
@@ -350,6 +495,9 @@ public slots:
     /// Marks all terrain patches dirty.
     void DirtyAllTerrainPatches();
 
+    /// Regenerates the GPU geometry of the chunks whose patches have been dirtied, and reports the edited heights with HeightFieldChanged().
+    /** The vertex data is built in the thread pool, and reaches the screen once the builds have finished, typically on the next frame.
+        Without a view, no GPU geometry is created at all. */
     void RegenerateDirtyTerrainPatches();
 
     /// Returns the minimum height value in the whole terrain.
@@ -360,10 +508,39 @@ public slots:
     /** This function blindly iterates through the whole terrain, so avoid calling it in performance-critical code. */
     float GetTerrainMaxHeight() const;
 
+    /// Enables or disables the distance-based level of detail of the terrain chunks. When disabled, all chunks are rendered at full detail.
+    /** The initial value is read from the "terrain lod" key of the rendering config section. */
+    void SetLodEnabled(bool enabled);
+
+    /// Returns whether the distance-based level of detail of the terrain chunks is enabled.
+    bool IsLodEnabled() const { return lodEnabled; }
+
+    /// Sets the camera distance (in world units) up to which chunks are rendered at full detail. Each further level doubles the distance.
+    /** The initial value is read from the "terrain lod distance" key of the rendering config section. */
+    void SetLodDistance(float distance);
+
+    /// Returns the camera distance up to which chunks are rendered at full detail.
+    float LodDistance() const { return lodDistance; }
+
+    /// Sets the distance from the camera (in terrain grid units) beyond which the GPU chunks are released. Zero keeps all the chunks loaded.
+    /** The chunks come back as the camera approaches them. The initial value is read from the "terrain paging distance" key of the rendering config section. */
+    void SetPagingDistance(float distance);
+
+    /// Returns the distance from the camera beyond which the GPU chunks are released, or zero if paging is disabled.
+    float PagingDistance() const { return pagingDistance; }
+
 signals:
     /// Emitted when the terrain data is regenerated.
     void TerrainRegenerated();
 
+    /// Emitted by RegenerateDirtyTerrainPatches() with the bounding rectangle, in grid vertices, of the heights that have been edited in place since the last regeneration.
+    /** Not emitted when the terrain switches to a new height value store, as TerrainRegenerated() already covers that. */
+    void HeightFieldChanged(int x, int y, int width, int height);
+
+    /// Emitted before the heights are edited in place. The heights may be read by a physics step running in a worker thread,
+    /// so the receivers must not return until nothing reads the height value store any more. Use a direct connection.
+    void HeightFieldAboutToChange();
+
 private slots:
     /// Emitted when the parrent entity has been set.
     void UpdateSignals();
@@ -379,19 +556,25 @@ private slots:
     /** Additionally re-applies the visibility of each terrain patch that is currently attached to the terrain node. */
     void AttachTerrainRootNode();
 
+    /// Uploads the finished chunk geometry builds and updates the detail levels of the chunks.
+    void OnFrameUpdated(float frametime);
+
 private:
     /// Creates the patch parent/root node if it does not exist.
     /** After this function returns, the 'root' member node will exist, unless Ogre rendering subsystem fails. */
     void CreateRootNode();
 
-    void CreateOgreTerrainPatchNode(Ogre::SceneNode *&node, int patchX, int patchY);
+    void CreateOgreTerrainChunkNode(Ogre::SceneNode *&node, int chunkX, int chunkY);
 
-    /// Sets the given patch to use the currently set material and textures.
-    void UpdateTerrainPatchMaterial(int patchX, int patchY);
+    /// Sets the given chunk to use the currently set material and textures.
+    void UpdateTerrainChunkMaterial(int chunkX, int chunkY);
 
     /// Updates the root node transform from the current attribute values, if the root node exists.
     void UpdateRootNodeTransform();
 
+    /// Returns the local->world transform of the terrain, also when the root node has not been created.
+    Ogre::Matrix4 WorldTransform() const;
+
     /// Readjusts the terrain to contain the given number of patches in the horizontal and vertical directions.
     /** Preserves as much of the terrain height data as possible. Dirties the patches, but does not regenerate them.
         @note This function does not adjust the xPatches or yPatches attributes. */
@@ -402,7 +585,112 @@ private:
     /// @param textureName The Ogre texture resource name to set.
     void SetTerrainMaterialTexture(int index, const char *textureName);
 
-    void GenerateTerrainGeometryForOnePatch(int patchX, int patchY);
+    /// CPU-side vertex data of a single chunk, produced by BuildChunkGeometry().
+    struct ChunkGeometry
+    {
+        int vertsX;
+        int vertsY;
+        int numLodLevels;
+        float minHeight;
+        float maxHeight;
+        /// Interleaved vertices: position, normal, UV0, UV1 and the geomorph target heights. The grid vertices come first, then the skirts.
+        std::vector<float> vertices;
+    };
+
+    /// A chunk geometry build that runs in the thread pool.
+    /** The input heights are copied from the patches on the main thread, so the job does not access the component at all,
+        and the terrain can be edited, resized or deleted while it runs. Finished jobs are recycled to keep their buffers allocated. */
+    struct ChunkBuildJob
+    {
+        int chunkX;
+        int chunkY;
+        /// The Chunk::buildGeneration this build was started with.
+        u32 generation;
+        /// The chunk grid generation this build was started with.
+        u32 gridGeneration;
+
+        int originX;
+        int originY;
+        int terrainVertsX;
+        int terrainVertsY;
+        float uScale;
+        float vScale;
+        /// Height values of the chunk grid, with a one vertex border around it for computing the normals. Stored row by row.
+        std::vector<float> heights;
+
+        /// The result of the build.
+        ChunkGeometry geometry;
+    };
+    typedef boost::shared_ptr<ChunkBuildJob> ChunkBuildJobPtr;
+
+    /// A chunk build job that has been started and the future for waiting its completion.
+    struct PendingChunkBuild
+    {
+        ChunkBuildJobPtr job;
+        QFuture<void> future;
+    };
+
+    /// Shared index buffer holding the triangle lists of all detail levels for one chunk size and skirt configuration.
+    struct LodIndexBuffer;
+
+    /// Computes the vertex data of a chunk from the height values copied into the job. Does not touch any GPU resources.
+    /** This function is run in the worker threads, and it must not access anything but the given job. */
+    static void BuildChunkGeometry(ChunkBuildJobPtr job);
+
+    /// Creates or updates the GPU mesh of the given chunk from the given vertex data.
+    void UploadChunkGeometry(int chunkX, int chunkY, const ChunkGeometry &geometry);
+
+    /// Copies the height values of the given chunk and starts building its vertex data in the thread pool.
+    /** The geometry is uploaded to the GPU in UploadFinishedChunkBuilds() once the build has completed. Does nothing if the scene has no view. */
+    void StartChunkBuild(int chunkX, int chunkY);
+
+    /// Uploads the vertex data of all the chunk builds that have finished since the last call. Results that have become stale are dropped.
+    void UploadFinishedChunkBuilds();
+
+    /// Chooses the detail level and the geomorph weights of each chunk from the distance to the active camera.
+    void UpdateChunkLods();
+
+    /// Releases the GPU resources of the chunks that are beyond the paging distance from the active camera, and starts building
+    /// the chunks that have come within it.
+    void UpdateChunkPaging();
+
+    /// Returns the height value at the given in-bounds grid vertex, from the height value store or from the mapped height map file.
+    float HeightAt(int x, int y) const { return heightField->Height(x, y); }
+
+    /// Copies the heights from the mapped height map file into the height value store and closes the file, so that the heights can be edited.
+    /** Call BeginHeightEdit() first, as the physics may be reading the mapped heights. */
+    void MakeHeightsResident();
+
+    /// Replaces the terrain with the given height value store, and regenerates it.
+    /** The store may be left empty if the heights are read from the mapped height map file. */
+    void SetLoadedHeightField(const TerrainHeightFieldPtr &newHeightField, int newPatchWidth, int newPatchHeight);
+
+    /// Reallocates the patch grid to the current patch dimensions.
+    void ResizePatches();
+
+    /// Emits HeightFieldAboutToChange(). Called before editing the heights in place. The edits done after it in the same
+    /// function are safe, since the physics are stepped again only on the next frame.
+    void BeginHeightEdit();
+
+    /// Sets the height of the given grid vertex in place, like SetPointHeight(), but without calling BeginHeightEdit().
+    void WriteHeight(int x, int y, float height);
+
+    /// Memory-maps the given open tiled height map file and replaces the terrain with it. Returns false if the file could not be mapped.
+    /** The file is kept open until the heights are edited, or the last user of the height value store releases it.
+        @param source The name the terrain was loaded from. */
+    bool MapHeightFile(const boost::shared_ptr<QFile> &file, const QString &source);
+
+    /// Releases all GPU resources used for the given chunk.
+    void DestroyChunk(int chunkX, int chunkY);
+
+    /// Reallocates the chunk grid to cover the current patch grid. Releases the GPU resources of all the old chunks.
+    void ResizeChunks();
+
+    /// Returns the index buffer for the given chunk size and skirt edge mask, creating it if it does not exist yet.
+    LodIndexBuffer *GetLodIndexBuffer(int vertsX, int vertsY, int numLodLevels, int edgeMask);
+
+    /// Switches the index range drawn for the given chunk, and sets the geomorph weight towards the next coarser level.
+    void SetChunkLod(Chunk &chunk, int lod, float morph);
 
     boost::shared_ptr<AssetRefListener> heightMapAsset;
 
@@ -420,8 +708,36 @@ private:
     /// Specifies the Ogre material name of the material that is currently being used to display the terrain.
     QString currentMaterial;
 
-    /// Stores the actual height patches.
+    /// Stores the patch states. The height values themselves are in heightField.
     std::vector<Patch> patches;
+
+    /// The height values of the whole terrain. Never null.
+    TerrainHeightFieldPtr heightField;
+
+    /// The grid vertices edited in place since the last HeightFieldChanged() signal.
+    QRect dirtyHeights;
+
+    /// Stores the GPU chunks, each covering a block of cChunkPatches x cChunkPatches patches.
+    std::vector<Chunk> chunks;
+
+    int chunkWidth;
+    int chunkHeight;
+
+    /// Incremented whenever the chunk grid is reallocated, to drop the results of the builds started for the old grid.
+    u32 chunkGridGeneration;
+
+    /// Chunk geometry builds that have been started, but not yet uploaded.
+    std::vector<PendingChunkBuild> pendingChunkBuilds;
+
+    /// Finished build jobs, kept for reuse.
+    std::vector<ChunkBuildJobPtr> freeChunkBuildJobs;
+
+    /// Index buffers shared by all chunks of the same size and skirt configuration.
+    std::map<int, boost::shared_ptr<LodIndexBuffer> > lodIndexBuffers;
+
+    bool lodEnabled;
+    float lodDistance;
+    float pagingDistance;
     
     /// Ogre world for referring to the Ogre scene manager
     OgreWorldWeakPtr world_;
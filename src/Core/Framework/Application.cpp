@@ -47,12 +47,25 @@ Application::Application(Framework *framework_, int &argc, char **argv) :
     QApplication(argc, argv),
     framework(framework_),
     appActivated(true),
+    targetFpsLimit(60.0),
     nativeTranslator(new QTranslator),
     appTranslator(new QTranslator),
     splashScreen(0)
 {
     QApplication::setApplicationName("Tundra");
 
+    // With a fixed time step, run the frames at the step rate unless a frame rate is specified explicitly.
+    QStringList fpsLimitParam = framework->CommandLineParameters("--fpslimit");
+    if (fpsLimitParam.isEmpty())
+        fpsLimitParam = framework->CommandLineParameters("--fixedtimestep");
+    if (fpsLimitParam.size() > 0)
+    {
+        bool ok;
+        double target = fpsLimitParam.first().toDouble(&ok);
+        if (ok)
+            SetTargetFpsLimit(target);
+    }
+
     // Make sure that the required Tundra data directories exist.
     boost::filesystem::wpath path(QStringToWString(UserDataDirectory()));
     if (!boost::filesystem::exists(path))
@@ -435,24 +448,13 @@ void Application::UpdateFrame()
 
         framework->ProcessOneFrame();
 
-        double targetFpsLimit = 60.0;
-        QStringList fpsLimitParam = framework->CommandLineParameters("--fpslimit");
-        if (fpsLimitParam.size() > 0)
-        {
-            bool ok;
-            double target = fpsLimitParam.first().toDouble(&ok);
-            if (ok)
-                targetFpsLimit = target;
-            if (targetFpsLimit < 1.f)
-                targetFpsLimit = 0.f;
-        }
-
         tick_t timeNow = GetCurrentClockTime();
 
         static tick_t timerFrequency = GetCurrentClockFreq();
 
         double msecsSpentInFrame = (double)(timeNow - frameStartTime) * 1000.0 / timerFrequency;
-        const double msecsPerFrame = 1000.0 / targetFpsLimit;
+        // Without a limit, only yield the 1 msec to the Win32 message loop, see below.
+        const double msecsPerFrame = targetFpsLimit > 0.0 ? 1000.0 / targetFpsLimit : 1.0;
 
         ///\note Ideally we should sleep 0 msecs when running at a high fps rate,
         /// but need to avoid QTimer::start() with 0 msecs, since that will cause the timer to immediately fire,
@@ -482,6 +484,11 @@ void Application::UpdateFrame()
     }
 }
 
+void Application::SetTargetFpsLimit(double fpsLimit)
+{
+    targetFpsLimit = fpsLimit < 1.0 ? 0.0 : fpsLimit;
+}
+
 void Application::AboutToExit()
 {
     emit ExitRequested();
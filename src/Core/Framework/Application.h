@@ -62,8 +62,15 @@ public:
         The returned path contains a trailing slash. */
     static QString UserDocumentsDirectory();
 
+    /// Returns the frame rate the main loop is limited to, or 0 if the frame rate is not limited.
+    double TargetFpsLimit() const { return targetFpsLimit; }
+
 public slots:
     void UpdateFrame();
+
+    /// Sets the frame rate the main loop is limited to. Pass in 0 to disable the limit.
+    void SetTargetFpsLimit(double fpsLimit);
+
     void ChangeLanguage(const QString& file);
     void AboutToExit();
     void SetSplashMessage(const QString &message);
@@ -84,6 +91,7 @@ private:
 
     Framework *framework;
     bool appActivated;
+    double targetFpsLimit; ///< Parsed from --fpslimit on startup, 0 if not limited.
 
     QSplashScreen *splashScreen;
     QTimer frameUpdateTimer;
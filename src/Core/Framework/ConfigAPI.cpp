@@ -19,10 +19,23 @@ QString ConfigAPI::SECTION_CLIENT = "client";
 QString ConfigAPI::SECTION_RENDERING = "rendering";
 QString ConfigAPI::SECTION_UI = "ui";
 
+namespace
+{
+    /// The time in milliseconds the changed values are kept in memory before they are written to the file.
+    const int cFlushDelay = 2000;
+}
+
 ConfigAPI::ConfigAPI(Framework *framework) :
     QObject(framework),
     framework_(framework)
 {
+    flushTimer_.setSingleShot(true);
+    connect(&flushTimer_, SIGNAL(timeout()), SLOT(Flush()));
+}
+
+ConfigAPI::~ConfigAPI()
+{
+    Flush();
 }
 
 void ConfigAPI::PrepareDataFolder(const QString &configFolderName)
@@ -126,10 +139,9 @@ bool ConfigAPI::HasValue(QString file, QString section, QString key) const
     if (!IsFilePathSecure(file))
         return false;
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
     if (!section.isEmpty())
         key = section + "/" + key;
-    return config.allKeys().contains(key) == true;
+    return CachedFile(GetFilePath(file)).values.contains(key);
 }
 
 QVariant ConfigAPI::Get(const ConfigData &data) const
@@ -172,11 +184,11 @@ QVariant ConfigAPI::Get(QString file, QString section, QString key, const QVaria
     if (!IsFilePathSecure(file))
         return QVariant();
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
-    if (section.isEmpty())
-        return config.value(key, defaultValue);
-    else
-        return config.value(section + "/" + key, defaultValue);
+    if (!section.isEmpty())
+        key = section + "/" + key;
+    const ConfigFile &config = CachedFile(GetFilePath(file));
+    QHash<QString, QVariant>::const_iterator iter = config.values.find(key);
+    return iter != config.values.end() ? iter.value() : defaultValue;
 }
 
 void ConfigAPI::Set(const ConfigData &data)
@@ -214,12 +226,59 @@ void ConfigAPI::Set(QString file, QString section, QString key, const QVariant &
     if (!IsFilePathSecure(file))
         return;
 
-    QSettings config(GetFilePath(file), QSettings::IniFormat);
-    if (!config.isWritable())
+    QString fullKey = section.isEmpty() ? key : section + "/" + key;
+    ConfigFile &config = CachedFile(GetFilePath(file));
+    QHash<QString, QVariant>::iterator iter = config.values.find(fullKey);
+    if (iter != config.values.end() && iter.value() == value)
         return;
-    if (section.isEmpty())
-        config.setValue(key, value);
+
+    config.values[fullKey] = value;
+    config.dirtyKeys.insert(fullKey);
+
+    // Timers need the event loop, so write at once if the application does not exist yet.
+    if (QCoreApplication::instance())
+    {
+        if (!flushTimer_.isActive())
+            flushTimer_.start(cFlushDelay);
+    }
     else
-        config.setValue(section + "/" + key, value);
-    config.sync();
+        Flush();
+
+    emit ConfigChanged(file, section, key, value);
+}
+
+void ConfigAPI::Flush()
+{
+    flushTimer_.stop();
+    for(QHash<QString, ConfigFile>::iterator iter = files_.begin(); iter != files_.end(); ++iter)
+    {
+        ConfigFile &config = iter.value();
+        if (config.dirtyKeys.isEmpty())
+            continue;
+
+        QSettings settings(iter.key(), QSettings::IniFormat);
+        if (!settings.isWritable())
+        {
+            LogError("ConfigAPI::Flush: Config file " + iter.key() + " is not writable.");
+            config.dirtyKeys.clear();
+            continue;
+        }
+        foreach(const QString &key, config.dirtyKeys)
+            settings.setValue(key, config.values[key]);
+        settings.sync();
+        config.dirtyKeys.clear();
+    }
+}
+
+ConfigAPI::ConfigFile &ConfigAPI::CachedFile(const QString &filePath) const
+{
+    QHash<QString, ConfigFile>::iterator iter = files_.find(filePath);
+    if (iter != files_.end())
+        return iter.value();
+
+    ConfigFile &config = files_[filePath];
+    QSettings settings(filePath, QSettings::IniFormat);
+    foreach(const QString &key, settings.allKeys())
+        config.values[key] = settings.value(key);
+    return config;
 }
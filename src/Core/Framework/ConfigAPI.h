@@ -5,6 +5,9 @@
 #include <QObject>
 #include <QVariant>
 #include <QString>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
 
 class Framework;
 
@@ -73,6 +76,14 @@ public slots:
 
     @note All file, key and section parameters are case insensitive. This means all of them are transformed to 
     lower case before any accessing files. "MyKey" will get and set you same value as "mykey".
+
+    Each config file is read from disk once, when it is first accessed, and the values are then served from memory.
+    Set() changes the value in memory immediately, and the changed values are written to the file after a short delay,
+    when Flush() is called, or when the API is destroyed. Changes made to the files by other programs while Tundra is running are not seen.
+    If Tundra crashes, the values set during the last two seconds before the crash are lost, so call Flush() after
+    setting a value that must survive a crash.
+
+    The file cache and the flush timer are not guarded by a lock, so the API may only be used from the main thread.
 */
 
 class ConfigAPI : public QObject
@@ -88,6 +99,8 @@ public:
     static QString SECTION_RENDERING;
     static QString SECTION_UI;
     
+    ~ConfigAPI();
+
 public slots:
     /// Returns if a key is available in the config.
     /// @param data ConfigData. Filled ConfigData object.
@@ -149,6 +162,13 @@ public slots:
     /// @return QString. Absolute path to config storage folder.
     QString GetConfigFolder() const { return configFolder_; }
 
+    /// Writes the values that have been changed with Set() to the config files now.
+    void Flush();
+
+signals:
+    /// Emitted when a value is changed with Set(). The file, section and key are in the lower case form they are stored in.
+    void ConfigChanged(const QString &file, const QString &section, const QString &key, const QVariant &value);
+
 private slots:
     /// Get absolute file path for file. Guarantees that it ends with .ini.
     QString GetFilePath(const QString &file) const;
@@ -174,10 +194,26 @@ private:
     /// @param configFolderName QString. The sub folder name on where to store configs.
     void PrepareDataFolder(const QString &configFolderName);
     
+    /// The values of a config file, and the keys that have been changed but not yet written to the file.
+    struct ConfigFile
+    {
+        QHash<QString, QVariant> values; ///< By "section/key", or "key" for the keys without a section.
+        QSet<QString> dirtyKeys;
+    };
+
+    /// Returns the cached contents of the config file with the given absolute path, reading the file if it has not been read yet.
+    ConfigFile &CachedFile(const QString &filePath) const;
+
     /// Framework ptr.
     Framework *framework_;
 
     /// Absolute path to the folder where to store the config files.
     QString configFolder_;
 
+    /// The config files that have been accessed, by absolute file path.
+    mutable QHash<QString, ConfigFile> files_;
+
+    /// Delays writing the changed values to the files, so that subsequent Set() calls are written at once.
+    QTimer flushTimer_;
+
 };
@@ -0,0 +1,181 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "FrameScheduler.h"
+#include "IModule.h"
+#include "Framework.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <iostream>
+#include <map>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+    /// The minimum time between two budget warnings of the same module, in seconds.
+    const double cBudgetWarningInterval = 5.0;
+}
+
+FrameScheduler::FrameScheduler(Framework *framework) :
+    framework_(framework),
+    scheduleDirty_(false),
+    defaultBudget_(0.0)
+{
+}
+
+FrameScheduler::~FrameScheduler()
+{
+}
+
+void FrameScheduler::AddModule(const boost::shared_ptr<IModule> &module)
+{
+    modules_.push_back(module);
+    scheduleDirty_ = true;
+}
+
+void FrameScheduler::Clear()
+{
+    modules_.clear();
+    phases_.clear();
+    scheduleDirty_ = false;
+}
+
+double FrameScheduler::LastUpdateTime(const std::string &moduleName) const
+{
+    for(size_t p = 0; p < phases_.size(); ++p)
+        for(size_t i = 0; i < phases_[p].size(); ++i)
+            if (phases_[p][i].module->Name() == moduleName)
+                return phases_[p][i].lastUpdateTime;
+    return 0.0;
+}
+
+void FrameScheduler::BuildSchedule()
+{
+    scheduleDirty_ = false;
+
+    // Keep the timings of the modules that were already scheduled.
+    std::map<IModule *, ScheduledModule> previous;
+    for(size_t p = 0; p < phases_.size(); ++p)
+        for(size_t i = 0; i < phases_[p].size(); ++i)
+            previous[phases_[p][i].module.get()] = phases_[p][i];
+
+    phases_.clear();
+    phases_.resize(IModule::NumUpdatePhases);
+
+    for(int phase = 0; phase < IModule::NumUpdatePhases; ++phase)
+    {
+        // The modules of this phase in registration order, and the names of the modules each of them must be updated after.
+        std::vector<boost::shared_ptr<IModule> > unplaced;
+        for(size_t i = 0; i < modules_.size(); ++i)
+        {
+            int modulePhase = modules_[i]->Phase();
+            if (modulePhase < 0 || modulePhase >= IModule::NumUpdatePhases)
+                modulePhase = IModule::PhaseLogic;
+            if (modulePhase == phase)
+                unplaced.push_back(modules_[i]);
+        }
+
+        QStringList phaseModuleNames;
+        for(size_t i = 0; i < unplaced.size(); ++i)
+            phaseModuleNames << QString::fromStdString(unplaced[i]->Name());
+
+        // Repeatedly place the first module, in registration order, whose dependencies in this phase have all been placed.
+        QStringList placedNames;
+        while(!unplaced.empty())
+        {
+            size_t next = unplaced.size();
+            for(size_t i = 0; i < unplaced.size() && next == unplaced.size(); ++i)
+            {
+                bool ready = true;
+                foreach(const QString &dependency, unplaced[i]->UpdateAfter())
+                    if (phaseModuleNames.contains(dependency) && !placedNames.contains(dependency))
+                    {
+                        ready = false;
+                        break;
+                    }
+                if (ready)
+                    next = i;
+            }
+
+            if (next == unplaced.size())
+            {
+                LogWarning("FrameScheduler: The update dependencies of module " + unplaced.front()->Name() + " are circular, ignoring them.");
+                next = 0;
+            }
+
+            boost::shared_ptr<IModule> module = unplaced[next];
+            unplaced.erase(unplaced.begin() + next);
+            placedNames << QString::fromStdString(module->Name());
+
+            ScheduledModule scheduled;
+            std::map<IModule *, ScheduledModule>::iterator iter = previous.find(module.get());
+            if (iter != previous.end())
+                scheduled = iter->second;
+            scheduled.module = module;
+#ifdef PROFILING
+            if (scheduled.profilerBlock < 0)
+                scheduled.profilerBlock = framework_->GetProfiler()->InternBlock("Module_" + module->Name() + "_Update");
+#endif
+            phases_[phase].push_back(scheduled);
+        }
+    }
+}
+
+void FrameScheduler::Update(f64 frametime)
+{
+    if (scheduleDirty_)
+        BuildSchedule();
+
+    for(size_t p = 0; p < phases_.size(); ++p)
+    {
+        std::vector<ScheduledModule> &phase = phases_[p];
+
+        for(size_t i = 0; i < phase.size(); ++i)
+            UpdateModule(&phase[i], frametime);
+
+        tick_t now = GetCurrentClockTime();
+        for(size_t i = 0; i < phase.size(); ++i)
+        {
+            ScheduledModule &scheduled = phase[i];
+            double budget = scheduled.module->UpdateBudget() > 0.0 ? scheduled.module->UpdateBudget() : defaultBudget_;
+            if (budget <= 0.0 || scheduled.lastUpdateTime <= budget)
+                continue;
+            if (scheduled.lastBudgetWarning != 0 && (double)(now - scheduled.lastBudgetWarning) / GetCurrentClockFreq() < cBudgetWarningInterval)
+                continue;
+
+            scheduled.lastBudgetWarning = now;
+            LogWarning("FrameScheduler: Module " + scheduled.module->Name() + " took " + QString::number(scheduled.lastUpdateTime, 'f', 2).toStdString() +
+                " msecs to update, exceeding its budget of " + QString::number(budget, 'f', 2).toStdString() + " msecs.");
+        }
+    }
+}
+
+void FrameScheduler::UpdateModule(ScheduledModule *scheduled, f64 frametime)
+{
+    const tick_t startTime = GetCurrentClockTime();
+    IModule *module = scheduled->module.get();
+    try
+    {
+#ifdef PROFILING
+        ProfilerSection ps(scheduled->profilerBlock);
+#endif
+        module->Update(frametime);
+    }
+    catch(const std::exception &e)
+    {
+        std::cout << "ProcessOneFrame caught an exception while updating module " << module->Name()
+            << ": " << (e.what() ? e.what() : "(null)") << std::endl;
+        LogError(std::string("ProcessOneFrame caught an exception while updating module " + module->Name()
+            + ": " + (e.what() ? e.what() : "(null)")));
+    }
+    catch(...)
+    {
+        std::cout << "ProcessOneFrame caught an unknown exception while updating module " << module->Name() << std::endl;
+        LogError(std::string("ProcessOneFrame caught an unknown exception while updating module " + module->Name()));
+    }
+    scheduled->lastUpdateTime = (double)(GetCurrentClockTime() - startTime) * 1000.0 / GetCurrentClockFreq();
+}
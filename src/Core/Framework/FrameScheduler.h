@@ -0,0 +1,64 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "FrameworkFwd.h"
+#include "HighPerfClock.h"
+
+#include <string>
+#include <vector>
+
+/// Updates the modules of the Framework once per frame, in the phases and the order they declare.
+/** The modules are grouped by IModule::Phase(), and within a phase ordered so that each module is updated after the modules
+    it names in IModule::UpdateAfter(), keeping the registration order otherwise. Each phase is completed before the next one starts.
+
+    The time spent in each Update() is measured, and a warning is logged, at most every few seconds per module, when a module
+    exceeds its time budget, either IModule::UpdateBudget() or the default budget set with SetDefaultBudget(). */
+class FrameScheduler
+{
+public:
+    explicit FrameScheduler(Framework *framework);
+    ~FrameScheduler();
+
+    /// Adds a module to the schedule.
+    void AddModule(const boost::shared_ptr<IModule> &module);
+
+    /// Removes all modules from the schedule.
+    void Clear();
+
+    /// Updates all the modules.
+    void Update(f64 frametime);
+
+    /// Sets the time budget in milliseconds of the modules that do not declare their own, or 0 for no budget.
+    void SetDefaultBudget(double msecs) { defaultBudget_ = msecs; }
+
+    /// Returns the default time budget of module updates in milliseconds.
+    double DefaultBudget() const { return defaultBudget_; }
+
+    /// Returns the time the last Update() of the given module took in milliseconds, or 0 if there is no such module.
+    double LastUpdateTime(const std::string &moduleName) const;
+
+private:
+    struct ScheduledModule
+    {
+        ScheduledModule() : profilerBlock(-1), lastUpdateTime(0.0), lastBudgetWarning(0) {}
+
+        boost::shared_ptr<IModule> module;
+        int profilerBlock; ///< Interned profiling block ID of the Update() of the module.
+        double lastUpdateTime; ///< In milliseconds.
+        tick_t lastBudgetWarning;
+    };
+
+    /// Sorts the modules into phases and resolves the update order. Called on the first update after the modules have changed.
+    void BuildSchedule();
+
+    /// Updates a single module, catching and logging any exceptions, and checks the time against the budget.
+    void UpdateModule(ScheduledModule *scheduled, f64 frametime);
+
+    std::vector<boost::shared_ptr<IModule> > modules_; ///< In registration order.
+    std::vector<std::vector<ScheduledModule> > phases_; ///< The modules of each phase, in update order.
+    Framework *framework_;
+    bool scheduleDirty_;
+    double defaultBudget_;
+};
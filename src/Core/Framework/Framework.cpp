@@ -13,6 +13,8 @@
 #include "PluginAPI.h"
 #include "LoggingFunctions.h"
 #include "IModule.h"
+#include "FrameScheduler.h"
+#include "JobAPI.h"
 #include "FrameAPI.h"
 
 #include "InputAPI.h"
@@ -89,12 +91,16 @@ Framework::Framework(int argc, char** argv) :
     plugin(0),
     config(0),
     ui(0),
+    jobs(0),
 #ifdef PROFILING
     profiler(0),
 #endif
     renderer(0),
     apiVersionInfo(0),
-    applicationVersionInfo(0)
+    applicationVersionInfo(0),
+    scheduler(new FrameScheduler(this)),
+    fixedTimeStep(0.0),
+    fixedTimeAccumulator(0.0)
 {    // Remember this Framework instance in a static pointer. Note that this does not help visibility for external DLL code linking to Framework.
     instance = this;
 
@@ -119,6 +125,12 @@ Framework::Framework(int argc, char** argv) :
     cmdLineDescs.commands["--config"] = "Specifies the startup configration file to use"; // Framework
     cmdLineDescs.commands["--login"] = "Automatically login to server using provided data. Url syntax: {tundra|http|https}://host[:port]/?username=x[&password=y&avatarurl=z&protocol={udp|tcp}]. Minimum information needed to try a connection in the url are host and username";
     cmdLineDescs.commands["--clear-asset-cache"] = "At the start of Tundra, remove all data and metadata files from asset cache.";
+    cmdLineDescs.commands["--physicsthread"] = "Step the physics simulation in a worker thread, overlapping it with the rest of the frame. The physics results lag one frame behind."; // PhysicsModule
+    cmdLineDescs.commands["--fixedtimestep"] = "Update the modules with a fixed time step, given as the number of updates per second, independent of the frame rate. Intended for servers."; // Framework
+    cmdLineDescs.commands["--moduleupdatebudget"] = "Log a warning when a module update takes longer than the given number of milliseconds."; // Framework
+    cmdLineDescs.commands["--jobthreads"] = "Specifies the number of worker threads of the job system. Default: one less than the number of hardware threads."; // Framework
+    cmdLineDescs.commands["--telemetry"] = "Periodically writes frame, module update, physics, asset and network metrics to the given file in the Prometheus text format."; // DebugStatsModule
+    cmdLineDescs.commands["--telemetryinterval"] = "Specifies the interval in seconds for writing the --telemetry file. Default: 10."; // DebugStatsModule
 
     if (HasCommandLineParameter("--help"))
     {
@@ -130,10 +142,22 @@ Framework::Framework(int argc, char** argv) :
     {
         if (HasCommandLineParameter("--headless"))
             headless_ = true;
+
+        QStringList fixedTimeStepParam = CommandLineParameters("--fixedtimestep");
+        if (!fixedTimeStepParam.isEmpty() && fixedTimeStepParam.first().toDouble() > 0.0)
+            fixedTimeStep = 1.0 / fixedTimeStepParam.first().toDouble();
+        QStringList budgetParam = CommandLineParameters("--moduleupdatebudget");
+        if (!budgetParam.isEmpty())
+            scheduler->SetDefaultBudget(budgetParam.first().toDouble());
 #ifdef PROFILING
         profiler = new Profiler();
+        profiler->SetThreadName("Main");
         PROFILE(FW_Startup);
 #endif
+        // Create the job workers first, so that they are available to everything created after this.
+        QStringList jobThreadsParam = CommandLineParameters("--jobthreads");
+        jobs = new JobAPI(this, jobThreadsParam.isEmpty() ? 0 : jobThreadsParam.first().toInt());
+
         // Create ConfigAPI, pass application data and prepare data folder.
         config = new ConfigAPI(this);
         config->PrepareDataFolder("configuration");
@@ -152,6 +176,10 @@ Framework::Framework(int argc, char** argv) :
         plugin = new PluginAPI(this);
         console = new ConsoleAPI(this);
         console->RegisterCommand("exit", "Shuts down gracefully.", this, SLOT(Exit()));
+        console->RegisterCommand("profilertrace", "Starts or stops recording a timeline of the profiling blocks of all threads. Stopping discards the timeline, so save it first. Usage: profilertrace(on|off)",
+            this, SLOT(SetProfilerTrace(const QString &)));
+        console->RegisterCommand("saveprofilertrace", "Saves the recorded profiling timeline in the Chrome trace event format, "
+            "viewable in chrome://tracing or Perfetto. Usage: saveprofilertrace(filename)", this, SLOT(SaveProfilerTrace(const QString &)));
 
         // Initialize SceneAPI.
         scene->Initialise();
@@ -171,6 +199,8 @@ Framework::Framework(int argc, char** argv) :
 
 Framework::~Framework()
 {
+    // Stops the workers, if Go() did not run.
+    SAFE_DELETE(jobs);
     SAFE_DELETE(input);
     SAFE_DELETE(asset);
     SAFE_DELETE(audio);
@@ -186,6 +216,7 @@ Framework::~Framework()
 
     SAFE_DELETE(apiVersionInfo);
     SAFE_DELETE(applicationVersionInfo);
+    SAFE_DELETE(scheduler);
 
     // This delete must be the last one in Framework since application derives QApplication.
     // When we delete QApplication, we must have ensured that all QObjects have been deleted.
@@ -213,29 +244,29 @@ void Framework::ProcessOneFrame()
     double frametime = ((double)curr_clocktime - (double)last_clocktime) / (double) clock_freq;
     last_clocktime = curr_clocktime;
 
-    for(size_t i = 0; i < modules.size(); ++i)
+    // Apply the results of the jobs that finished since the last frame before the modules are updated.
+    jobs->ProcessMainThreadJobs();
+
+    if (fixedTimeStep > 0.0)
     {
-        try
+        // Consume the real time in fixed steps, so that the simulation does not depend on the frame rate.
+        // If the frame took too long to catch up with, drop the excess time instead of falling further behind.
+        const int cMaxFixedStepsPerFrame = 5;
+        fixedTimeAccumulator += frametime;
+        int numSteps = 0;
+        while(fixedTimeAccumulator >= fixedTimeStep && numSteps < cMaxFixedStepsPerFrame)
         {
-#ifdef PROFILING
-            ProfilerSection ps(("Module_" + modules[i]->Name() + "_Update").c_str());
-#endif
-            modules[i]->Update(frametime);
-        }
-        catch(const std::exception &e)
-        {
-            std::cout << "ProcessOneFrame caught an exception while updating module " << modules[i]->Name()
-                << ": " << (e.what() ? e.what() : "(null)") << std::endl;
-            LogError(std::string("ProcessOneFrame caught an exception while updating module " + modules[i]->Name()
-                + ": " + (e.what() ? e.what() : "(null)")));
-        }
-        catch(...)
-        {
-            std::cout << "ProcessOneFrame caught an unknown exception while updating module " << modules[i]->Name() << std::endl;
-            LogError(std::string("ProcessOneFrame caught an unknown exception while updating module " + modules[i]->Name()));
+            scheduler->Update(fixedTimeStep);
+            fixedTimeAccumulator -= fixedTimeStep;
+            ++numSteps;
         }
+        if (fixedTimeAccumulator >= fixedTimeStep)
+            fixedTimeAccumulator = 0.0;
     }
+    else
+        scheduler->Update(frametime);
 
+    // The core APIs poll their inputs and deliver their events once per frame regardless of the module step.
     asset->Update(frametime);
     input->Update(frametime);
     audio->Update(frametime);
@@ -268,6 +299,9 @@ void Framework::Go()
     // Qt main loop execution has ended, we are exiting.
     exit_signal_ = true;
 
+    // Finish the queued jobs and stop the workers while the modules, whose code and data the jobs may refer to, still exist.
+    jobs->Stop();
+
     for(size_t i = 0; i < modules.size(); ++i)
     {
         LogDebug("Uninitializing module " + modules[i]->Name());
@@ -290,6 +324,7 @@ void Framework::Go()
     }
 
     // Actually unload all DLLs from memory.
+    scheduler->Clear();
     modules.clear();
     plugin->UnloadPlugins();
 }
@@ -301,6 +336,38 @@ void Framework::Exit()
         application->AboutToExit();
 }
 
+void Framework::SetProfilerTrace(const QString &state)
+{
+#ifdef PROFILING
+    bool enable = !profiler->IsTraceEnabled();
+    if (state.compare("on", Qt::CaseInsensitive) == 0)
+        enable = true;
+    else if (state.compare("off", Qt::CaseInsensitive) == 0)
+        enable = false;
+    profiler->SetTraceEnabled(enable);
+    LogInfo(enable ? "Profiler timeline trace started." : "Profiler timeline trace stopped and discarded.");
+#else
+    LogWarning("Framework::SetProfilerTrace: Profiling is not enabled in this build.");
+#endif
+}
+
+void Framework::SaveProfilerTrace(const QString &filename)
+{
+#ifdef PROFILING
+    if (filename.trimmed().isEmpty())
+    {
+        LogError("Framework::SaveProfilerTrace: No filename given.");
+        return;
+    }
+    if (profiler->SaveTrace(filename.trimmed().toStdString()))
+        LogInfo("Profiler timeline trace saved to " + filename.trimmed());
+    else
+        LogError("Framework::SaveProfilerTrace: Failed to write " + filename.trimmed());
+#else
+    LogWarning("Framework::SaveProfilerTrace: Profiling is not enabled in this build.");
+#endif
+}
+
 void Framework::ForceExit()
 {
     exit_signal_ = true;
@@ -409,6 +476,7 @@ void Framework::RegisterModule(IModule *module)
 {
     module->SetFramework(this);
     modules.push_back(boost::shared_ptr<IModule>(module));
+    scheduler->AddModule(modules.back());
     module->Load();
 }
 
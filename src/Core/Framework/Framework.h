@@ -71,6 +71,17 @@ public:
     /// Returns the main QApplication
     Application *App() const;
 
+    /// Returns core API Job object, the thread pool for parallel work.
+    /** @note Not exposed to scripts, as the jobs are C++ functions run in worker threads. */
+    JobAPI *Jobs() const { return jobs; }
+
+    /// Returns the scheduler that updates the modules each frame.
+    FrameScheduler *Scheduler() const { return scheduler; }
+
+    /// Returns the fixed time step in seconds the modules are updated with, or 0 if they are updated once per frame with the real frame time.
+    /** The core APIs, such as the asset, input and frame APIs, are always updated once per frame with the real frame time. */
+    f64 FixedTimeStep() const { return fixedTimeStep; }
+
 
 public slots:
     /// Returns the core API UI object.
@@ -156,6 +167,14 @@ public slots:
         @param key Key with possible prefixes. */
     QStringList CommandLineParameters(const QString &key) const;
 
+private slots:
+    /// Starts or stops recording the timeline trace of the profiler. Toggles the recording if @c state is not "on" or "off".
+    /** Stopping the recording discards the trace, so save it with SaveProfilerTrace() first. */
+    void SetProfilerTrace(const QString &state = QString());
+
+    /// Writes the timeline trace of the profiler to a file in the Chrome trace event format.
+    void SaveProfilerTrace(const QString &filename);
+
 private:
     Q_DISABLE_COPY(Framework)
 
@@ -174,6 +193,7 @@ private:
     SceneAPI *scene; ///< The Scene API.
     ConfigAPI *config; ///< The Config API.
     PluginAPI *plugin;
+    JobAPI *jobs; ///< The Job API.
     IRenderer *renderer;
 //    ConnectionAPI *connection; ///< The Connection API.
 //    ServerAPI *server; ///< The Server API, null if we're not operating as a server.
@@ -187,6 +207,10 @@ private:
 
     /// Framework owns the memory of all the modules in the system. These are freed when Framework is exiting.
     std::vector<boost::shared_ptr<IModule> > modules;
+    FrameScheduler *scheduler; ///< Updates the modules.
+
+    f64 fixedTimeStep; ///< If nonzero, the modules are updated in steps of this length, in seconds.
+    f64 fixedTimeAccumulator; ///< Real time that has not yet been consumed by fixed steps, in seconds.
 
     static Framework *instance;
     int argc_; ///< Command line argument count as supplied by the operating system.
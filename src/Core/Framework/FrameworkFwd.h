@@ -23,6 +23,7 @@ class ConsoleAPI;
 class SceneAPI;
 class ConfigAPI;
 class PluginAPI;
+class JobAPI;
 
 class Application;
 class ApiVersionInfo;
@@ -30,3 +31,4 @@ class ApplicationVersionInfo;
 
 class Profiler;
 class IModule;
+class FrameScheduler;
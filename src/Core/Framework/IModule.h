@@ -17,6 +17,8 @@
 #include "FrameworkFwd.h"
 #include <boost/enable_shared_from_this.hpp>
 
+#include <QStringList>
+
 /// Interface for modules. When creating new modules, inherit from this class.
 /** See @ref ModuleArchitecture for details. */
 class IModule : public QObject, public boost::enable_shared_from_this<IModule>
@@ -52,6 +54,25 @@ public:
         @param frametime elapsed time in seconds since last frame */
     virtual void Update(f64 frametime) {}
 
+    /// The phases of a frame, in the order the modules are updated in.
+    enum UpdatePhase
+    {
+        PhaseNetworkIn = 0, ///< Receiving and handling network messages.
+        PhaseSimulation, ///< Physics and other simulation.
+        PhaseLogic, ///< Application logic. The default phase.
+        PhaseNetworkOut, ///< Sending the changes of the frame to the network.
+        NumUpdatePhases
+    };
+
+    /// Returns the phase of the frame the module is updated in. Override in your own module if it is not PhaseLogic.
+    virtual UpdatePhase Phase() const { return PhaseLogic; }
+
+    /// Returns the names of the modules that must be updated before this module in the same phase. Override to declare dependencies.
+    virtual QStringList UpdateAfter() const { return QStringList(); }
+
+    /// Returns the time budget of Update() in milliseconds, or 0 to use the default budget of the scheduler.
+    virtual double UpdateBudget() const { return 0.0; }
+
     /// Returns the name of the module.
     const std::string &Name() const { return name; }
 
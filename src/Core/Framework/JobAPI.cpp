@@ -0,0 +1,348 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "JobAPI.h"
+#include "Framework.h"
+#include "Profiler.h"
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+#include "MemoryLeakCheck.h"
+
+Job::Job(JobAPI *owner_, const boost::function<void()> &function_, bool mainThread_) :
+    owner(owner_),
+    function(function_),
+    mainThread(mainThread_),
+    pendingDependencies(0),
+    finished(false)
+{
+}
+
+bool Job::IsFinished() const
+{
+    boost::mutex::scoped_lock lock(owner->graphMutex_);
+    return finished;
+}
+
+JobAPI::JobAPI(Framework *fw, int numWorkers) :
+    framework_(fw),
+    mainThreadId_(boost::this_thread::get_id()),
+    currentWorker_(&JobAPI::KeepWorker),
+    numQueued_(0),
+    quit_(false)
+{
+    if (numWorkers <= 0)
+        numWorkers = std::max<int>((int)boost::thread::hardware_concurrency() - 1, 1);
+
+    // Create all the workers before starting any, as the workers steal from each other.
+    for(int i = 0; i < numWorkers; ++i)
+    {
+        workers_.push_back(new Worker);
+        workers_.back()->index = i;
+    }
+    for(size_t i = 0; i < workers_.size(); ++i)
+        workers_[i]->thread = boost::thread(boost::bind(&JobAPI::WorkerMain, this, workers_[i]));
+}
+
+JobAPI::~JobAPI()
+{
+    Stop();
+}
+
+void JobAPI::Stop()
+{
+    {
+        boost::mutex::scoped_lock lock(sleepMutex_);
+        if (quit_)
+            return;
+        quit_ = true;
+    }
+    jobQueued_.notify_all();
+
+    // Discard the main thread jobs before joining, as a worker may be waiting for one of them. The main thread jobs
+    // queued after this are discarded by Enqueue().
+    std::vector<JobPtr> mainThreadJobs;
+    {
+        boost::mutex::scoped_lock lock(mainThreadMutex_);
+        mainThreadJobs.swap(mainThreadJobs_);
+    }
+    for(size_t i = 0; i < mainThreadJobs.size(); ++i)
+        Discard(mainThreadJobs[i]);
+
+    // The workers exit once the queues are empty. The workers steal from each other until they exit, so none can be deleted
+    // before all have been joined.
+    for(size_t i = 0; i < workers_.size(); ++i)
+        workers_[i]->thread.join();
+    for(size_t i = 0; i < workers_.size(); ++i)
+        delete workers_[i];
+    workers_.clear();
+}
+
+JobPtr JobAPI::Submit(const JobFunction &function, const std::vector<JobPtr> &dependencies)
+{
+    JobPtr job(new Job(this, function, false));
+    AddJob(job, dependencies);
+    return job;
+}
+
+JobPtr JobAPI::Submit(const JobFunction &function, const JobPtr &dependency)
+{
+    return Submit(function, std::vector<JobPtr>(1, dependency));
+}
+
+JobPtr JobAPI::RunOnMainThread(const JobFunction &function, const std::vector<JobPtr> &dependencies)
+{
+    JobPtr job(new Job(this, function, true));
+    AddJob(job, dependencies);
+    return job;
+}
+
+void JobAPI::Wait(const JobPtr &job)
+{
+    if (!job)
+        return;
+
+    Worker *worker = currentWorker_.get();
+    // Running the other main thread jobs here would run them out of order, and in the middle of whatever called Wait().
+    const bool runMainThreadJobs = job->mainThread && IsMainThread();
+    for(;;)
+    {
+        {
+            boost::mutex::scoped_lock lock(graphMutex_);
+            if (job->finished)
+                return;
+        }
+
+        JobPtr next = FindJob(worker);
+        // The main thread has to run the main thread jobs itself, or waiting for one would never return.
+        if (!next && runMainThreadJobs)
+        {
+            boost::mutex::scoped_lock lock(mainThreadMutex_);
+            if (!mainThreadJobs_.empty())
+            {
+                next = mainThreadJobs_.front();
+                mainThreadJobs_.erase(mainThreadJobs_.begin());
+            }
+        }
+        if (next)
+        {
+            Execute(next);
+            continue;
+        }
+
+        // Nothing to help with, sleep until some job finishes. The job we wait for may be running in another thread.
+        boost::mutex::scoped_lock lock(graphMutex_);
+        if (!job->finished)
+            jobFinished_.timed_wait(lock, boost::posix_time::milliseconds(1));
+    }
+}
+
+void JobAPI::Wait(const std::vector<JobPtr> &jobs)
+{
+    for(size_t i = 0; i < jobs.size(); ++i)
+        Wait(jobs[i]);
+}
+
+void JobAPI::ParallelFor(int begin, int end, int grainSize, const RangeFunction &function)
+{
+    if (end <= begin)
+        return;
+    if (grainSize <= 0)
+        grainSize = std::max(1, (end - begin) / (4 * (NumWorkers() + 1)));
+
+    // Queue all but the first subrange, and process the first one in the calling thread.
+    std::vector<JobPtr> jobs;
+    for(int i = begin + grainSize; i < end; i += grainSize)
+        jobs.push_back(Submit(boost::bind(function, i, std::min(i + grainSize, end))));
+    function(begin, std::min(begin + grainSize, end));
+    Wait(jobs);
+}
+
+void JobAPI::ProcessMainThreadJobs()
+{
+    // Jobs queued by the jobs run here are left for the next frame.
+    std::vector<JobPtr> jobs;
+    {
+        boost::mutex::scoped_lock lock(mainThreadMutex_);
+        jobs.swap(mainThreadJobs_);
+    }
+    if (jobs.empty())
+        return;
+
+    PROFILE(JobAPI_ProcessMainThreadJobs);
+    for(size_t i = 0; i < jobs.size(); ++i)
+        Execute(jobs[i]);
+}
+
+void JobAPI::AddJob(const JobPtr &job, const std::vector<JobPtr> &dependencies)
+{
+    {
+        boost::mutex::scoped_lock lock(graphMutex_);
+        for(size_t i = 0; i < dependencies.size(); ++i)
+            if (dependencies[i] && !dependencies[i]->finished)
+            {
+                dependencies[i]->dependents.push_back(job);
+                ++job->pendingDependencies;
+            }
+        // The last dependency to finish queues the job.
+        if (job->pendingDependencies > 0)
+            return;
+    }
+    Enqueue(job);
+}
+
+void JobAPI::Enqueue(const JobPtr &job)
+{
+    if (job->mainThread)
+    {
+        {
+            boost::mutex::scoped_lock lock(mainThreadMutex_);
+            boost::mutex::scoped_lock quitLock(sleepMutex_);
+            if (!quit_)
+            {
+                mainThreadJobs_.push_back(job);
+                return;
+            }
+        }
+        // There are no more frames to run the job on.
+        Discard(job);
+        return;
+    }
+
+    Worker *worker = currentWorker_.get();
+    bool queued = false;
+    {
+        boost::mutex::scoped_lock lock(worker ? worker->mutex : injectedMutex_);
+        // Count the job while the queue is locked, so that it cannot be taken before it has been counted. The workers do not
+        // exit while there are counted jobs, so a job queued before Stop() is always run by them.
+        boost::mutex::scoped_lock countLock(sleepMutex_);
+        if (!quit_)
+        {
+            (worker ? worker->queue : injected_).push_back(job);
+            ++numQueued_;
+            queued = true;
+        }
+    }
+    if (queued)
+        jobQueued_.notify_one();
+    else
+        Execute(job); // The workers have been stopped.
+}
+
+JobPtr JobAPI::FindJob(Worker *worker)
+{
+    JobPtr job;
+
+    // The newest job of the own queue is the most likely to have its data in the cache.
+    if (worker)
+        job = TakeJob(worker->mutex, worker->queue, true);
+
+    if (!job)
+        job = TakeJob(injectedMutex_, injected_, false);
+
+    // Steal the oldest job of another worker, starting from the next worker so that the victims are spread out.
+    const size_t first = worker ? worker->index + 1 : 0;
+    for(size_t i = 0; i < workers_.size() && !job; ++i)
+    {
+        Worker *victim = workers_[(first + i) % workers_.size()];
+        if (victim != worker)
+            job = TakeJob(victim->mutex, victim->queue, false);
+    }
+    return job;
+}
+
+JobPtr JobAPI::TakeJob(boost::mutex &mutex, std::deque<JobPtr> &queue, bool newest)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    if (queue.empty())
+        return JobPtr();
+
+    JobPtr job = newest ? queue.back() : queue.front();
+    if (newest)
+        queue.pop_back();
+    else
+        queue.pop_front();
+
+    boost::mutex::scoped_lock countLock(sleepMutex_);
+    --numQueued_;
+    return job;
+}
+
+void JobAPI::Execute(const JobPtr &job)
+{
+    try
+    {
+        PROFILE(JobAPI_Job);
+        job->function();
+    }
+    catch(const std::exception &e)
+    {
+        std::cout << "JobAPI: A job threw an exception: " << (e.what() ? e.what() : "(null)") << std::endl;
+    }
+    catch(...)
+    {
+        std::cout << "JobAPI: A job threw an unknown exception." << std::endl;
+    }
+
+    std::vector<JobPtr> ready = Finish(job);
+    for(size_t i = 0; i < ready.size(); ++i)
+        Enqueue(ready[i]);
+}
+
+void JobAPI::Discard(const JobPtr &job)
+{
+    // The dependents would run without the results of the job.
+    std::vector<JobPtr> ready = Finish(job);
+    for(size_t i = 0; i < ready.size(); ++i)
+        Discard(ready[i]);
+}
+
+std::vector<JobPtr> JobAPI::Finish(const JobPtr &job)
+{
+    // Release the function and whatever it has bound now, as the job may be referenced for a long time.
+    job->function = JobFunction();
+
+    std::vector<JobPtr> ready;
+    {
+        boost::mutex::scoped_lock lock(graphMutex_);
+        job->finished = true;
+        for(size_t i = 0; i < job->dependents.size(); ++i)
+            if (--job->dependents[i]->pendingDependencies == 0)
+                ready.push_back(job->dependents[i]);
+        job->dependents.clear();
+    }
+    jobFinished_.notify_all();
+    return ready;
+}
+
+void JobAPI::WorkerMain(Worker *worker)
+{
+    currentWorker_.reset(worker);
+#ifdef PROFILING
+    framework_->GetProfiler()->SetThreadName("Job worker " + QString::number(worker->index + 1).toStdString());
+#endif
+
+    for(;;)
+    {
+        JobPtr job = FindJob(worker);
+        if (job)
+        {
+            Execute(job);
+            continue;
+        }
+
+        // Exit only when all the queues are empty, so that the queued jobs are finished on shutdown.
+        boost::mutex::scoped_lock lock(sleepMutex_);
+        while(numQueued_ == 0 && !quit_)
+            jobQueued_.wait(lock);
+        if (numQueued_ == 0 && quit_)
+            break;
+    }
+
+    currentWorker_.release();
+}
@@ -0,0 +1,168 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "FrameworkFwd.h"
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <deque>
+#include <vector>
+
+class Job;
+typedef boost::shared_ptr<Job> JobPtr;
+
+/// A unit of work submitted to the JobAPI.
+/** Returned by JobAPI::Submit() and JobAPI::RunOnMainThread(), and can be passed in as a dependency of later jobs or to JobAPI::Wait(). */
+class Job
+{
+public:
+    /// Returns true if the function of the job has been run.
+    bool IsFinished() const;
+
+private:
+    friend class JobAPI;
+
+    Job(JobAPI *owner, const boost::function<void()> &function, bool mainThread);
+
+    JobAPI *owner;
+    boost::function<void()> function;
+    bool mainThread; ///< If true, the job is run by the main thread in Framework::ProcessOneFrame() instead of the workers.
+
+    // The following are guarded by the graph mutex of the owner.
+    int pendingDependencies; ///< The number of unfinished jobs this job waits for.
+    std::vector<JobPtr> dependents; ///< The jobs that wait for this job.
+    bool finished;
+};
+
+/// Runs work in a pool of worker threads shared by the whole application.
+/** Each worker has its own queue of jobs. A worker runs the jobs it has queued itself newest first, and when it runs out,
+    takes the jobs submitted from the other threads, and then steals the oldest jobs from the queues of the other workers.
+    A thread that waits for a job with Wait() runs queued jobs meanwhile, so jobs may submit and wait for other jobs.
+
+    Jobs can depend on other jobs, forming a task graph: a job is queued only when all its dependencies have finished.
+    Jobs created with RunOnMainThread() are run by the main thread at the start of the next frame, which makes them
+    suitable as continuations that apply the results of the worker jobs to the scene or the Qt objects.
+
+    The jobs must not access the scene, the Qt objects or the other core APIs, and must not log using the logging functions,
+    as those are not thread-safe. The profiling blocks of the jobs show up under the threads named "Job worker <n>".
+
+    The number of workers is one less than the number of hardware threads, and can be set with --jobthreads <number>.
+    When the main loop exits, Framework stops the workers before the modules are uninitialized. After that, the jobs submitted
+    to the workers are run in the thread that queues them, and the main thread jobs are discarded without being run.
+    This class cannot be created directly, it's created by Framework. */
+class JobAPI
+{
+public:
+    typedef boost::function<void()> JobFunction;
+    /// Function that processes the subrange [begin, end) of a ParallelFor().
+    typedef boost::function<void(int, int)> RangeFunction;
+
+    /// Queues a function to be run in a worker thread once all the given jobs have finished.
+    JobPtr Submit(const JobFunction &function, const std::vector<JobPtr> &dependencies = std::vector<JobPtr>());
+
+    /// Queues a function to be run in a worker thread once the given job has finished.
+    JobPtr Submit(const JobFunction &function, const JobPtr &dependency);
+
+    /// Queues a function to be run in the main thread on the next frame, once all the given jobs have finished.
+    JobPtr RunOnMainThread(const JobFunction &function, const std::vector<JobPtr> &dependencies = std::vector<JobPtr>());
+
+    /// Returns when the given job has finished, running other queued jobs in the calling thread meanwhile.
+    /** The main thread runs the queued main thread jobs only when it waits for a main thread job. It must therefore not wait
+        for a worker job that depends on a main thread job, as that would never return. */
+    void Wait(const JobPtr &job);
+
+    /// Returns when all the given jobs have finished, running other queued jobs in the calling thread meanwhile.
+    void Wait(const std::vector<JobPtr> &jobs);
+
+    /// Calls the function for the subranges of [begin, end) in parallel, and returns when all of them have been processed.
+    /** The calling thread processes subranges as well.
+        @param grainSize The size of the subranges. If 0, the range is split into a few subranges per worker. */
+    void ParallelFor(int begin, int end, int grainSize, const RangeFunction &function);
+
+    /// Returns the number of worker threads.
+    int NumWorkers() const { return (int)workers_.size(); }
+
+    /// Returns true if called from the main thread.
+    bool IsMainThread() const { return boost::this_thread::get_id() == mainThreadId_; }
+
+private:
+    friend class Framework;
+    friend class Job;
+
+    /// A worker thread and its queue.
+    struct Worker
+    {
+        Worker() : index(0) {}
+        int index;
+        boost::thread thread;
+        boost::mutex mutex;
+        std::deque<JobPtr> queue; ///< Own jobs are taken from the back, stolen jobs from the front.
+    };
+
+    /// Starts the worker threads. Framework takes ownership of this object.
+    /** @param numWorkers The number of worker threads. If 0, one less than the number of hardware threads. */
+    JobAPI(Framework *fw, int numWorkers);
+    /// Stops the worker threads, if not stopped already.
+    ~JobAPI();
+
+    /// Stops accepting jobs for the workers and the main thread, runs the worker jobs that are already queued, discards the queued
+    /// main thread jobs and the jobs that depend on them, and joins the worker threads. Called by Framework when the main loop exits.
+    void Stop();
+
+    /// Runs the main thread jobs that have been queued. Called by Framework each frame.
+    void ProcessMainThreadJobs();
+
+    /// Registers the job as a dependent of its unfinished dependencies, or queues it if there are none.
+    void AddJob(const JobPtr &job, const std::vector<JobPtr> &dependencies);
+
+    /// Queues a job whose dependencies have finished.
+    void Enqueue(const JobPtr &job);
+
+    /// Returns the next job for the given worker, or for a thread that is not a worker if null, or null if there are no queued jobs.
+    JobPtr FindJob(Worker *worker);
+
+    /// Removes the newest or the oldest job from the queue guarded by the mutex and uncounts it, or returns null if the queue is empty.
+    JobPtr TakeJob(boost::mutex &mutex, std::deque<JobPtr> &queue, bool newest);
+
+    /// Runs the function of the job and queues the jobs that were waiting for it.
+    void Execute(const JobPtr &job);
+
+    /// Marks the job finished without running it, and discards the jobs that were waiting for it.
+    void Discard(const JobPtr &job);
+
+    /// Releases the function of a job that has been run or discarded and marks the job finished.
+    /** @return The jobs that were waiting only for this job. */
+    std::vector<JobPtr> Finish(const JobPtr &job);
+
+    /// Boost thread entry point of the workers.
+    void WorkerMain(Worker *worker);
+
+    /// Cleanup function of currentWorker_. The workers are owned by workers_, so this does nothing.
+    static void KeepWorker(Worker *) {}
+
+    Framework *framework_;
+    boost::thread::id mainThreadId_;
+    std::vector<Worker *> workers_;
+    /// The worker the calling thread is, or null if the calling thread is not a worker.
+    boost::thread_specific_ptr<Worker> currentWorker_;
+
+    boost::mutex injectedMutex_;
+    std::deque<JobPtr> injected_; ///< Jobs submitted by the threads that are not workers.
+
+    boost::mutex mainThreadMutex_;
+    std::vector<JobPtr> mainThreadJobs_;
+
+    boost::mutex sleepMutex_;
+    boost::condition_variable jobQueued_;
+    /// The number of jobs in the worker and injected queues. Guarded by sleepMutex_, which is taken while holding the lock
+    /// of the queue the job is added to or removed from.
+    int numQueued_;
+    bool quit_; ///< Set by Stop(). Guarded by sleepMutex_.
+
+    boost::mutex graphMutex_;
+    boost::condition_variable jobFinished_;
+};
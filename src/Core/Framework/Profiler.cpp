@@ -9,6 +9,7 @@
 #include "HighPerfClock.h"
 #include "MemoryLeakCheck.h"
 #include <iostream>
+#include <fstream>
 #include <utility>
 
 #ifdef min
@@ -29,31 +30,84 @@ bool ProfilerBlock::QueryCapability()
 #endif
 }
 
-void Profiler::StartBlock(const std::string &name)
+const size_t Profiler::cTraceEventsPerThread;
+
+Profiler::Profiler() :
+    root_("Root"),
+    num_pruned_threads_(0),
+    trace_enabled_(false),
+    trace_start_time_(0)
+{
+}
+
+int Profiler::InternBlock(const std::string &name)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    std::map<std::string, int>::const_iterator iter = block_ids_.find(name);
+    if (iter != block_ids_.end())
+        return iter->second;
+
+    int id = (int)block_names_.size();
+    block_names_.push_back(name);
+    block_ids_[name] = id;
+    return id;
+}
+
+std::string Profiler::BlockName(int id)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return (id >= 0 && id < (int)block_names_.size()) ? block_names_[id] : std::string();
+}
+
+ProfilerThreadData *Profiler::GetOrCreateThreadData()
+{
+    ProfilerThreadDataPtr *data = thread_data_.get();
+    if (!data)
+    {
+        data = new ProfilerThreadDataPtr(new ProfilerThreadData);
+        mutex_.lock();
+        thread_data_list_.push_back(*data);
+        mutex_.unlock();
+        thread_data_.reset(data);
+    }
+    return data->get();
+}
+
+ProfilerThreadData *Profiler::GetThreadData()
+{
+    ProfilerThreadDataPtr *data = thread_data_.get();
+    return data ? data->get() : 0;
+}
+
+ProfilerThreadData *Profiler::StartBlock(int id)
 {
 #ifdef PROFILING
     // Get the current topmost profiling node in the stack, or 
     // if none exists, get the root node or create a new root node.
     // This will be the parent node of the new block we're starting.
-    ProfilerNodeTree *parent = current_node_;
+    ProfilerThreadData *data = GetOrCreateThreadData();
+    ProfilerNodeTree *parent = data->current;
     if (!parent)
     {
         parent = GetOrCreateThreadRootBlock();
-        current_node_ = parent;
+        data->current = parent;
     }
     assert(parent);
 
-    // If parent name == new block name, we assume that we're
+    // If parent ID == new block ID, we assume that we're
     // recursively re-entering the same function (with a single
     // profiling block).
-    ProfilerNodeTree *node = (name != parent->Name()) ? parent->GetChild(name) : parent;
+    ProfilerNodeTree *node = (id != parent->id_) ? parent->GetChild(id) : parent;
 
-    // We're entering this PROFILE() block for the first time,
-    // need to allocate the memory for it.
+    // We're entering this PROFILE() block for the first time in this thread,
+    // need to allocate the memory for it. The lock keeps the reporting
+    // functions from seeing the child list while it is modified.
     if (!node)
     {
-        node = new ProfilerNode(name);
+        node = new ProfilerNode(BlockName(id), id);
+        mutex_.lock();
         parent->AddChild(boost::shared_ptr<ProfilerNodeTree>(node));
+        mutex_.unlock();
     }
 
     assert (parent->recursion_ >= 0);
@@ -65,22 +119,29 @@ void Profiler::StartBlock(const std::string &name)
         parent->recursion_++; // handle recursion
     else
     {
-        current_node_ = node;
+        data->current = node;
 
         checked_static_cast<ProfilerNode*>(node)->block_.Start();
     }
+    return data;
+#else
+    return 0;
 #endif
 }
 
-void Profiler::EndBlock(const std::string &name)
+void Profiler::EndBlock(int id, ProfilerThreadData *data)
 {
 #ifdef PROFILING
     using namespace std;
 
-    ProfilerNodeTree *treeNode = current_node_;
-    if (!treeNode)
+    if (!data)
+        data = GetThreadData();
+    if (!data)
+        return;
+    ProfilerNodeTree *treeNode = data->current;
+    if (!treeNode || treeNode == data->root)
         return;
-    assert (treeNode->Name() == name && "New profiling block started before old one ended!");
+    assert (treeNode->id_ == id && "New profiling block started before old one ended!");
 
     ProfilerNode* node = checked_static_cast<ProfilerNode*>(treeNode);
     node->block_.Stop();
@@ -106,23 +167,249 @@ void Profiler::EndBlock(const std::string &name)
         --node->recursion_;
     else
     {
-        current_node_ = node->Parent();
+        data->current = node->Parent();
+
+        if (trace_enabled_)
+            RecordTraceEvent(data, id, node->block_.StartTime(), node->block_.EndTime());
     }
 #endif
 }
 
+void Profiler::AddSample(const int *ids, size_t depth, double elapsed)
+{
+#ifdef PROFILING
+    ProfilerThreadData *data = GetOrCreateThreadData();
+    ProfilerNodeTree *parent = data->current;
+    if (!parent)
+    {
+        parent = GetOrCreateThreadRootBlock();
+        data->current = parent;
+    }
+
+    for(size_t i = 0; i < depth; ++i)
+    {
+        ProfilerNodeTree *treeNode = parent->GetChild(ids[i]);
+        if (!treeNode)
+        {
+            treeNode = new ProfilerNode(BlockName(ids[i]), ids[i]);
+            mutex_.lock();
+            parent->AddChild(boost::shared_ptr<ProfilerNodeTree>(treeNode));
+            mutex_.unlock();
+        }
+
+        // A sample is not a call, so only the time is credited. The call counts and the per-call times are left to EndBlock().
+        ProfilerNode *node = checked_static_cast<ProfilerNode*>(treeNode);
+        node->num_samples_current_++;
+        node->elapsed_current_ += elapsed;
+        node->total_ += elapsed;
+        node->total_custom_ += elapsed;
+
+        parent = node;
+    }
+#endif
+}
+
+void Profiler::AddTraceEvent(int id, s64 start, s64 end)
+{
+#ifdef PROFILING
+    if (!trace_enabled_)
+        return;
+    RecordTraceEvent(GetOrCreateThreadData(), id, start, end);
+#endif
+}
+
+void Profiler::RecordTraceEvent(ProfilerThreadData *data, int id, s64 start, s64 end)
+{
+    boost::mutex::scoped_lock lock(data->traceMutex);
+    // The trace may have been disabled, and the buffer freed, after the caller checked the flag.
+    if (!trace_enabled_)
+        return;
+    if (data->trace.empty())
+    {
+        data->trace.resize(cTraceEventsPerThread);
+        data->traceNext = 0;
+        data->traceWrapped = false;
+    }
+
+    ProfilerTraceEvent &event = data->trace[data->traceNext];
+    event.id = id;
+    event.start = start;
+    event.end = end;
+    if (++data->traceNext == data->trace.size())
+    {
+        data->traceNext = 0;
+        data->traceWrapped = true;
+    }
+}
+
+void Profiler::SetTraceEnabled(bool enabled)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    PruneExitedThreads();
+    if (enabled == trace_enabled_)
+        return;
+
+    if (enabled)
+    {
+        // The buffers are allocated by the threads when they record their first event.
+        trace_start_time_ = GetCurrentClockTime();
+        trace_enabled_ = true;
+        return;
+    }
+
+    trace_enabled_ = false;
+    for(std::list<ProfilerThreadDataPtr>::iterator iter = thread_data_list_.begin(); iter != thread_data_list_.end(); ++iter)
+    {
+        ProfilerThreadData *data = iter->get();
+        boost::mutex::scoped_lock traceLock(data->traceMutex);
+        std::vector<ProfilerTraceEvent>().swap(data->trace);
+        data->traceNext = 0;
+        data->traceWrapped = false;
+    }
+}
+
+void Profiler::PruneExitedThreads()
+{
+    // The list holds the last reference to the data of a thread after boost::thread_specific_ptr has released it at thread exit.
+    for(std::list<ProfilerThreadDataPtr>::iterator iter = thread_data_list_.begin(); iter != thread_data_list_.end();)
+    {
+        if (!iter->unique())
+        {
+            ++iter;
+            continue;
+        }
+
+        ProfilerNodeTree *root = (*iter)->root;
+        if (root)
+        {
+            root_.RemoveChild(root);
+            thread_root_nodes_.remove(root);
+            // mutex_ is already held, so the root block must not notify the profiler of its deletion.
+            root->MarkAsRootBlock(0);
+            delete root;
+        }
+        iter = thread_data_list_.erase(iter);
+        ++num_pruned_threads_;
+    }
+}
+
+void Profiler::SetThreadName(const std::string &name)
+{
+    ProfilerThreadData *data = GetOrCreateThreadData();
+    mutex_.lock();
+    data->name = name;
+    mutex_.unlock();
+}
+
+namespace
+{
+    /// Writes the string as a JSON string literal.
+    void WriteJsonString(std::ostream &out, const std::string &str)
+    {
+        out << '"';
+        for(size_t i = 0; i < str.length(); ++i)
+        {
+            char c = str[i];
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if ((unsigned char)c < 0x20)
+                out << ' ';
+            else
+                out << c;
+        }
+        out << '"';
+    }
+
+    /// Events of a thread copied out of its trace buffer for writing, oldest first.
+    struct ThreadTrace
+    {
+        std::string name;
+        std::vector<ProfilerTraceEvent> events;
+    };
+}
+
+bool Profiler::SaveTrace(const std::string &filename)
+{
+    std::ofstream out(filename.c_str());
+    if (!out.is_open())
+        return false;
+
+    // Copy the events out of the buffers, locking one thread at a time, so that the threads keep recording
+    // while the file is written.
+    std::vector<ThreadTrace> threads;
+    std::vector<std::string> blockNames;
+    s64 startTime;
+
+    mutex_.lock();
+    PruneExitedThreads();
+    for(std::list<ProfilerThreadDataPtr>::iterator iter = thread_data_list_.begin(); iter != thread_data_list_.end(); ++iter)
+    {
+        ProfilerThreadData *data = iter->get();
+        threads.push_back(ThreadTrace());
+        ThreadTrace &thread = threads.back();
+        thread.name = data->name;
+        if (thread.name.empty() && data->root)
+            thread.name = data->root->Name();
+
+        // Copy the events from the oldest to the newest.
+        boost::mutex::scoped_lock traceLock(data->traceMutex);
+        if (data->trace.empty())
+            continue;
+        size_t numEvents = data->traceWrapped ? data->trace.size() : data->traceNext;
+        size_t begin = data->traceWrapped ? data->traceNext : 0;
+        thread.events.reserve(numEvents);
+        for(size_t i = 0; i < numEvents; ++i)
+            thread.events.push_back(data->trace[(begin + i) % data->trace.size()]);
+    }
+    blockNames = block_names_;
+    startTime = trace_start_time_;
+    mutex_.unlock();
+
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    const double usecsPerTick = 1000000.0 / (double)GetCurrentClockFreq();
+    bool first = true;
+    out << "{\"traceEvents\":[";
+    for(size_t threadIndex = 0; threadIndex < threads.size(); ++threadIndex)
+    {
+        const ThreadTrace &thread = threads[threadIndex];
+        if (thread.events.empty())
+            continue;
+
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadIndex << ",\"args\":{\"name\":";
+        WriteJsonString(out, thread.name);
+        out << "}}";
+        first = false;
+
+        for(size_t i = 0; i < thread.events.size(); ++i)
+        {
+            const ProfilerTraceEvent &event = thread.events[i];
+            if (event.start < startTime || event.id < 0 || event.id >= (int)blockNames.size())
+                continue;
+            out << ",\n{\"name\":";
+            WriteJsonString(out, blockNames[event.id]);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadIndex
+                << ",\"ts\":" << (event.start - startTime) * usecsPerTick
+                << ",\"dur\":" << std::max(event.end - event.start, (s64)0) * usecsPerTick << "}";
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return out.good();
+}
+
 ProfilerNodeTree *Profiler::GetThreadRootBlock()
 { 
-    return thread_specific_root_;
+    ProfilerThreadData *data = GetThreadData();
+    return data ? data->root : 0;
 }
 
 ProfilerNodeTree *Profiler::GetOrCreateThreadRootBlock()
 { 
 #ifdef PROFILING // If not profiling, never create the root block so the getter will always return 0.
-    if (!thread_specific_root_)
+    if (!GetThreadRootBlock())
         return CreateThreadRootBlock();
 #endif
-    return thread_specific_root_;
+    return GetThreadRootBlock();
 }
 
 std::string Profiler::GetThisThreadRootBlockName()
@@ -159,8 +446,9 @@ ProfilerNodeTree *Profiler::CreateThreadRootBlock()
     std::string rootObjectName = GetThisThreadRootBlockName();
 
     ProfilerNodeTree *root = new ProfilerNodeTree(rootObjectName);
-    assert(!thread_specific_root_);
-    thread_specific_root_ = root;
+    ProfilerThreadData *data = GetOrCreateThreadData();
+    assert(!data->root);
+    data->root = root;
 
     // Each thread root block is added as a child of a dummy node root_ owned by
     // this Profiler. The root_ object doesn't own the memory of its children,
@@ -16,14 +16,26 @@
 #include <boost/thread.hpp>
 #pragma warning( pop )
 
+#include <QAtomicInt>
+
+#include <list>
+#include <map>
+#include <vector>
+
 #if (defined(_POSIX_C_SOURCE) || defined(_WINDOWS)) && defined(PROFILING)
 
 /// Profiles a block of code in current scope. Ends the profiling when it goes out of scope
 /** Name of the profiling block must be unique in the scope, so do not use the name of the function
     as the name of the profiling block!
 
+    The name is interned to a block ID the first time the block is entered, so entering the block afterwards
+    does not handle strings or allocate memory. The ID is cached in a constant-initialized atomic instead of a
+    dynamically initialized static, as the initialization of function-local statics is not thread-safe on all
+    supported compilers.
+
     @param x Unique name for the profiling block, use without quotes, f.ex. PROFILE(name_of_the_block) */
-#define PROFILE(x) ProfilerSection x ## __profiler__(#x);
+#define PROFILE(x) static QBasicAtomicInt x ## __profiler_id__ = Q_BASIC_ATOMIC_INITIALIZER(-1); \
+    ProfilerSection x ## __profiler__(ProfilerSection::BlockId(x ## __profiler_id__, #x));
 
 /// Optionally ends the current profiling block
 /** Use when you wish to end a profiling block before it goes out of scope. */
@@ -76,6 +88,12 @@ public:
         return (elapsed_s < 0 ? 0 : elapsed_s);
     }
 
+    /// Returns the clock time of the last Start()
+    s64 StartTime() const { return start_time_; }
+
+    /// Returns the clock time of the last Stop()
+    s64 EndTime() const { return end_time_; }
+
     static double ElapsedTimeSeconds(const s64 &start, const s64 &end)
     {
         double elapsed_s = (double)(end - start) / (double)GetCurrentClockFreq();
@@ -109,8 +127,8 @@ class ProfilerNodeTree
 public:
     typedef std::list<boost::shared_ptr<ProfilerNodeTree> > NodeList;
 
-    /// constructor that takes a name for the node
-    explicit ProfilerNodeTree(const std::string &name) : name_(name), parent_(0), recursion_(0), owner_(0) {}
+    /// constructor that takes a name and the interned block ID for the node
+    explicit ProfilerNodeTree(const std::string &name, int id = -1) : name_(name), id_(id), parent_(0), recursion_(0), owner_(0) {}
 
     /// destructor
     virtual ~ProfilerNodeTree()
@@ -133,6 +151,12 @@ public:
     {
         children_.push_back(node);
         node->parent_ = this;
+        if (node->id_ >= 0)
+        {
+            if (node->id_ >= (int)childrenById_.size())
+                childrenById_.resize(node->id_ + 1, 0);
+            childrenById_[node->id_] = node.get();
+        }
     }
 
     /// Removes the child node.
@@ -142,6 +166,8 @@ public:
             for(NodeList::iterator iter = children_.begin(); iter != children_.end(); ++iter)
                 if ((*iter).get() == node)
                 {
+                    if (node->id_ >= 0 && node->id_ < (int)childrenById_.size())
+                        childrenById_[node->id_] = 0;
                     children_.erase(iter);
                     return;
                 }
@@ -159,9 +185,19 @@ public:
         return 0;
     }
 
+    /// Returns a child node by the interned block ID of the child
+    /** @return Child node or 0 if the node was not child */
+    ProfilerNodeTree* GetChild(int id)
+    {
+        return (id >= 0 && id < (int)childrenById_.size()) ? childrenById_[id] : 0;
+    }
+
     /// Returns the name of this node
     const std::string &Name() const { return name_; }
 
+    /// Returns the interned block ID of this node, or -1 for root nodes
+    int Id() const { return id_; }
+
     /// Returns the parent of this node
     ProfilerNodeTree *Parent() { return parent_; }
 
@@ -178,12 +214,16 @@ private:
 
     /// list of all children for this node
     NodeList children_;
+    /// children indexed by their block ID, for finding the child of a block without comparing names
+    std::vector<ProfilerNodeTree*> childrenById_;
     /// cached parent node for easy access
     ProfilerNodeTree *parent_;
     /// If non-null, this node is a root block owned by the given profiler.
     Profiler *owner_;
     /// Name of this node
     const std::string name_;
+    /// Interned block ID of this node
+    const int id_;
 
     /// helper counter for recursion
     int recursion_;
@@ -194,12 +234,14 @@ typedef boost::shared_ptr<ProfilerNodeTree> ProfilerNodeTreePtr;
 class ProfilerNode : public ProfilerNodeTree
 {
 public:
-    /// constructor that takes a name for the node
-    explicit ProfilerNode(const std::string &name) : 
-    ProfilerNodeTree(name),
+    /// constructor that takes a name and the interned block ID for the node
+    ProfilerNode(const std::string &name, int id) :
+    ProfilerNodeTree(name, id),
         num_called_total_(0),
         num_called_(0),
         num_called_current_(0),
+        num_samples_(0),
+        num_samples_current_(0),
         total_(0.0),
         elapsed_current_(0.0),
         elapsed_(0.0) ,
@@ -223,6 +265,9 @@ public:
         num_called_ = num_called_current_;
         num_called_current_ = 0;
 
+        num_samples_ = num_samples_current_;
+        num_samples_current_ = 0;
+
         elapsed_ = elapsed_current_;
         elapsed_current_ = 0;
 
@@ -241,6 +286,9 @@ public:
     /// Number of times this profile was called during last frame
     unsigned long num_called_;
 
+    /// Number of sampled call stacks this profile was in during last frame, see Profiler::AddSample()
+    unsigned long num_samples_;
+
     /// Total time spend in this profile during the execution of the program
     double total_;
 
@@ -267,6 +315,7 @@ private:
     ProfilerNode(const ProfilerNode &rhs); // N/I
 
     unsigned long num_called_current_;
+    unsigned long num_samples_current_;
     double elapsed_current_;
     double elapsed_min_current_;
     double elapsed_max_current_;
@@ -280,6 +329,42 @@ namespace
     void EmptyDeletor(ProfilerNodeTree *node) { }
 }
 
+/// A profiling block recorded for the timeline trace.
+struct ProfilerTraceEvent
+{
+    /// Interned block ID of the block.
+    int id;
+    /// Clock times of the start and the end of the block.
+    s64 start;
+    s64 end;
+};
+
+/// Profiling data of a single thread.
+struct ProfilerThreadData
+{
+    ProfilerThreadData() : root(0), current(0), traceNext(0), traceWrapped(false) {}
+
+    /// Guards the trace ring buffer. Taken by the thread for each event it records while the trace is enabled,
+    /// and by Profiler::SetTraceEnabled() and Profiler::SaveTrace() to access the buffer from another thread.
+    boost::mutex traceMutex;
+
+    /// The root profile block of the thread.
+    ProfilerNodeTree *root;
+    /// The current topmost profile block in the stack of the thread.
+    ProfilerNodeTree *current;
+
+    /// Name of the thread in the timeline trace. If empty, the name of the root block is used.
+    std::string name;
+    /// Ring buffer of the most recent blocks of the thread. Allocated when the thread records its first event after
+    /// the timeline trace is enabled, and freed when the trace is disabled.
+    std::vector<ProfilerTraceEvent> trace;
+    /// Index of the next event to write in the ring buffer.
+    size_t traceNext;
+    /// True if the ring buffer has been filled and the oldest events are being overwritten.
+    bool traceWrapped;
+};
+typedef boost::shared_ptr<ProfilerThreadData> ProfilerThreadDataPtr;
+
 /// Profiler can be used to measure execution time of a block of code.
 /** Do not use this class directly for profiling, use instead PROFILE
     and ELIFORP macros.
@@ -297,18 +382,54 @@ namespace
     thread specific profiling data. 
 
     Locks are not used when dealing with profiling blocks, as they might skew
-    the data too much.
+    the data too much. The names of the blocks are interned to integer IDs with
+    InternBlock(), and the child blocks of each block are indexed by their IDs,
+    so after a block has been entered once in a thread, entering and leaving
+    it again only reads the clock and updates the counters of the block. The
+    lock is taken only when a thread enters a block for the first time.
+
+    In addition to the per-frame statistics, the profiler can record a timeline
+    of the individual blocks of all threads into per-thread ring buffers, see
+    SetTraceEnabled() and SaveTrace().
+
+    The profiling data of a thread, including its trace, is freed after the thread
+    has exited, the next time the data of all threads is accessed.
 
     \todo A memory leak around here somewhere of several kilobytes. */
 class Profiler
 {
 public:
-    Profiler() :current_node_(0), root_("Root"), thread_specific_root_(0)
-    {
-    }
+    Profiler();
 
     ~Profiler();
 
+    /// Returns the ID of the profiling block with the given name, allocating a new ID for a new name.
+    /** The IDs are shared by all threads. Takes a lock, so call once per block and store the ID,
+        as the PROFILE macro does. Re-entrant. */
+    int InternBlock(const std::string &name);
+
+    /// Returns the name of the profiling block with the given ID, or an empty string if the ID is unknown. Re-entrant.
+    std::string BlockName(int id);
+
+    /// The number of most recent blocks kept in the timeline trace for each thread.
+    static const size_t cTraceEventsPerThread = 65536;
+
+    /// Starts or stops recording the timeline trace.
+    /** Stopping the recording frees the trace buffers, so save the trace with SaveTrace() before stopping it. */
+    void SetTraceEnabled(bool enabled);
+
+    /// Returns true if the timeline trace is being recorded.
+    bool IsTraceEnabled() const { return trace_enabled_; }
+
+    /// Writes the recorded timeline trace of all threads to a file in the Chrome trace event JSON format.
+    /** The file can be opened in chrome://tracing or Perfetto. The buffer of each thread is copied while holding its lock,
+        so a thread is blocked only while its own buffer is copied, and the file is written after that.
+        @return True if the file was written successfully. */
+    bool SaveTrace(const std::string &filename);
+
+    /// Sets the name the calling thread is shown with in the timeline trace.
+    void SetThreadName(const std::string &name);
+
     /// Start a profiling block.
     /** Normally you don't use this directly, instead you use the macro PROFILE.
         However if you want profiling that lasts out of scope, you can use this directly,
@@ -317,13 +438,37 @@ public:
         Can be called multiple times with the same name without calling EndBlock() for
         recursion support.
 
-        Re-entrant. */
-    void StartBlock(const std::string &name);
+        Re-entrant.
+        @return The profiling data of the calling thread, which can be passed to EndBlock() to save looking it up again. */
+    ProfilerThreadData *StartBlock(int id);
+
+    /// Start a profiling block by name. Interns the name on every call, prefer StartBlock(int) in frequently run code.
+    void StartBlock(const std::string &name) { StartBlock(InternBlock(name)); }
 
     /// End the profiling block
     /** Each StartBlock() should have a matching EndBlock(). Recursion is supported.
-        Re-entrant. */
-    void EndBlock(const std::string &name);
+        Re-entrant.
+        @param thread The profiling data of the calling thread as returned by StartBlock(), or null to look it up. */
+    void EndBlock(int id, ProfilerThreadData *thread = 0);
+
+    /// End the profiling block by name. Interns the name on every call, prefer EndBlock(int) in frequently run code.
+    void EndBlock(const std::string &name) { EndBlock(InternBlock(name)); }
+
+    /// Records a sampled call stack of the calling thread under its current profiling block.
+    /** For sampling profilers, such as the script profiler, that see the call stack only at intervals instead of
+        every block start and end. Each block of the stack is credited with the given time and counted as one sample
+        in ProfilerNode::num_samples_. The call counts and the per-call minimum and maximum times are not affected.
+        Re-entrant.
+        @param ids The interned block IDs of the stack, outermost first.
+        @param depth The number of blocks in the stack.
+        @param elapsed The time the stack is credited with, in seconds. */
+    void AddSample(const int *ids, size_t depth, double elapsed);
+
+    /// Records a block of the calling thread in the timeline trace, if the trace is being recorded.
+    /** For the sampling profilers, which know the start and the end of a block only after it has ended.
+        @param start Clock time the block started at.
+        @param end Clock time the block ended at. */
+    void AddTraceEvent(int id, s64 start, s64 end);
 
     /// Reset profiling data for the current thread. Don't call directly, use RESETPROFILER macro instead.
     void ThreadedReset();
@@ -344,6 +489,7 @@ public:
     ProfilerNodeTree *Lock()
     {
         mutex_.lock();
+        PruneExitedThreads();
         return &root_;
     }
 
@@ -352,26 +498,58 @@ public:
         mutex_.unlock();
     }
 
+    /// Returns the number of exited threads whose profiling data has been freed. Call between Lock() and Release().
+    /** The nodes of the threads that have exited are freed when the lock is taken, so a reporter that keeps pointers to the nodes
+        of other threads across frames must drop them when this count changes. */
+    unsigned int NumPrunedThreads() const { return num_pruned_threads_; }
+
     ProfilerNodeTree *GetRoot() { return &root_; }
 
     void Reset();
 
 private:
+    /// Returns the profiling data of the calling thread, creating it on the first call in the thread.
+    ProfilerThreadData *GetOrCreateThreadData();
+
+    /// Returns the profiling data of the calling thread, or null if the thread has not profiled anything.
+    ProfilerThreadData *GetThreadData();
+
+    /// Writes a block to the timeline trace ring buffer of the given thread, allocating the buffer on the first event.
+    void RecordTraceEvent(ProfilerThreadData *data, int id, s64 start, s64 end);
+
+    /// Frees the profiling data of the threads that have exited. Must be called with mutex_ locked.
+    void PruneExitedThreads();
+
     /// The single global root node object.
     /// This is a dummy root node that doesn't track any  timing statistics, but just contains
     /// all the root blocks of each thread as its children.
     /// This root_ node doesn't own any of the memory of any of its children, those are owned 
     /// and freed by each thread separately Namely, freeing all instances inside the 
-    /// thread_specific_root_ will cause all blocks to be freed.
+    /// root blocks of the threads will cause all blocks to be freed.
     ProfilerNodeTree root_;
 
-    /// Contains the root profile block for each thread.
-    ProfilerNodeTree *thread_specific_root_;
-    /// Points to the current topmost profile block in the stack for each thread.
-    ProfilerNodeTree *current_node_;
+    /// Contains the root profile block and the current topmost profile block in the stack for each thread.
+    /// The data is shared with thread_data_list_. When the thread exits, only the list refers to it, which marks it for pruning.
+    boost::thread_specific_ptr<ProfilerThreadDataPtr> thread_data_;
+
+    /// container for the profiling data of all threads.
+    std::list<ProfilerThreadDataPtr> thread_data_list_;
 
     /// container for all the root profile nodes for each thread.
     std::list<ProfilerNodeTree*> thread_root_nodes_;
+    /// The number of exited threads whose profiling data has been freed.
+    unsigned int num_pruned_threads_;
+
+    /// Maps the names of the profiling blocks to their IDs.
+    std::map<std::string, int> block_ids_;
+    /// The names of the profiling blocks, indexed by their IDs.
+    std::vector<std::string> block_names_;
+
+    /// If true, the blocks that end are recorded in the timeline trace of their thread. Read without a lock as a hint,
+    /// and checked again under the trace lock of the thread before the buffer is touched.
+    volatile bool trace_enabled_;
+    /// Clock time the timeline trace was started at.
+    s64 trace_start_time_;
 
     boost::mutex mutex_;
 };
@@ -380,10 +558,18 @@ private:
 class ProfilerSection
 {
 public:
-    explicit ProfilerSection(const std::string &name) : name_(name), destroyed_(false)
+    explicit ProfilerSection(int id) : id_(id), destroyed_(false)
     {
         assert(Framework::Instance() && "Cannot get Framework instance! Did you forget to call Framework::SetInstance(fw); in your TundraPluginMain?");
-        GetProfiler()->StartBlock(name);
+        profiler_ = GetProfiler();
+        thread_ = profiler_->StartBlock(id);
+    }
+
+    /// Profiles a block by name. Interns the name on every call, prefer the block ID in frequently run code.
+    explicit ProfilerSection(const std::string &name) : id_(GetProfiler()->InternBlock(name)), destroyed_(false)
+    {
+        profiler_ = GetProfiler();
+        thread_ = profiler_->StartBlock(id_);
     }
 
     ~ProfilerSection()
@@ -399,9 +585,23 @@ public:
     {
         assert (Framework::Instance() && "Trying to profile before profiler initialized.");
 
-        GetProfiler()->EndBlock(name_);
+        profiler_->EndBlock(id_, thread_);
         destroyed_ = true;
     }
+    /// Returns the block ID cached in the given atomic, interning the name if the ID is not cached yet.
+    /** Used by the PROFILE macro. Threads that enter the block for the first time at the same time all intern the name,
+        which returns the same ID to each of them, and the first one to finish caches it. */
+    static int BlockId(QBasicAtomicInt &cachedId, const char *name)
+    {
+        int id = cachedId;
+        if (id < 0)
+        {
+            id = GetProfiler()->InternBlock(name);
+            cachedId.testAndSetOrdered(-1, id);
+        }
+        return id;
+    }
+
     static Profiler *GetProfiler()
     {
         assert(Framework::Instance());
@@ -416,8 +616,12 @@ private:
     ProfilerSection(); // N/I
     ProfilerSection(const ProfilerSection &rhs);
 
-    /// Name of this profiling section
-    const std::string name_;
+    /// Interned block ID of this profiling section
+    const int id_;
+
+    /// The profiler and the profiling data of the thread the section was started in
+    Profiler *profiler_;
+    ProfilerThreadData *thread_;
 
     /// True if this section has explicitly been destroyed before it run out of scope
     bool destroyed_;
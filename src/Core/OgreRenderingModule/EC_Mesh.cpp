@@ -14,12 +14,14 @@
 #include "OgreSkeletonAsset.h"
 #include "OgreMeshAsset.h"
 #include "OgreMaterialAsset.h"
+#include "StaticMeshBatcher.h"
 #include "IAssetTransfer.h"
 #include "AssetAPI.h"
 #include "AttributeMetadata.h"
 
 #include <Ogre.h>
 #include <OgreTagPoint.h>
+#include <algorithm>
 
 #include "LoggingFunctions.h"
 
@@ -35,7 +37,10 @@ EC_Mesh::EC_Mesh(Scene* scene) :
     meshMaterial(this, "Mesh materials", AssetReferenceList("OgreMaterial")),
     drawDistance(this, "Draw distance", 0.0f),
     castShadows(this, "Cast shadows", false),
+    lodBias(this, "LOD bias", 1.0f),
+    lodDistance(this, "LOD distance", 0.0f),
     entity_(0),
+    adjustment_node_(0),
     attached_(false)
 {
     if (scene)
@@ -43,6 +48,10 @@ EC_Mesh::EC_Mesh(Scene* scene) :
 
     static AttributeMetadata drawDistanceData("", "0", "10000");
     drawDistance.SetMetadata(&drawDistanceData);
+    lodDistance.SetMetadata(&drawDistanceData);
+
+    static AttributeMetadata lodBiasData("", "0.01", "100", "0.1");
+    lodBias.SetMetadata(&lodBiasData);
 
     static AttributeMetadata materialMetadata;
     materialMetadata.elementType = "assetreference";
@@ -54,8 +63,12 @@ EC_Mesh::EC_Mesh(Scene* scene) :
     OgreWorldPtr world = world_.lock();
     if (world)
     {
-        Ogre::SceneManager* sceneMgr = world->GetSceneManager();
-        adjustment_node_ = sceneMgr->createSceneNode(world->GetUniqueObjectName("EC_Mesh_adjustment_node"));
+        // Without a view, no Ogre objects are created and only the bounds of the mesh asset are used.
+        if (scene->ViewEnabled())
+        {
+            Ogre::SceneManager* sceneMgr = world->GetSceneManager();
+            adjustment_node_ = sceneMgr->createSceneNode(world->GetUniqueObjectName("EC_Mesh_adjustment_node"));
+        }
 
         connect(this, SIGNAL(ParentEntitySet()), SLOT(UpdateSignals()));
         connect(this, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), SLOT(OnAttributeUpdated(IAttribute*)));
@@ -203,6 +216,9 @@ float3 EC_Mesh::GetAttachmentScale(uint index) const
 
 float3x4 EC_Mesh::LocalToParent() const
 {
+    if (!adjustment_node_)
+        return nodeTransformation.Get().ToFloat3x4();
+
     if (!entity_)
     {
         LogError(QString("EC_Mesh::LocalToParent failed! No entity exists in mesh \"%1\" (entity: \"%2\")!").arg(meshRef.Get().ref, (ParentEntity() ? ParentEntity()->Name() : "(EC_Mesh with no parent entity)")));
@@ -221,6 +237,14 @@ float3x4 EC_Mesh::LocalToParent() const
 
 float3x4 EC_Mesh::LocalToWorld() const
 {
+    if (!adjustment_node_)
+    {
+        // Without a view the mesh is not attached to a placeable, so look up the placeable of the entity.
+        Entity *entity = ParentEntity();
+        EC_Placeable *placeable = entity ? entity->GetComponent<EC_Placeable>().get() : 0;
+        return placeable ? placeable->LocalToWorld() * LocalToParent() : LocalToParent();
+    }
+
     if (!entity_)
     {
         LogError(QString("EC_Mesh::LocalToParent failed! No entity exists in mesh \"%1\" (entity: \"%2\")!").arg(meshRef.Get().ref, (ParentEntity() ? ParentEntity()->Name() : "(EC_Mesh with no parent entity)")));
@@ -280,6 +304,7 @@ bool EC_Mesh::SetMesh(QString meshResourceName, bool clone)
         
         entity_->setRenderingDistance(drawDistance.Get());
         entity_->setCastShadows(castShadows.Get());
+        ApplyLodBias();
         entity_->setUserAny(Ogre::Any(ParentEntity()));
         // Set UserAny also on subentities
         for(uint i = 0; i < entity_->getNumSubEntities(); ++i)
@@ -366,6 +391,7 @@ bool EC_Mesh::SetMeshWithSkeleton(const std::string& mesh_name, const std::strin
         
         entity_->setRenderingDistance(drawDistance.Get());
         entity_->setCastShadows(castShadows.Get());
+        ApplyLodBias();
         entity_->setUserAny(Ogre::Any(ParentEntity()));
         // Set UserAny also on subentities
         for(uint i = 0; i < entity_->getNumSubEntities(); ++i)
@@ -539,6 +565,8 @@ bool EC_Mesh::SetAttachmentMesh(uint index, const std::string& mesh_name, const
         LogError("EC_Mesh::SetAttachmentMesh: Could not set attachment mesh " + mesh_name + ": " + std::string(e.what()));
         return false;
     }
+    // Meshes with attachments are not batched.
+    TouchBatcher();
     return true;
 }
 
@@ -610,6 +638,7 @@ bool EC_Mesh::SetMaterial(uint index, const std::string& material_name)
     try
     {
         entity_->getSubEntity(index)->setMaterialName(SanitateAssetIdForOgre(material_name));
+        TouchBatcher();
         emit MaterialChanged(index, QString(material_name.c_str()));
     }
     catch(Ogre::Exception& e)
@@ -785,7 +814,12 @@ void EC_Mesh::DetachEntity()
     if ((!attached_) || (!entity_) || (!placeable_))
         return;
     
+    OgreWorldPtr world = world_.lock();
+    if (world && world->GetMeshBatcher())
+        world->GetMeshBatcher()->Remove(this);
+
     EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
+    disconnect(placeable, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(OnPlaceableAttributeChanged(IAttribute*)));
     Ogre::SceneNode* node = placeable->GetSceneNode();
     adjustment_node_->detachObject(entity_);
     node->removeChild(adjustment_node_);
@@ -806,6 +840,48 @@ void EC_Mesh::AttachEntity()
     adjustment_node_->setVisible(placeable->visible.Get());
 
     attached_ = true;
+
+    // The batch of a static mesh has to be rebuilt when the placeable moves or is hidden.
+    connect(placeable, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(OnPlaceableAttributeChanged(IAttribute*)), Qt::UniqueConnection);
+    TouchBatcher();
+}
+
+void EC_Mesh::ApplyLodBias()
+{
+    if (!entity_)
+        return;
+
+    float factor = lodBias.Get();
+    // Ogre only supports a per-entity bias on the LOD distances of the mesh, so express the distance relative to the first LOD level of the mesh.
+    Ogre::Mesh *mesh = entity_->getMesh().get();
+    if (lodDistance.Get() > 0.f && mesh && mesh->getNumLodLevels() > 1)
+    {
+#if OGRE_VERSION_MAJOR >= 1 && OGRE_VERSION_MINOR >= 7
+        float meshDistance = mesh->getLodLevel(1).userValue;
+#else
+        float meshDistance = sqrt(mesh->getLodLevel(1).fromDepthSquared);
+#endif
+        if (meshDistance > 0.f)
+            factor *= lodDistance.Get() / meshDistance;
+    }
+    // Ogre requires a positive factor.
+    entity_->setMeshLodBias(std::max(factor, 0.01f));
+}
+
+void EC_Mesh::TouchBatcher()
+{
+    if (!attached_)
+        return;
+    OgreWorldPtr world = world_.lock();
+    if (world && world->GetMeshBatcher())
+        world->GetMeshBatcher()->Touch(this);
+}
+
+void EC_Mesh::OnPlaceableAttributeChanged(IAttribute *attribute)
+{
+    EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
+    if (placeable && (attribute == &placeable->transform || attribute == &placeable->visible || attribute == &placeable->parentRef))
+        TouchBatcher();
 }
 
 Ogre::Mesh* EC_Mesh::PrepareMesh(const std::string& mesh_name, bool clone)
@@ -883,6 +959,12 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
     {
         if(entity_)
             entity_->setRenderingDistance(drawDistance.Get());
+        TouchBatcher();
+    }
+    else if (attribute == &lodBias || attribute == &lodDistance)
+    {
+        ApplyLodBias();
+        TouchBatcher();
     }
     else if (attribute == &castShadows)
     {
@@ -897,9 +979,12 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
                     attachment_entities_[i]->setCastShadows(castShadows.Get());
             }
         }
+        TouchBatcher();
     }
     else if (attribute == &nodeTransformation)
     {
+        if (!adjustment_node_)
+            return;
         Transform newTransform = nodeTransformation.Get();
         adjustment_node_->setPosition(newTransform.pos);
         adjustment_node_->setOrientation(newTransform.Orientation());
@@ -913,12 +998,11 @@ void EC_Mesh::OnAttributeUpdated(IAttribute *attribute)
             newTransform.scale.z = 0.0000001f;
         
         adjustment_node_->setScale(newTransform.scale);
+        TouchBatcher();
     }
     else if (attribute == &meshRef)
     {
-        if (!ViewEnabled())
-            return;
-            
+        // The mesh asset is requested also without a view, as its bounds are used e.g. by the spatial index.
         //Ensure that mesh is requested only when it's has actually changed.
 //        if(entity_)
  //           if(QString::fromStdString(entity_->getMesh()->getName()) == meshRef.Get().ref/*meshResourceId.Get()*/)
@@ -998,6 +1082,12 @@ void EC_Mesh::OnMeshAssetLoaded(AssetPtr asset)
         return;
     }
 
+    if (!ViewEnabled())
+    {
+        emit MeshChanged();
+        return;
+    }
+
     QString ogreMeshName = mesh->Name();
     if (mesh)
     {
@@ -1331,10 +1421,21 @@ OBB EC_Mesh::WorldOBB() const
     return obb;
 }
 
+bool EC_Mesh::HasBounds() const
+{
+    if (entity_)
+        return entity_->getParentSceneNode() != 0;
+    OgreMeshAsset *mesh = dynamic_cast<OgreMeshAsset*>(meshAsset->Asset().get());
+    return mesh && mesh->HasBounds();
+}
+
 OBB EC_Mesh::LocalOBB() const
 {
     if (!entity_)
-        return OBB();
+    {
+        OgreMeshAsset *mesh = dynamic_cast<OgreMeshAsset*>(meshAsset->Asset().get());
+        return mesh && mesh->HasBounds() ? OBB(mesh->Bounds()) : OBB();
+    }
 
     Ogre::MeshPtr mesh = entity_->getMesh();
     if (mesh.isNull())
@@ -45,6 +45,10 @@ Registered by OgreRenderer::OgreRenderingModule.
 <div>Distance where the mesh is shown from the camera, 0.0 = draw always (default).</div> 
 <li>bool: castShadows
 <div>Will the mesh cast shadows.</div> 
+<li>float: lodBias
+<div>Multiplier for the distances at which the mesh switches to lower LOD levels, 1.0 = as authored (default). Larger values keep the full detail further away.</div> 
+<li>float: lodDistance
+<div>Distance from the camera where the mesh switches to its first lower LOD level, 0.0 = use the distances of the mesh asset (default).</div> 
 </ul>
 
 <b>Exposes the following scriptable functions:</b>
@@ -170,6 +174,14 @@ public:
     Q_PROPERTY(bool castShadows READ getcastShadows WRITE setcastShadows);
     DEFINE_QPROPERTY_ATTRIBUTE(bool, castShadows);
 
+    /// Multiplier for the LOD switch distances, 1.0 = as authored (default). Larger values keep the full detail further away.
+    Q_PROPERTY(float lodBias READ getlodBias WRITE setlodBias);
+    DEFINE_QPROPERTY_ATTRIBUTE(float, lodBias);
+
+    /// Distance where the mesh switches to its first lower LOD level, 0.0 = use the distances of the mesh asset (default). Scaled by lodBias.
+    Q_PROPERTY(float lodDistance READ getlodDistance WRITE setlodDistance);
+    DEFINE_QPROPERTY_ATTRIBUTE(float, lodDistance);
+
 public slots:
     /// Automatically finds the placeable from the parent entity and sets it.
     void AutoSetPlaceable();
@@ -399,8 +411,12 @@ public slots:
     OBB WorldOBB() const;
 
     /// Returns the local space bounding box of this object.
+    /** Without a view, no Ogre entity is created, and the bounds of the mesh asset are returned instead. */
     OBB LocalOBB() const;
 
+    /// Returns true if the bounds of this object can be queried, i.e. the Ogre entity is attached to the scene, or without a view, the mesh asset has been loaded.
+    bool HasBounds() const;
+
 signals:
     /// Emitted before the Ogre mesh entity is about to be destroyed
     void MeshAboutToBeDestroyed();
@@ -436,6 +452,9 @@ private slots:
     /// Called when loading a material asset failed
     void OnMaterialAssetFailed(IAssetTransfer* transfer, QString reason);
 
+    /// Called when an attribute of the placeable the mesh is attached to has been changed.
+    void OnPlaceableAttributeChanged(IAttribute *attribute);
+
 private:
     /// Prepares a mesh for creating an entity. some safeguards are needed because of Ogre "features"
     /** @param mesh_name Mesh to prepare
@@ -449,6 +468,12 @@ private:
     /// detaches entity from placeable
     void DetachEntity();
 
+    /// Applies the lodBias and lodDistance attributes to the Ogre entity.
+    void ApplyLodBias();
+
+    /// Notifies the static mesh batcher of the world that the mesh has changed, so that it is rendered individually until it stays unchanged again.
+    void TouchBatcher();
+
     bool HasMaterialsChanged() const;
 
     /// placeable component 
@@ -176,6 +176,8 @@ void EC_OgreCustomObject::AttachEntity()
     {
         EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
         Ogre::SceneNode* node = placeable->GetSceneNode();
+        if (!node)
+            return;
         node->attachObject(entity_);
         attached_ = true;
     }
@@ -187,7 +189,8 @@ void EC_OgreCustomObject::DetachEntity()
     {
         EC_Placeable* placeable = checked_static_cast<EC_Placeable*>(placeable_.get());
         Ogre::SceneNode* node = placeable->GetSceneNode();
-        node->detachObject(entity_);
+        if (node)
+            node->detachObject(entity_);
         attached_ = false;
     }
 }
@@ -17,6 +17,8 @@
 #include "Math/Quat.h"
 #include "Math/float3x3.h"
 #include "Math/float3x4.h"
+#include "Math/OBB.h"
+#include "Math/AABB.h"
 #include "LoggingFunctions.h"
 
 #include <Ogre.h>
@@ -170,6 +172,10 @@ EC_Placeable::EC_Placeable(Scene* scene) :
     parentBone_(0),
     parentPlaceable_(0),
     parentMesh_(0),
+    indexedId_(0),
+    hierarchyNode_(-1),
+    worldTransform_(float3x4::identity),
+    worldTransformDirty_(true),
     attached_(false),
     transform(this, "Transform"),
     drawDebug(this, "Show bounding box", false),
@@ -194,18 +200,28 @@ EC_Placeable::EC_Placeable(Scene* scene) :
     transform.SetMetadata(&transAttrData);
 
     OgreWorldPtr world = world_.lock();
-    if (world)
+    if (scene && !scene->ViewEnabled())
+    {
+        // Without a view, nothing is rendered, so the world transforms are computed in the lightweight hierarchy of the scene instead of the Ogre scene graph.
+        hierarchyScene_ = scene->shared_from_this();
+        hierarchyNode_ = scene->GetTransformHierarchy().CreateNode();
+    }
+    else if (world)
     {
         Ogre::SceneManager* sceneMgr = world->GetSceneManager();
         sceneNode_ = sceneMgr->createSceneNode(world->GetUniqueObjectName("EC_Placeable_SceneNode"));
 // Would like to do this for improved debugging in the Profiler window, but because we don't have the parent entity yet, we don't know the id or the name of this entity.
 //        sceneNode_ = sceneMgr->createSceneNode(world->GetUniqueObjectName(("EC_Placeable_SceneNode_" + QString::number(ParentEntity()->Id()) + "_" + ParentEntity()->Name()).toStdString()));
-    
+    }
+
+    if (sceneNode_ || hierarchyNode_ != -1)
+    {
         // Hook the transform attribute change
         connect(this, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)),
             SLOT(HandleAttributeChanged(IAttribute*, AttributeChange::Type)));
 
         connect(this, SIGNAL(ParentEntitySet()), SLOT(RegisterActions()));
+        connect(this, SIGNAL(ParentEntityDetached()), SLOT(RemoveSpatialBounds()));
     
         AttachNode();
     }
@@ -213,6 +229,19 @@ EC_Placeable::EC_Placeable(Scene* scene) :
 
 EC_Placeable::~EC_Placeable()
 {
+    RemoveSpatialBounds();
+
+    if (hierarchyNode_ != -1)
+    {
+        emit AboutToBeDestroyed();
+        DetachNode();
+        TransformHierarchy *hierarchy = Hierarchy();
+        if (hierarchy)
+            hierarchy->DestroyNode(hierarchyNode_);
+        hierarchyNode_ = -1;
+        return;
+    }
+
     if (world_.expired())
     {
         if (sceneNode_)
@@ -243,12 +272,19 @@ EC_Placeable::~EC_Placeable()
 
 void EC_Placeable::AttachNode()
 {
+    if (hierarchyNode_ != -1)
+    {
+        AttachHierarchyNode();
+        return;
+    }
     if (world_.expired())
     {
         LogError("EC_Placeable::AttachNode: No OgreWorld available to call this function!");
         return;
     }
     OgreWorldPtr world = world_.lock();
+
+    InvalidateWorldTransform();
     
     try
     {
@@ -317,6 +353,14 @@ void EC_Placeable::AttachNode()
                             parentBone_ = bone;
                             parentMesh_ = parentMesh;
                             connect(parentMesh, SIGNAL(MeshAboutToBeDestroyed()), this, SLOT(OnParentMeshDestroyed()), Qt::UniqueConnection);
+
+                            // Track the placeable of the parent entity as well, so that it knows its children
+                            parentPlaceable_ = parentEntity->GetComponent<EC_Placeable>().get();
+                            if (parentPlaceable_)
+                            {
+                                parentPlaceable_->childPlaceables_.push_back(this);
+                                connect(parentPlaceable_, SIGNAL(AboutToBeDestroyed()), this, SLOT(OnParentPlaceableDestroyed()), Qt::UniqueConnection);
+                            }
                             attached_ = true;
                             return;
                         }
@@ -339,6 +383,7 @@ void EC_Placeable::AttachNode()
                 if (parentPlaceable_)
                 {
                     parentPlaceable_->GetSceneNode()->addChild(sceneNode_);
+                    parentPlaceable_->childPlaceables_.push_back(this);
                     
                     // Connect to destruction of the placeable to be able to detach gracefully
                     connect(parentPlaceable_, SIGNAL(AboutToBeDestroyed()), this, SLOT(OnParentPlaceableDestroyed()), Qt::UniqueConnection);
@@ -372,6 +417,17 @@ void EC_Placeable::AttachNode()
 
 void EC_Placeable::DetachNode()
 {
+    if (hierarchyNode_ != -1)
+    {
+        if (!attached_)
+            return;
+        RemoveFromParentPlaceable();
+        TransformHierarchy *hierarchy = Hierarchy();
+        if (hierarchy)
+            hierarchy->SetParent(hierarchyNode_, -1);
+        attached_ = false;
+        return;
+    }
     if (world_.expired())
     {
         LogError("EC_Placeable::DetachNode: No OgreWorld available to call this function!");
@@ -381,6 +437,8 @@ void EC_Placeable::DetachNode()
     
     if (!attached_)
         return;
+
+    InvalidateWorldTransform();
     
     try
     {
@@ -393,17 +451,17 @@ void EC_Placeable::DetachNode()
         // 3) attached to a bone via manual tracking
         if (parentBone_)
         {
-            disconnect(parentMesh_, SIGNAL(MeshAboutToBeDestroyed()));
+            disconnect(parentMesh_, SIGNAL(MeshAboutToBeDestroyed()), this, SLOT(OnParentMeshDestroyed()));
             attachmentListener.RemoveAttachment(parentBone_, this);
             boneAttachmentNode_->removeChild(sceneNode_);
             parentBone_ = 0;
             parentMesh_ = 0;
+            RemoveFromParentPlaceable();
         }
         else if (parentPlaceable_)
         {
-            disconnect(parentPlaceable_, SIGNAL(AboutToBeDestroyed()));
             parentPlaceable_->GetSceneNode()->removeChild(sceneNode_);
-            parentPlaceable_ = 0;
+            RemoveFromParentPlaceable();
         }
         else
             root_node->removeChild(sceneNode_);
@@ -416,6 +474,98 @@ void EC_Placeable::DetachNode()
     }
 }
 
+void EC_Placeable::RemoveFromParentPlaceable()
+{
+    if (!parentPlaceable_)
+        return;
+    // Disconnect only this placeable, the siblings must still be notified when the parent is destroyed.
+    disconnect(parentPlaceable_, SIGNAL(AboutToBeDestroyed()), this, SLOT(OnParentPlaceableDestroyed()));
+    std::vector<EC_Placeable*> &siblings = parentPlaceable_->childPlaceables_;
+    siblings.erase(std::remove(siblings.begin(), siblings.end(), this), siblings.end());
+    parentPlaceable_ = 0;
+}
+
+void EC_Placeable::InvalidateWorldTransform()
+{
+    // A placeable with a valid cached transform always has a parent with a valid cached transform,
+    // so the children of a placeable that is already invalid are invalid as well.
+    if (worldTransformDirty_)
+        return;
+    worldTransformDirty_ = true;
+    for(size_t i = 0; i < childPlaceables_.size(); ++i)
+        childPlaceables_[i]->InvalidateWorldTransform();
+}
+
+void EC_Placeable::AttachHierarchyNode()
+{
+    TransformHierarchy *hierarchy = Hierarchy();
+    if (!hierarchy)
+        return;
+
+    if (attached_)
+        DetachNode();
+
+    disconnect(this, SLOT(CheckParentEntityCreated(Entity*, AttributeChange::Type)));
+    disconnect(this, SLOT(OnParentMeshChanged()));
+    disconnect(this, SLOT(OnComponentAdded(IComponent*, AttributeChange::Type)));
+
+    const EntityReference& parent = parentRef.Get();
+    if (!parent.IsEmpty())
+    {
+        Entity* ownEntity = ParentEntity();
+        if (!ownEntity)
+            return;
+        Scene* scene = ownEntity->ParentScene();
+        if (!scene)
+            return;
+
+        Entity* parentEntity = parent.Lookup(scene).get();
+        if (!parentEntity)
+        {
+            // Could not find parent entity. Check for it later, when new entities are created into the scene
+            connect(scene, SIGNAL(EntityCreated(Entity*, AttributeChange::Type)), this, SLOT(CheckParentEntityCreated(Entity*, AttributeChange::Type)), Qt::UniqueConnection);
+            return;
+        }
+
+        // If we refer to self, attach to the root
+        if (parentEntity != ownEntity)
+        {
+            EC_Placeable *parentPlaceable = parentEntity->GetComponent<EC_Placeable>().get();
+            if (!parentPlaceable)
+            {
+                // If can't find the placeable component yet, wait for it to be created
+                connect(parentEntity, SIGNAL(ComponentAdded(IComponent*, AttributeChange::Type)), this, SLOT(OnComponentAdded(IComponent*, AttributeChange::Type)), Qt::UniqueConnection);
+                return;
+            }
+
+            // The Ogre scene graph refuses cyclic parenting by throwing, the hierarchy has to check for it explicitly.
+            bool cyclic = false;
+            for(EC_Placeable *p = parentPlaceable; p && !cyclic; p = p->parentPlaceable_)
+                cyclic = (p == this);
+            if (!cyclic && parentPlaceable->hierarchyNode_ != -1)
+            {
+                hierarchy->SetParent(hierarchyNode_, parentPlaceable->hierarchyNode_);
+                parentPlaceable_ = parentPlaceable;
+                parentPlaceable_->childPlaceables_.push_back(this);
+                connect(parentPlaceable_, SIGNAL(AboutToBeDestroyed()), this, SLOT(OnParentPlaceableDestroyed()), Qt::UniqueConnection);
+                attached_ = true;
+                return;
+            }
+            LogError("EC_Placeable::AttachHierarchyNode: Cannot parent entity " + ownEntity->ToString() + " to entity " + parentEntity->ToString() + " as it would create a cycle. Attaching to the root instead.");
+        }
+    }
+
+    attached_ = true;
+}
+
+TransformHierarchy *EC_Placeable::Hierarchy() const
+{
+    if (hierarchyNode_ == -1)
+        return 0;
+    ScenePtr scene = hierarchyScene_.lock();
+    return scene ? &scene->GetTransformHierarchy() : 0;
+}
+
 void EC_Placeable::Show()
 {
     if (!sceneNode_)
@@ -549,18 +699,12 @@ void EC_Placeable::DumpNodeHierarhy()
 EntityList EC_Placeable::Children()
 {
     EntityList children;
-
-    Scene *scene = ParentEntity()->ParentScene();
-    ///\todo Optimize this function! The current implementation is very slow since it iterates through the whole scene! Instead, keep a list of weak_ptrs to child EC_Placeables.
-    for(Scene::iterator iter = scene->begin(); iter != scene->end(); ++iter)
+    for(size_t i = 0; i < childPlaceables_.size(); ++i)
     {
-        boost::shared_ptr<EC_Placeable> placeable = iter->second->GetComponent<EC_Placeable>();
-        if (placeable)
-        {
-            EntityPtr parent = placeable->parentRef.Get().Lookup(scene);
-            if (parent.get() == this->ParentEntity())
-                children.push_back(iter->second);
-        }
+        // Skip entities that have been removed from the scene, but are still kept alive elsewhere
+        Entity *child = childPlaceables_[i]->ParentEntity();
+        if (child && child->ParentScene())
+            children.push_back(child->shared_from_this());
     }
     return children;
 }
@@ -575,17 +719,100 @@ void EC_Placeable::RegisterActions()
         entity->ConnectAction("ShowEntity", this, SLOT(Show()));
         entity->ConnectAction("HideEntity", this, SLOT(Hide()));
         entity->ConnectAction("ToggleEntity", this, SLOT(ToggleVisibility()));
+
+        // Track the mesh of this entity for the spatial index bounds
+        connect(entity, SIGNAL(ComponentAdded(IComponent*, AttributeChange::Type)), this, SLOT(OnOwnComponentAdded(IComponent*, AttributeChange::Type)), Qt::UniqueConnection);
+        EC_Mesh* mesh = entity->GetComponent<EC_Mesh>().get();
+        if (mesh)
+            connect(mesh, SIGNAL(MeshChanged()), this, SLOT(UpdateSpatialBounds()), Qt::UniqueConnection);
+        UpdateSpatialBounds();
+    }
+}
+
+void EC_Placeable::OnOwnComponentAdded(IComponent* component, AttributeChange::Type change)
+{
+    if (component->TypeName() == EC_Mesh::TypeNameStatic())
+        connect(component, SIGNAL(MeshChanged()), this, SLOT(UpdateSpatialBounds()), Qt::UniqueConnection);
+}
+
+float3x4 EC_Placeable::ComputeWorldTransform() const
+{
+    if (hierarchyNode_ != -1)
+        return LocalToWorld();
+    if (!worldTransformDirty_)
+        return worldTransform_;
+
+    if (parentBone_)
+        worldTransform_ = LocalToWorld();
+    else if (parentPlaceable_)
+        worldTransform_ = parentPlaceable_->ComputeWorldTransform() * LocalToParent();
+    else
+        worldTransform_ = LocalToParent();
+
+    // Bones animate without notifying the attached placeables, so transforms below a bone attachment are never kept cached.
+    worldTransformDirty_ = (parentBone_ != 0 || (parentPlaceable_ && parentPlaceable_->worldTransformDirty_));
+    return worldTransform_;
+}
+
+void EC_Placeable::UpdateSpatialBounds()
+{
+    Entity* entity = ParentEntity();
+    Scene* scene = entity ? entity->ParentScene() : 0;
+    if (!scene)
+        return;
+
+    float3x4 worldTransform = ComputeWorldTransform();
+    AABB bounds(worldTransform.TranslatePart(), worldTransform.TranslatePart());
+    EC_Mesh* mesh = entity->GetComponent<EC_Mesh>().get();
+    if (mesh && mesh->HasBounds())
+    {
+        OBB meshBounds = mesh->LocalOBB();
+        meshBounds.Transform(worldTransform * mesh->LocalToParent());
+        bounds = AABB(meshBounds);
     }
+
+    if (indexedId_ && indexedId_ != entity->Id())
+        RemoveSpatialBounds();
+    scene->GetSpatialIndex().Update(entity->Id(), bounds);
+    indexedScene_ = scene->shared_from_this();
+    indexedId_ = entity->Id();
+
+    // The world transforms of the attached placeables changed as well
+    for(size_t i = 0; i < childPlaceables_.size(); ++i)
+        childPlaceables_[i]->UpdateSpatialBounds();
+}
+
+void EC_Placeable::RemoveSpatialBounds()
+{
+    ScenePtr scene = indexedScene_.lock();
+    if (scene && indexedId_)
+        scene->GetSpatialIndex().Remove(indexedId_);
+    indexedScene_.reset();
+    indexedId_ = 0;
 }
 
 void EC_Placeable::HandleAttributeChanged(IAttribute* attribute, AttributeChange::Type change)
 {
     // If parent ref or parent bone changed, reattach node to scene hierarchy
     if ((attribute == &parentRef) || (attribute == &parentBone))
+    {
         AttachNode();
+        UpdateSpatialBounds();
+    }
     
     if (attribute == &transform)
     {
+        if (hierarchyNode_ != -1)
+        {
+            TransformHierarchy *hierarchy = Hierarchy();
+            if (hierarchy)
+                hierarchy->SetLocalTransform(hierarchyNode_, transform.Get().ToFloat3x4());
+            UpdateSpatialBounds();
+            return;
+        }
+
+        InvalidateWorldTransform();
+
         const Transform& trans = transform.Get();
         if (trans.pos.IsFinite())
             sceneNode_->setPosition(trans.pos);
@@ -607,6 +834,8 @@ void EC_Placeable::HandleAttributeChanged(IAttribute* attribute, AttributeChange
             scale.z = 0.0000001f;
 
         sceneNode_->setScale(scale);
+
+        UpdateSpatialBounds();
     }
     else if (attribute == &drawDebug)
     {
@@ -626,6 +855,7 @@ void EC_Placeable::OnParentMeshDestroyed()
 void EC_Placeable::OnParentPlaceableDestroyed()
 {
     DetachNode();
+    UpdateSpatialBounds();
 }
 
 void EC_Placeable::CheckParentEntityCreated(Entity* entity, AttributeChange::Type change)
@@ -634,7 +864,10 @@ void EC_Placeable::CheckParentEntityCreated(Entity* entity, AttributeChange::Typ
     {
         // Check if the entity is the one we should use as parent
         if (entity == parentRef.Get().Lookup(entity->ParentScene()).get())
+        {
             AttachNode();
+            UpdateSpatialBounds();
+        }
     }
 }
 
@@ -647,7 +880,10 @@ void EC_Placeable::OnParentMeshChanged()
 void EC_Placeable::OnComponentAdded(IComponent* component, AttributeChange::Type change)
 {
     if (!attached_)
+    {
         AttachNode();
+        UpdateSpatialBounds();
+    }
 }
 
 void EC_Placeable::SetPosition(float x, float y, float z)
@@ -744,8 +980,8 @@ void EC_Placeable::SetWorldTransform(const float3x4 &tm)
 
     float3x4 parentWorldTransform = float3x4::identity;
 
-    if (parentBone_)
-        parentWorldTransform = float4x4(parentBone_->_getFullTransform()).Float3x4Part();
+    if (parentBone_ && boneAttachmentNode_)
+        parentWorldTransform = float4x4(boneAttachmentNode_->_getFullTransform()).Float3x4Part(); // The attachment node follows the bone in world space.
     else
         parentWorldTransform = parentPlaceable_->LocalToWorld();
 
@@ -820,8 +1056,10 @@ float3x4 EC_Placeable::LocalToWorld() const
 {
     if (sceneNode_)
         return ((float4x4)sceneNode_->_getFullTransform()).Float3x4Part();
-    else
-        return float3x4::identity;
+    TransformHierarchy *hierarchy = Hierarchy();
+    if (hierarchy)
+        return hierarchy->WorldTransform(hierarchyNode_);
+    return float3x4::identity;
 }
 
 float3x4 EC_Placeable::WorldToLocal() const
@@ -12,6 +12,7 @@
 #include "Math/MathFwd.h"
 
 namespace Ogre { class Bone; }
+class TransformHierarchy;
 
 /// Ogre placeable (scene node) component
 /**
@@ -96,7 +97,8 @@ public:
     DEFINE_QPROPERTY_ATTRIBUTE(QString, parentBone);
 
     /// Returns the Ogre scene node for attaching geometry.
-    /** Do not manipulate the pos/orientation/scale of this node directly, but instead use the Transform property. */
+    /** Do not manipulate the pos/orientation/scale of this node directly, but instead use the Transform property.
+        Returns null if the scene has no view, in which case the transforms are kept in the TransformHierarchy of the scene. */
     Ogre::SceneNode* GetSceneNode() const { return sceneNode_; }
 
 public slots:
@@ -225,7 +227,8 @@ public slots:
     /// @note This function sets the parentRef and parentBone attributes of this component to achieve the parenting.
     void SetParent(Entity *parent, QString boneName, bool preserveWorldTransform);
 
-    /// Returns all entities that are attached to this placeable.
+    /// Returns all entities that are attached to this placeable, either to its scene node or to a bone of its mesh.
+    /** The children are kept in a list that is updated as they are attached and detached, so this does not search the scene. */
     EntityList Children();
 
     /// Prints the scene node hierarchy this scene node is part of.
@@ -258,12 +261,39 @@ private slots:
     /// Handle a component being added to the parent entity, in case it is the missing component we need
     void OnComponentAdded(IComponent* component, AttributeChange::Type change);
 
+    /// Handle a component being added to our own entity, to track the bounds of a mesh
+    void OnOwnComponentAdded(IComponent* component, AttributeChange::Type change);
+
+    /// Recomputes the world space bounds of this entity and its child placeables into the scene spatial index.
+    void UpdateSpatialBounds();
+
+    /// Removes this entity from the scene spatial index.
+    void RemoveSpatialBounds();
+
 private:
     /// attaches scenenode to parent
     void AttachNode();
     
     /// detaches scenenode from parent
     void DetachNode();
+
+    /// Attaches the transform hierarchy node to the node of the parent placeable. Used instead of AttachNode() when the scene has no view.
+    /** Bone attachments are not tracked, as skeletons are not animated without a view, and the node is attached to the parent placeable instead. */
+    void AttachHierarchyNode();
+
+    /// Returns the transform hierarchy the node of this placeable is stored in, or null if the placeable uses an Ogre scene node.
+    TransformHierarchy *Hierarchy() const;
+
+    /// Removes this placeable from the children of the parent placeable, and clears the parent.
+    void RemoveFromParentPlaceable();
+
+    /// Marks the cached world transform of this placeable and its children out of date.
+    void InvalidateWorldTransform();
+
+    /// Computes the local->world transform from the transform attributes of this placeable and its parents.
+    /** Unlike LocalToWorld(), does not depend on the Ogre scene graph having been updated. The result is cached until the
+        transform or the parent of this placeable or one of its ancestors changes. */
+    float3x4 ComputeWorldTransform() const;
     
     /// Ogre world ptr
     OgreWorldWeakPtr world_;
@@ -279,6 +309,27 @@ private:
     
     /// Parent placeable, if any
     EC_Placeable* parentPlaceable_;
+
+    /// Placeables that are attached to this placeable's scene node or to a bone of this entity's mesh
+    std::vector<EC_Placeable*> childPlaceables_;
+
+    /// Cached result of ComputeWorldTransform() when the placeable uses an Ogre scene node
+    mutable float3x4 worldTransform_;
+
+    /// True if worldTransform_ has to be recomputed
+    mutable bool worldTransformDirty_;
+
+    /// Scene whose spatial index contains the bounds of this entity
+    SceneWeakPtr indexedScene_;
+
+    /// Entity id the bounds are stored with in the spatial index, 0 if not indexed
+    entity_id_t indexedId_;
+
+    /// Scene whose transform hierarchy contains the node of this placeable
+    SceneWeakPtr hierarchyScene_;
+
+    /// Node index in the transform hierarchy of the scene, -1 if this placeable uses an Ogre scene node
+    int hierarchyNode_;
     
     /// Parent mesh in bone attachment mode
     EC_Mesh* parentMesh_;
@@ -1,6 +1,7 @@
 // For conditions of distribution and use, see copyright notice in license.txt
 
 #include "StableHeaders.h"
+#define OGRE_INTEROP
 #include "DebugOperatorNew.h"
 #include "OgreMeshAsset.h"
 #include "OgreConversionUtils.h"
@@ -8,14 +9,578 @@
 #include "AssetAPI.h"
 #include "AssetCache.h"
 #include "Profiler.h"
+#include "Framework.h"
+#include "ConfigAPI.h"
+#include "JobAPI.h"
 
 #include <QFile>
 #include <QFileInfo>
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <functional>
+#include <cstdio>
+#include <boost/bind.hpp>
 #include <Ogre.h>
 
 #include "LoggingFunctions.h"
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+    /// Chunk identifiers of the Ogre binary mesh format, see OgreMeshFileFormat.h.
+    const u16 cMeshHeaderChunk = 0x1000;
+    const u16 cMeshChunk = 0x3000;
+    const u16 cMeshBoundsChunk = 0x9000;
+    /// Size of a chunk header: the u16 identifier and the u32 length of the chunk, which includes the header.
+    const size_t cChunkHeaderSize = 6;
+
+    /// Meshes with fewer triangles are not worth generating LOD levels for.
+    const size_t cLodMinTriangles = 500;
+
+    /// The distance at which the first generated LOD level is used. Each further level is used at twice the distance of the previous one.
+    const float cLodBaseDistance = 50.f;
+
+    /// The number of generated LOD levels. Each level removes half of the remaining vertices.
+    const int cNumLodLevels = 3;
+
+    /// Identifies a LOD cache file, which stores the index lists of the generated LOD levels.
+    const char cLodCacheMagic[4] = { 'T', 'L', 'O', 'D' };
+    const u32 cLodCacheVersion = 2;
+
+    /// The weight of the planes that keep the border edges of a mesh in place, relative to the planes of the triangles.
+    const double cLodBorderWeight = 100.0;
+
+    /// Reads the bounding box stored in the header chunks of a serialized Ogre mesh, without loading the mesh itself.
+    /** @return False if the data is not in the expected format, e.g. if it has a different endianness. */
+    bool ReadMeshBounds(const u8 *data, size_t numBytes, AABB &bounds)
+    {
+        // The file starts with the header chunk identifier and a newline-terminated version string, without a chunk length.
+        if (numBytes < sizeof(u16) || *(const u16*)data != cMeshHeaderChunk)
+            return false;
+        size_t offset = sizeof(u16);
+        while(offset < numBytes && data[offset] != '\n')
+            ++offset;
+        ++offset;
+
+        if (offset + cChunkHeaderSize + 1 > numBytes || *(const u16*)(data + offset) != cMeshChunk)
+            return false;
+        const size_t meshEnd = std::min(numBytes, offset + *(const u32*)(data + offset + sizeof(u16)));
+        offset += cChunkHeaderSize + 1; // The mesh chunk starts with a bool telling whether the mesh is skeletally animated.
+
+        // The bounds are stored in a subchunk of the mesh chunk, after the geometry and the submeshes.
+        while(offset + cChunkHeaderSize <= meshEnd)
+        {
+            const u16 id = *(const u16*)(data + offset);
+            const u32 length = *(const u32*)(data + offset + sizeof(u16));
+            if (length < cChunkHeaderSize)
+                return false;
+            if (id == cMeshBoundsChunk)
+            {
+                if (offset + cChunkHeaderSize + 6 * sizeof(float) > meshEnd)
+                    return false;
+                const float *values = (const float*)(data + offset + cChunkHeaderSize);
+                bounds = AABB(float3(values[0], values[1], values[2]), float3(values[3], values[4], values[5]));
+                return bounds.IsFinite();
+            }
+            offset += length;
+        }
+        return false;
+    }
+}
+
+/// The data of a LOD generation job of an OgreMeshAsset. The main thread fills in copies of the mesh geometry,
+/// and the worker the index lists of the LOD levels.
+struct MeshLodJob
+{
+    /// A triangle list submesh of the mesh.
+    struct SubMesh
+    {
+        SubMesh() : vertexSet(-1) {}
+        int vertexSet; ///< Index to vertexSets, or -1 if the submesh is not simplified.
+        std::vector<u32> indices;
+    };
+
+    unsigned int generation; ///< OgreMeshAsset::lodGeneration_ when the job was started.
+    std::string cacheFile;
+    /// The vertex positions of each vertex data of the mesh used by the simplified submeshes.
+    std::vector<std::vector<float3> > vertexSets;
+    std::vector<SubMesh> subMeshes;
+    /// The index lists of the LOD levels, levels[level][subMesh]. Empty for the submeshes that are not simplified.
+    std::vector<std::vector<std::vector<u32> > > levels;
+    /// Set by the worker, which cannot log, if the cache file could not be written.
+    std::string error;
+};
+
+namespace
+{
+    /// Copies the vertex positions of the vertex data.
+    bool ReadPositions(const Ogre::VertexData *vertexData, std::vector<float3> &positions)
+    {
+        const Ogre::VertexElement *posElem = vertexData->vertexDeclaration->findElementBySemantic(Ogre::VES_POSITION);
+        if (!posElem || posElem->getType() != Ogre::VET_FLOAT3)
+            return false;
+        Ogre::HardwareVertexBufferSharedPtr vbuf = vertexData->vertexBufferBinding->getBuffer(posElem->getSource());
+        const size_t vertexSize = vbuf->getVertexSize();
+        unsigned char *vertices = static_cast<unsigned char*>(vbuf->lock(Ogre::HardwareBuffer::HBL_READ_ONLY)) + vertexData->vertexStart * vertexSize;
+        positions.resize(vertexData->vertexCount);
+        for(size_t i = 0; i < vertexData->vertexCount; ++i)
+        {
+            float *pReal = 0;
+            posElem->baseVertexPointerToElement(vertices + i * vertexSize, &pReal);
+            positions[i] = float3(pReal[0], pReal[1], pReal[2]);
+        }
+        vbuf->unlock();
+        return true;
+    }
+
+    /// Copies the indices of the index data.
+    void ReadIndices(const Ogre::IndexData *indexData, std::vector<u32> &indices)
+    {
+        Ogre::HardwareIndexBufferSharedPtr ibuf = indexData->indexBuffer;
+        void *data = ibuf->lock(indexData->indexStart * ibuf->getIndexSize(), indexData->indexCount * ibuf->getIndexSize(), Ogre::HardwareBuffer::HBL_READ_ONLY);
+        if (ibuf->getType() == Ogre::HardwareIndexBuffer::IT_32BIT)
+            indices.assign((const u32*)data, (const u32*)data + indexData->indexCount);
+        else
+            indices.assign((const u16*)data, (const u16*)data + indexData->indexCount);
+        ibuf->unlock();
+    }
+
+    /// A symmetric 4x4 error quadric, which sums the squared distances of a point to a set of weighted planes. Stores the upper triangle of the matrix.
+    struct Quadric
+    {
+        Quadric() { for(int i = 0; i < 10; ++i) q[i] = 0.0; }
+
+        /// Adds the plane dot(normal, p) + d = 0, with a unit normal.
+        void AddPlane(const float3 &normal, float d, double weight)
+        {
+            const double a = normal.x, b = normal.y, c = normal.z, e = d;
+            q[0] += weight * a * a; q[1] += weight * a * b; q[2] += weight * a * c; q[3] += weight * a * e;
+            q[4] += weight * b * b; q[5] += weight * b * c; q[6] += weight * b * e;
+            q[7] += weight * c * c; q[8] += weight * c * e;
+            q[9] += weight * e * e;
+        }
+
+        void Add(const Quadric &rhs)
+        {
+            for(int i = 0; i < 10; ++i)
+                q[i] += rhs.q[i];
+        }
+
+        /// Returns the weighted sum of the squared distances of the point to the planes.
+        double Error(const float3 &p) const
+        {
+            const double x = p.x, y = p.y, z = p.z;
+            return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+                + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+                + q[7] * z * z + 2.0 * q[8] * z
+                + q[9];
+        }
+
+        double q[10];
+    };
+
+    /// A candidate collapse of a vertex onto a neighbouring vertex. Stale once either vertex has changed after the cost was computed.
+    struct EdgeCollapse
+    {
+        double cost;
+        u32 from;
+        u32 to;
+        u32 fromVersion;
+        u32 toVersion;
+
+        bool operator >(const EdgeCollapse &rhs) const { return cost > rhs.cost; }
+    };
+
+    /// Simplifies the triangles of a vertex set by quadric error edge collapse (Garland & Heckbert), always collapsing the edge
+    /// that adds the least error. An edge is collapsed by moving one of its vertices onto the other, so the simplified triangles
+    /// only refer to the existing vertices and the LOD levels can share the vertex data of the mesh.
+    /** Vertices at the same position, e.g. at texture seams, are welded and collapse together. */
+    class EdgeCollapser
+    {
+    public:
+        EdgeCollapser(const std::vector<float3> &positions, const std::vector<const std::vector<u32>*> &indexLists) :
+            positions_(positions),
+            weld_(positions.size()),
+            collapsedTo_(positions.size()),
+            version_(positions.size(), 0),
+            quadrics_(positions.size()),
+            vertexTriangles_(positions.size()),
+            numVertices_(0)
+        {
+            // Weld the vertices at the same position to the first of them.
+            std::vector<u32> order(positions.size());
+            for(size_t i = 0; i < order.size(); ++i)
+                order[i] = (u32)i;
+            const PositionLess less(positions);
+            std::sort(order.begin(), order.end(), less);
+            for(size_t i = 0; i < order.size(); ++i)
+                weld_[order[i]] = (i > 0 && !less(order[i-1], order[i])) ? weld_[order[i-1]] : order[i];
+            for(size_t i = 0; i < collapsedTo_.size(); ++i)
+                collapsedTo_[i] = (u32)i;
+
+            std::vector<std::pair<std::pair<u32, u32>, u32> > edges;
+            for(size_t list = 0; list < indexLists.size(); ++list)
+            {
+                const std::vector<u32> &indices = *indexLists[list];
+                for(size_t i = 0; i + 2 < indices.size(); i += 3)
+                {
+                    if (indices[i] >= positions.size() || indices[i+1] >= positions.size() || indices[i+2] >= positions.size())
+                        continue;
+                    const u32 v[3] = { weld_[indices[i]], weld_[indices[i+1]], weld_[indices[i+2]] };
+                    if (v[0] == v[1] || v[1] == v[2] || v[0] == v[2])
+                        continue;
+
+                    const u32 triangle = (u32)triangles_.size() / 3;
+                    triangles_.insert(triangles_.end(), v, v + 3);
+                    triangleAlive_.push_back(true);
+                    for(int j = 0; j < 3; ++j)
+                    {
+                        vertexTriangles_[v[j]].push_back(triangle);
+                        edges.push_back(std::make_pair(std::make_pair(std::min(v[j], v[(j+1)%3]), std::max(v[j], v[(j+1)%3])), triangle));
+                    }
+
+                    // The planes are weighted by the triangle area, so that small triangles are removed first.
+                    float3 normal = Cross(positions[v[1]] - positions[v[0]], positions[v[2]] - positions[v[0]]);
+                    const float length = normal.Length();
+                    if (length <= 0.f)
+                        continue;
+                    normal /= length;
+                    for(int j = 0; j < 3; ++j)
+                        quadrics_[v[j]].AddPlane(normal, -Dot(normal, positions[v[0]]), 0.5 * length);
+                }
+            }
+
+            for(size_t i = 0; i < vertexTriangles_.size(); ++i)
+                if (!vertexTriangles_[i].empty())
+                    ++numVertices_;
+
+            // Edges used by only one triangle are on the border of the mesh. The border is kept in place by planes that are
+            // perpendicular to the triangle through the edge.
+            std::sort(edges.begin(), edges.end());
+            for(size_t i = 0; i < edges.size();)
+            {
+                size_t end = i + 1;
+                while(end < edges.size() && edges[end].first == edges[i].first)
+                    ++end;
+                const u32 a = edges[i].first.first;
+                const u32 b = edges[i].first.second;
+                if (end - i == 1)
+                {
+                    const float3 edge = positions[b] - positions[a];
+                    float3 border = Cross(edge, TriangleNormal(edges[i].second));
+                    const float length = border.Length();
+                    if (length > 0.f)
+                    {
+                        border /= length;
+                        const double weight = cLodBorderWeight * edge.LengthSq();
+                        quadrics_[a].AddPlane(border, -Dot(border, positions[a]), weight);
+                        quadrics_[b].AddPlane(border, -Dot(border, positions[a]), weight);
+                    }
+                }
+                PushCollapse(a, b);
+                PushCollapse(b, a);
+                i = end;
+            }
+        }
+
+        /// Returns the number of vertices left in the simplified triangles, counting the welded vertices once.
+        size_t NumVertices() const { return numVertices_; }
+
+        /// Collapses edges until at most the given number of vertices are left, or no edge can be collapsed without flipping triangles.
+        void CollapseTo(size_t numVertices)
+        {
+            while(numVertices_ > numVertices && !queue_.empty())
+            {
+                const EdgeCollapse collapse = queue_.top();
+                queue_.pop();
+                if (collapsedTo_[collapse.from] != collapse.from || collapsedTo_[collapse.to] != collapse.to ||
+                    version_[collapse.from] != collapse.fromVersion || version_[collapse.to] != collapse.toVersion)
+                    continue;
+                if (!FlipsTriangles(collapse.from, collapse.to))
+                    Collapse(collapse.from, collapse.to);
+            }
+        }
+
+        /// Returns the triangles of the index list with their vertices moved to where they have collapsed, leaving out the triangles
+        /// that have collapsed.
+        void RemapTriangles(const std::vector<u32> &indices, std::vector<u32> &result)
+        {
+            result.clear();
+            for(size_t i = 0; i + 2 < indices.size(); i += 3)
+            {
+                if (indices[i] >= positions_.size() || indices[i+1] >= positions_.size() || indices[i+2] >= positions_.size())
+                    continue;
+                u32 v[3];
+                for(int j = 0; j < 3; ++j)
+                    v[j] = Find(weld_[indices[i+j]]);
+                if (v[0] == v[1] || v[1] == v[2] || v[0] == v[2])
+                    continue;
+                // Vertices that have not collapsed keep their own attributes, even if they are welded to another vertex.
+                for(int j = 0; j < 3; ++j)
+                    result.push_back(v[j] == weld_[indices[i+j]] ? indices[i+j] : v[j]);
+            }
+        }
+
+    private:
+        /// Orders vertex indices by the positions of the vertices.
+        struct PositionLess
+        {
+            explicit PositionLess(const std::vector<float3> &positions) : positions_(positions) {}
+            bool operator()(u32 a, u32 b) const
+            {
+                const float3 &p = positions_[a];
+                const float3 &q = positions_[b];
+                if (p.x != q.x) return p.x < q.x;
+                if (p.y != q.y) return p.y < q.y;
+                return p.z < q.z;
+            }
+            const std::vector<float3> &positions_;
+        };
+
+        /// Returns the vertex the given vertex has collapsed to, through any number of collapses.
+        u32 Find(u32 vertex)
+        {
+            u32 root = vertex;
+            while(collapsedTo_[root] != root)
+                root = collapsedTo_[root];
+            while(collapsedTo_[vertex] != root)
+            {
+                const u32 next = collapsedTo_[vertex];
+                collapsedTo_[vertex] = root;
+                vertex = next;
+            }
+            return root;
+        }
+
+        /// Returns the unnormalized normal of the triangle, with its vertex replaced by the given position.
+        float3 TriangleNormal(u32 triangle, u32 vertex = (u32)-1, const float3 &position = float3::zero) const
+        {
+            float3 p[3];
+            for(int j = 0; j < 3; ++j)
+                p[j] = (triangles_[triangle * 3 + j] == vertex) ? position : positions_[triangles_[triangle * 3 + j]];
+            return Cross(p[1] - p[0], p[2] - p[0]);
+        }
+
+        void PushCollapse(u32 from, u32 to)
+        {
+            Quadric quadric = quadrics_[from];
+            quadric.Add(quadrics_[to]);
+            EdgeCollapse collapse = { quadric.Error(positions_[to]), from, to, version_[from], version_[to] };
+            queue_.push(collapse);
+        }
+
+        /// Returns whether moving the vertex onto another one would turn any of the remaining triangles of the vertex around.
+        bool FlipsTriangles(u32 from, u32 to) const
+        {
+            const std::vector<u32> &triangles = vertexTriangles_[from];
+            for(size_t i = 0; i < triangles.size(); ++i)
+            {
+                const u32 t = triangles[i];
+                if (!triangleAlive_[t] || triangles_[t*3] == to || triangles_[t*3+1] == to || triangles_[t*3+2] == to)
+                    continue;
+                if (Dot(TriangleNormal(t), TriangleNormal(t, from, positions_[to])) <= 0.f)
+                    return true;
+            }
+            return false;
+        }
+
+        /// Moves the vertex onto another one, removes the triangles between them, and queues the new collapses of the remaining vertex.
+        void Collapse(u32 from, u32 to)
+        {
+            std::vector<u32> &toTriangles = vertexTriangles_[to];
+            std::vector<u32> &fromTriangles = vertexTriangles_[from];
+            for(size_t i = 0; i < fromTriangles.size(); ++i)
+            {
+                const u32 t = fromTriangles[i];
+                if (!triangleAlive_[t])
+                    continue;
+                if (triangles_[t*3] == to || triangles_[t*3+1] == to || triangles_[t*3+2] == to)
+                {
+                    triangleAlive_[t] = false;
+                    continue;
+                }
+                for(int j = 0; j < 3; ++j)
+                    if (triangles_[t*3+j] == from)
+                        triangles_[t*3+j] = to;
+                toTriangles.push_back(t);
+            }
+            std::vector<u32>().swap(fromTriangles);
+
+            quadrics_[to].Add(quadrics_[from]);
+            collapsedTo_[from] = to;
+            ++version_[to];
+            --numVertices_;
+
+            // Drop the removed triangles, and queue the collapses of the edges of the remaining vertex with their new costs.
+            std::vector<u32> neighbours;
+            size_t numAlive = 0;
+            for(size_t i = 0; i < toTriangles.size(); ++i)
+            {
+                const u32 t = toTriangles[i];
+                if (!triangleAlive_[t])
+                    continue;
+                toTriangles[numAlive++] = t;
+                for(int j = 0; j < 3; ++j)
+                    if (triangles_[t*3+j] != to)
+                        neighbours.push_back(triangles_[t*3+j]);
+            }
+            toTriangles.resize(numAlive);
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+            for(size_t i = 0; i < neighbours.size(); ++i)
+            {
+                PushCollapse(to, neighbours[i]);
+                PushCollapse(neighbours[i], to);
+            }
+        }
+
+        const std::vector<float3> &positions_;
+        std::vector<u32> weld_; ///< The vertex each vertex is welded to.
+        std::vector<u32> collapsedTo_; ///< The vertex each welded vertex has collapsed to, or the vertex itself if it remains.
+        std::vector<u32> version_; ///< Incremented each time a vertex is collapsed onto, which changes the cost of its edges.
+        std::vector<Quadric> quadrics_;
+        std::vector<std::vector<u32> > vertexTriangles_; ///< The remaining triangles of each welded vertex.
+        std::vector<u32> triangles_; ///< The vertices of the triangles, three per triangle.
+        std::vector<bool> triangleAlive_;
+        std::priority_queue<EdgeCollapse, std::vector<EdgeCollapse>, std::greater<EdgeCollapse> > queue_;
+        size_t numVertices_;
+    };
+
+    /// Computes the index lists of the LOD levels by collapsing edges until half of the vertices of the previous level are left.
+    void SimplifyMesh(MeshLodJob &job)
+    {
+        job.levels.assign(cNumLodLevels, std::vector<std::vector<u32> >(job.subMeshes.size()));
+        for(size_t set = 0; set < job.vertexSets.size(); ++set)
+        {
+            // The submeshes that share the vertex set are simplified together, so that they stay connected.
+            std::vector<const std::vector<u32>*> indexLists;
+            for(size_t i = 0; i < job.subMeshes.size(); ++i)
+                if (job.subMeshes[i].vertexSet == (int)set)
+                    indexLists.push_back(&job.subMeshes[i].indices);
+            if (job.vertexSets[set].empty() || indexLists.empty())
+                continue;
+
+            EdgeCollapser collapser(job.vertexSets[set], indexLists);
+            const size_t numVertices = collapser.NumVertices();
+            for(int level = 0; level < cNumLodLevels; ++level)
+            {
+                collapser.CollapseTo(numVertices >> (level + 1));
+                for(size_t i = 0; i < job.subMeshes.size(); ++i)
+                {
+                    if (job.subMeshes[i].vertexSet != (int)set)
+                        continue;
+                    std::vector<u32> &indices = job.levels[level][i];
+                    collapser.RemapTriangles(job.subMeshes[i].indices, indices);
+                    // A level cannot be empty, so a submesh that collapses completely keeps the triangles of the previous level.
+                    if (indices.empty())
+                        indices = (level > 0) ? job.levels[level-1][i] : job.subMeshes[i].indices;
+                }
+            }
+        }
+    }
+
+    /// Reads the index lists of the LOD levels from the cache file of the job. Returns false if the file does not exist
+    /// or does not match the mesh.
+    bool ReadLodCache(MeshLodJob &job)
+    {
+        // LoadFileToVector() is not used, as it logs when the file does not exist.
+        FILE *handle = fopen(job.cacheFile.c_str(), "rb");
+        if (!handle)
+            return false;
+        std::vector<u8> data;
+        fseek(handle, 0, SEEK_END);
+        data.resize(std::max(0L, ftell(handle)));
+        fseek(handle, 0, SEEK_SET);
+        const bool readOk = data.empty() || fread(&data[0], 1, data.size(), handle) == data.size();
+        fclose(handle);
+        if (!readOk || data.size() < sizeof(cLodCacheMagic) + 3 * sizeof(u32) ||
+            memcmp(&data[0], cLodCacheMagic, sizeof(cLodCacheMagic)) != 0)
+            return false;
+
+        const u32 *values = (const u32*)&data[sizeof(cLodCacheMagic)];
+        const size_t numValues = (data.size() - sizeof(cLodCacheMagic)) / sizeof(u32);
+        if (values[0] != cLodCacheVersion || values[1] != (u32)cNumLodLevels || values[2] != (u32)job.subMeshes.size())
+            return false;
+
+        size_t offset = 3;
+        job.levels.assign(cNumLodLevels, std::vector<std::vector<u32> >(job.subMeshes.size()));
+        for(int level = 0; level < cNumLodLevels; ++level)
+            for(size_t i = 0; i < job.subMeshes.size(); ++i)
+            {
+                if (offset >= numValues || values[offset] > numValues - offset - 1)
+                    return false;
+                const u32 count = values[offset++];
+                std::vector<u32> &indices = job.levels[level][i];
+                indices.assign(values + offset, values + offset + count);
+                offset += count;
+
+                const MeshLodJob::SubMesh &subMesh = job.subMeshes[i];
+                if ((subMesh.vertexSet < 0) != indices.empty())
+                    return false;
+                const size_t numVertices = (subMesh.vertexSet < 0) ? 0 : job.vertexSets[subMesh.vertexSet].size();
+                for(size_t j = 0; j < indices.size(); ++j)
+                    if (indices[j] >= numVertices)
+                        return false;
+            }
+        return true;
+    }
+
+    /// Writes the index lists of the LOD levels of the job to its cache file.
+    bool WriteLodCache(const MeshLodJob &job)
+    {
+        FILE *handle = fopen(job.cacheFile.c_str(), "wb");
+        if (!handle)
+            return false;
+        const u32 header[3] = { cLodCacheVersion, (u32)cNumLodLevels, (u32)job.subMeshes.size() };
+        fwrite(cLodCacheMagic, sizeof(cLodCacheMagic), 1, handle);
+        fwrite(header, sizeof(header), 1, handle);
+        for(size_t level = 0; level < job.levels.size(); ++level)
+            for(size_t i = 0; i < job.levels[level].size(); ++i)
+            {
+                const std::vector<u32> &indices = job.levels[level][i];
+                const u32 count = (u32)indices.size();
+                fwrite(&count, sizeof(count), 1, handle);
+                if (count > 0)
+                    fwrite(&indices[0], sizeof(u32), count, handle);
+            }
+        bool success = !ferror(handle);
+        fclose(handle);
+        return success;
+    }
+
+    /// Worker job that reads the LOD levels from the cache, or computes and caches them.
+    void ComputeLodLevels(MeshLodJobPtr job)
+    {
+        PROFILE(OgreMeshAsset_ComputeLodLevels);
+        if (ReadLodCache(*job))
+            return;
+        SimplifyMesh(*job);
+        if (!WriteLodCache(*job))
+            job->error = "Could not write the LOD cache file " + job->cacheFile;
+    }
+
+    /// Creates an index buffer of the given type with the given indices, for a LOD level of the mesh.
+    Ogre::IndexData *CreateLodIndexData(Ogre::Mesh *mesh, Ogre::HardwareIndexBuffer::IndexType type, const std::vector<u32> &indices)
+    {
+#include "DisableMemoryLeakCheck.h"
+        Ogre::IndexData *indexData = OGRE_NEW Ogre::IndexData();
+#include "EnableMemoryLeakCheck.h"
+        indexData->indexStart = 0;
+        indexData->indexCount = indices.size();
+        indexData->indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(type, indices.size(),
+            mesh->getIndexBufferUsage(), mesh->isIndexBufferShadowed());
+        if (type == Ogre::HardwareIndexBuffer::IT_32BIT)
+            indexData->indexBuffer->writeData(0, indices.size() * sizeof(u32), &indices[0], true);
+        else
+        {
+            std::vector<u16> shortIndices(indices.begin(), indices.end());
+            indexData->indexBuffer->writeData(0, shortIndices.size() * sizeof(u16), &shortIndices[0], true);
+        }
+        return indexData;
+    }
+}
+
 OgreMeshAsset::~OgreMeshAsset()
 {
     Unload();
@@ -31,10 +596,22 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, const
     /// Force an unload of this data first.
     Unload();
 
+    // Without a renderer, only the bounds are needed until something asks for the Ogre mesh itself.
+    if (assetAPI->IsHeadless() && ReadMeshBounds(data_, numBytes, bounds_))
+    {
+        hasBounds_ = true;
+        ogreMeshDeferred_ = true;
+        if (DiskSource().isEmpty())
+            deferredData_.assign(data_, data_ + numBytes);
+        assetAPI->AssetLoadCompleted(Name());
+        return true;
+    }
+
     // Asynchronous loading
     // 1. AssetAPI allows a asynch load. This is false when called from LoadFromFile(), LoadFromCache() etc.
     // 2. We have a rendering window for Ogre as Ogre::ResourceBackgroundQueue does not work otherwise. Its not properly initialized without a rendering window.
     // 3. The Ogre we are building against has thread support.
+    lodCacheFile_ = LodCacheFile(data_, numBytes);
     if (allowAsynchronous && !assetAPI->IsHeadless() && (OGRE_THREAD_SUPPORT != 0))
     {
         // We can only do threaded loading from disk, and not any disk location but only from asset cache.
@@ -44,14 +621,24 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, const
         if (!cacheDiskSource.isEmpty())
         {
             QFileInfo fileInfo(cacheDiskSource);
-            std::string sanitatedAssetRef = fileInfo.fileName().toStdString();
+            asyncResourceName_ = fileInfo.fileName().toStdString();
             loadTicket_ = Ogre::ResourceBackgroundQueue::getSingleton().load(Ogre::MeshManager::getSingleton().getResourceType(),
-                              sanitatedAssetRef, OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP, false, 0, 0, this);
+                              asyncResourceName_, OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP, false, 0, 0, this);
             return true;
         }
     }
 
     // Synchronous loading
+    if (!CreateOgreMesh(data_, numBytes))
+        return false;
+
+    // We did a synchronous load, must call AssetLoadCompleted here.
+    assetAPI->AssetLoadCompleted(Name());
+    return true;
+}
+
+bool OgreMeshAsset::CreateOgreMesh(const u8 *data_, size_t numBytes)
+{
     if (ogreMesh.isNull())
     {   
         ogreMesh = Ogre::MeshManager::getSingleton().createManual(
@@ -68,7 +655,7 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, const
     {
         std::vector<u8> tempData(data_, data_ + numBytes);
 #include "DisableMemoryLeakCheck.h"
-        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream((void*)&tempData[0], numBytes, false));
+        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream((void*)&tempData[0], tempData.size(), false));
 #include "EnableMemoryLeakCheck.h"
         Ogre::MeshSerializer serializer;
         serializer.importMesh(stream, ogreMesh.getPointer()); // Note: importMesh *adds* submeshes to an existing mesh. It doesn't replace old ones.
@@ -100,6 +687,8 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, const
         }
     }
     catch(...) {}
+
+    GenerateLodLevels();
         
     try
     {
@@ -118,11 +707,152 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, const
     //internal_name_ = SanitateAssetIdForOgre(id_);
     //LogDebug("Ogre mesh " + this->Name().toStdString() + " created");
 
-    // We did a synchronous load, must call AssetLoadCompleted here.
-    assetAPI->AssetLoadCompleted(Name());
+    UpdateBoundsFromOgreMesh();
     return true;
 }
 
+Ogre::MeshPtr OgreMeshAsset::GetOgreMesh()
+{
+    if (ogreMeshDeferred_)
+    {
+        PROFILE(OgreMeshAsset_GetOgreMesh);
+        ogreMeshDeferred_ = false;
+        std::vector<u8> data;
+        data.swap(deferredData_);
+        if (data.empty() && !LoadFileToVector(DiskSource().toStdString().c_str(), data))
+            LogError("OgreMeshAsset::GetOgreMesh: Failed to read mesh data for " + Name() + " from " + DiskSource());
+        else if (!data.empty())
+            CreateOgreMesh(&data[0], data.size());
+    }
+    return ogreMesh;
+}
+
+QString OgreMeshAsset::LodCacheFile(const u8 *data_, size_t numBytes) const
+{
+    if (assetAPI->IsHeadless() || !assetAPI->GetAssetCache() || numBytes == 0)
+        return QString();
+    if (!assetAPI->GetFramework()->Config()->Get(ConfigAPI::FILE_FRAMEWORK, ConfigAPI::SECTION_RENDERING, "mesh lod generation", true).toBool())
+        return QString();
+
+    // The hash of the original data invalidates the cached result when the asset changes.
+    uint hash = qHash(QByteArray::fromRawData((const char*)data_, (int)numBytes));
+    QString cacheName = Name() + "_lod_" + QString::number(numBytes) + "_" + QString::number(hash, 16);
+    return assetAPI->GetAssetCache()->GetCacheDirectory() + SanitateAssetRefForCache(cacheName);
+}
+
+void OgreMeshAsset::GenerateLodLevels()
+{
+    if (lodCacheFile_.isEmpty() || ogreMesh.isNull() || ogreMesh->getNumLodLevels() > 1)
+        return;
+
+    size_t numTriangles = 0;
+    for(unsigned short i = 0; i < ogreMesh->getNumSubMeshes(); ++i)
+    {
+        Ogre::SubMesh *subMesh = ogreMesh->getSubMesh(i);
+        if (subMesh->operationType == Ogre::RenderOperation::OT_TRIANGLE_LIST && subMesh->indexData)
+            numTriangles += subMesh->indexData->indexCount / 3;
+    }
+    if (numTriangles < cLodMinTriangles)
+        return;
+
+    PROFILE(OgreMeshAsset_GenerateLodLevels);
+
+    // The geometry is copied in the main thread, as the buffers of the mesh must not be accessed from the workers.
+    MeshLodJobPtr job(new MeshLodJob);
+    job->generation = lodGeneration_;
+    job->cacheFile = lodCacheFile_.toStdString();
+    try
+    {
+        std::map<Ogre::VertexData*, int> vertexSets;
+        for(unsigned short i = 0; i < ogreMesh->getNumSubMeshes(); ++i)
+        {
+            Ogre::SubMesh *subMesh = ogreMesh->getSubMesh(i);
+            job->subMeshes.push_back(MeshLodJob::SubMesh());
+            if (subMesh->operationType != Ogre::RenderOperation::OT_TRIANGLE_LIST || !subMesh->indexData || subMesh->indexData->indexCount == 0)
+                continue;
+
+            Ogre::VertexData *vertexData = subMesh->useSharedVertices ? ogreMesh->sharedVertexData : subMesh->vertexData;
+            std::map<Ogre::VertexData*, int>::const_iterator iter = vertexSets.find(vertexData);
+            if (iter == vertexSets.end())
+            {
+                job->vertexSets.push_back(std::vector<float3>());
+                if (!vertexData || !ReadPositions(vertexData, job->vertexSets.back()))
+                    return; // Meshes with unusual vertex formats are left at full detail.
+                iter = vertexSets.insert(std::make_pair(vertexData, (int)job->vertexSets.size() - 1)).first;
+            }
+            job->subMeshes.back().vertexSet = iter->second;
+            ReadIndices(subMesh->indexData, job->subMeshes.back().indices);
+        }
+    }
+    catch(Ogre::Exception &e)
+    {
+        // The mesh stays usable at full detail even if the simplification fails.
+        LogWarning("OgreMeshAsset::GenerateLodLevels: Failed to read the geometry of " + Name() + ": " + QString(e.what()));
+        return;
+    }
+
+    JobAPI *jobs = assetAPI->GetFramework()->Jobs();
+    JobPtr simplify = jobs->Submit(boost::bind(&ComputeLodLevels, job));
+    jobs->RunOnMainThread(boost::bind(&OgreMeshAsset::ApplyLodLevels, QPointer<OgreMeshAsset>(this), job), std::vector<JobPtr>(1, simplify));
+}
+
+void OgreMeshAsset::ApplyLodLevels(QPointer<OgreMeshAsset> asset, MeshLodJobPtr job)
+{
+    if (!asset || asset->lodGeneration_ != job->generation || asset->ogreMesh.isNull() || asset->ogreMesh->getNumLodLevels() > 1)
+        return;
+    if (!job->error.empty())
+        LogWarning("OgreMeshAsset::GenerateLodLevels: " + job->error);
+
+    PROFILE(OgreMeshAsset_ApplyLodLevels);
+
+    Ogre::Mesh *mesh = asset->ogreMesh.get();
+    try
+    {
+        const bool edgeListBuilt = mesh->isEdgeListBuilt();
+        mesh->freeEdgeList();
+        mesh->_setLodInfo((unsigned short)job->levels.size() + 1, false);
+        for(size_t level = 0; level < job->levels.size(); ++level)
+        {
+            const float distance = cLodBaseDistance * (float)(1 << level);
+            Ogre::MeshLodUsage usage;
+#if OGRE_VERSION_MAJOR >= 1 && OGRE_VERSION_MINOR >= 7
+            usage.userValue = distance;
+            usage.value = mesh->getLodStrategy()->transformUserValue(distance);
+#else
+            usage.fromDepthSquared = distance * distance;
+#endif
+            usage.edgeData = 0;
+            mesh->_setLodUsage((unsigned short)level + 1, usage);
+
+            for(unsigned short i = 0; i < mesh->getNumSubMeshes(); ++i)
+            {
+                // The submeshes that are not simplified use a copy of their full detail indices on every level.
+                Ogre::SubMesh *subMesh = mesh->getSubMesh(i);
+                const std::vector<u32> &indices = job->levels[level][i];
+                Ogre::IndexData *indexData = indices.empty() ? subMesh->indexData->clone(true) :
+                    CreateLodIndexData(mesh, subMesh->indexData->indexBuffer->getType(), indices);
+                mesh->_setSubMeshLodFaceList(i, (unsigned short)level + 1, indexData);
+            }
+        }
+        if (edgeListBuilt)
+            mesh->buildEdgeList();
+    }
+    catch(Ogre::Exception &e)
+    {
+        // The mesh stays usable at full detail even if the simplification fails.
+        LogWarning("OgreMeshAsset::GenerateLodLevels: Failed to add LOD levels to " + asset->Name() + ": " + QString(e.what()));
+        mesh->removeLodLevels();
+    }
+}
+
+void OgreMeshAsset::UpdateBoundsFromOgreMesh()
+{
+    if (hasBounds_ || ogreMesh.isNull())
+        return;
+    bounds_ = AABB(ogreMesh->getBounds());
+    hasBounds_ = true;
+}
+
 void OgreMeshAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, const Ogre::BackgroundProcessResult &result)
 {
     if (ticket != loadTicket_)
@@ -138,13 +868,14 @@ void OgreMeshAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, con
             for non-manual created meshes via thread loading.
         */
 
-        ogreMesh = Ogre::MeshManager::getSingleton().getByName(OgreRenderer::SanitateAssetIdForOgre(assetRef), 
-                                                               OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP);
+        ogreMesh = Ogre::MeshManager::getSingleton().getByName(asyncResourceName_, OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP);
         if (!ogreMesh.isNull())
         {        
             try
             {
+                GenerateLodLevels();
                 SetDefaultMaterial();
+                UpdateBoundsFromOgreMesh();
                 assetAPI->AssetLoadCompleted(assetRef);
                 return;
             }
@@ -165,6 +896,11 @@ void OgreMeshAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, con
 
 void OgreMeshAsset::DoUnload()
 {
+    lodCacheFile_.clear();
+    ++lodGeneration_;
+    hasBounds_ = false;
+    ogreMeshDeferred_ = false;
+    deferredData_.clear();
     if (ogreMesh.isNull())
         return;
 
@@ -196,11 +932,21 @@ void OgreMeshAsset::SetDefaultMaterial()
 
 bool OgreMeshAsset::IsLoaded() const
 {
-    return ogreMesh.get() != 0;
+    return ogreMesh.get() != 0 || ogreMeshDeferred_;
 }
 
 bool OgreMeshAsset::SerializeTo(std::vector<u8> &data, const QString &serializationParameters) const
 {
+    if (ogreMeshDeferred_)
+    {
+        // The Ogre mesh has not been created, so the original data is returned as is.
+        if (!deferredData_.empty())
+        {
+            data = deferredData_;
+            return true;
+        }
+        return LoadFileToVector(DiskSource().toStdString().c_str(), data);
+    }
     if (ogreMesh.isNull())
     {
         ::LogWarning("Tried to export non-existing Ogre mesh " + Name() + ".");
@@ -5,18 +5,35 @@
 #include <boost/shared_ptr.hpp>
 #include "IAsset.h"
 #include "OgreModuleApi.h"
+#include "Math/AABB.h"
 
 #include <OgreMesh.h>
 #include <OgreResourceBackgroundQueue.h>
 
+#include <QPointer>
+
+struct MeshLodJob;
+typedef boost::shared_ptr<MeshLodJob> MeshLodJobPtr;
+
 /// Represents an Ogre .mesh loaded to the GPU.
+/** In headless mode, only the bounds are read from the mesh data when the asset is loaded, and the Ogre mesh is created
+    the first time GetOgreMesh() is called, e.g. when the mesh is used as a physics collision mesh.
+
+    Meshes that are authored without LOD levels and have enough triangles get reduced LOD levels generated when loaded.
+    The geometry is simplified by quadric error edge collapse in a JobAPI worker, and the LOD levels are added to the mesh on a later
+    frame, so loading a mesh does not stall the main thread. The index lists of the levels are stored to the asset cache, keyed
+    by the hash of the original data, and read from there on subsequent runs. The generation can be disabled with the
+    "mesh lod generation" rendering config setting. */
 class OGRE_MODULE_API OgreMeshAsset : public IAsset, Ogre::ResourceBackgroundQueue::Listener
 {
     Q_OBJECT
 
 public:
     OgreMeshAsset(AssetAPI *owner, const QString &type_, const QString &name_)
-    :IAsset(owner, type_, name_)
+    :IAsset(owner, type_, name_),
+    hasBounds_(false),
+    ogreMeshDeferred_(false),
+    lodGeneration_(0)
     {
     }
 
@@ -41,12 +58,56 @@ public:
 
     bool IsLoaded() const;
 
-    /// This points to the loaded mesh asset, if it is present.
+    /// Returns the Ogre mesh, creating it first if its creation was deferred in headless mode. Returns a null pointer if the mesh could not be created.
+    Ogre::MeshPtr GetOgreMesh();
+
+    /// Returns true if the bounds of the mesh are known.
+    bool HasBounds() const { return hasBounds_; }
+
+    /// Returns the local space bounding box of the mesh. Only valid if HasBounds() returns true.
+    const AABB &Bounds() const { return bounds_; }
+
+    /// This points to the loaded mesh asset, if it is present. In headless mode, use GetOgreMesh() instead.
     Ogre::MeshPtr ogreMesh;
 
     /// Ticket for ogres threaded loading operation.
     Ogre::BackgroundProcessTicket loadTicket_;
 
+private:
+    /// Creates the Ogre mesh from the given serialized .mesh data.
+    bool CreateOgreMesh(const u8 *data_, size_t numBytes);
+
+    /// Reads the bounds of the mesh from the Ogre mesh, if they were not read from the mesh data.
+    void UpdateBoundsFromOgreMesh();
+
+    /// Returns the asset cache file for the LOD-generated version of the given mesh data, or an empty string if LOD generation is disabled.
+    QString LodCacheFile(const u8 *data_, size_t numBytes) const;
+
+    /// Starts generating reduced LOD levels to the loaded Ogre mesh if it has none, or reading them from lodCacheFile_.
+    /** The geometry is copied and simplified in a worker job, and the levels are added to the mesh by ApplyLodLevels(). */
+    void GenerateLodLevels();
+
+    /// Adds the LOD levels computed by the job to the mesh, unless the asset has been deleted or reloaded meanwhile. Run in the main thread.
+    static void ApplyLodLevels(QPointer<OgreMeshAsset> asset, MeshLodJobPtr job);
+
+    /// The asset cache file for the LOD levels of the mesh, empty if LOD generation is disabled.
+    QString lodCacheFile_;
+
+    /// Incremented when the mesh is unloaded, so that the results of the LOD jobs of an earlier mesh are discarded.
+    unsigned int lodGeneration_;
+
+    /// The Ogre resource name the mesh is being loaded with in the threaded loading.
+    std::string asyncResourceName_;
+
+    AABB bounds_;
+    bool hasBounds_;
+
+    /// True if the Ogre mesh has not been created yet in headless mode.
+    bool ogreMeshDeferred_;
+
+    /// The mesh data kept for creating the Ogre mesh later, if the asset has no disk source to read it from.
+    std::vector<u8> deferredData_;
+
     /// Specifies the unique mesh name Ogre uses in its asset pool for this mesh.
     //QString ogreAssetName;
 
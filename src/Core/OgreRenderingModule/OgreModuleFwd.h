@@ -51,6 +51,9 @@ namespace OgreRenderer
 
 class OgreWorld;
 class OgreMaterialAsset;
+class TextureAsset;
+class TextureUploadQueue;
+class TextureStreamer;
 
 class EC_AnimationController;
 class EC_Camera;
@@ -15,6 +15,7 @@
 #include "ConfigAPI.h"
 #include "FrameAPI.h"
 #include "OgreShadowCameraSetupFocusedPSSM.h"
+#include "StaticMeshBatcher.h"
 
 #include <Ogre.h>
 
@@ -23,7 +24,8 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
     renderer_(renderer),
     scene_(scene),
     sceneManager_(0),
-    rayQuery_(0)
+    rayQuery_(0),
+    meshBatcher_(0)
 {
     assert(renderer_->IsInitialized());
     
@@ -39,6 +41,8 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
             sceneManager_->setFog(Ogre::FOG_LINEAR, Ogre::ColourValue::White, 0.001f, 2000.0f, 4000.0f);
         
         SetupShadows();
+
+        meshBatcher_ = new StaticMeshBatcher(this);
     }
     
     connect(framework_->Frame(), SIGNAL(Updated(float)), this, SLOT(OnUpdated(float)));
@@ -46,6 +50,9 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
 
 OgreWorld::~OgreWorld()
 {
+    delete meshBatcher_;
+    meshBatcher_ = 0;
+
     if (rayQuery_)
         sceneManager_->destroyQuery(rayQuery_);
     
@@ -519,6 +526,9 @@ void OgreWorld::EmitActiveCameraChanged(EC_Camera *camera)
 
 void OgreWorld::OnUpdated(float timeStep)
 {
+    if (meshBatcher_)
+        meshBatcher_->Update(timeStep);
+
     // Do nothing if visibility not being tracked for any entities
     if (visibilityTrackedEntities_.empty())
     {
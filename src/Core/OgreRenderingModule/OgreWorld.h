@@ -16,6 +16,7 @@
 #include <boost/enable_shared_from_this.hpp>
 
 class Framework;
+class StaticMeshBatcher;
 
 /// Contains the Ogre representation of a scene, ie. the Ogre Scene
 class OGRE_MODULE_API OgreWorld : public QObject, public boost::enable_shared_from_this<OgreWorld>
@@ -85,6 +86,9 @@ public slots:
     /// Return the parent scene
     ScenePtr GetScene() { return scene_.lock(); }
 
+    /// Return the batcher that renders identical static meshes together, or null in headless mode
+    StaticMeshBatcher* GetMeshBatcher() const { return meshBatcher_; }
+
     /// Called by the Renderer upon the change of active camera.
     void EmitActiveCameraChanged(EC_Camera *camera);
 
@@ -99,7 +103,7 @@ signals:
     void ActiveCameraChanged(EC_Camera *camera);
 
 private slots:
-    /// Handle frame update. Used for entity visibility tracking
+    /// Handle frame update. Used for entity visibility tracking and updating the static mesh batches
     void OnUpdated(float timeStep);
 
 private:
@@ -132,6 +136,9 @@ private:
     
     /// Ray query result
     RaycastResult result_;
+
+    /// Static mesh batcher, null in headless mode
+    StaticMeshBatcher* meshBatcher_;
     
     /// Soft shadow gaussian listeners
     std::list<OgreRenderer::GaussianListener *> gaussianListeners_;
@@ -14,6 +14,8 @@
 #include "UiGraphicsView.h"
 #include "OgreShadowCameraSetupFocusedPSSM.h"
 #include "CompositionHandler.h"
+#include "TextureUploadQueue.h"
+#include "TextureStreamer.h"
 #include "OgreDefaultHardwareBufferManager.h"
 #include "Scene.h"
 #include "CoreException.h"
@@ -109,7 +111,9 @@ namespace OgreRenderer
         resized_dirty_(0),
         view_distance_(500.0f),
         shadowquality_(Shadows_High),
-        texturequality_(Texture_Normal)        
+        texturequality_(Texture_Normal),
+        textureUploadQueue_(0),
+        textureStreamer_(0)
     {
         c_handler_ = new CompositionHandler;
         logListener = new OgreLogListener; 
@@ -135,6 +139,8 @@ namespace OgreRenderer
             defaultScene_ = 0;
         }
         
+        SAFE_DELETE(textureStreamer_);
+        SAFE_DELETE(textureUploadQueue_);
         root_.reset();
         SAFE_DELETE(c_handler_);
         SAFE_DELETE(logListener);
@@ -156,6 +162,14 @@ namespace OgreRenderer
         // Soft shadow
         if (!framework_->Config()->HasValue(configData, "soft shadow"))
             framework_->Config()->Set(configData, "soft shadow", false);
+        // Time spent uploading textures to the GPU per frame, in milliseconds
+        if (!framework_->Config()->HasValue(configData, "texture upload budget"))
+            framework_->Config()->Set(configData, "texture upload budget", 4.0);
+        // Texture streaming, and the GPU memory the streamed textures may use in megabytes
+        if (!framework_->Config()->HasValue(configData, "texture streaming"))
+            framework_->Config()->Set(configData, "texture streaming", false);
+        if (!framework_->Config()->HasValue(configData, "texture memory budget"))
+            framework_->Config()->Set(configData, "texture memory budget", 512);
         // Rendering plugin
 #ifdef _WINDOWS
         if (!framework_->Config()->HasValue(configData, "rendering plugin"))
@@ -230,6 +244,13 @@ namespace OgreRenderer
 
         texturequality_ = (TextureQuality)framework_->Config()->Get(configData, "texture quality").toInt();
 
+        if (!framework_->IsHeadless())
+        {
+            textureUploadQueue_ = new TextureUploadQueue(framework_->Jobs(), framework_->Config()->Get(configData, "texture upload budget").toFloat());
+            if (framework_->Config()->Get(configData, "texture streaming").toBool())
+                textureStreamer_ = new TextureStreamer(this, (size_t)framework_->Config()->Get(configData, "texture memory budget").toUInt() * 1024 * 1024);
+        }
+
         // Ask Ogre if rendering system is available
         rendersystem = root_->getRenderSystemByName(rendersystem_name);
 
@@ -562,21 +583,15 @@ namespace OgreRenderer
 #ifdef UNIX
         Ogre::WindowEventUtilities::messagePump();
 #endif
-        // If we are headless, only update the scenegraphs of all Ogre worlds
+        // If we are headless, there is nothing to do: the placeables compute their world transforms in the transform hierarchy
+        // of the scene instead of the Ogre scene graph, so the scene graphs need not be updated.
         if (framework_->IsHeadless())
-        {
-            for (std::map<Scene*, OgreWorldPtr>::const_iterator i = ogreWorlds_.begin(); i != ogreWorlds_.end(); ++i)
-            {
-                OgreWorld* world = i->second.get();
-                if (world)
-                {
-                    Ogre::SceneManager* mgr = world->GetSceneManager();
-                    if (mgr)
-                        mgr->_updateSceneGraph(0);
-                }
-            }
             return;
-        }
+
+        if (textureStreamer_)
+            textureStreamer_->Update(frameTime);
+        if (textureUploadQueue_)
+            textureUploadQueue_->Update();
         
         // If rendering into different size window, dirty the UI view for now & next frame
         if (last_width_ != GetWindowWidth() || last_height_ != GetWindowHeight())
@@ -184,6 +184,12 @@ namespace OgreRenderer
 
         RenderWindow *GetRenderWindow() const { return renderWindow; }
 
+        /// Returns the queue that decodes textures in worker threads and uploads them under a per-frame budget, or null in headless mode.
+        TextureUploadQueue *GetTextureUploadQueue() const { return textureUploadQueue_; }
+
+        /// Returns the texture streamer, or null if texture streaming is disabled.
+        TextureStreamer *GetTextureStreamer() const { return textureStreamer_; }
+
     private:
         friend class OgreRenderingModule;
 
@@ -265,6 +271,12 @@ namespace OgreRenderer
 
         /// Texture quality
         TextureQuality texturequality_;
+
+        /// Decodes and uploads the asynchronously loaded textures
+        TextureUploadQueue *textureUploadQueue_;
+
+        /// Manages the resident mipmaps of the streamed textures
+        TextureStreamer *textureStreamer_;
         
         /// Pixel buffer used with screen captures
         Ogre::uchar *capture_screen_pixel_data_;
@@ -0,0 +1,227 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "StaticMeshBatcher.h"
+#include "OgreWorld.h"
+#include "EC_Mesh.h"
+#include "EC_Placeable.h"
+#include "Profiler.h"
+#include "LoggingFunctions.h"
+
+#include <Ogre.h>
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+    /// How long a mesh must stay unchanged, in seconds, before it is batched. Keeps moving objects out of the batches.
+    const float cSettleTime = 2.f;
+
+    /// The minimum number of identical meshes worth rendering as a batch.
+    const size_t cMinInstances = 8;
+
+    /// The size of the regions a batch is split to for culling, in world units.
+    const float cRegionSize = 250.f;
+}
+
+StaticMeshBatcher::StaticMeshBatcher(OgreWorld *world) :
+    world_(world)
+{
+}
+
+StaticMeshBatcher::~StaticMeshBatcher()
+{
+    // The entities are destroyed along with the scene manager, so only the static geometries need to be released.
+    Ogre::SceneManager *sceneMgr = world_->GetSceneManager();
+    for(std::map<std::string, Batch>::iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        if (iter->second.geometry)
+            sceneMgr->destroyStaticGeometry(iter->second.geometry);
+}
+
+void StaticMeshBatcher::Touch(EC_Mesh *mesh)
+{
+    RemoveFromBatch(mesh);
+    pending_[mesh] = 0.f;
+}
+
+void StaticMeshBatcher::Remove(EC_Mesh *mesh)
+{
+    RemoveFromBatch(mesh);
+    pending_.erase(mesh);
+}
+
+void StaticMeshBatcher::Update(float timeStep)
+{
+    if (pending_.empty() && batchOf_.empty())
+        return;
+
+    PROFILE(StaticMeshBatcher_Update);
+
+    for(std::map<EC_Mesh*, float>::iterator iter = pending_.begin(); iter != pending_.end();)
+    {
+        iter->second += timeStep;
+        if (iter->second < cSettleTime)
+        {
+            ++iter;
+            continue;
+        }
+
+        EC_Mesh *mesh = iter->first;
+        std::string key = BatchKey(mesh);
+        if (!key.empty())
+        {
+            Batch &batch = batches_[key];
+            batch.meshes.push_back(mesh);
+            batch.dirty = true;
+            batchOf_[mesh] = key;
+        }
+        pending_.erase(iter++);
+    }
+
+    for(std::map<std::string, Batch>::iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        if (iter->second.dirty)
+            Rebuild(iter->first, iter->second);
+}
+
+size_t StaticMeshBatcher::NumBatches() const
+{
+    size_t numBatches = 0;
+    for(std::map<std::string, Batch>::const_iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        if (iter->second.geometry)
+            ++numBatches;
+    return numBatches;
+}
+
+size_t StaticMeshBatcher::NumBatchedMeshes() const
+{
+    size_t numMeshes = 0;
+    for(std::map<std::string, Batch>::const_iterator iter = batches_.begin(); iter != batches_.end(); ++iter)
+        if (iter->second.geometry)
+            numMeshes += iter->second.meshes.size();
+    return numMeshes;
+}
+
+std::string StaticMeshBatcher::BatchKey(EC_Mesh *mesh)
+{
+    Ogre::Entity *entity = mesh->GetEntity();
+    if (!entity || !entity->getParentSceneNode())
+        return std::string();
+
+    // Animated and attachment-carrying meshes are rendered as individual entities.
+    if (entity->hasSkeleton() || entity->getMesh()->hasVertexAnimation() || mesh->GetNumAttachments() > 0)
+        return std::string();
+
+    // Static geometry uses the LOD distances of the mesh as authored, without the per-entity LOD bias.
+    if (mesh->lodBias.Get() != 1.f || mesh->lodDistance.Get() > 0.f)
+        return std::string();
+
+    // Parented placeables would move along with their parents without notifying the batcher.
+    EC_Placeable *placeable = dynamic_cast<EC_Placeable*>(mesh->GetPlaceable().get());
+    if (!placeable || !placeable->visible.Get() || !placeable->parentRef.Get().IsEmpty())
+        return std::string();
+
+    std::string key = entity->getMesh()->getName();
+    for(uint i = 0; i < entity->getNumSubEntities(); ++i)
+        key += "|" + entity->getSubEntity(i)->getMaterialName();
+    key += "|" + Ogre::StringConverter::toString(entity->getRenderingDistance());
+    key += entity->getCastShadows() ? "|1" : "|0";
+    return key;
+}
+
+void StaticMeshBatcher::Rebuild(const std::string &key, Batch &batch)
+{
+    batch.dirty = false;
+    if (batch.meshes.size() < cMinInstances)
+    {
+        Unbatch(batch);
+        return;
+    }
+
+    PROFILE(StaticMeshBatcher_Rebuild);
+
+    Ogre::SceneManager *sceneMgr = world_->GetSceneManager();
+    try
+    {
+        if (!batch.geometry)
+        {
+            batch.geometry = sceneMgr->createStaticGeometry(world_->GetUniqueObjectName("EC_Mesh_batch"));
+            batch.geometry->setRegionDimensions(Ogre::Vector3(cRegionSize, cRegionSize, cRegionSize));
+        }
+        else
+            batch.geometry->reset();
+
+        // All the members share the rendering distance and shadow casting, as they are part of the key.
+        Ogre::Entity *first = batch.meshes.front()->GetEntity();
+        batch.geometry->setRenderingDistance(first->getRenderingDistance());
+        batch.geometry->setCastShadows(first->getCastShadows());
+
+        for(size_t i = 0; i < batch.meshes.size(); ++i)
+        {
+            EC_Mesh *mesh = batch.meshes[i];
+            Ogre::Entity *entity = mesh->GetEntity();
+            Ogre::SceneNode *node = entity->getParentSceneNode();
+            batch.geometry->addEntity(entity, node->_getDerivedPosition(), node->_getDerivedOrientation(), node->_getDerivedScale());
+            // Members that were already batched before this rebuild have their original flags saved.
+            if (savedVisibilityFlags_.find(mesh) == savedVisibilityFlags_.end())
+                savedVisibilityFlags_[mesh] = entity->getVisibilityFlags();
+            // Keep the entity in the scene for raycasts and visibility queries, but exclude it from rendering.
+            entity->setVisibilityFlags(0);
+        }
+        batch.geometry->build();
+    }
+    catch(Ogre::Exception &e)
+    {
+        LogError("StaticMeshBatcher::Rebuild: Failed to build batch " + key + ": " + std::string(e.what()));
+        Unbatch(batch);
+    }
+}
+
+void StaticMeshBatcher::Unbatch(Batch &batch)
+{
+    if (!batch.geometry)
+        return;
+
+    for(size_t i = 0; i < batch.meshes.size(); ++i)
+        RestoreVisibilityFlags(batch.meshes[i]);
+
+    world_->GetSceneManager()->destroyStaticGeometry(batch.geometry);
+    batch.geometry = 0;
+}
+
+void StaticMeshBatcher::RemoveFromBatch(EC_Mesh *mesh)
+{
+    std::map<EC_Mesh*, std::string>::iterator member = batchOf_.find(mesh);
+    if (member == batchOf_.end())
+        return;
+
+    std::map<std::string, Batch>::iterator iter = batches_.find(member->second);
+    batchOf_.erase(member);
+    if (iter == batches_.end())
+        return;
+
+    Batch &batch = iter->second;
+    batch.meshes.erase(std::remove(batch.meshes.begin(), batch.meshes.end(), mesh), batch.meshes.end());
+    RestoreVisibilityFlags(mesh);
+
+    if (batch.meshes.empty())
+    {
+        Unbatch(batch);
+        batches_.erase(iter);
+    }
+    else
+        batch.dirty = true;
+}
+
+void StaticMeshBatcher::RestoreVisibilityFlags(EC_Mesh *mesh)
+{
+    std::map<EC_Mesh*, unsigned int>::iterator iter = savedVisibilityFlags_.find(mesh);
+    if (iter == savedVisibilityFlags_.end())
+        return;
+
+    if (mesh->GetEntity())
+        mesh->GetEntity()->setVisibilityFlags(iter->second);
+    savedVisibilityFlags_.erase(iter);
+}
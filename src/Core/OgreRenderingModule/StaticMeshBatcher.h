@@ -0,0 +1,74 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Ogre { class StaticGeometry; }
+
+/// Renders identical static meshes of an OgreWorld in batches to reduce the number of draw calls.
+/** EC_Mesh notifies the batcher whenever something that affects batching changes: the mesh, its materials, its transform
+    or the transform or visibility of its placeable. After a mesh has stayed unchanged for a while, it is grouped with the other
+    meshes that have the same mesh, materials, draw distance and shadow casting, and once a group has enough members, the members
+    are rendered as one Ogre::StaticGeometry. The Ogre entities of the batched meshes still exist, so raycasts and visibility queries
+    keep working, but they are excluded from rendering with their visibility flags.
+
+    Only meshes without skeletons, vertex animation, attachments and LOD bias, whose placeables have no parent, are batched. A batched mesh that
+    is changed leaves its batch and is rendered as an individual entity again, and the batch is rebuilt without it. */
+class OGRE_MODULE_API StaticMeshBatcher
+{
+public:
+    explicit StaticMeshBatcher(OgreWorld *world);
+    ~StaticMeshBatcher();
+
+    /// Removes the mesh from its batch, if any, and starts waiting for it to stay unchanged before batching it again.
+    void Touch(EC_Mesh *mesh);
+
+    /// Removes the mesh from its batch, if any, and stops tracking it. Call before the Ogre entity of the mesh is detached or destroyed.
+    void Remove(EC_Mesh *mesh);
+
+    /// Batches the meshes that have stayed unchanged long enough and rebuilds the changed batches.
+    void Update(float timeStep);
+
+    /// Returns the number of batches currently rendered.
+    size_t NumBatches() const;
+
+    /// Returns the number of meshes currently rendered through batches.
+    size_t NumBatchedMeshes() const;
+
+private:
+    struct Batch
+    {
+        Batch() : geometry(0), dirty(false) {}
+
+        Ogre::StaticGeometry *geometry; ///< Null if the batch has too few members to be rendered as a batch.
+        std::vector<EC_Mesh*> meshes;
+        bool dirty;
+    };
+
+    /// Returns the key of meshes that can be batched together, or an empty string if the mesh can not be batched.
+    static std::string BatchKey(EC_Mesh *mesh);
+
+    /// Recreates the static geometry of a batch from its current members.
+    void Rebuild(const std::string &key, Batch &batch);
+
+    /// Destroys the static geometry of a batch and makes its members render as individual entities again.
+    void Unbatch(Batch &batch);
+
+    /// Removes the mesh from the batch it is a member of.
+    void RemoveFromBatch(EC_Mesh *mesh);
+
+    /// Gives the entity of a mesh back the visibility flags it had before it was batched.
+    void RestoreVisibilityFlags(EC_Mesh *mesh);
+
+    OgreWorld *world_;
+    std::map<std::string, Batch> batches_;
+    std::map<EC_Mesh*, std::string> batchOf_; ///< The batch key of each batch member.
+    std::map<EC_Mesh*, float> pending_; ///< The time each changed mesh has stayed unchanged.
+    std::map<EC_Mesh*, unsigned int> savedVisibilityFlags_; ///< The visibility flags each batched entity had before it was excluded from rendering.
+};
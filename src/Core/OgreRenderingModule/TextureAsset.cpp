@@ -5,14 +5,18 @@
 
 #include "Profiler.h"
 #include "TextureAsset.h"
+#include "TextureUploadQueue.h"
+#include "TextureStreamer.h"
 #include "OgreConversionUtils.h"
-#include "AssetCache.h"
+#include "Renderer.h"
+#include "Framework.h"
 
 #include <QPixmap>
 #include <QRect>
 #include <QFontMetrics>
 #include <QPainter>
-#include <QFileInfo>
+
+#include <algorithm>
 
 #include "OgreRenderingModule.h"
 #include <Ogre.h>
@@ -27,8 +31,25 @@
 
 #include "LoggingFunctions.h"
 
+namespace
+{
+    /// Returns the renderer of the Ogre rendering module, or null if it has been already destroyed.
+    OgreRenderer::Renderer *GetRenderer(AssetAPI *assetAPI)
+    {
+        OgreRenderer::OgreRenderingModule *module = assetAPI->GetFramework()->GetModule<OgreRenderer::OgreRenderingModule>();
+        return module ? module->GetRenderer().get() : 0;
+    }
+}
+
 TextureAsset::TextureAsset(AssetAPI *owner, const QString &type_, const QString &name_)
-:IAsset(owner, type_, name_)
+:IAsset(owner, type_, name_),
+loadGeneration_(0),
+asyncLoadPending_(false),
+residencyRequestPending_(false),
+fullWidth_(0),
+fullHeight_(0),
+residentMip_(0),
+mipTail_(0)
 {
     ogreAssetName = OgreRenderer::SanitateAssetIdForOgre(this->Name().toStdString()).c_str();
 }
@@ -56,26 +77,28 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, const bo
     assert(!assetAPI->IsHeadless());
 
     // Asynchronous loading
-    // 1. AssetAPI allows a asynch load. This is false when called from LoadFromFile(), LoadFromCache() etc.
-    // 2. We have a rendering window for Ogre as Ogre::ResourceBackgroundQueue does not work otherwise. Its not properly initialized without a rendering window.
-    // 3. The Ogre we are building against has thread support.
-    if (allowAsynchronous && !assetAPI->IsHeadless() && (OGRE_THREAD_SUPPORT != 0))
+    // AssetAPI allows an asynchronous load. This is false when called from LoadFromFile(), LoadFromCache() etc.
+    // The image is decoded in a worker thread and uploaded later in the main thread by the texture upload queue of the renderer.
+    // With texture streaming enabled, only the mip tail is uploaded at first, and the data is kept for streaming in the larger mipmaps later.
+    StopStreaming();
+    residencyRequestPending_ = false;
+    OgreRenderer::Renderer *renderer = GetRenderer(assetAPI);
+    if (allowAsynchronous && renderer && renderer->GetTextureUploadQueue())
     {
-        // We can only do threaded loading from disk, and not any disk location but only from asset cache.
-        // local:// refs will return empty string here and those will fall back to the non-threaded loading.
-        // Do not change this to do DiskCache() as that directory for local:// refs will not be a known resource location for ogre.
-        QString cacheDiskSource = assetAPI->GetAssetCache()->GetDiskSourceByRef(Name());
-        if (!cacheDiskSource.isEmpty())
+        uint maxSize = 0;
+        if (renderer->GetTextureStreamer())
         {
-            QFileInfo fileInfo(cacheDiskSource);
-            std::string sanitatedAssetRef = fileInfo.fileName().toStdString();             
-            loadTicket_ = Ogre::ResourceBackgroundQueue::getSingleton().load(Ogre::TextureManager::getSingleton().getResourceType(),
-                              sanitatedAssetRef, OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP, false, 0, 0, this);
-            return true;
+            streamingData_.assign(data, data + numBytes);
+            maxSize = TextureStreamer::cMipTailSize;
         }
-    }   
+        asyncLoadPending_ = true;
+        renderer->GetTextureUploadQueue()->Enqueue(boost::static_pointer_cast<TextureAsset>(shared_from_this()), ++loadGeneration_, data, numBytes, maxSize);
+        return true;
+    }
 
     // Synchronous loading
+    ++loadGeneration_;
+    asyncLoadPending_ = false;
     try
     {
         // Convert the data into Ogre's own DataStream format.
@@ -87,6 +110,25 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, const bo
         Ogre::Image image;
         image.load(stream);
 
+        if (!UploadImage(image))
+            return false;
+
+        // We did a synchronous load, must call AssetLoadCompleted here.
+        assetAPI->AssetLoadCompleted(Name());
+        return true;
+    }
+    catch(Ogre::Exception &e)
+    {
+        LogError("TextureAsset::DeserializeFromData: Failed to create texture " + this->Name().toStdString() + ": " + std::string(e.what()));
+        return false;
+    }
+}
+
+bool TextureAsset::UploadImage(Ogre::Image &image)
+{
+    PROFILE(TextureAsset_UploadImage);
+    try
+    {
         if (ogreTexture.isNull()) // If we are creating this texture for the first time, create a new Ogre::Texture object.
         {
             ogreAssetName = OgreRenderer::SanitateAssetIdForOgre(this->Name().toStdString()).c_str();
@@ -94,61 +136,94 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, const bo
         }
         else // If we're loading on top of an Ogre::Texture we've created before, don't lose the old Ogre::Texture object, but reuse the old.
         {    // This will allow all existing materials to keep referring to this texture, and they'll get the updated texture image immediately.
-            ogreTexture->freeInternalResources(); 
-
-            if (image.getWidth() != ogreTexture->getWidth() || image.getHeight() != ogreTexture->getHeight() || image.getFormat() != ogreTexture->getFormat())
-            {
-                ogreTexture->setWidth(image.getWidth());
-                ogreTexture->setHeight(image.getHeight());
-                ogreTexture->setFormat(image.getFormat());
-            }
-
-            if (ogreTexture->getBuffer().isNull())
-            {
-                LogError("DeserializeFromData: Failed to create texture " + this->Name() + ": OgreTexture::getBuffer() was null!");
-                return false;
-            }
-
-            Ogre::PixelBox pixelBox(Ogre::Box(0,0, image.getWidth(), image.getHeight()), image.getFormat(), (void*)image.getData());
-            ogreTexture->getBuffer()->blitFromMemory(pixelBox);
-
-            ogreTexture->createInternalResources();
+            // The texture is recreated with the size of the new image, which is also how streamed textures change their resident mipmaps.
+            // Texture::loadImage() does nothing on a texture that is loaded, so the texture is unloaded first. This also frees its GPU resources.
+            ogreTexture->unload();
+            ogreTexture->setNumMipmaps(image.getNumMipmaps() > 0 ? image.getNumMipmaps() : Ogre::TextureManager::getSingleton().getDefaultNumMipmaps());
+            ogreTexture->loadImage(image);
         }
-
-        // We did a synchronous load, must call AssetLoadCompleted here.
-        assetAPI->AssetLoadCompleted(Name());
         return true;
     }
     catch(Ogre::Exception &e)
     {
-        LogError("TextureAsset::DeserializeFromData: Failed to create texture " + this->Name().toStdString() + ": " + std::string(e.what()));
+        LogError("TextureAsset::UploadImage: Failed to create texture " + this->Name().toStdString() + ": " + std::string(e.what()));
         return false;
     }
 }
 
-void TextureAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, const Ogre::BackgroundProcessResult &result)
+void TextureAsset::AsyncLoadCompleted(Ogre::Image &image, uint fullWidth, uint fullHeight, uint skippedMips, const QString &error)
 {
-    if (ticket != loadTicket_)
-        return;
-
     const QString assetRef = Name();
-    ogreAssetName = QString::fromStdString(OgreRenderer::SanitateAssetIdForOgre(assetRef));
-    if (!result.error)
+    // A residency change of a streamed texture is not a load of the asset, so it does not signal the completion.
+    const bool initialLoad = asyncLoadPending_;
+    asyncLoadPending_ = false;
+    residencyRequestPending_ = false;
+
+    if (!error.isEmpty())
+        LogError("TextureAsset asynch load: Failed to decode texture " + assetRef + ": " + error);
+    else if (UploadImage(image))
     {
-        ogreTexture = Ogre::TextureManager::getSingleton().getByName(ogreAssetName.toStdString(), OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP);
-        if (!ogreTexture.isNull())
+        fullWidth_ = fullWidth;
+        fullHeight_ = fullHeight;
+        residentMip_ = skippedMips;
+        if (initialLoad)
         {
+            mipTail_ = skippedMips;
+            OgreRenderer::Renderer *renderer = GetRenderer(assetAPI);
+            if (IsStreamed() && renderer && renderer->GetTextureStreamer())
+                renderer->GetTextureStreamer()->Register(this);
             assetAPI->AssetLoadCompleted(assetRef);
-            return;
         }
-        else
-            LogError("TextureAsset asynch load: Ogre::Texture was null after threaded loading: " + assetRef);
+        return;
     }
-    else
-        LogError("TextureAsset asynch load: Ogre failed to do threaded loading: " + result.message);
 
-    DoUnload();
-    assetAPI->AssetLoadFailed(assetRef);
+    if (initialLoad)
+    {
+        DoUnload();
+        assetAPI->AssetLoadFailed(assetRef);
+    }
+}
+
+void TextureAsset::StopStreaming()
+{
+    if (!IsStreamed())
+        return;
+    OgreRenderer::Renderer *renderer = GetRenderer(assetAPI);
+    if (renderer && renderer->GetTextureStreamer())
+        renderer->GetTextureStreamer()->Unregister(this);
+    std::vector<u8>().swap(streamingData_);
+}
+
+uint TextureAsset::NumFullMipmaps() const
+{
+    uint numMipmaps = 0;
+    for(uint w = fullWidth_, h = fullHeight_; w > 1 || h > 1; w = std::max(w / 2, 1U), h = std::max(h / 2, 1U))
+        ++numMipmaps;
+    return numMipmaps;
+}
+
+size_t TextureAsset::MemorySize(uint topMip) const
+{
+    if (ogreTexture.isNull())
+        return 0;
+    size_t size = 0;
+    for(uint mip = topMip; mip <= NumFullMipmaps(); ++mip)
+        size += Ogre::PixelUtil::getMemorySize(std::max(fullWidth_ >> mip, 1U), std::max(fullHeight_ >> mip, 1U), 1, ogreTexture->getFormat());
+    return size * ogreTexture->getNumFaces();
+}
+
+void TextureAsset::RequestResidentMip(uint mip)
+{
+    if (!IsStreamed() || asyncLoadPending_ || residencyRequestPending_ || mip == residentMip_)
+        return;
+    OgreRenderer::Renderer *renderer = GetRenderer(assetAPI);
+    if (!renderer || !renderer->GetTextureUploadQueue())
+        return;
+
+    residencyRequestPending_ = true;
+    const uint maxSize = std::max(std::max(fullWidth_ >> mip, 1U), std::max(fullHeight_ >> mip, 1U));
+    renderer->GetTextureUploadQueue()->Enqueue(boost::static_pointer_cast<TextureAsset>(shared_from_this()), loadGeneration_,
+        &streamingData_[0], streamingData_.size(), maxSize);
 }
 
 /*
@@ -222,6 +297,12 @@ bool TextureAsset::SerializeTo(std::vector<u8> &data, const QString &serializati
 
 void TextureAsset::DoUnload()
 {
+    // Discard the result of an asynchronous load that is still in progress.
+    ++loadGeneration_;
+    asyncLoadPending_ = false;
+    residencyRequestPending_ = false;
+    StopStreaming();
+
     if (!ogreTexture.isNull())
         ogreAssetName = ogreTexture->getName().c_str();
 
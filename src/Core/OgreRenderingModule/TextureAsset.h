@@ -9,10 +9,15 @@
 #include "AssetAPI.h"
 #include <QImage>
 #include "OgreModuleApi.h"
-#include <OgreResourceBackgroundQueue.h>
 
 /// Represents a texture on the GPU.
-class OGRE_MODULE_API TextureAsset : public IAsset, Ogre::ResourceBackgroundQueue::Listener
+/** Asynchronous loads decode the image in a worker thread and upload it to the GPU under the per-frame budget of the
+    TextureUploadQueue of the Renderer, regardless of whether the data came from the asset cache, a local:// ref or elsewhere.
+
+    When texture streaming is enabled, an asynchronous load uploads only the mip tail of the texture, and the TextureStreamer
+    of the Renderer requests the larger mipmaps as the texture becomes visible on the screen. The encoded data is kept in memory
+    for decoding the requested mipmaps. */
+class OGRE_MODULE_API TextureAsset : public IAsset
 {
     Q_OBJECT;
 
@@ -26,9 +31,6 @@ public:
     /// Load texture into memory
     virtual bool SerializeTo(std::vector<u8> &data, const QString &serializationParameters) const;
 
-    /// Ogre threaded load listener. Ogre::ResourceBackgroundQueue::Listener override.
-    virtual void operationCompleted(Ogre::BackgroundProcessTicket ticket, const Ogre::BackgroundProcessResult &result);
-
     /// Unload texture from ogre
     virtual void DoUnload();
 
@@ -56,8 +58,63 @@ public:
     /// Specifies the unique texture name Ogre uses in its asset pool for this texture.
     QString ogreAssetName;
 
-    /// Ticket for ogres threaded loading operation.
-    Ogre::BackgroundProcessTicket loadTicket_;
+    /// Returns true if the resident mipmaps of this texture are managed by the TextureStreamer.
+    bool IsStreamed() const { return !streamingData_.empty(); }
+
+    /// Returns the width of the largest mipmap of the texture, whether it is resident or not. Valid for streamed textures.
+    uint FullWidth() const { return fullWidth_; }
+
+    /// Returns the height of the largest mipmap of the texture, whether it is resident or not. Valid for streamed textures.
+    uint FullHeight() const { return fullHeight_; }
+
+    /// Returns the number of mipmaps below the largest one in the full mipmap chain. Valid for streamed textures.
+    uint NumFullMipmaps() const;
+
+    /// Returns the index of the largest mipmap that is resident on the GPU, 0 if the full texture is resident.
+    uint ResidentMip() const { return residentMip_; }
+
+    /// Returns the index of the largest mipmap of the mip tail, which stays resident as long as the texture is loaded.
+    uint MipTail() const { return mipTail_; }
+
+    /// Returns the GPU memory used by the texture when its mipmaps from the given index down are resident, in bytes.
+    size_t MemorySize(uint topMip) const;
+
+    /// Starts decoding and uploading the texture with the given mipmap as the largest resident one.
+    /** Does nothing if the texture is not streamed, or if a load or an earlier request is still in progress. */
+    void RequestResidentMip(uint mip);
+
+private:
+    friend class TextureUploadQueue;
+
+    /// Creates the Ogre texture from the given image, or replaces the contents of the existing Ogre texture with it.
+    bool UploadImage(Ogre::Image &image);
+
+    /// Called by the TextureUploadQueue when the image of an asynchronous load has been decoded and can be uploaded.
+    /** @param fullWidth The width of the image before its largest mipmaps were dropped for streaming.
+        @param fullHeight The height of the image before its largest mipmaps were dropped for streaming.
+        @param skippedMips The number of the largest mipmaps that were dropped.
+        @param error Describes why the decoding failed, or is empty if the image was decoded successfully. */
+    void AsyncLoadCompleted(Ogre::Image &image, uint fullWidth, uint fullHeight, uint skippedMips, const QString &error);
+
+    /// Unregisters the texture from the TextureStreamer and releases the encoded data kept for streaming.
+    void StopStreaming();
+
+    /// Incremented on every load and unload, so that the results of an outdated asynchronous load can be discarded.
+    uint loadGeneration_;
+
+    /// True while the asynchronous load of the asset is in progress.
+    bool asyncLoadPending_;
+
+    /// True while a change of the resident mipmaps is in progress.
+    bool residencyRequestPending_;
+
+    /// The encoded image data of a streamed texture, empty if the texture is not streamed.
+    std::vector<u8> streamingData_;
+
+    uint fullWidth_;
+    uint fullHeight_;
+    uint residentMip_;
+    uint mipTail_;
 };
 
 typedef boost::shared_ptr<TextureAsset> TextureAssetPtr;
@@ -0,0 +1,179 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TextureStreamer.h"
+#include "TextureAsset.h"
+#include "Renderer.h"
+#include "OgreWorld.h"
+#include "Profiler.h"
+
+#include <Ogre.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+    /// How often the demand and the residency of the textures are updated, in seconds.
+    const float cUpdateInterval = 0.5f;
+
+    struct StreamingCandidate
+    {
+        TextureAsset *texture;
+        float demand;
+
+        bool operator <(const StreamingCandidate &rhs) const { return demand > rhs.demand; }
+    };
+
+    /// Returns the smallest mipmap of the texture that is at least the given size in pixels, or the mip tail if it is smaller.
+    uint DesiredMip(const TextureAsset *texture, float demand)
+    {
+        if (demand <= 0.f)
+            return texture->MipTail();
+        const uint size = std::max(texture->FullWidth(), texture->FullHeight());
+        uint mip = 0;
+        while(mip < texture->MipTail() && (float)(size >> (mip + 1)) >= demand)
+            ++mip;
+        return mip;
+    }
+}
+
+TextureStreamer::TextureStreamer(OgreRenderer::Renderer *renderer, size_t budgetBytes) :
+    renderer_(renderer),
+    budget_(budgetBytes),
+    timeSinceUpdate_(0.f)
+{
+}
+
+void TextureStreamer::Register(TextureAsset *texture)
+{
+    if (texture && !texture->ogreTexture.isNull())
+        textures_[texture->ogreTexture->getName()] = texture;
+}
+
+void TextureStreamer::Unregister(TextureAsset *texture)
+{
+    for(std::map<std::string, TextureAsset*>::iterator iter = textures_.begin(); iter != textures_.end(); ++iter)
+        if (iter->second == texture)
+        {
+            textures_.erase(iter);
+            return;
+        }
+}
+
+TextureAsset *TextureStreamer::GetTexture(const std::string &ogreTextureName) const
+{
+    std::map<std::string, TextureAsset*>::const_iterator iter = textures_.find(ogreTextureName);
+    return iter != textures_.end() ? iter->second : 0;
+}
+
+size_t TextureStreamer::ResidentMemory() const
+{
+    size_t memory = 0;
+    for(std::map<std::string, TextureAsset*>::const_iterator iter = textures_.begin(); iter != textures_.end(); ++iter)
+        memory += iter->second->MemorySize(iter->second->ResidentMip());
+    return memory;
+}
+
+float TextureStreamer::Demand(const std::string &ogreTextureName) const
+{
+    std::map<std::string, float>::const_iterator iter = demand_.find(ogreTextureName);
+    return iter != demand_.end() ? iter->second : 0.f;
+}
+
+void TextureStreamer::Update(float frameTime)
+{
+    timeSinceUpdate_ += frameTime;
+    if (timeSinceUpdate_ < cUpdateInterval || textures_.empty())
+        return;
+    timeSinceUpdate_ = 0.f;
+
+    PROFILE(TextureStreamer_Update);
+    UpdateDemand();
+    UpdateResidency();
+}
+
+void TextureStreamer::UpdateDemand()
+{
+    demand_.clear();
+
+    OgreWorldPtr world = renderer_->GetActiveOgreWorld();
+    Ogre::Camera *camera = renderer_->GetActiveOgreCamera();
+    Ogre::Viewport *viewport = renderer_->GetViewport();
+    if (!world || !camera || !viewport)
+        return;
+
+    // The size of one world unit at unit distance, in pixels.
+    const float pixelsPerUnit = viewport->getActualHeight() * 0.5f / Ogre::Math::Tan(camera->getFOVy() * 0.5f);
+    const Ogre::Vector3 cameraPos = camera->getDerivedPosition();
+
+    Ogre::SceneManager::MovableObjectIterator iter = world->GetSceneManager()->getMovableObjectIterator(Ogre::EntityFactory::FACTORY_TYPE_NAME);
+    while(iter.hasMoreElements())
+    {
+        Ogre::Entity *entity = static_cast<Ogre::Entity*>(iter.getNext());
+        if (!entity->isInScene())
+            continue;
+
+        // Entities that are not visible still register their textures with zero demand, so that the textures are not treated as unmanaged.
+        float demand = 0.f;
+        const Ogre::Sphere &sphere = entity->getWorldBoundingSphere(true);
+        if (entity->isVisible() && camera->isVisible(sphere))
+        {
+            const float distance = (sphere.getCenter() - cameraPos).length() - sphere.getRadius();
+            demand = distance > 1e-3f ? 2.f * sphere.getRadius() * pixelsPerUnit / distance : FLT_MAX;
+        }
+
+        for(uint i = 0; i < entity->getNumSubEntities(); ++i)
+        {
+            Ogre::MaterialPtr material = entity->getSubEntity(i)->getMaterial();
+            Ogre::Technique *technique = material.isNull() ? 0 : material->getBestTechnique();
+            if (!technique)
+                continue;
+            for(ushort p = 0; p < technique->getNumPasses(); ++p)
+            {
+                Ogre::Pass *pass = technique->getPass(p);
+                for(ushort t = 0; t < pass->getNumTextureUnitStates(); ++t)
+                {
+                    float &textureDemand = demand_[pass->getTextureUnitState(t)->getTextureName()];
+                    textureDemand = std::max(textureDemand, demand);
+                }
+            }
+        }
+    }
+}
+
+void TextureStreamer::UpdateResidency()
+{
+    // The mip tails are always resident, so they are taken from the budget first.
+    std::vector<StreamingCandidate> candidates;
+    size_t tailMemory = 0;
+    for(std::map<std::string, TextureAsset*>::const_iterator iter = textures_.begin(); iter != textures_.end(); ++iter)
+    {
+        StreamingCandidate candidate;
+        candidate.texture = iter->second;
+        std::map<std::string, float>::const_iterator demand = demand_.find(iter->first);
+        candidate.demand = (demand != demand_.end() ? demand->second : FLT_MAX);
+        candidates.push_back(candidate);
+        tailMemory += candidate.texture->MemorySize(candidate.texture->MipTail());
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    size_t remaining = (budget_ > tailMemory ? budget_ - tailMemory : 0);
+    for(size_t i = 0; i < candidates.size(); ++i)
+    {
+        TextureAsset *texture = candidates[i].texture;
+        const size_t tail = texture->MemorySize(texture->MipTail());
+        uint mip = DesiredMip(texture, candidates[i].demand);
+        while(mip < texture->MipTail() && texture->MemorySize(mip) - tail > remaining)
+            ++mip;
+        remaining -= texture->MemorySize(mip) - tail;
+
+        if (mip != texture->ResidentMip())
+            texture->RequestResidentMip(mip);
+    }
+}
@@ -0,0 +1,74 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "CoreTypes.h"
+
+#include <map>
+#include <string>
+
+/// Streams the mipmaps of textures to the GPU based on how large they appear on the screen.
+/** Streamed textures are uploaded with only their mip tail, the mipmaps at most cMipTailSize texels in size, when they are loaded.
+    Periodically, the streamer goes through the Ogre entities of the active world, and estimates the screen-space demand of each
+    texture as the largest projected size, in pixels, of the visible entities using it. The textures then get the smallest mipmap that is
+    at least as large as their demand, in the order of decreasing demand, as long as the texture memory budget allows. The textures that
+    do not fit are reduced, so the high mipmaps of the least demanded textures are evicted first.
+
+    Textures that are not used by any entity of the active world, e.g. sky or UI textures, are kept fully resident.
+
+    Streaming is enabled with the "texture streaming" rendering config setting, and the budget is set with "texture memory budget", in megabytes.
+    The budget covers the streamed textures only. */
+class OGRE_MODULE_API TextureStreamer
+{
+public:
+    /// The maximum width and height of the mipmaps that are uploaded when a streamed texture is loaded.
+    static const uint cMipTailSize = 64;
+
+    /// @param budgetBytes The GPU memory that the streamed textures may use, in bytes.
+    TextureStreamer(OgreRenderer::Renderer *renderer, size_t budgetBytes);
+
+    /// Starts managing the resident mipmaps of the texture. Called by TextureAsset when a streamed texture has been loaded.
+    void Register(TextureAsset *texture);
+
+    /// Stops managing the texture. Called by TextureAsset when the texture is unloaded.
+    void Unregister(TextureAsset *texture);
+
+    /// Updates the demand of the textures and requests residency changes. Called once per frame by the Renderer.
+    void Update(float frameTime);
+
+    /// Returns the streamed texture with the given Ogre texture name, or null if the texture is not streamed.
+    TextureAsset *GetTexture(const std::string &ogreTextureName) const;
+
+    /// Returns the number of streamed textures.
+    size_t NumTextures() const { return textures_.size(); }
+
+    /// Returns the GPU memory used by the resident mipmaps of the streamed textures, in bytes.
+    size_t ResidentMemory() const;
+
+    /// Returns the GPU memory the streamed textures may use, in bytes.
+    size_t Budget() const { return budget_; }
+
+    /// Returns the screen-space demand of the texture computed in the last update, in pixels.
+    float Demand(const std::string &ogreTextureName) const;
+
+private:
+    /// Recomputes demand_ from the entities of the active world.
+    void UpdateDemand();
+
+    /// Assigns the resident mipmaps of the textures within the budget and requests the changes.
+    void UpdateResidency();
+
+    OgreRenderer::Renderer *renderer_;
+    size_t budget_;
+
+    /// Time since the last update, in seconds.
+    float timeSinceUpdate_;
+
+    /// The streamed textures by their Ogre texture names.
+    std::map<std::string, TextureAsset*> textures_;
+
+    /// The screen-space demand of the textures used by the entities of the active world, in pixels. Textures not visible have zero demand.
+    std::map<std::string, float> demand_;
+};
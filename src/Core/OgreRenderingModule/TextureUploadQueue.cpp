@@ -0,0 +1,178 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TextureUploadQueue.h"
+#include "TextureAsset.h"
+#include "HighPerfClock.h"
+#include "Profiler.h"
+
+#include <Ogre.h>
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+TextureUploadQueue::TextureUploadQueue(JobAPI *jobs, float budgetMsecs) :
+    jobs_(jobs),
+    budgetMsecs_(budgetMsecs)
+{
+}
+
+TextureUploadQueue::~TextureUploadQueue()
+{
+    // The jobs only touch their own data, but wait for them so that no decoding outlives the Ogre codecs.
+    for(std::list<PendingUpload>::iterator iter = pending_.begin(); iter != pending_.end(); ++iter)
+        jobs_->Wait(iter->decoding);
+}
+
+void TextureUploadQueue::Enqueue(const boost::shared_ptr<TextureAsset> &asset, uint generation, const u8 *data, size_t numBytes, uint maxSize)
+{
+    DecodeJobPtr job(new DecodeJob);
+    job->data.assign(data, data + numBytes);
+    job->maxSize = maxSize;
+
+    PendingUpload pending;
+    pending.asset = asset;
+    pending.generation = generation;
+    pending.job = job;
+    pending.decoding = jobs_->Submit(boost::bind(&TextureUploadQueue::Decode, job));
+    pending_.push_back(pending);
+}
+
+void TextureUploadQueue::Update()
+{
+    if (pending_.empty())
+        return;
+
+    PROFILE(TextureUploadQueue_Update);
+
+    const tick_t start = GetCurrentClockTime();
+    const tick_t budget = (tick_t)(budgetMsecs_ * GetCurrentClockFreq() / 1000.0);
+    bool uploaded = false;
+
+    for(std::list<PendingUpload>::iterator iter = pending_.begin(); iter != pending_.end();)
+    {
+        if (uploaded && GetCurrentClockTime() - start >= budget)
+            break;
+        if (!iter->decoding->IsFinished())
+        {
+            ++iter;
+            continue;
+        }
+
+        PendingUpload upload = *iter;
+        iter = pending_.erase(iter);
+
+        // The asset may have been destroyed, unloaded or loaded again while the image was being decoded.
+        boost::shared_ptr<TextureAsset> asset = upload.asset.lock();
+        if (!asset || asset->loadGeneration_ != upload.generation)
+            continue;
+
+        DecodeJob &job = *upload.job;
+        asset->AsyncLoadCompleted(job.image, job.fullWidth, job.fullHeight, job.skippedMips, QString::fromStdString(job.error));
+        uploaded = true;
+    }
+}
+
+void TextureUploadQueue::Decode(DecodeJobPtr job)
+{
+    PROFILE(TextureUploadQueue_Decode);
+
+    try
+    {
+#include "DisableMemoryLeakCheck.h"
+        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream(&job->data[0], job->data.size(), false));
+#include "EnableMemoryLeakCheck.h"
+        job->image.load(stream);
+        job->fullWidth = job->image.getWidth();
+        job->fullHeight = job->image.getHeight();
+        GenerateMipmaps(*job);
+        DropLargestMipmaps(*job);
+    }
+    catch(Ogre::Exception &e)
+    {
+        job->error = e.what();
+    }
+
+    // The encoded data is not needed anymore.
+    std::vector<u8>().swap(job->data);
+}
+
+void TextureUploadQueue::GenerateMipmaps(DecodeJob &job)
+{
+    Ogre::Image &image = job.image;
+    if (image.getNumMipmaps() > 0 || image.getDepth() > 1 || Ogre::PixelUtil::isCompressed(image.getFormat()))
+        return;
+
+    const size_t width = image.getWidth();
+    const size_t height = image.getHeight();
+    const size_t numFaces = image.getNumFaces();
+    const Ogre::PixelFormat format = image.getFormat();
+
+    size_t numMipmaps = 0;
+    for(size_t w = width, h = height; w > 1 || h > 1; w = std::max<size_t>(w / 2, 1), h = std::max<size_t>(h / 2, 1))
+        ++numMipmaps;
+    if (numMipmaps == 0)
+        return;
+
+    // The data of an Ogre::Image is stored face by face, and each face stores its mipmaps from the largest to the smallest.
+    const size_t dataSize = Ogre::Image::calculateSize(numMipmaps, numFaces, width, height, 1, format);
+    Ogre::uchar *data = OGRE_ALLOC_T(Ogre::uchar, dataSize, Ogre::MEMCATEGORY_GENERAL);
+    Ogre::uchar *dst = data;
+    for(size_t face = 0; face < numFaces; ++face)
+    {
+        Ogre::PixelBox level(width, height, 1, format, dst);
+        Ogre::PixelUtil::bulkPixelConversion(image.getPixelBox(face, 0), level);
+        dst += Ogre::PixelUtil::getMemorySize(width, height, 1, format);
+
+        for(size_t mip = 1; mip <= numMipmaps; ++mip)
+        {
+            Ogre::PixelBox nextLevel(std::max<size_t>(width >> mip, 1), std::max<size_t>(height >> mip, 1), 1, format, dst);
+            Ogre::Image::scale(level, nextLevel, Ogre::Image::FILTER_BILINEAR);
+            dst += Ogre::PixelUtil::getMemorySize(nextLevel.getWidth(), nextLevel.getHeight(), 1, format);
+            level = nextLevel;
+        }
+    }
+
+    // The image takes the ownership of the data.
+    image.loadDynamicImage(data, width, height, 1, format, true, numFaces, numMipmaps);
+}
+
+void TextureUploadQueue::DropLargestMipmaps(DecodeJob &job)
+{
+    Ogre::Image &image = job.image;
+    if (job.maxSize == 0 || image.getDepth() > 1)
+        return;
+
+    const size_t numMipmaps = image.getNumMipmaps();
+    size_t skip = 0;
+    while(skip < numMipmaps && (std::max<size_t>(image.getWidth() >> skip, 1) > job.maxSize || std::max<size_t>(image.getHeight() >> skip, 1) > job.maxSize))
+        ++skip;
+    if (skip == 0)
+        return;
+
+    const size_t width = std::max<size_t>(image.getWidth() >> skip, 1);
+    const size_t height = std::max<size_t>(image.getHeight() >> skip, 1);
+    const size_t numFaces = image.getNumFaces();
+    const Ogre::PixelFormat format = image.getFormat();
+
+    const size_t dataSize = Ogre::Image::calculateSize(numMipmaps - skip, numFaces, width, height, 1, format);
+    Ogre::uchar *data = OGRE_ALLOC_T(Ogre::uchar, dataSize, Ogre::MEMCATEGORY_GENERAL);
+    Ogre::uchar *dst = data;
+    for(size_t face = 0; face < numFaces; ++face)
+        for(size_t mip = skip; mip <= numMipmaps; ++mip)
+        {
+            Ogre::PixelBox level = image.getPixelBox(face, mip);
+            const size_t levelSize = Ogre::PixelUtil::getMemorySize(level.getWidth(), level.getHeight(), 1, format);
+            memcpy(dst, level.data, levelSize);
+            dst += levelSize;
+        }
+
+    image.loadDynamicImage(data, width, height, 1, format, true, numFaces, numMipmaps - skip);
+    job.skippedMips = (uint)skip;
+}
@@ -0,0 +1,92 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "CoreTypes.h"
+#include "JobAPI.h"
+
+#include <OgreImage.h>
+
+#include <list>
+#include <string>
+#include <vector>
+
+/// Decodes texture images in the worker threads of the JobAPI and uploads them to the GPU under a per-frame time budget.
+/** TextureAsset hands the encoded image data (PNG, JPG, DDS or any other format Ogre has a codec for) to the queue when it is
+    loaded asynchronously, regardless of where the data came from. The image is decoded with Ogre::Image in a worker thread,
+    which also builds the mipmap chain of uncompressed images, so that the main thread only has to copy the finished levels to the GPU.
+    For streamed textures, the worker also drops the mipmaps that are larger than requested, see TextureStreamer.
+
+    Once per frame, the Renderer calls Update(), which uploads the decoded textures in the order they were queued until the
+    time budget of the frame has been used. At least one texture is uploaded per frame, so a budget smaller than the time of a single upload
+    only slows the loading down. The budget is read from the "texture upload budget" rendering config setting, in milliseconds. */
+class OGRE_MODULE_API TextureUploadQueue
+{
+public:
+    /// @param jobs The job system the images are decoded in.
+    /// @param budgetMsecs The time that can be spent uploading textures each frame, in milliseconds.
+    TextureUploadQueue(JobAPI *jobs, float budgetMsecs);
+    ~TextureUploadQueue();
+
+    /// Starts decoding the given image data in a worker thread. The data is copied.
+    /** When the texture has been uploaded, TextureAsset::AsyncLoadCompleted() is called with the result.
+        @param generation The load generation of the asset. The upload is dropped if the asset has been loaded again or unloaded meanwhile.
+        @param maxSize If nonzero, the largest mipmaps are dropped until the width and height of the image are at most this. Used for texture streaming. */
+    void Enqueue(const boost::shared_ptr<TextureAsset> &asset, uint generation, const u8 *data, size_t numBytes, uint maxSize = 0);
+
+    /// Uploads the decoded textures to the GPU until the time budget of this frame has been used.
+    void Update();
+
+    /// Returns the number of textures that are being decoded or waiting for upload.
+    size_t NumPending() const { return pending_.size(); }
+
+    /// Returns the time that can be spent uploading textures each frame, in milliseconds.
+    float Budget() const { return budgetMsecs_; }
+
+    /// Sets the time that can be spent uploading textures each frame, in milliseconds.
+    void SetBudget(float budgetMsecs) { budgetMsecs_ = budgetMsecs; }
+
+private:
+    /// The encoded data of a texture and the image decoded from it.
+    struct DecodeJob
+    {
+        DecodeJob() : maxSize(0), fullWidth(0), fullHeight(0), skippedMips(0) {}
+
+        std::vector<u8> data;
+        uint maxSize;
+        Ogre::Image image;
+        /// The size of the image before the largest mipmaps were dropped.
+        uint fullWidth;
+        uint fullHeight;
+        /// The number of the largest mipmaps that were dropped to fit maxSize.
+        uint skippedMips;
+        /// Describes the failure if the decoding failed, empty on success.
+        std::string error;
+    };
+    typedef boost::shared_ptr<DecodeJob> DecodeJobPtr;
+
+    /// A texture that is being decoded or waits for upload.
+    struct PendingUpload
+    {
+        boost::weak_ptr<TextureAsset> asset;
+        uint generation;
+        DecodeJobPtr job;
+        JobPtr decoding; ///< The job that runs Decode().
+    };
+
+    /// Decodes the image and generates its mipmaps. Run in a worker thread, and must not access anything but the given job.
+    static void Decode(DecodeJobPtr job);
+
+    /// Replaces the image of the job with an image that contains the full mipmap chain of the decoded image.
+    /** Does nothing for compressed and volume images and images that already have mipmaps, e.g. most DDS files. */
+    static void GenerateMipmaps(DecodeJob &job);
+
+    /// Replaces the image of the job with its mipmap chain starting from the first mipmap that fits in the maximum size of the job.
+    static void DropLargestMipmaps(DecodeJob &job);
+
+    JobAPI *jobs_;
+    std::list<PendingUpload> pending_;
+    float budgetMsecs_;
+};
@@ -26,9 +26,11 @@
 #include <btBulletDynamicsCommon.h>
 #include <BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h>
 #include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
+#include <LinearMath/btAabbUtil2.h>
 
 #include <BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h>
 #include <set>
+#include <algorithm>
 
 #include <OgreSceneNode.h>
 
@@ -38,6 +40,25 @@ static const float cForceThreshold = 0.0005f;
 static const float cImpulseThreshold = 0.0005f;
 static const float cTorqueThreshold = 0.0005f;
 
+/// Heightfield shape that reads the heights through TerrainHeightField::Height(), so that the heights of a memory-mapped
+/// terrain file are paged in only where bodies touch the terrain, instead of being copied in whole for the physics.
+class TerrainHeightfieldShape : public btHeightfieldTerrainShape
+{
+public:
+    TerrainHeightfieldShape(const TerrainHeightField *heights, float minHeight, float maxHeight) :
+        btHeightfieldTerrainShape(heights->width, heights->height, 0, 1.0f, minHeight, maxHeight, 1, PHY_FLOAT, false),
+        heights_(heights)
+    {
+    }
+
+protected:
+    virtual btScalar getRawHeightFieldValue(int x, int y) const { return heights_->Height(x, y); }
+
+private:
+    /// Owned by EC_RigidBody::heightFieldData_, which outlives the shape.
+    const TerrainHeightField *heights_;
+};
+
 EC_RigidBody::EC_RigidBody(Scene* scene) :
     IComponent(scene),
     mass(this, "Mass", 0.0f),
@@ -62,7 +83,14 @@ EC_RigidBody::EC_RigidBody(Scene* scene) :
     shape_(0),
     childShape_(0),
     heightField_(0),
+    heightFieldMinY_(0.f),
+    heightFieldMaxY_(0.f),
     disconnected_(false),
+    hasCollisionListeners_(false),
+    collisionListenerFrame_(0),
+    hasWrittenTransform_(false),
+    pendingTransformIndex_(-1),
+    awakeFrame_(0),
     cachedShapeType_(-1),
     cachedSize_(float3::zero)
 {
@@ -129,6 +157,8 @@ void EC_RigidBody::SetAngularVelocity(const float3& velocity)
 
 void EC_RigidBody::ApplyForce(const float3& force, const float3& position)
 {
+    WaitForSimulation();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -151,6 +181,8 @@ void EC_RigidBody::ApplyForce(const float3& force, const float3& position)
 
 void EC_RigidBody::ApplyTorque(const float3& torque)
 {
+    WaitForSimulation();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -170,6 +202,8 @@ void EC_RigidBody::ApplyTorque(const float3& torque)
 
 void EC_RigidBody::ApplyImpulse(const float3& impulse, const float3& position)
 {
+    WaitForSimulation();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -192,6 +226,8 @@ void EC_RigidBody::ApplyImpulse(const float3& impulse, const float3& position)
 
 void EC_RigidBody::ApplyTorqueImpulse(const float3& torqueImpulse)
 {
+    WaitForSimulation();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -211,6 +247,8 @@ void EC_RigidBody::ApplyTorqueImpulse(const float3& torqueImpulse)
 
 void EC_RigidBody::Activate()
 {
+    WaitForSimulation();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -223,12 +261,16 @@ void EC_RigidBody::Activate()
 
 void EC_RigidBody::KeepActive()
 {
+    WaitForSimulation();
+    
     if (body_)
         body_->activate(true);
 }
 
 bool EC_RigidBody::IsActive()
 {
+    WaitForSimulation();
+    
     if (body_)
         return body_->isActive();
     else
@@ -237,6 +279,8 @@ bool EC_RigidBody::IsActive()
 
 void EC_RigidBody::ResetForces()
 {
+    WaitForSimulation();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -283,6 +327,8 @@ void EC_RigidBody::CheckForPlaceableAndTerrain()
         {
             terrain_ = terrain;
             connect(terrain.get(), SIGNAL(TerrainRegenerated()), this, SLOT(OnTerrainRegenerated()));
+            connect(terrain.get(), SIGNAL(HeightFieldChanged(int, int, int, int)), this, SLOT(OnTerrainHeightFieldChanged(int, int, int, int)));
+            connect(terrain.get(), SIGNAL(HeightFieldAboutToChange()), this, SLOT(OnTerrainHeightFieldAboutToChange()), Qt::DirectConnection);
             connect(terrain.get(), SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(TerrainUpdated(IAttribute*)));
         }
     }
@@ -290,6 +336,8 @@ void EC_RigidBody::CheckForPlaceableAndTerrain()
 
 void EC_RigidBody::CreateCollisionShape()
 {
+    WaitForSimulation();
+    
     RemoveCollisionShape();
     
     float3 sizeVec = size.Get();
@@ -340,6 +388,8 @@ void EC_RigidBody::CreateCollisionShape()
 
 void EC_RigidBody::RemoveCollisionShape()
 {
+    WaitForSimulation();
+    
     if (shape_)
     {
         if (body_)
@@ -357,6 +407,7 @@ void EC_RigidBody::RemoveCollisionShape()
         delete heightField_;
         heightField_ = 0;
     }
+    heightFieldData_.reset();
 }
 
 void EC_RigidBody::CreateBody()
@@ -364,6 +415,8 @@ void EC_RigidBody::CreateBody()
     if ((!world_) || (!ParentEntity()) || (body_))
         return;
     
+    WaitForSimulation();
+    
     CheckForPlaceableAndTerrain();
     
     CreateCollisionShape();
@@ -386,6 +439,8 @@ void EC_RigidBody::ReaddBody()
     if ((!world_) || (!ParentEntity()) || (!body_))
         return;
     
+    WaitForSimulation();
+    
     btVector3 localInertia;
     float m;
     int collisionFlags;
@@ -408,6 +463,8 @@ void EC_RigidBody::RemoveBody()
 {
     if ((body_) && (world_))
     {
+        WaitForSimulation();
+        world_->DiscardTransformUpdates(this, true);
         world_->GetWorld()->removeRigidBody(body_);
         delete body_;
         body_ = 0;
@@ -416,6 +473,13 @@ void EC_RigidBody::RemoveBody()
 
 void EC_RigidBody::getWorldTransform(btTransform &worldTrans) const
 {
+    // In the worker thread the placeable must not be accessed, use the transform captured before the step
+    if (world_ && world_->threadStepping_)
+    {
+        worldTrans = threadedWorldTransform_;
+        return;
+    }
+    
     EC_Placeable* placeable = placeable_.lock().get();
     if (!placeable)
         return;
@@ -433,65 +497,173 @@ void EC_RigidBody::setWorldTransform(const btTransform &worldTrans)
     if (!HasAuthority())
         return;
     
+    // Queue the update to be applied after the step. This coalesces the substeps and, in threaded mode, moves the
+    // update from the worker thread to the main thread
+    world_->QueueTransformUpdate(this, worldTrans);
+}
+
+void EC_RigidBody::ApplyWorldTransform(const btTransform &worldTrans, const btVector3 &linearVel, const btVector3 &angularVel, bool force)
+{
     EC_Placeable* placeable = placeable_.lock().get();
     if (!placeable)
         return;
     
+    // Skip changes too small to be visible, to not generate attribute change traffic for them
+    bool writeTransform = force || !hasWrittenTransform_;
+    if (!writeTransform)
+    {
+        float positionEpsilon = world_->GetPositionEpsilon();
+        writeTransform = worldTrans.getOrigin().distance2(lastWrittenTransform_.getOrigin()) >= positionEpsilon * positionEpsilon ||
+            fabs(worldTrans.getRotation().dot(lastWrittenTransform_.getRotation())) < world_->orientationEpsilonCos_;
+    }
+    
     // Important: disconnect our own response to attribute changes to not create an endless loop!
     disconnected_ = true;
     
-    // Set transform
-    float3 position = worldTrans.getOrigin();
-    Quat orientation = worldTrans.getRotation();
-    
-    // Non-parented case
-    if (placeable->parentRef.Get().IsEmpty())
-    {
-        Transform newTrans = placeable->transform.Get();
-        newTrans.SetPos(position.x, position.y, position.z);
-        newTrans.SetOrientation(orientation);
-        placeable->transform.Set(newTrans, AttributeChange::Default);
-    }
-    else
-    // The placeable has a parent itself
+    if (writeTransform)
     {
-        if (placeable->IsAttached())
+        lastWrittenTransform_ = worldTrans;
+        hasWrittenTransform_ = true;
+        
+        // Set linear & angular velocity along with the transform, so that they do not generate traffic of their own
+        linearVelocity.Set(linearVel, AttributeChange::Default);
+        angularVelocity.Set(float3(angularVel.x() * RADTODEG, angularVel.y() * RADTODEG, angularVel.z() * RADTODEG), AttributeChange::Default);
+        
+        // Set transform
+        float3 position = worldTrans.getOrigin();
+        Quat orientation = worldTrans.getRotation();
+        
+        // Non-parented case
+        if (placeable->parentRef.Get().IsEmpty())
         {
-            position = placeable->GetSceneNode()->convertWorldToLocalPosition(position);
-            orientation = placeable->GetSceneNode()->convertWorldToLocalOrientation(orientation);
-            
             Transform newTrans = placeable->transform.Get();
-            newTrans.SetPos(position);
+            newTrans.SetPos(position.x, position.y, position.z);
             newTrans.SetOrientation(orientation);
             placeable->transform.Set(newTrans, AttributeChange::Default);
         }
+        else
+        // The placeable has a parent itself
+        {
+            if (placeable->IsAttached() && !placeable->GetSceneNode())
+            {
+                // Without a view, there is no Ogre scene node to convert with, so let the placeable resolve the local transform from its parent.
+                placeable->SetWorldTransform(orientation, position, placeable->WorldScale());
+            }
+            else if (placeable->IsAttached())
+            {
+                position = placeable->GetSceneNode()->convertWorldToLocalPosition(position);
+                orientation = placeable->GetSceneNode()->convertWorldToLocalOrientation(orientation);
+                
+                Transform newTrans = placeable->transform.Get();
+                newTrans.SetPos(position);
+                newTrans.SetOrientation(orientation);
+                placeable->transform.Set(newTrans, AttributeChange::Default);
+            }
+        }
     }
-    // Set linear & angular velocity
-    if (body_)
-    {
-        linearVelocity.Set(body_->getLinearVelocity(), AttributeChange::Default);
-        const btVector3& angular = body_->getAngularVelocity();
-        angularVelocity.Set(float3(angular.x() * RADTODEG, angular.y() * RADTODEG, angular.z() * RADTODEG), AttributeChange::Default);
-    }
+
     
     disconnected_ = false;
 }
 
 void EC_RigidBody::OnTerrainRegenerated()
 {
-    if (shapeType.Get() == Shape_HeightField)
+    if (shapeType.Get() != Shape_HeightField)
+        return;
+
+    // The shape reads the heights straight from the terrain, and in-place edits are handled in OnTerrainHeightFieldChanged().
+    // Only a new height value store, i.e. a resized or reloaded terrain, requires recreating the shape.
+    EC_Terrain* terrain = terrain_.lock().get();
+    if (heightField_ && terrain && terrain->HeightField() == heightFieldData_)
+        return;
+
+    CreateCollisionShape();
+}
+
+void EC_RigidBody::OnTerrainHeightFieldChanged(int x, int y, int width, int height)
+{
+    if (shapeType.Get() != Shape_HeightField || !heightField_ || !heightFieldData_)
+        return;
+
+    // If the terrain has switched to a new store since the shape was created, the rectangle refers to the new one.
+    EC_Terrain* terrain = terrain_.lock().get();
+    if (!terrain || terrain->HeightField() != heightFieldData_)
+    {
+        CreateCollisionShape();
+        return;
+    }
+
+    float minY = heightFieldMinY_;
+    float maxY = heightFieldMaxY_;
+    for(int z = y; z < y + height; ++z)
+        for(int i = x; i < x + width; ++i)
+        {
+            float value = heightFieldData_->Height(i, z);
+            minY = std::min(minY, value);
+            maxY = std::max(maxY, value);
+        }
+
+    // The height range of a Bullet heightfield is fixed, so the shape has to be recreated if the edit goes outside it.
+    if (minY < heightFieldMinY_ || maxY > heightFieldMaxY_)
+    {
         CreateCollisionShape();
+        return;
+    }
+
+    if (!body_ || !world_)
+        return;
+
+    // The new heights are already visible to the shape. Wake up the bodies over the edited region, as they would not notice the change
+    // while asleep, and drop their cached contacts so that they are recomputed against the new surface. The region includes the
+    // triangles around the edited vertices, and the whole height range of the shape, since the old heights are no longer known.
+    WaitForSimulation();
+    btCompoundShape* compound = static_cast<btCompoundShape*>(shape_);
+    const btVector3 scale = heightField_->getLocalScaling();
+    const btVector3 center(0.5f * (heightFieldData_->width - 1), 0.5f * (heightFieldMinY_ + heightFieldMaxY_), 0.5f * (heightFieldData_->height - 1));
+    const btVector3 cornerA = (btVector3((float)(x - 1), heightFieldMinY_, (float)(y - 1)) - center) * scale;
+    const btVector3 cornerB = (btVector3((float)(x + width), heightFieldMaxY_, (float)(y + height)) - center) * scale;
+    btVector3 localMin = cornerA;
+    btVector3 localMax = cornerA;
+    localMin.setMin(cornerB);
+    localMax.setMax(cornerB);
+    btVector3 regionMin, regionMax;
+    btTransformAabb(localMin, localMax, heightField_->getMargin(), body_->getWorldTransform() * compound->getChildTransform(0), regionMin, regionMax);
+
+    btDispatcher* dispatcher = world_->GetWorld()->getDispatcher();
+    for(int i = 0; i < dispatcher->getNumManifolds(); ++i)
+    {
+        btPersistentManifold* manifold = dispatcher->getManifoldByIndexInternal(i);
+        btCollisionObject* objectA = static_cast<btCollisionObject*>(manifold->getBody0());
+        btCollisionObject* objectB = static_cast<btCollisionObject*>(manifold->getBody1());
+        btCollisionObject* other = (objectA == body_) ? objectB : ((objectB == body_) ? objectA : 0);
+        if (!other)
+            continue;
+
+        btVector3 otherMin, otherMax;
+        other->getCollisionShape()->getAabb(other->getWorldTransform(), otherMin, otherMax);
+        if (!TestAabbAgainstAabb2(regionMin, regionMax, otherMin, otherMax))
+            continue;
+
+        other->activate();
+        manifold->clearManifold();
+    }
+}
+
+void EC_RigidBody::OnTerrainHeightFieldAboutToChange()
+{
+    if (shapeType.Get() == Shape_HeightField && heightField_)
+        WaitForSimulation();
 }
 
 void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
 {
     OgreMeshAsset *meshAsset = dynamic_cast<OgreMeshAsset*>(asset.get());
-    if (!meshAsset || !meshAsset->ogreMesh.get())
+    // In headless mode, the Ogre mesh is created on demand when used for collision.
+    Ogre::Mesh *mesh = meshAsset ? meshAsset->GetOgreMesh().get() : 0;
+    if (!mesh)
         LogError("EC_RigidBody::OnCollisionMeshAssetLoaded: Mesh asset load finished for asset \"" +
             asset->Name() + "\", but Ogre::Mesh pointer was null!");
 
-    Ogre::Mesh *mesh = meshAsset->ogreMesh.get();
-
     if (mesh)
     {
         if (shapeType.Get() == Shape_TriMesh)
@@ -515,6 +687,8 @@ void EC_RigidBody::OnAttributeUpdated(IAttribute* attribute)
     if (disconnected_)
         return;
     
+    WaitForSimulation();
+    
     // Create body now if does not exist yet
     if (!body_)
         CreateBody();
@@ -629,10 +803,19 @@ void EC_RigidBody::OnAboutToUpdate()
     EC_Placeable* placeable = placeable_.lock().get();
     if (placeable && !placeable->parentRef.Get().IsEmpty() && placeable->IsAttached())
         UpdatePosRotFromPlaceable();
+    
+    // Bullet reads the transforms of kinematic bodies during the step. Capture them now if the step will run in the worker thread
+    if (world_ && world_->GetThreadedSimulation() && body_ && body_->isKinematicObject())
+    {
+        threadedWorldTransform_.setIdentity();
+        getWorldTransform(threadedWorldTransform_);
+    }
 }
 
 void EC_RigidBody::SetRotation(const float3& rotation)
 {
+    WaitForSimulation();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -661,6 +844,8 @@ void EC_RigidBody::SetRotation(const float3& rotation)
 
 void EC_RigidBody::Rotate(const float3& rotation)
 {
+    WaitForSimulation();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -689,6 +874,8 @@ void EC_RigidBody::Rotate(const float3& rotation)
 
 float3 EC_RigidBody::GetLinearVelocity()
 {
+    WaitForSimulation();
+    
     if (body_)
         return body_->getLinearVelocity();
     else 
@@ -697,6 +884,8 @@ float3 EC_RigidBody::GetLinearVelocity()
 
 float3 EC_RigidBody::GetAngularVelocity()
 {
+    WaitForSimulation();
+    
     if (body_)
         return body_->getAngularVelocity() * RADTODEG;
     else
@@ -705,6 +894,8 @@ float3 EC_RigidBody::GetAngularVelocity()
 
 void EC_RigidBody::GetAabbox(float3 &outAabbMin, float3 &outAabbMax)
 {
+    WaitForSimulation();
+    
     btVector3 aabbMin, aabbMax;
     body_->getAabb(aabbMin, aabbMax);
     outAabbMin.Set(aabbMin.x(), aabbMin.y(), aabbMin.z());
@@ -753,6 +944,8 @@ void EC_RigidBody::RequestMesh()
 
 void EC_RigidBody::UpdateScale()
 {
+    WaitForSimulation();
+    
    float3 sizeVec = size.Get();
     // Sanitize the size
     if (sizeVec.x < 0)
@@ -784,35 +977,44 @@ void EC_RigidBody::CreateHeightFieldFromTerrain()
     if (!terrain)
         return;
     
-    int width = terrain->PatchWidth() * EC_Terrain::cPatchSize;
-    int height = terrain->PatchHeight() * EC_Terrain::cPatchSize;
+    // The shape reads the heights directly from the height value store of the terrain, or from its mapped height map file,
+    // so nothing is copied.
+    heightFieldData_ = terrain->HeightField();
+    int width = heightFieldData_->width;
+    int height = heightFieldData_->height;
     
     if ((!width) || (!height))
+    {
+        heightFieldData_.reset();
         return;
-    
-    heightValues_.resize(width * height);
+    }
     
     float xzSpacing = 1.0f;
-    float ySpacing = 1.0f;
     float minY = 1000000000;
     float maxY = -1000000000;
-    for(uint z = 0; z < (uint)height; ++z)
-        for(uint x = 0; x < (uint)width; ++x)
-        {
-            float value = terrain->GetPoint(x, z);
-            if (value < minY)
-                minY = value;
-            if (value > maxY)
-                maxY = value;
-            heightValues_[z * width + x] = value;
-        }
+    const std::vector<float> &heights = heightFieldData_->heights;
+    if (heights.empty())
+    {
+        // The range of a mapped file is stored in its header, so the heights are not paged in for it.
+        minY = heightFieldData_->mappedMinHeight;
+        maxY = heightFieldData_->mappedMaxHeight;
+    }
+    for(size_t i = 0; i < heights.size(); ++i)
+    {
+        if (heights[i] < minY)
+            minY = heights[i];
+        if (heights[i] > maxY)
+            maxY = heights[i];
+    }
+    heightFieldMinY_ = minY;
+    heightFieldMaxY_ = maxY;
 
     float3 scale = terrain->nodeTransformation.Get().scale;
     float3 bbMin(0, minY, 0);
     float3 bbMax(xzSpacing * (width - 1), maxY, xzSpacing * (height - 1));
     float3 bbCenter = scale.Mul((bbMin + bbMax) * 0.5f);
     
-    heightField_ = new btHeightfieldTerrainShape(width, height, &heightValues_[0], ySpacing, minY, maxY, 1, PHY_FLOAT, false);
+    heightField_ = new TerrainHeightfieldShape(heightFieldData_.get(), minY, maxY);
     
     /** \todo EC_Terrain uses its own transform that is independent of the placeable. It is not nice to support, since rest of EC_RigidBody assumes
         the transform is in the placeable. Right now, we only support position & scaling. Here, we also counteract Bullet's nasty habit to center 
@@ -882,10 +1084,16 @@ void EC_RigidBody::GetProperties(btVector3& localInertia, float& m, int& collisi
 
 void EC_RigidBody::UpdatePosRotFromPlaceable()
 {
+    WaitForSimulation();
+    
     EC_Placeable* placeable = placeable_.lock().get();
     if (!placeable || !body_)
         return;
     
+    // The placeable transform overrides any simulated transform still waiting to be applied
+    world_->DiscardTransformUpdates(this);
+    hasWrittenTransform_ = false;
+    
     float3 position = placeable->WorldPosition();
     Quat orientation = placeable->WorldOrientation();
 
@@ -907,3 +1115,20 @@ void EC_RigidBody::EmitPhysicsCollision(Entity* otherEntity, const float3& posit
     emit PhysicsCollision(otherEntity, position, normal, distance, impulse, newCollision);
 }
 
+void EC_RigidBody::WaitForSimulation()
+{
+    if (world_)
+        world_->WaitForSimulation();
+}
+
+bool EC_RigidBody::HasCollisionListeners(u32 frameNumber)
+{
+    if (collisionListenerFrame_ != frameNumber)
+    {
+        // Script connections do not go through connectNotify(), so query the connection list instead
+        hasCollisionListeners_ = receivers(SIGNAL(PhysicsCollision(Entity*,float3,float3,float,float,bool))) > 0;
+        collisionListenerFrame_ = frameNumber;
+    }
+    return hasCollisionListeners_;
+}
+
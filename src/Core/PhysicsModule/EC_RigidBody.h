@@ -20,6 +20,7 @@ class btHeightfieldTerrainShape;
 
 class EC_Placeable;
 class EC_Terrain;
+struct TerrainHeightField;
 
 namespace Physics
 {
@@ -310,6 +311,7 @@ public slots:
     */
     void GetAabbox(float3 &outAabbMin, float3 &outAabbMax);
 
+    /// Returns the Bullet rigid body. If the physics world is stepped in a worker thread, call PhysicsWorld::WaitForSimulation() before accessing it.
     btRigidBody* GetRigidBody() const { return body_; }
     
     /// Return whether have authority. On the client, returns false for non-local objects.
@@ -337,6 +339,12 @@ private slots:
     /// Called when EC_Terrain has been regenerated
     void OnTerrainRegenerated();
 
+    /// Called when heights of EC_Terrain have been edited in place
+    void OnTerrainHeightFieldChanged(int x, int y, int width, int height);
+
+    /// Called before heights of EC_Terrain are edited in place. Waits for the threaded simulation step, which may be reading them
+    void OnTerrainHeightFieldAboutToChange();
+
     /// Called when collision mesh has been downloaded.
     void OnCollisionMeshAssetLoaded(AssetPtr asset);
 
@@ -376,9 +384,42 @@ private:
     /// Calculate mass, shape & static/dynamic-classification dependant properties
     void GetProperties(btVector3& localInertia, float& m, int& collisionFlags);
     
+    /// Write a simulated transform & velocities to the placeable and the velocity attributes. Called from PhysicsWorld once per frame after the simulation step
+    /** Changes below the position and orientation epsilons of the physics world are skipped, unless force is true.
+        The velocities are written only together with the transform. */
+    void ApplyWorldTransform(const btTransform &worldTrans, const btVector3 &linearVel, const btVector3 &angularVel, bool force);
+    
+    /// Block until the threaded simulation step has finished, so that the Bullet objects can be accessed
+    void WaitForSimulation();
+    
+    /// World transform for Bullet to read during a threaded simulation step, captured before the step starts
+    btTransform threadedWorldTransform_;
+    
+    /// Last transform written to the placeable by ApplyWorldTransform
+    btTransform lastWrittenTransform_;
+    
+    /// Whether lastWrittenTransform_ is valid. Reset when the transform is set from the placeable
+    bool hasWrittenTransform_;
+    
+    /// Index of this body's queued motion state update in PhysicsWorld, or -1 if none
+    int pendingTransformIndex_;
+    
+    /// Physics frame number on which this body was last listed as awake in PhysicsWorld
+    u32 awakeFrame_;
+    
     /// Emit a physics collision. Called from PhysicsWorld
     void EmitPhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
     
+    /// Returns whether anything is connected to the PhysicsCollision signal. Called from PhysicsWorld
+    /** The result is cached for the duration of a physics frame, so that the connection list is not inspected for each contact point. */
+    bool HasCollisionListeners(u32 frameNumber);
+    
+    /// Cached result of HasCollisionListeners
+    bool hasCollisionListeners_;
+    
+    /// Physics frame number for which hasCollisionListeners_ was last updated
+    u32 collisionListenerFrame_;
+    
     /// Placeable pointer
     boost::weak_ptr<EC_Placeable> placeable_;
     
@@ -417,8 +458,12 @@ private:
     /// Bullet heightfield shape. Note: this is always put inside a compound shape (shape_)
     btHeightfieldTerrainShape* heightField_;
     
-    /// Heightfield values, for the case the shape is a heightfield.
-    std::vector<float> heightValues_;
+    /// The height value store of the terrain that the heightfield shape reads from. Kept alive as long as the shape exists.
+    boost::shared_ptr<TerrainHeightField> heightFieldData_;
+
+    /// The height range the heightfield shape was created with. Bullet does not support changing it afterwards.
+    float heightFieldMinY_;
+    float heightFieldMaxY_;
 };
 
 
@@ -132,6 +132,8 @@ bool EC_VolumeTrigger::IsPivotInside(Entity *entity) const
     {
         const Transform& trans = placeable->transform.Get();
         const float3& pivot = trans.pos;
+        if (rigidbody->GetPhysicsWorld())
+            rigidbody->GetPhysicsWorld()->WaitForSimulation();
 
         return ( RayTestSingle(float3(pivot.x, pivot.y - 1e7f, pivot.z), pivot, rigidbody->GetRigidBody()) &&
                  RayTestSingle(float3(pivot.x, pivot.y + 1e7f, pivot.z), pivot, rigidbody->GetRigidBody()) );
@@ -148,6 +150,8 @@ bool EC_VolumeTrigger::IsInsideVolume(const float3& point) const
         LogWarning("Volume has no EC_RigidBody.");
         return false;
     }
+    if (rigidbody->GetPhysicsWorld())
+        rigidbody->GetPhysicsWorld()->WaitForSimulation();
 
     return RayTestSingle(float3(point.x, point.y - 1e7f, point.z), point, rigidbody->GetRigidBody()) &&
            RayTestSingle(float3(point.x, point.y + 1e7f, point.z), point, rigidbody->GetRigidBody());
@@ -172,6 +172,8 @@ void PhysicsModule::OnSceneAdded(const QString& name)
     
     boost::shared_ptr<PhysicsWorld> newWorld(new PhysicsWorld(scene, !scene->IsAuthority()));
     newWorld->SetGravity(scene->UpVector() * -9.81f);
+    if (framework_->HasCommandLineParameter("--physicsthread"))
+        newWorld->SetThreadedSimulation(true);
     physicsWorlds_[scene.get()] = newWorld;
     scene->setProperty(PhysicsWorld::PropertyName(), QVariant::fromValue<QObject*>(newWorld.get()));
 }
@@ -41,6 +41,9 @@ public:
     void Initialize();
     void Update(f64 frametime);
     void Uninitialize();
+
+    /// Steps the physics worlds after the network messages have been applied.
+    UpdatePhase Phase() const { return PhaseSimulation; }
    
     /// Get a Bullet triangle mesh corresponding to an Ogre mesh.
     /** If already has been generated, returns the previously created one
@@ -12,7 +12,9 @@
 #include "OgreWorld.h"
 #include "OgreBulletCollisionsDebugLines.h"
 #include "EC_RigidBody.h"
+#include "Entity.h"
 #include "Transform.h"
+#include "CoreMath.h"
 #include "Math/float3x4.h"
 #include "Math/AABB.h"
 #include "Math/OBB.h"
@@ -24,6 +26,11 @@
 
 #include <Ogre.h>
 
+#include <QtConcurrentRun>
+
+#include <algorithm>
+#include <cmath>
+
 namespace Physics
 {
 
@@ -48,7 +55,16 @@ PhysicsWorld::PhysicsWorld(ScenePtr scene, bool isClient) :
     drawDebugGeometry_(false),
     drawDebugManuallySet_(false),
     debugGeometryObject_(0),
-    debugDrawMode_(0)
+    debugDrawMode_(0),
+    collisionGeneration_(0),
+    frameNumber_(0),
+    collectCollisionReport_(false),
+    threadedSimulation_(false),
+    threadStepping_(false),
+    resultsPending_(false),
+    positionEpsilon_(0.0001f),
+    orientationEpsilon_(0.01f),
+    orientationEpsilonCos_(cos(0.01f * DEGTORAD * 0.5f))
 {
     collisionConfiguration_ = new btDefaultCollisionConfiguration();
     collisionDispatcher_ = new btCollisionDispatcher(collisionConfiguration_);
@@ -61,6 +77,8 @@ PhysicsWorld::PhysicsWorld(ScenePtr scene, bool isClient) :
 
 PhysicsWorld::~PhysicsWorld()
 {
+    WaitForSimulation();
+    
     delete world_;
     world_ = 0;
     
@@ -87,6 +105,7 @@ void PhysicsWorld::SetPhysicsUpdatePeriod(float updatePeriod)
 
 void PhysicsWorld::SetGravity(const float3& gravity)
 {
+    WaitForSimulation();
     world_->setGravity(gravity);
 }
 
@@ -102,6 +121,9 @@ btDiscreteDynamicsWorld* PhysicsWorld::GetWorld() const
 
 void PhysicsWorld::Simulate(f64 frametime)
 {
+    // In threaded mode, finish the step started on the previous frame and apply its results first
+    SyncSimulation();
+    
     if (!runPhysics_)
         return;
     
@@ -109,9 +131,37 @@ void PhysicsWorld::Simulate(f64 frametime)
     
     emit AboutToUpdate((float)frametime);
     
+    ++frameNumber_;
+    collisionReport_.clear();
+    collectCollisionReport_ = receivers(SIGNAL(CollisionReport(QVariantList))) > 0;
+    
     int maxSubSteps = (int)((1.0f / physicsUpdatePeriod_) / cMinFps);
-    world_->stepSimulation((float)frametime, maxSubSteps, physicsUpdatePeriod_);
-            
+    if (threadedSimulation_)
+    {
+        threadStepping_ = true;
+        resultsPending_ = true;
+        simulationFuture_ = QtConcurrent::run(this, &PhysicsWorld::StepSimulation, (float)frametime, maxSubSteps);
+        return;
+    }
+    
+    // The substeps have queued the transforms of the moving bodies, write them once for the whole step
+    StepSimulation((float)frametime, maxSubSteps);
+    ApplyTransformUpdates();
+    
+    if (collectCollisionReport_)
+        EmitCollisionReport();
+    
+    UpdateDebugDrawState();
+}
+
+void PhysicsWorld::StepSimulation(float frametime, int maxSubSteps)
+{
+    PROFILE(PhysicsWorld_StepSimulation);
+    world_->stepSimulation(frametime, maxSubSteps, physicsUpdatePeriod_);
+}
+
+void PhysicsWorld::UpdateDebugDrawState()
+{
     // Automatically enable debug geometry if at least one debug-enabled rigidbody. Automatically disable if no debug-enabled rigidbodies
     // However, do not do this if user has used the physicsdebug console command
     if (!drawDebugManuallySet_)
@@ -126,17 +176,180 @@ void PhysicsWorld::Simulate(f64 frametime)
         UpdateDebugGeometry();
 }
 
+void PhysicsWorld::WaitForSimulation()
+{
+    if (!threadStepping_)
+        return;
+    
+    PROFILE(PhysicsWorld_WaitForSimulation);
+    simulationFuture_.waitForFinished();
+    threadStepping_ = false;
+}
+
+bool PhysicsWorld::IsSimulating() const
+{
+    return threadStepping_ && !simulationFuture_.isFinished();
+}
+
+void PhysicsWorld::SyncSimulation()
+{
+    WaitForSimulation();
+    if (!resultsPending_)
+        return;
+    resultsPending_ = false;
+    
+    PROFILE(PhysicsWorld_SyncSimulation);
+    
+    ApplyTransformUpdates();
+    
+    if (!pendingSubsteps_.empty())
+    {
+        ProcessCollisions();
+        for(size_t i = 0; i < pendingSubsteps_.size(); ++i)
+            emit Updated(pendingSubsteps_[i]);
+        pendingSubsteps_.clear();
+    }
+    
+    if (collectCollisionReport_)
+        EmitCollisionReport();
+    
+    UpdateDebugDrawState();
+}
+
+void PhysicsWorld::ApplyTransformUpdates()
+{
+    PROFILE(PhysicsWorld_ApplyTransformUpdates);
+    
+    // The worker thread is idle now, so the buffers can be swapped without locking. The back buffer keeps its capacity for the next step
+    appliedTransforms_.swap(pendingTransforms_);
+    pendingTransforms_.clear();
+    for(size_t i = 0; i < appliedTransforms_.size(); ++i)
+        if (appliedTransforms_[i].body)
+            appliedTransforms_[i].body->pendingTransformIndex_ = -1;
+    
+    for(size_t i = 0; i < appliedTransforms_.size(); ++i)
+    {
+        // The body may have discarded its updates while we are applying them, as a response to the attribute changes
+        const RigidBodyTransformUpdate &update = appliedTransforms_[i];
+        if (update.body)
+            ApplyTransformUpdate(update.body, update.worldTransform, update.linearVelocity, update.angularVelocity);
+    }
+    appliedTransforms_.clear();
+    
+    // Bullet does not update the motion state of sleeping bodies. Write the exact final transform of the bodies
+    // that were moving on the previous frame but fell asleep, as the last movements may have been below the epsilon
+    for(size_t i = 0; i < awakeBodies_.size(); ++i)
+    {
+        EC_RigidBody* body = awakeBodies_[i];
+        if (!body || body->awakeFrame_ == frameNumber_ || !body->GetRigidBody())
+            continue;
+        if (body->GetRigidBody()->isActive())
+        {
+            body->awakeFrame_ = frameNumber_;
+            nextAwakeBodies_.push_back(body);
+        }
+        else
+            body->ApplyWorldTransform(body->GetRigidBody()->getWorldTransform(), btVector3(0.0f, 0.0f, 0.0f), btVector3(0.0f, 0.0f, 0.0f), true);
+    }
+    awakeBodies_.swap(nextAwakeBodies_);
+    nextAwakeBodies_.clear();
+}
+
+void PhysicsWorld::ApplyTransformUpdate(EC_RigidBody* body, const btTransform& worldTrans, const btVector3& linearVel, const btVector3& angularVel)
+{
+    // Listed before applying, as the body may be removed in response to the attribute changes, which also clears it from the list
+    if (body->awakeFrame_ != frameNumber_)
+    {
+        body->awakeFrame_ = frameNumber_;
+        nextAwakeBodies_.push_back(body);
+    }
+    body->ApplyWorldTransform(worldTrans, linearVel, angularVel, false);
+}
+
+void PhysicsWorld::SetPositionEpsilon(float epsilon)
+{
+    positionEpsilon_ = std::max(epsilon, 0.0f);
+}
+
+void PhysicsWorld::SetOrientationEpsilon(float epsilon)
+{
+    orientationEpsilon_ = std::max(epsilon, 0.0f);
+    orientationEpsilonCos_ = cos(orientationEpsilon_ * DEGTORAD * 0.5f);
+}
+
+void PhysicsWorld::SetThreadedSimulation(bool enable)
+{
+    if (enable == threadedSimulation_)
+        return;
+    
+    // Apply the results of the last threaded step before switching to synchronous stepping
+    SyncSimulation();
+    threadedSimulation_ = enable;
+}
+
+void PhysicsWorld::QueueTransformUpdate(EC_RigidBody* body, const btTransform& worldTrans)
+{
+    // Only the last update of a body during the frame is kept
+    if (body->pendingTransformIndex_ < 0)
+    {
+        body->pendingTransformIndex_ = (int)pendingTransforms_.size();
+        pendingTransforms_.push_back(RigidBodyTransformUpdate());
+    }
+    RigidBodyTransformUpdate &update = pendingTransforms_[body->pendingTransformIndex_];
+    update.body = body;
+    update.worldTransform = worldTrans;
+    update.linearVelocity = body->GetRigidBody()->getLinearVelocity();
+    update.angularVelocity = body->GetRigidBody()->getAngularVelocity();
+}
+
+void PhysicsWorld::DiscardTransformUpdates(EC_RigidBody* body, bool remove)
+{
+    if (body->pendingTransformIndex_ >= 0)
+    {
+        pendingTransforms_[body->pendingTransformIndex_].body = 0;
+        body->pendingTransformIndex_ = -1;
+    }
+    for(size_t i = 0; i < appliedTransforms_.size(); ++i)
+        if (appliedTransforms_[i].body == body)
+            appliedTransforms_[i].body = 0;
+    
+    if (remove)
+    {
+        std::replace(awakeBodies_.begin(), awakeBodies_.end(), body, (EC_RigidBody*)0);
+        std::replace(nextAwakeBodies_.begin(), nextAwakeBodies_.end(), body, (EC_RigidBody*)0);
+    }
+}
+
 void PhysicsWorld::ProcessPostTick(float substeptime)
+{
+    // In threaded mode we are in the worker thread. Defer the signals to the sync point on the main thread
+    if (threadStepping_)
+    {
+        pendingSubsteps_.push_back(substeptime);
+        return;
+    }
+    
+    ProcessCollisions();
+    
+    emit Updated(substeptime);
+}
+
+void PhysicsWorld::ProcessCollisions()
 {
     // Check contacts and send collision signals for them
     int numManifolds = collisionDispatcher_->getNumManifolds();
     
-    std::set<std::pair<btCollisionObject*, btCollisionObject*> > currentCollisions;
+    // Pairs still in contact are stamped with the current generation, the rest are dropped at the end
+    ++collisionGeneration_;
+    newCollisionPairs_.clear();
     
     if (numManifolds > 0)
     {
         PROFILE(PhysicsWorld_SendCollisions);
         
+        // Look up the connection status once per substep instead of for each contact point
+        const bool worldListeners = receivers(SIGNAL(PhysicsCollision(Entity*,Entity*,float3,float3,float,float,bool))) > 0;
+        
         for(int i = 0; i < numManifolds; ++i)
         {
             btPersistentManifold* contactManifold = collisionDispatcher_->getManifoldByIndexInternal(i);
@@ -146,11 +359,10 @@ void PhysicsWorld::ProcessPostTick(float substeptime)
             
             btCollisionObject* objectA = static_cast<btCollisionObject*>(contactManifold->getBody0());
             btCollisionObject* objectB = static_cast<btCollisionObject*>(contactManifold->getBody1());
-            std::pair<btCollisionObject*, btCollisionObject*> objectPair;
-            if (objectA < objectB)
-                objectPair = std::make_pair(objectA, objectB);
-            else
-                objectPair = std::make_pair(objectB, objectA);
+            CollisionPair objectPair;
+            objectPair.objectA = std::min(objectA, objectB);
+            objectPair.objectB = std::max(objectA, objectB);
+            objectPair.generation = collisionGeneration_;
             
             EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objectA->getUserPointer());
             EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objectB->getUserPointer());
@@ -173,7 +385,41 @@ void PhysicsWorld::ProcessPostTick(float substeptime)
             if (!objectA->isActive() && !objectB->isActive())
                 continue;
             
-            bool newCollision = previousCollisions_.find(objectPair) == previousCollisions_.end();
+            bool newCollision;
+            std::vector<CollisionPair>::iterator existing = std::lower_bound(collisionPairs_.begin(), collisionPairs_.end(), objectPair);
+            if (existing != collisionPairs_.end() && existing->objectA == objectPair.objectA && existing->objectB == objectPair.objectB)
+            {
+                newCollision = false;
+                existing->generation = collisionGeneration_;
+            }
+            else
+            {
+                // A pair may have several manifolds, so it is new only the first time it is seen in this substep.
+                // The new pairs are kept sorted for the lookup.
+                std::vector<CollisionPair>::iterator added = std::lower_bound(newCollisionPairs_.begin(), newCollisionPairs_.end(), objectPair);
+                newCollision = added == newCollisionPairs_.end() || added->objectA != objectPair.objectA || added->objectB != objectPair.objectB;
+                if (newCollision)
+                    newCollisionPairs_.insert(added, objectPair);
+            }
+            
+            if (collectCollisionReport_)
+            {
+                btManifoldPoint& point = contactManifold->getContactPoint(0);
+                CollisionReportItem item;
+                item.entityA = entityA->shared_from_this();
+                item.entityB = entityB->shared_from_this();
+                item.position = point.m_positionWorldOnB;
+                item.normal = point.m_normalWorldOnB;
+                item.distance = point.m_distance1;
+                item.impulse = point.m_appliedImpulse;
+                item.newCollision = newCollision;
+                collisionReport_.push_back(item);
+            }
+            
+            const bool listenersA = bodyA->HasCollisionListeners(frameNumber_);
+            const bool listenersB = bodyB->HasCollisionListeners(frameNumber_);
+            if (!worldListeners && !listenersA && !listenersB)
+                continue;
             
             for(int j = 0; j < numContacts; ++j)
             {
@@ -184,28 +430,70 @@ void PhysicsWorld::ProcessPostTick(float substeptime)
                 float distance = point.m_distance1;
                 float impulse = point.m_appliedImpulse;
                 
-                emit PhysicsCollision(entityA, entityB, position, normal, distance, impulse, newCollision);
-                bodyA->EmitPhysicsCollision(entityB, position, normal, distance, impulse, newCollision);
-                bodyB->EmitPhysicsCollision(entityA, position, normal, distance, impulse, newCollision);
+                if (worldListeners)
+                    emit PhysicsCollision(entityA, entityB, position, normal, distance, impulse, newCollision);
+                if (listenersA)
+                    bodyA->EmitPhysicsCollision(entityB, position, normal, distance, impulse, newCollision);
+                if (listenersB)
+                    bodyB->EmitPhysicsCollision(entityA, position, normal, distance, impulse, newCollision);
                 
                 // Report newCollision = true only for the first contact, in case there are several contacts, and application does some logic depending on it
                 // (for example play a sound -> avoid multiple sounds being played)
                 newCollision = false;
             }
-            
-            currentCollisions.insert(objectPair);
         }
     }
     
-    previousCollisions_ = currentCollisions;
+    // Drop the pairs that are no longer in contact, and merge in the new ones. The storage is reused, so after
+    // the first frames this does not allocate.
+    size_t numPairs = 0;
+    for(size_t i = 0; i < collisionPairs_.size(); ++i)
+        if (collisionPairs_[i].generation == collisionGeneration_)
+            collisionPairs_[numPairs++] = collisionPairs_[i];
+    collisionPairs_.resize(numPairs);
+    if (!newCollisionPairs_.empty())
+    {
+        collisionPairs_.insert(collisionPairs_.end(), newCollisionPairs_.begin(), newCollisionPairs_.end());
+        std::inplace_merge(collisionPairs_.begin(), collisionPairs_.begin() + numPairs, collisionPairs_.end());
+    }
+}
+
+void PhysicsWorld::EmitCollisionReport()
+{
+    PROFILE(PhysicsWorld_EmitCollisionReport);
+    
+    QVariantList collisions;
+    collisions.reserve((int)collisionReport_.size());
+    for(size_t i = 0; i < collisionReport_.size(); ++i)
+    {
+        const CollisionReportItem &item = collisionReport_[i];
+        // The entities may have been removed by the receivers of the Updated signal during the substeps
+        EntityPtr entityA = item.entityA.lock();
+        EntityPtr entityB = item.entityB.lock();
+        if (!entityA || !entityB)
+            continue;
+        
+        QVariantMap collision;
+        collision["entityA"] = QVariant::fromValue<QObject*>(entityA.get());
+        collision["entityB"] = QVariant::fromValue<QObject*>(entityB.get());
+        collision["position"] = QVariant::fromValue<float3>(item.position);
+        collision["normal"] = QVariant::fromValue<float3>(item.normal);
+        collision["distance"] = item.distance;
+        collision["impulse"] = item.impulse;
+        collision["newCollision"] = item.newCollision;
+        collisions.push_back(collision);
+    }
+    collisionReport_.clear();
     
-    emit Updated(substeptime);
+    emit CollisionReport(collisions);
 }
 
 PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3& direction, float maxdistance, int collisiongroup, int collisionmask)
 {
     PROFILE(PhysicsWorld_Raycast);
     
+    WaitForSimulation();
+    
     static PhysicsRaycastResult result;
     
     float3 normalizedDir = direction.Normalized();
@@ -237,6 +525,7 @@ PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3&
 
 void PhysicsWorld::SetDrawDebugGeometry(bool enable)
 {
+    WaitForSimulation();
     if (scene_.expired() || !scene_.lock()->ViewEnabled() || drawDebugGeometry_ == enable)
         return;
     OgreWorldPtr ogreWorld = scene_.lock()->GetWorld<OgreWorld>();
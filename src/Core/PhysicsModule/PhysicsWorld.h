@@ -9,10 +9,14 @@
 #include "Math/MathFwd.h"
 
 #include <LinearMath/btIDebugDraw.h>
+#include <LinearMath/btTransform.h>
 
 #include <set>
+#include <vector>
 #include <QObject>
 #include <QVector>
+#include <QVariant>
+#include <QFuture>
 
 #include <boost/enable_shared_from_this.hpp>
 
@@ -53,6 +57,38 @@ namespace Physics
 
 class PhysicsModule;
 
+/// A pair of collision objects in contact. The pointers are stored ordered, objectA < objectB.
+struct CollisionPair
+{
+    btCollisionObject* objectA;
+    btCollisionObject* objectB;
+    /// Internal substep number when the pair was last seen in contact.
+    u32 generation;
+
+    bool operator <(const CollisionPair &rhs) const { return objectA < rhs.objectA || (objectA == rhs.objectA && objectB < rhs.objectB); }
+};
+
+/// Motion state update of a rigid body, produced by a simulation step and applied once per frame after it.
+struct RigidBodyTransformUpdate
+{
+    EC_RigidBody* body;
+    btTransform worldTransform;
+    btVector3 linearVelocity;
+    btVector3 angularVelocity;
+};
+
+/// A single contact recorded for the batched collision report, see PhysicsWorld::CollisionReport.
+struct CollisionReportItem
+{
+    EntityWeakPtr entityA;
+    EntityWeakPtr entityB;
+    float3 position;
+    float3 normal;
+    float distance;
+    float impulse;
+    bool newCollision;
+};
+
 /// A physics world that encapsulates a Bullet physics world
 class PHYSICS_MODULE_API PhysicsWorld : public QObject, public btIDebugDraw, public boost::enable_shared_from_this<PhysicsWorld>
 {
@@ -66,11 +102,22 @@ public:
     virtual ~PhysicsWorld();
     
     /// Step the physics world. May trigger several internal simulation substeps, according to the deltatime given.
+    /** In threaded mode, first waits for the step started on the previous frame and applies its results, then starts the next step
+        in a worker thread and returns immediately. The physics results then lag one frame behind. */
     void Simulate(f64 frametime);
     
     /// Process collision from an internal sub-step (Bullet post-tick callback)
     void ProcessPostTick(float substeptime);
     
+    /// Blocks until the simulation step running in the worker thread has finished. Does nothing if not in threaded mode.
+    /** Must be called before accessing the Bullet world or its objects from the main thread. EC_RigidBody and the functions
+        of this class do it automatically. The results of the step are not applied until the next Simulate call. */
+    void WaitForSimulation();
+    
+    /// Returns true if a simulation step is running in the worker thread. Always false if not in threaded mode.
+    /** When this returns false, the effects of the finished step, such as its profiling data, are visible to the calling thread. */
+    bool IsSimulating() const;
+    
     /// Dynamic scene property name
     static const char* PropertyName() { return "physics"; }
     
@@ -92,9 +139,9 @@ public:
     /// IDebugDraw override
     virtual int getDebugMode() const { return debugDrawMode_; }
     
-    /// Returns the set of collisions that occurred during the previous frame.
-    /// \important Use this function only for debugging, the availability of this set data structure is not guaranteed in the future.
-    const std::set<std::pair<btCollisionObject*, btCollisionObject*> > &PreviousFrameCollisions() const { return previousCollisions_; }
+    /// Returns the collision pairs of the previous simulation substep, sorted by the object pointers.
+    /// \important Use this function only for debugging, the availability of this data structure is not guaranteed in the future.
+    const std::vector<CollisionPair> &PreviousFrameCollisions() const { return collisionPairs_; }
 
 public slots:
     /// Set physics update period (= length of each simulation step.) By default 1/60th of a second.
@@ -121,6 +168,7 @@ public slots:
     float3 GetGravity() const;
     
     /// Return the Bullet world object
+    /** In threaded mode, call WaitForSimulation() before accessing it. */
     btDiscreteDynamicsWorld* GetWorld() const;
     
     /// Return whether the physics world is for a client scene. Client scenes only simulate local entities' motion on their own.
@@ -138,6 +186,28 @@ public slots:
     /// Return whether simulation is on
     bool GetRunPhysics() const { return runPhysics_; }
     
+    /// Enable/disable stepping the simulation in a worker thread, overlapping it with the rest of the frame.
+    /** In threaded mode the Updated signal is emitted for each substep at the sync point on the main thread, after all substeps
+        have been simulated, and collisions are evaluated only once per frame. Disabled by default, enabled for all scenes with
+        the --physicsthread command line parameter. */
+    void SetThreadedSimulation(bool enable);
+    
+    /// Return whether the simulation is stepped in a worker thread
+    bool GetThreadedSimulation() const { return threadedSimulation_; }
+    
+    /// Set the smallest position change that is written back from the simulation to EC_Placeable. Default 0.0001 world units.
+    /** Smaller changes are accumulated until they exceed the epsilon, or the body falls asleep. */
+    void SetPositionEpsilon(float epsilon);
+    
+    /// Return the smallest position change that is written back from the simulation
+    float GetPositionEpsilon() const { return positionEpsilon_; }
+    
+    /// Set the smallest orientation change, in degrees, that is written back from the simulation to EC_Placeable. Default 0.01 degrees.
+    void SetOrientationEpsilon(float epsilon);
+    
+    /// Return the smallest orientation change, in degrees, that is written back from the simulation
+    float GetOrientationEpsilon() const { return orientationEpsilon_; }
+    
     // Debugging aids:
     ///\todo This is a temporary function, which will be removed in the future.
     void DrawAABB(const AABB &aabb, float r, float g, float b);
@@ -165,6 +235,13 @@ signals:
                 If collision has multiple contact points, newCollision can only be true for the first of them. */
     void PhysicsCollision(Entity* entityA, Entity* entityB, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
     
+    /// All collisions of the frame as one batch. Emitted once per frame after the simulation steps, and only if connected to.
+    /** This is a cheaper alternative to PhysicsCollision for scripts that process many collisions. Each item of the list is
+        a map with the keys entityA, entityB, position, normal, distance, impulse and newCollision. Only the first contact
+        point of each colliding pair is reported per substep.
+        @param collisions List of collisions. */
+    void CollisionReport(const QVariantList &collisions);
+    
     /// Emitted before the simulation steps. Note: emitted only once per frame, not before each substep.
     /** @param frametime Length of simulation steps */
     void AboutToUpdate(float frametime);
@@ -194,8 +271,87 @@ private:
     /// Parent scene
     SceneWeakPtr scene_;
     
-    /// Previous frame's collisions. We store these to know whether the collision was new or "ongoing"
-    std::set<std::pair<btCollisionObject*, btCollisionObject*> > previousCollisions_;
+    /// Collision pairs of the previous substep, sorted. We store these to know whether the collision was new or "ongoing"
+    std::vector<CollisionPair> collisionPairs_;
+    
+    /// Pairs first seen during the current substep, sorted and without duplicates. Reused between substeps to avoid allocations
+    std::vector<CollisionPair> newCollisionPairs_;
+    
+    /// Current substep number, used to stamp the collision pairs that are still in contact
+    u32 collisionGeneration_;
+    
+    /// Frame number, incremented in each Simulate call. Used to cache the collision listener status of rigid bodies
+    u32 frameNumber_;
+    
+    /// Collisions of the current frame, collected only if someone is connected to CollisionReport
+    std::vector<CollisionReportItem> collisionReport_;
+    
+    /// Whether the collisions of the current frame are being collected for CollisionReport
+    bool collectCollisionReport_;
+    
+    /// Emits CollisionReport from the collected collisions
+    void EmitCollisionReport();
+    
+    /// Sends the collision signals of the current contacts
+    void ProcessCollisions();
+    
+    /// Enables or disables debug geometry as needed, and updates it
+    void UpdateDebugDrawState();
+    
+    /// Runs the Bullet simulation step. Called in the worker thread in threaded mode
+    void StepSimulation(float frametime, int maxSubSteps);
+    
+    /// Waits for the threaded simulation step to finish, and applies its results on the main thread
+    void SyncSimulation();
+    
+    /// Writes the queued motion state updates to the rigid bodies, and a final update for the bodies that fell asleep
+    void ApplyTransformUpdates();
+    
+    /// Writes a motion state update to a rigid body and lists the body as awake
+    void ApplyTransformUpdate(EC_RigidBody* body, const btTransform& worldTrans, const btVector3& linearVel, const btVector3& angularVel);
+    
+    /// Queues a motion state update, replacing an earlier update of the same body during the step. Called by EC_RigidBody
+    void QueueTransformUpdate(EC_RigidBody* body, const btTransform& worldTrans);
+    
+    /// Drops the queued motion state updates of a rigid body, e.g. when it is removed or teleported. Called by EC_RigidBody
+    /** If remove is true, the body is also forgotten from the list of awake bodies. */
+    void DiscardTransformUpdates(EC_RigidBody* body, bool remove = false);
+    
+    /// Whether the simulation is stepped in a worker thread
+    bool threadedSimulation_;
+    
+    /// True while a simulation step may be running in the worker thread. Bullet callbacks use this to know they must not touch the scene
+    bool threadStepping_;
+    
+    /// True when a finished threaded step has results that have not yet been applied
+    bool resultsPending_;
+    
+    /// The simulation step running in the worker thread
+    QFuture<void> simulationFuture_;
+    
+    /// Motion state updates written during a step, at most one per body
+    std::vector<RigidBodyTransformUpdate> pendingTransforms_;
+    
+    /// Motion state updates being applied on the main thread. Swapped with pendingTransforms_ after the step
+    std::vector<RigidBodyTransformUpdate> appliedTransforms_;
+    
+    /// Bodies that received motion state updates on the previous frame. Used to send a final update when they fall asleep
+    std::vector<EC_RigidBody*> awakeBodies_;
+    
+    /// Awake bodies of the current frame, swapped with awakeBodies_
+    std::vector<EC_RigidBody*> nextAwakeBodies_;
+    
+    /// Smallest position change written back to the placeables
+    float positionEpsilon_;
+    
+    /// Smallest orientation change written back to the placeables, in degrees
+    float orientationEpsilon_;
+    
+    /// Cosine of half of orientationEpsilon_, compared against the quaternion dot product
+    float orientationEpsilonCos_;
+    
+    /// Lengths of the substeps taken by the threaded step, for emitting the Updated signals at the sync point
+    std::vector<float> pendingSubsteps_;
     
     /// Update debug geometry manual object, if physics debug drawing is on
     void UpdateDebugGeometry();
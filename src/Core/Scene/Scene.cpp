@@ -204,6 +204,12 @@ void Scene::ChangeEntityId(entity_id_t old_id, entity_id_t new_id)
     old_entity->SetNewId(old_id);
     entities_.erase(old_id);
     entities_[new_id] = old_entity;
+
+    if (spatialIndex_.Contains(old_id))
+    {
+        spatialIndex_.Update(new_id, spatialIndex_.Bounds(old_id));
+        spatialIndex_.Remove(old_id);
+    }
 }
 
 void Scene::RemoveEntity(entity_id_t id, AttributeChange::Type change)
@@ -216,6 +222,7 @@ void Scene::RemoveEntity(entity_id_t id, AttributeChange::Type change)
         EmitEntityRemoved(del_entity.get(), change);
 
         entities_.erase(it);
+        spatialIndex_.Remove(id);
         // If entity somehow manages to live, at least it doesn't belong to the scene anymore
         del_entity->SetScene(0);
         del_entity.reset();
@@ -239,6 +246,7 @@ void Scene::RemoveAllEntities(bool send_events, AttributeChange::Type change)
         ++it;
     }
     entities_.clear();
+    spatialIndex_.Clear();
     if (send_events)
         emit SceneCleared(this);
 }
@@ -271,6 +279,51 @@ EntityList Scene::GetAllEntities() const
     return entities;
 }
 
+EntityList Scene::EntitiesInRadius(const float3 &center, float radius) const
+{
+    PROFILE(Scene_EntitiesInRadius);
+    std::vector<entity_id_t> ids;
+    spatialIndex_.QuerySphere(center, radius, ids);
+    return EntitiesFromIds(ids);
+}
+
+EntityList Scene::EntitiesInAABB(const AABB &aabb) const
+{
+    PROFILE(Scene_EntitiesInAABB);
+    std::vector<entity_id_t> ids;
+    spatialIndex_.QueryAABB(aabb, ids);
+    return EntitiesFromIds(ids);
+}
+
+EntityList Scene::EntitiesInFrustum(const Frustum &frustum) const
+{
+    PROFILE(Scene_EntitiesInFrustum);
+    std::vector<entity_id_t> ids;
+    spatialIndex_.QueryFrustum(frustum, ids);
+    return EntitiesFromIds(ids);
+}
+
+EntityList Scene::NearestEntities(const float3 &point, int count, float maxDistance) const
+{
+    PROFILE(Scene_NearestEntities);
+    std::vector<entity_id_t> ids;
+    if (count > 0)
+        spatialIndex_.QueryNearest(point, (size_t)count, ids, maxDistance);
+    return EntitiesFromIds(ids);
+}
+
+EntityList Scene::EntitiesFromIds(const std::vector<entity_id_t> &ids) const
+{
+    EntityList entities;
+    for(size_t i = 0; i < ids.size(); ++i)
+    {
+        EntityMap::const_iterator it = entities_.find(ids[i]);
+        if (it != entities_.end())
+            entities.push_back(it->second);
+    }
+    return entities;
+}
+
 void Scene::EmitComponentAdded(Entity* entity, IComponent* comp, AttributeChange::Type change)
 {
     if (change == AttributeChange::Disconnected)
@@ -7,6 +7,8 @@
 #include "AttributeChangeType.h"
 #include "EntityAction.h"
 #include "SceneDesc.h"
+#include "SpatialIndex.h"
+#include "TransformHierarchy.h"
 #include "Math/float3.h"
 #include "ChangeRequest.h"
 
@@ -90,6 +92,16 @@ public:
         return rawPtr ? rawPtr->shared_from_this() : boost::shared_ptr<T>();
     }
 
+    /// Returns the spatial index of the entity bounds in this scene.
+    /** The bounds are maintained by EC_Placeable. Entities without a placeable are not indexed. */
+    SpatialIndex &GetSpatialIndex() { return spatialIndex_; }
+    const SpatialIndex &GetSpatialIndex() const { return spatialIndex_; }
+
+    /// Returns the renderer-independent transform hierarchy of this scene.
+    /** Used by EC_Placeable to compute the world transforms when the scene has no view. */
+    TransformHierarchy &GetTransformHierarchy() { return transformHierarchy_; }
+    const TransformHierarchy &GetTransformHierarchy() const { return transformHierarchy_; }
+
 public slots:
     /// Creates new entity that contains the specified components.
     /** Entities should never be created directly, but instead created with this function.
@@ -238,6 +250,20 @@ public slots:
     /// Returns all entities as a list for scripting
     EntityList GetAllEntities() const;
 
+    /// Returns entities whose world space bounds intersect the given sphere.
+    /** @note Only entities with an EC_Placeable are indexed spatially. */
+    EntityList EntitiesInRadius(const float3 &center, float radius) const;
+
+    /// Returns entities whose world space bounds intersect the given axis-aligned box.
+    EntityList EntitiesInAABB(const AABB &aabb) const;
+
+    /// Returns entities whose world space bounds intersect the given perspective frustum.
+    EntityList EntitiesInFrustum(const Frustum &frustum) const;
+
+    /// Returns at most count entities nearest to the given point, ordered by ascending distance.
+    /** @param maxDistance If positive, entities further away than this are not returned. */
+    EntityList NearestEntities(const float3 &point, int count, float maxDistance = -1.f) const;
+
     /// Emits notification of an attribute changing. Called by IComponent.
     /** @param comp Component pointer
         @param attribute Attribute pointer
@@ -453,6 +479,9 @@ private:
         @param authority Whether the scene has authority ie. a singleuser or server scene, false for network client scenes */
     Scene(const QString &name, Framework *fw, bool viewEnabled, bool authority);
 
+    /// Resolves a list of entity ids returned by the spatial index.
+    EntityList EntitiesFromIds(const std::vector<entity_id_t> &ids) const;
+
     uint gid_; ///< Current global id for networked entities
     uint gid_local_; ///< Current id for local entities.
     EntityMap entities_; ///< All entities in the scene.
@@ -462,4 +491,6 @@ private:
     bool interpolating_; ///< Currently doing interpolation-flag.
     bool authority_; ///< Authority -flag
     std::vector<AttributeInterpolation> interpolations_; ///< Running attribute interpolations.
+    SpatialIndex spatialIndex_; ///< Bounds of the placeable entities for spatial queries.
+    TransformHierarchy transformHierarchy_; ///< Transforms of the placeables when the view is disabled.
 };
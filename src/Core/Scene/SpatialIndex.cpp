@@ -0,0 +1,488 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "SpatialIndex.h"
+#include "Math/Frustum.h"
+#include "Math/Plane.h"
+
+#include <queue>
+#include <functional>
+#include <utility>
+#include <algorithm>
+#include <limits>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+    AABB Union(const AABB &a, const AABB &b)
+    {
+        AABB u = a;
+        u.Enclose(b);
+        return u;
+    }
+
+    bool Overlaps(const AABB &a, const AABB &b)
+    {
+        return a.minPoint.x <= b.maxPoint.x && a.maxPoint.x >= b.minPoint.x &&
+            a.minPoint.y <= b.maxPoint.y && a.maxPoint.y >= b.minPoint.y &&
+            a.minPoint.z <= b.maxPoint.z && a.maxPoint.z >= b.minPoint.z;
+    }
+
+    float DistanceSq(const AABB &box, const float3 &point)
+    {
+        return box.ClosestPoint(point).DistanceSq(point);
+    }
+
+    /// Tests the box against outward-facing planes. Returns false if the box is fully outside any of them.
+    bool InsidePlanes(const AABB &box, const Plane *planes, int numPlanes)
+    {
+        for(int i = 0; i < numPlanes; ++i)
+        {
+            const float3 &n = planes[i].normal;
+            // The corner that is furthest along the inward direction
+            float3 p(n.x > 0.f ? box.minPoint.x : box.maxPoint.x,
+                     n.y > 0.f ? box.minPoint.y : box.maxPoint.y,
+                     n.z > 0.f ? box.minPoint.z : box.maxPoint.z);
+            if (planes[i].SignedDistance(p) > 0.f)
+                return false;
+        }
+        return true;
+    }
+}
+
+SpatialIndex::SpatialIndex() :
+    root_(-1),
+    freeList_(-1),
+    margin_(0.5f)
+{
+}
+
+bool SpatialIndex::Update(entity_id_t id, const AABB &bounds)
+{
+    if (!bounds.IsFinite())
+    {
+        Remove(id);
+        return false;
+    }
+
+    const float3 margin(margin_, margin_, margin_);
+    std::map<entity_id_t, int>::iterator iter = leaves_.find(id);
+    if (iter != leaves_.end())
+    {
+        int leaf = iter->second;
+        nodes_[leaf].bounds = bounds;
+        if (nodes_[leaf].fatBounds.Contains(bounds))
+            return false;
+
+        RemoveLeaf(leaf);
+        nodes_[leaf].fatBounds = AABB(bounds.minPoint - margin, bounds.maxPoint + margin);
+        InsertLeaf(leaf);
+        return true;
+    }
+
+    int leaf = AllocateNode();
+    nodes_[leaf].id = id;
+    nodes_[leaf].bounds = bounds;
+    nodes_[leaf].fatBounds = AABB(bounds.minPoint - margin, bounds.maxPoint + margin);
+    leaves_[id] = leaf;
+    InsertLeaf(leaf);
+    return true;
+}
+
+void SpatialIndex::Remove(entity_id_t id)
+{
+    std::map<entity_id_t, int>::iterator iter = leaves_.find(id);
+    if (iter == leaves_.end())
+        return;
+
+    int leaf = iter->second;
+    leaves_.erase(iter);
+    RemoveLeaf(leaf);
+    FreeNode(leaf);
+}
+
+void SpatialIndex::Clear()
+{
+    nodes_.clear();
+    leaves_.clear();
+    root_ = -1;
+    freeList_ = -1;
+}
+
+AABB SpatialIndex::Bounds(entity_id_t id) const
+{
+    std::map<entity_id_t, int>::const_iterator iter = leaves_.find(id);
+    if (iter == leaves_.end())
+        return AABB(float3::zero, float3::zero);
+    return nodes_[iter->second].bounds;
+}
+
+void SpatialIndex::QueryAABB(const AABB &aabb, std::vector<entity_id_t> &result) const
+{
+    if (root_ == -1)
+        return;
+
+    std::vector<int> stack;
+    stack.reserve(64);
+    stack.push_back(root_);
+    while(!stack.empty())
+    {
+        const Node &node = nodes_[stack.back()];
+        stack.pop_back();
+        if (!Overlaps(node.fatBounds, aabb))
+            continue;
+        if (node.IsLeaf())
+        {
+            if (Overlaps(node.bounds, aabb))
+                result.push_back(node.id);
+        }
+        else
+        {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+void SpatialIndex::QuerySphere(const float3 &center, float radius, std::vector<entity_id_t> &result) const
+{
+    if (root_ == -1 || radius < 0.f)
+        return;
+
+    const float radiusSq = radius * radius;
+    std::vector<int> stack;
+    stack.reserve(64);
+    stack.push_back(root_);
+    while(!stack.empty())
+    {
+        const Node &node = nodes_[stack.back()];
+        stack.pop_back();
+        if (DistanceSq(node.fatBounds, center) > radiusSq)
+            continue;
+        if (node.IsLeaf())
+        {
+            if (DistanceSq(node.bounds, center) <= radiusSq)
+                result.push_back(node.id);
+        }
+        else
+        {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+void SpatialIndex::QueryFrustum(const Frustum &frustum, std::vector<entity_id_t> &result) const
+{
+    if (root_ == -1)
+        return;
+
+    Plane planes[6];
+    for(int i = 0; i < 6; ++i)
+        planes[i] = frustum.GetPlane(i);
+
+    std::vector<int> stack;
+    stack.reserve(64);
+    stack.push_back(root_);
+    while(!stack.empty())
+    {
+        const Node &node = nodes_[stack.back()];
+        stack.pop_back();
+        if (!InsidePlanes(node.fatBounds, planes, 6))
+            continue;
+        if (node.IsLeaf())
+        {
+            if (InsidePlanes(node.bounds, planes, 6))
+                result.push_back(node.id);
+        }
+        else
+        {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+void SpatialIndex::QueryNearest(const float3 &point, size_t k, std::vector<entity_id_t> &result, float maxDistance) const
+{
+    if (root_ == -1 || k == 0)
+        return;
+
+    const float maxDistanceSq = (maxDistance >= 0.f) ? maxDistance * maxDistance : std::numeric_limits<float>::infinity();
+
+    // Best-first traversal. Internal nodes are keyed by the distance to their fattened bounds, which is a lower bound
+    // for the distance of every leaf below them, so leaves come out of the queue in ascending distance order.
+    typedef std::pair<float, int> QueueItem;
+    std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem> > queue;
+    queue.push(QueueItem(DistanceSq(nodes_[root_].IsLeaf() ? nodes_[root_].bounds : nodes_[root_].fatBounds, point), root_));
+
+    size_t found = 0;
+    while(!queue.empty() && found < k)
+    {
+        QueueItem item = queue.top();
+        queue.pop();
+        if (item.first > maxDistanceSq)
+            break;
+
+        const Node &node = nodes_[item.second];
+        if (node.IsLeaf())
+        {
+            result.push_back(node.id);
+            ++found;
+            continue;
+        }
+
+        const Node &child1 = nodes_[node.child1];
+        const Node &child2 = nodes_[node.child2];
+        queue.push(QueueItem(DistanceSq(child1.IsLeaf() ? child1.bounds : child1.fatBounds, point), node.child1));
+        queue.push(QueueItem(DistanceSq(child2.IsLeaf() ? child2.bounds : child2.fatBounds, point), node.child2));
+    }
+}
+
+int SpatialIndex::AllocateNode()
+{
+    int node;
+    if (freeList_ == -1)
+    {
+        nodes_.push_back(Node());
+        node = (int)nodes_.size() - 1;
+    }
+    else
+    {
+        node = freeList_;
+        freeList_ = nodes_[node].parent;
+    }
+
+    Node &n = nodes_[node];
+    n.parent = -1;
+    n.child1 = -1;
+    n.child2 = -1;
+    n.height = 0;
+    n.id = 0;
+    return node;
+}
+
+void SpatialIndex::FreeNode(int node)
+{
+    nodes_[node].parent = freeList_;
+    nodes_[node].height = -1;
+    freeList_ = node;
+}
+
+void SpatialIndex::InsertLeaf(int leaf)
+{
+    if (root_ == -1)
+    {
+        root_ = leaf;
+        nodes_[root_].parent = -1;
+        return;
+    }
+
+    // Find the best sibling for the new leaf using the surface area heuristic
+    const AABB leafBounds = nodes_[leaf].fatBounds;
+    int index = root_;
+    while(!nodes_[index].IsLeaf())
+    {
+        const Node &node = nodes_[index];
+        float area = node.fatBounds.SurfaceArea();
+        float combinedArea = Union(node.fatBounds, leafBounds).SurfaceArea();
+
+        // Cost of creating a new parent for this node and the new leaf
+        float cost = 2.f * combinedArea;
+        // Minimum cost of pushing the leaf further down the tree
+        float inheritanceCost = 2.f * (combinedArea - area);
+
+        const Node &child1 = nodes_[node.child1];
+        float cost1 = Union(leafBounds, child1.fatBounds).SurfaceArea() + inheritanceCost;
+        if (!child1.IsLeaf())
+            cost1 -= child1.fatBounds.SurfaceArea();
+
+        const Node &child2 = nodes_[node.child2];
+        float cost2 = Union(leafBounds, child2.fatBounds).SurfaceArea() + inheritanceCost;
+        if (!child2.IsLeaf())
+            cost2 -= child2.fatBounds.SurfaceArea();
+
+        if (cost < cost1 && cost < cost2)
+            break;
+
+        index = (cost1 < cost2) ? node.child1 : node.child2;
+    }
+
+    int sibling = index;
+    int oldParent = nodes_[sibling].parent;
+    int newParent = AllocateNode(); // Note: may reallocate nodes_, so no references are held across this call.
+    nodes_[newParent].parent = oldParent;
+    nodes_[newParent].fatBounds = Union(leafBounds, nodes_[sibling].fatBounds);
+    nodes_[newParent].height = nodes_[sibling].height + 1;
+    nodes_[newParent].child1 = sibling;
+    nodes_[newParent].child2 = leaf;
+    nodes_[sibling].parent = newParent;
+    nodes_[leaf].parent = newParent;
+
+    if (oldParent != -1)
+    {
+        if (nodes_[oldParent].child1 == sibling)
+            nodes_[oldParent].child1 = newParent;
+        else
+            nodes_[oldParent].child2 = newParent;
+    }
+    else
+        root_ = newParent;
+
+    // Walk back up the tree fixing heights and bounds
+    index = nodes_[leaf].parent;
+    while(index != -1)
+    {
+        index = Balance(index);
+        Node &node = nodes_[index];
+        node.height = 1 + std::max(nodes_[node.child1].height, nodes_[node.child2].height);
+        node.fatBounds = Union(nodes_[node.child1].fatBounds, nodes_[node.child2].fatBounds);
+        index = node.parent;
+    }
+}
+
+void SpatialIndex::RemoveLeaf(int leaf)
+{
+    if (leaf == root_)
+    {
+        root_ = -1;
+        return;
+    }
+
+    int parent = nodes_[leaf].parent;
+    int grandParent = nodes_[parent].parent;
+    int sibling = (nodes_[parent].child1 == leaf) ? nodes_[parent].child2 : nodes_[parent].child1;
+
+    if (grandParent != -1)
+    {
+        // Replace the parent with the sibling
+        if (nodes_[grandParent].child1 == parent)
+            nodes_[grandParent].child1 = sibling;
+        else
+            nodes_[grandParent].child2 = sibling;
+        nodes_[sibling].parent = grandParent;
+        FreeNode(parent);
+
+        int index = grandParent;
+        while(index != -1)
+        {
+            index = Balance(index);
+            Node &node = nodes_[index];
+            node.height = 1 + std::max(nodes_[node.child1].height, nodes_[node.child2].height);
+            node.fatBounds = Union(nodes_[node.child1].fatBounds, nodes_[node.child2].fatBounds);
+            index = node.parent;
+        }
+    }
+    else
+    {
+        root_ = sibling;
+        nodes_[sibling].parent = -1;
+        FreeNode(parent);
+    }
+}
+
+int SpatialIndex::Balance(int iA)
+{
+    Node &A = nodes_[iA];
+    if (A.IsLeaf() || A.height < 2)
+        return iA;
+
+    int iB = A.child1;
+    int iC = A.child2;
+    Node &B = nodes_[iB];
+    Node &C = nodes_[iC];
+    int balance = C.height - B.height;
+
+    // Rotate C up
+    if (balance > 1)
+    {
+        int iF = C.child1;
+        int iG = C.child2;
+        Node &F = nodes_[iF];
+        Node &G = nodes_[iG];
+
+        C.child1 = iA;
+        C.parent = A.parent;
+        A.parent = iC;
+        if (C.parent != -1)
+        {
+            if (nodes_[C.parent].child1 == iA)
+                nodes_[C.parent].child1 = iC;
+            else
+                nodes_[C.parent].child2 = iC;
+        }
+        else
+            root_ = iC;
+
+        if (F.height > G.height)
+        {
+            C.child2 = iF;
+            A.child2 = iG;
+            G.parent = iA;
+            A.fatBounds = Union(B.fatBounds, G.fatBounds);
+            C.fatBounds = Union(A.fatBounds, F.fatBounds);
+            A.height = 1 + std::max(B.height, G.height);
+            C.height = 1 + std::max(A.height, F.height);
+        }
+        else
+        {
+            C.child2 = iG;
+            A.child2 = iF;
+            F.parent = iA;
+            A.fatBounds = Union(B.fatBounds, F.fatBounds);
+            C.fatBounds = Union(A.fatBounds, G.fatBounds);
+            A.height = 1 + std::max(B.height, F.height);
+            C.height = 1 + std::max(A.height, G.height);
+        }
+        return iC;
+    }
+
+    // Rotate B up
+    if (balance < -1)
+    {
+        int iD = B.child1;
+        int iE = B.child2;
+        Node &D = nodes_[iD];
+        Node &E = nodes_[iE];
+
+        B.child1 = iA;
+        B.parent = A.parent;
+        A.parent = iB;
+        if (B.parent != -1)
+        {
+            if (nodes_[B.parent].child1 == iA)
+                nodes_[B.parent].child1 = iB;
+            else
+                nodes_[B.parent].child2 = iB;
+        }
+        else
+            root_ = iB;
+
+        if (D.height > E.height)
+        {
+            B.child2 = iD;
+            A.child1 = iE;
+            E.parent = iA;
+            A.fatBounds = Union(C.fatBounds, E.fatBounds);
+            B.fatBounds = Union(A.fatBounds, D.fatBounds);
+            A.height = 1 + std::max(C.height, E.height);
+            B.height = 1 + std::max(A.height, D.height);
+        }
+        else
+        {
+            B.child2 = iE;
+            A.child1 = iD;
+            D.parent = iA;
+            A.fatBounds = Union(C.fatBounds, D.fatBounds);
+            B.fatBounds = Union(A.fatBounds, E.fatBounds);
+            A.height = 1 + std::max(C.height, D.height);
+            B.height = 1 + std::max(A.height, E.height);
+        }
+        return iB;
+    }
+
+    return iA;
+}
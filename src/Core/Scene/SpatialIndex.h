@@ -0,0 +1,88 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "Math/AABB.h"
+#include "Math/float3.h"
+#include "Math/MathFwd.h"
+
+#include <vector>
+#include <map>
+
+/// Dynamic AABB tree of entity bounds, used for spatial queries over a Scene.
+/** Each indexed entity is stored as a leaf holding its tight world space bounds. The internal nodes use bounds that are
+    fattened by a margin, so that small per-frame movements of an entity do not require restructuring the tree.
+    Does not depend on the renderer, so it works in headless mode as well.
+
+    The index is owned by the Scene, see Scene::GetSpatialIndex(). The bounds are fed in by EC_Placeable whenever its
+    world transform or the attached geometry changes.
+    \ingroup Scene_group */
+class SpatialIndex
+{
+public:
+    SpatialIndex();
+
+    /// Inserts or updates the world space bounds of an entity.
+    /** @return true if the tree structure had to be modified, false if the new bounds still fit the previous fattened node. */
+    bool Update(entity_id_t id, const AABB &bounds);
+
+    /// Removes an entity from the index. Does nothing if the entity is not indexed.
+    void Remove(entity_id_t id);
+
+    /// Removes all entities from the index.
+    void Clear();
+
+    /// Returns whether the entity is indexed.
+    bool Contains(entity_id_t id) const { return leaves_.find(id) != leaves_.end(); }
+
+    /// Returns the tight world space bounds of an indexed entity, or a degenerate AABB if not indexed.
+    AABB Bounds(entity_id_t id) const;
+
+    /// Returns the number of indexed entities.
+    size_t Size() const { return leaves_.size(); }
+
+    /// Appends the ids of all entities whose bounds intersect the given AABB to result.
+    void QueryAABB(const AABB &aabb, std::vector<entity_id_t> &result) const;
+
+    /// Appends the ids of all entities whose bounds intersect the given sphere to result.
+    void QuerySphere(const float3 &center, float radius, std::vector<entity_id_t> &result) const;
+
+    /// Appends the ids of all entities whose bounds intersect the given perspective frustum to result.
+    /** The test is conservative: entities near the frustum corners may be reported even if they are just outside. */
+    void QueryFrustum(const Frustum &frustum, std::vector<entity_id_t> &result) const;
+
+    /// Appends the ids of the at most k entities whose bounds are nearest to the given point to result, closest first.
+    /** @param maxDistance If positive, entities further away than this are not reported. */
+    void QueryNearest(const float3 &point, size_t k, std::vector<entity_id_t> &result, float maxDistance = -1.f) const;
+
+    /// Margin by which the bounds of the internal nodes are enlarged. Default 0.5 world units.
+    void SetMargin(float margin) { margin_ = margin; }
+    float Margin() const { return margin_; }
+
+private:
+    struct Node
+    {
+        AABB fatBounds; ///< Bounds used for the tree traversal. For leaves these are the tight bounds grown by the margin.
+        AABB bounds; ///< Tight bounds of the entity. Only valid for leaves.
+        int parent; ///< Parent node index, or the next free node index when the node is in the free list.
+        int child1; ///< First child, or -1 for leaves.
+        int child2; ///< Second child, or -1 for leaves.
+        int height; ///< Height of the subtree, 0 for leaves, -1 for free nodes.
+        entity_id_t id; ///< Entity id of a leaf.
+
+        bool IsLeaf() const { return child1 == -1; }
+    };
+
+    int AllocateNode();
+    void FreeNode(int node);
+    void InsertLeaf(int leaf);
+    void RemoveLeaf(int leaf);
+    int Balance(int node);
+
+    std::vector<Node> nodes_;
+    std::map<entity_id_t, int> leaves_; ///< Maps entity ids to leaf node indices.
+    int root_;
+    int freeList_;
+    float margin_;
+};
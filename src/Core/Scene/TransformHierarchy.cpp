@@ -0,0 +1,116 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TransformHierarchy.h"
+
+#include <cassert>
+
+#include "MemoryLeakCheck.h"
+
+TransformHierarchy::TransformHierarchy() :
+    freeList_(-1),
+    numFree_(0)
+{
+}
+
+int TransformHierarchy::CreateNode()
+{
+    int node;
+    if (freeList_ != -1)
+    {
+        node = freeList_;
+        freeList_ = parents_[node];
+        --numFree_;
+    }
+    else
+    {
+        node = (int)parents_.size();
+        parents_.push_back(-1);
+        firstChild_.push_back(-1);
+        nextSibling_.push_back(-1);
+        prevSibling_.push_back(-1);
+        localTransforms_.push_back(float3x4::identity);
+        worldTransforms_.push_back(float3x4::identity);
+        dirty_.push_back(0);
+    }
+
+    parents_[node] = -1;
+    firstChild_[node] = -1;
+    nextSibling_[node] = -1;
+    prevSibling_[node] = -1;
+    localTransforms_[node] = float3x4::identity;
+    worldTransforms_[node] = float3x4::identity;
+    dirty_[node] = 0;
+    return node;
+}
+
+void TransformHierarchy::DestroyNode(int node)
+{
+    assert(firstChild_[node] == -1);
+    SetParent(node, -1);
+    parents_[node] = freeList_;
+    freeList_ = node;
+    ++numFree_;
+}
+
+void TransformHierarchy::SetParent(int node, int parent)
+{
+    if (parents_[node] == parent)
+        return;
+    assert(parent != node);
+
+    // Unlink from the children of the old parent
+    const int oldParent = parents_[node];
+    if (oldParent != -1)
+    {
+        if (prevSibling_[node] != -1)
+            nextSibling_[prevSibling_[node]] = nextSibling_[node];
+        else
+            firstChild_[oldParent] = nextSibling_[node];
+        if (nextSibling_[node] != -1)
+            prevSibling_[nextSibling_[node]] = prevSibling_[node];
+    }
+    nextSibling_[node] = -1;
+    prevSibling_[node] = -1;
+
+    parents_[node] = parent;
+    if (parent != -1)
+    {
+        nextSibling_[node] = firstChild_[parent];
+        if (firstChild_[parent] != -1)
+            prevSibling_[firstChild_[parent]] = node;
+        firstChild_[parent] = node;
+    }
+    MarkDirty(node);
+}
+
+void TransformHierarchy::SetLocalTransform(int node, const float3x4 &localToParent)
+{
+    localTransforms_[node] = localToParent;
+    MarkDirty(node);
+}
+
+void TransformHierarchy::MarkDirty(int node)
+{
+    if (dirty_[node])
+        return;
+    dirty_[node] = 1;
+    for(int child = firstChild_[node]; child != -1; child = nextSibling_[child])
+        MarkDirty(child);
+}
+
+const float3x4 &TransformHierarchy::WorldTransform(int node) const
+{
+    if (!dirty_[node])
+        return worldTransforms_[node];
+
+    const int parent = parents_[node];
+    if (parent == -1)
+        worldTransforms_[node] = localTransforms_[node];
+    else
+        worldTransforms_[node] = WorldTransform(parent) * localTransforms_[node];
+    dirty_[node] = 0;
+    return worldTransforms_[node];
+}
@@ -0,0 +1,69 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "Math/float3x4.h"
+
+#include <vector>
+
+/// Compact transform hierarchy for computing world transforms without a renderer scene graph.
+/** The nodes are stored in flat arrays, and each node refers to its parent, first child and siblings by index. The world
+    transforms are computed lazily and cached: a change to the local transform or the parent of a node marks the world transforms
+    of the node and its subtree dirty, and a query recomputes only the dirty nodes on the path to the root. A query is O(1) when
+    nothing has changed and O(depth) otherwise, and marking stops at nodes that are already dirty.
+
+    The hierarchy is owned by the Scene, see Scene::GetTransformHierarchy(). EC_Placeable uses it instead of Ogre scene nodes
+    when the scene has no view, e.g. on a headless server.
+    \ingroup Scene_group */
+class TransformHierarchy
+{
+public:
+    TransformHierarchy();
+
+    /// Creates a new root node with an identity transform and returns its index.
+    int CreateNode();
+
+    /// Frees a node. Its index may be reused by a later CreateNode().
+    /** The node must not have any children left, so detach them first. */
+    void DestroyNode(int node);
+
+    /// Sets the parent of a node. Pass -1 to make the node a root.
+    void SetParent(int node, int parent);
+
+    /// Returns the parent of a node, or -1 if the node is a root.
+    int Parent(int node) const { return parents_[node]; }
+
+    /// Sets the local->parent transform of a node.
+    void SetLocalTransform(int node, const float3x4 &localToParent);
+
+    /// Returns the local->parent transform of a node.
+    const float3x4 &LocalTransform(int node) const { return localTransforms_[node]; }
+
+    /// Returns the local->world transform of a node, recomputing it and its ancestors if something on the path to the root has changed.
+    const float3x4 &WorldTransform(int node) const;
+
+    /// Returns the first child of a node, or -1 if the node has no children. Iterate the rest with NextSibling().
+    int FirstChild(int node) const { return firstChild_[node]; }
+
+    /// Returns the next child of the parent of a node, or -1 if the node is the last child.
+    int NextSibling(int node) const { return nextSibling_[node]; }
+
+    /// Returns the number of nodes in use.
+    size_t Size() const { return parents_.size() - numFree_; }
+
+private:
+    /// Marks the cached world transforms of the node and its subtree dirty.
+    /** A clean node always has a clean parent, so the subtree of a node that is already dirty does not need to be visited. */
+    void MarkDirty(int node);
+
+    std::vector<int> parents_; ///< Parent index of each node, -1 for roots. For free nodes, the index of the next free node.
+    std::vector<int> firstChild_;
+    std::vector<int> nextSibling_;
+    std::vector<int> prevSibling_;
+    std::vector<float3x4> localTransforms_;
+    mutable std::vector<float3x4> worldTransforms_;
+    mutable std::vector<u8> dirty_; ///< Nonzero if the cached world transform of the node has to be recomputed.
+    int freeList_;
+    size_t numFree_;
+};
@@ -27,6 +27,9 @@ namespace KristalliProtocol
         void Uninitialize();
         void Update(f64 frametime);
 
+        /// Processes the incoming network messages before the scene is simulated.
+        UpdatePhase Phase() const { return PhaseNetworkIn; }
+
         /// Connects to the Kristalli server at the given address.
         void Connect(const char *ip, unsigned short port, kNet::SocketTransportLayer transport);
 
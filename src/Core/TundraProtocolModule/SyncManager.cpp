@@ -155,9 +155,19 @@ void SyncManager::HandleKristalliMessage(kNet::MessageConnection* source, kNet::
             HandleEntityAction(source, msg);
         }
         break;
+    default:
+        currentSender = 0;
+        return;
     }
     
     currentSender = 0;
+    
+    SceneSyncState* state = GetSceneSyncState(source);
+    if (state)
+    {
+        state->bytes_received_ += numBytes;
+        ++state->messages_received_;
+    }
 }
 
 void SyncManager::NewUserConnected(UserConnection* user)
@@ -471,6 +481,18 @@ void SyncManager::Update(f64 frametime)
     }
 }
 
+namespace
+{
+    /// Sends a replication message and adds it to the traffic counters of the sync state
+    template<typename T>
+    void SendSyncMessage(kNet::MessageConnection* destination, SceneSyncState* state, const T& msg)
+    {
+        destination->Send(msg);
+        state->bytes_sent_ += msg.Size();
+        ++state->messages_sent_;
+    }
+}
+
 void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSyncState* state)
 {
     PROFILE(SyncManager_ProcessSyncState);
@@ -524,7 +546,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                 
                 entitystate->AckDirty(component->TypeId(), component->Name());
             }
-            destination->Send(msg);
+            SendSyncMessage(destination, state, msg);
             ++num_messages_sent;
         }
         else
@@ -635,12 +657,12 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                 // Send message(s) only if there were components
                 if (createMsg.components.size())
                 {
-                    destination->Send(createMsg);
+                    SendSyncMessage(destination, state, createMsg);
                     ++num_messages_sent;
                 }
                 if (updateMsg.components.size() || updateMsg.dynamiccomponents.size())
                 {
-                    destination->Send(updateMsg);
+                    SendSyncMessage(destination, state, updateMsg);
                     ++num_messages_sent;
                 }
             }
@@ -664,7 +686,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                 
                 if (removeMsg.components.size())
                 {
-                    destination->Send(removeMsg);
+                    SendSyncMessage(destination, state, removeMsg);
                     ++num_messages_sent;
                 }
             }
@@ -680,7 +702,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
     {
         MsgRemoveEntity msg;
         msg.entityID = *i;
-        destination->Send(msg);
+        SendSyncMessage(destination, state, msg);
         state->RemoveEntity(*i);
         state->AckRemove(*i);
         ++num_messages_sent;
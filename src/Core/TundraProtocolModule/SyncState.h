@@ -125,6 +125,20 @@ struct EntitySyncState
 /// State of scene replication for a specific user
 struct SceneSyncState : public ISyncState
 {
+    SceneSyncState() :
+        bytes_sent_(0),
+        messages_sent_(0),
+        bytes_received_(0),
+        messages_received_(0)
+    {
+    }
+    
+    /// Scene replication traffic to and from this client since the state was created
+    u64 bytes_sent_;
+    u64 messages_sent_;
+    u64 bytes_received_;
+    u64 messages_received_;
+    
     /// Entities that this client is already aware of
     std::map<entity_id_t, EntitySyncState> entities_;
     /// Created/modified entities
@@ -38,6 +38,9 @@ public:
     void Uninitialize();
     void Update(f64 frametime);
 
+    /// Replicates the scene changes of the frame after the simulation and the logic have run.
+    UpdatePhase Phase() const { return PhaseNetworkOut; }
+
     /// Checks whether we are a server
     bool IsServer() const;
 
@@ -6,14 +6,13 @@
  */
 
 #include "EC_ProximityTrigger.h"
+#include "ProximityTriggerManager.h"
 
 #include "Framework.h"
 #include "Scene.h"
 #include "Entity.h"
 
-#include "EC_Placeable.h"
 #include "LoggingFunctions.h"
-#include "FrameAPI.h"
 
 EC_ProximityTrigger::EC_ProximityTrigger(Scene *scene) :
     IComponent(scene),
@@ -21,81 +20,33 @@ EC_ProximityTrigger::EC_ProximityTrigger(Scene *scene) :
     thresholdDistance(this, "Threshold distance", 0.0f),
     interval(this, "Trigger signal interval", 0.0f)
 {
-    SetUpdateMode();
     connect(this, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), SLOT(OnAttributeUpdated(IAttribute*)));
+    connect(this, SIGNAL(ParentEntitySet()), SLOT(RegisterToManager()));
+    connect(this, SIGNAL(ParentEntityDetached()), SLOT(UnregisterFromManager()));
 }
 
 EC_ProximityTrigger::~EC_ProximityTrigger()
 {
+    UnregisterFromManager();
 }
 
 void EC_ProximityTrigger::OnAttributeUpdated(IAttribute* attr)
 {
-    if (attr == &interval)
-        SetUpdateMode();
+    if (attr == &interval && manager_)
+        manager_->ResetTimer(this);
 }
 
-void EC_ProximityTrigger::Update(float timeStep)
+void EC_ProximityTrigger::RegisterToManager()
 {
-    if (!active.Get())
-        return;
-    float threshold = thresholdDistance.Get();
-    
-    Entity* entity = ParentEntity();
-    if (!entity)
-        return;
-    Scene* scene = entity->ParentScene();
-    if (!scene)
-        return;
-    EC_Placeable* placeable = entity->GetComponent<EC_Placeable>().get();
-    if (!placeable)
-        return;
-    
-    EntityList otherTriggers = scene->GetEntitiesWithComponent(EC_ProximityTrigger::TypeNameStatic());
-    for(EntityList::iterator i = otherTriggers.begin(); i != otherTriggers.end(); ++i)
-    {
-        Entity* otherEntity = (*i).get();
-        if (otherEntity != entity)
-        {
-            EC_Placeable* otherPlaceable = otherEntity->GetComponent<EC_Placeable>().get();
-            if (!otherPlaceable)
-                continue;
-            float3 offset = placeable->transform.Get().pos - otherPlaceable->transform.Get().pos;
-            float distance = offset.Length();
-            
-            if ((threshold <= 0.0f) || (distance <= threshold))
-            {
-                emit triggered(otherEntity, distance);
-            }
-        }
-    }
+    UnregisterFromManager();
+    manager_ = ProximityTriggerManager::ForScene(ParentScene());
+    if (manager_)
+        manager_->Register(this);
 }
 
-void EC_ProximityTrigger::SetUpdateMode()
+void EC_ProximityTrigger::UnregisterFromManager()
 {
-    FrameAPI* frame = framework->Frame();
-    
-    float intervalSec = interval.Get();
-    if (intervalSec <= 0.0f)
-    {
-        // Update every frame
-        connect(frame, SIGNAL(Updated(float)), this, SLOT(Update(float)));
-    }
-    else
-    {
-        // Update periodically
-        disconnect(frame, SIGNAL(Updated(float)), this, SLOT(Update(float)));
-        frame->DelayedExecute(intervalSec, this, SLOT(PeriodicUpdate()));
-    }
+    if (manager_)
+        manager_->Unregister(this);
+    manager_ = 0;
 }
-
-void EC_ProximityTrigger::PeriodicUpdate()
-{
-    // Set up the next periodic update
-    float intervalSec = interval.Get();
-    if (intervalSec > 0.0f)
-        framework->Frame()->DelayedExecute(intervalSec, this, SLOT(PeriodicUpdate()));
-    
-    Update(intervalSec);
-}
-
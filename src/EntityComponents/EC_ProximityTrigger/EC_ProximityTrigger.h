@@ -11,6 +11,9 @@
 
 #include <QVector3D>
 #include <QQuaternion>
+#include <QPointer>
+
+class ProximityTriggerManager;
 
 /// EntityComponent that reports distance of other entities that also have an EC_ProximityTrigger component
 /**
@@ -31,6 +34,9 @@ also need to have EC_Placeable component so that distance can be calculated.
 <div>Interval of trigger signals in seconds. If 0, the signal is sent every frame. Default is 0.</div>
 </ul>
 
+All proximity triggers of a scene are evaluated together once per frame by ProximityTriggerManager, using a spatial hash
+so that only the nearby trigger entities are tested.
+
 <b>Exposes the following scriptable functions:</b>
 <ul>
 <li>...
@@ -80,12 +86,15 @@ public slots:
     void OnAttributeUpdated(IAttribute* attr);
     
 private slots:
-    /// Check for other triggers and emit signals
-    void Update(float timeStep);
+    /// Registers this trigger to the manager of the parent scene
+    void RegisterToManager();
+
+    /// Unregisters this trigger from the manager
+    void UnregisterFromManager();
 
-    /// Periodic update. Set up the next periodic update, then check triggers
-    void PeriodicUpdate();
+private:
+    friend class ProximityTriggerManager;
 
-    /// Change update mode (periodic, or every frame)
-    void SetUpdateMode();
+    /// Manager that evaluates this trigger, null when not in a scene
+    QPointer<ProximityTriggerManager> manager_;
 };
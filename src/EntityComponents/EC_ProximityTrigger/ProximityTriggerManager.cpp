@@ -0,0 +1,206 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ProximityTriggerManager.cpp
+ *  @brief  Evaluates all EC_ProximityTrigger components of a scene in one pass per frame.
+ */
+
+#include "ProximityTriggerManager.h"
+#include "EC_ProximityTrigger.h"
+
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "Scene.h"
+#include "Entity.h"
+#include "Profiler.h"
+#include "EC_Placeable.h"
+
+#include <algorithm>
+#include <cmath>
+
+ProximityTriggerManager *ProximityTriggerManager::ForScene(Scene *scene)
+{
+    if (!scene)
+        return 0;
+
+    QObject *existing = scene->property(PropertyName()).value<QObject*>();
+    if (existing)
+        return checked_static_cast<ProximityTriggerManager*>(existing);
+
+    // The scene owns the manager, so it is deleted along with the scene
+    ProximityTriggerManager *manager = new ProximityTriggerManager(scene->GetFramework(), scene);
+    scene->setProperty(PropertyName(), QVariant::fromValue<QObject*>(manager));
+    return manager;
+}
+
+ProximityTriggerManager::ProximityTriggerManager(Framework *framework, Scene *scene) :
+    QObject(scene)
+{
+    connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(Update(float)));
+}
+
+void ProximityTriggerManager::Register(EC_ProximityTrigger *trigger)
+{
+    for(size_t i = 0; i < triggers_.size(); ++i)
+        if (triggers_[i].trigger == trigger)
+            return;
+
+    TriggerState state;
+    state.trigger = trigger;
+    state.timeSinceUpdate = 0.0f;
+    triggers_.push_back(state);
+}
+
+void ProximityTriggerManager::Unregister(EC_ProximityTrigger *trigger)
+{
+    for(size_t i = 0; i < triggers_.size(); ++i)
+        if (triggers_[i].trigger == trigger)
+        {
+            triggers_[i] = triggers_.back();
+            triggers_.pop_back();
+            return;
+        }
+}
+
+void ProximityTriggerManager::ResetTimer(EC_ProximityTrigger *trigger)
+{
+    for(size_t i = 0; i < triggers_.size(); ++i)
+        if (triggers_[i].trigger == trigger)
+            triggers_[i].timeSinceUpdate = 0.0f;
+}
+
+unsigned long long ProximityTriggerManager::CellKey(int x, int y, int z)
+{
+    // 21 bits per axis. Coordinates far outside the range wrap around, which only causes extra distance tests.
+    const unsigned long long mask = 0x1FFFFF;
+    const int bias = 1 << 20;
+    return (((unsigned long long)(x + bias) & mask) << 42) | (((unsigned long long)(y + bias) & mask) << 21) | ((unsigned long long)(z + bias) & mask);
+}
+
+void ProximityTriggerManager::Update(float frametime)
+{
+    PROFILE(ProximityTriggerManager_Update);
+
+    entries_.clear();
+    hits_.clear();
+
+    // Snapshot the positions of all triggers, and figure out which active triggers are due for evaluation
+    dueByLevel_.clear();
+    for(size_t i = 0; i < triggers_.size(); ++i)
+    {
+        EC_ProximityTrigger *trigger = triggers_[i].trigger;
+        Entity *entity = trigger->ParentEntity();
+        if (!entity)
+            continue;
+        EC_Placeable *placeable = entity->GetComponent<EC_Placeable>().get();
+        if (!placeable)
+            continue;
+
+        Entry entry;
+        entry.trigger = trigger->shared_from_this();
+        entry.entity = entity->shared_from_this();
+        entry.pos = placeable->transform.Get().pos;
+        entry.threshold = trigger->thresholdDistance.Get();
+        entry.due = false;
+
+        if (trigger->active.Get())
+        {
+            float interval = trigger->interval.Get();
+            triggers_[i].timeSinceUpdate += frametime;
+            if (interval <= 0.0f || triggers_[i].timeSinceUpdate >= interval)
+            {
+                triggers_[i].timeSinceUpdate = 0.0f;
+                entry.due = true;
+                // Group the triggers by the power of two their threshold is below. Triggers without a threshold report every other entity.
+                int level = 0;
+                if (entry.threshold > 0.0f)
+                    frexp(entry.threshold, &level);
+                else
+                    level = cNoThreshold;
+                dueByLevel_.push_back(std::make_pair(level, (int)entries_.size()));
+            }
+        }
+        entries_.push_back(entry);
+    }
+
+    if (dueByLevel_.empty())
+        return;
+
+    std::sort(dueByLevel_.begin(), dueByLevel_.end());
+    for(size_t first = 0; first < dueByLevel_.size();)
+    {
+        const int level = dueByLevel_[first].first;
+        size_t last = first;
+        while(last < dueByLevel_.size() && dueByLevel_[last].first == level)
+            ++last;
+
+        if (level == cNoThreshold)
+        {
+            for(size_t d = first; d < last; ++d)
+            {
+                const int i = dueByLevel_[d].second;
+                for(size_t j = 0; j < entries_.size(); ++j)
+                    if ((int)j != i)
+                    {
+                        Hit hit = { i, (int)j, (entries_[i].pos - entries_[j].pos).Length() };
+                        hits_.push_back(hit);
+                    }
+            }
+            first = last;
+            continue;
+        }
+
+        // Bucket the entries into a spatial hash whose cell size is the power of two above the thresholds of this group,
+        // so that a query sphere, whose radius is at most one cell, overlaps at most three cells along each axis,
+        // however large the thresholds of the other groups are.
+        const float invCellSize = (float)ldexp(1.0, -level);
+        cells_.clear();
+        for(size_t i = 0; i < entries_.size(); ++i)
+        {
+            const float3 &pos = entries_[i].pos;
+            cells_.push_back(CellItem(CellKey((int)floor(pos.x * invCellSize), (int)floor(pos.y * invCellSize), (int)floor(pos.z * invCellSize)), (int)i));
+        }
+        std::sort(cells_.begin(), cells_.end());
+
+        for(size_t d = first; d < last; ++d)
+        {
+            const int i = dueByLevel_[d].second;
+            const Entry &entry = entries_[i];
+            const float3 minPos = entry.pos - float3(entry.threshold, entry.threshold, entry.threshold);
+            const float3 maxPos = entry.pos + float3(entry.threshold, entry.threshold, entry.threshold);
+            const int minX = (int)floor(minPos.x * invCellSize), maxX = (int)floor(maxPos.x * invCellSize);
+            const int minY = (int)floor(minPos.y * invCellSize), maxY = (int)floor(maxPos.y * invCellSize);
+            const int minZ = (int)floor(minPos.z * invCellSize), maxZ = (int)floor(maxPos.z * invCellSize);
+            for(int x = minX; x <= maxX; ++x)
+                for(int y = minY; y <= maxY; ++y)
+                    for(int z = minZ; z <= maxZ; ++z)
+                    {
+                        const unsigned long long key = CellKey(x, y, z);
+                        std::vector<CellItem>::const_iterator iter = std::lower_bound(cells_.begin(), cells_.end(), CellItem(key, -1));
+                        for(; iter != cells_.end() && iter->first == key; ++iter)
+                        {
+                            int j = iter->second;
+                            if (j == i)
+                                continue;
+                            float distance = (entry.pos - entries_[j].pos).Length();
+                            if (distance <= entry.threshold)
+                            {
+                                Hit hit = { i, j, distance };
+                                hits_.push_back(hit);
+                            }
+                        }
+                    }
+        }
+        first = last;
+    }
+
+    // Emit the signals last, as the receivers may modify the scene. Everything is re-validated through weak pointers.
+    for(size_t i = 0; i < hits_.size(); ++i)
+    {
+        const Hit &hit = hits_[i];
+        ComponentPtr trigger = entries_[hit.trigger].trigger.lock();
+        EntityPtr other = entries_[hit.other].entity.lock();
+        if (trigger && other && other.get() != trigger->ParentEntity())
+            emit checked_static_cast<EC_ProximityTrigger*>(trigger.get())->triggered(other.get(), hit.distance);
+    }
+}
@@ -0,0 +1,93 @@
+/**
+ *  For conditions of distribution and use, see copyright notice in license.txt
+ *
+ *  @file   ProximityTriggerManager.h
+ *  @brief  Evaluates all EC_ProximityTrigger components of a scene in one pass per frame.
+ */
+
+#pragma once
+
+#include "SceneFwd.h"
+#include "Math/float3.h"
+
+#include <QObject>
+
+#include <vector>
+#include <utility>
+
+class Framework;
+class EC_ProximityTrigger;
+
+/// Evaluates all EC_ProximityTrigger components of a scene centrally, once per frame.
+/** The triggers due for an update are grouped by the power of two above their threshold distance. For each group, the trigger
+    positions are bucketed into a uniform spatial hash with that power of two as the cell size, so that each trigger only needs
+    to test the entities in the neighbouring cells, and one large trigger does not make the cells of the small ones coarse.
+    The working buffers are reused between frames to avoid per-frame allocations.
+
+    One manager is created for each scene on demand, and is owned by the scene. Use ForScene() to access it. */
+class ProximityTriggerManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    /// Returns the manager of a scene, creating it if it does not exist yet.
+    static ProximityTriggerManager *ForScene(Scene *scene);
+
+    /// Dynamic scene property name
+    static const char* PropertyName() { return "proximitytriggers"; }
+
+    /// Starts evaluating a trigger. Called by EC_ProximityTrigger when it is added to an entity.
+    void Register(EC_ProximityTrigger *trigger);
+
+    /// Stops evaluating a trigger. Called by EC_ProximityTrigger when it is removed or destroyed.
+    void Unregister(EC_ProximityTrigger *trigger);
+
+    /// Resets the interval timer of a trigger, so that it is evaluated on the next frame.
+    void ResetTimer(EC_ProximityTrigger *trigger);
+
+private slots:
+    /// Evaluates the triggers that are due for an update and emits their signals.
+    void Update(float frametime);
+
+private:
+    ProximityTriggerManager(Framework *framework, Scene *scene);
+
+    /// Registered trigger and the time elapsed since it was last evaluated
+    struct TriggerState
+    {
+        EC_ProximityTrigger *trigger;
+        float timeSinceUpdate;
+    };
+
+    /// Per-frame snapshot of a trigger entity
+    struct Entry
+    {
+        ComponentWeakPtr trigger;
+        EntityWeakPtr entity;
+        float3 pos;
+        float threshold;
+        bool due;
+    };
+
+    /// Pair of entries within range of each other, waiting for the signal to be emitted
+    struct Hit
+    {
+        int trigger;
+        int other;
+        float distance;
+    };
+
+    typedef std::pair<unsigned long long, int> CellItem;
+
+    /// Group of the triggers that have no threshold distance, sorted after the others.
+    static const int cNoThreshold = 0x7FFFFFFF;
+
+    /// Returns the hash key of the cell the given integer coordinates correspond to.
+    static unsigned long long CellKey(int x, int y, int z);
+
+    std::vector<TriggerState> triggers_;
+    std::vector<Entry> entries_;
+    std::vector<CellItem> cells_; ///< Entry indices sorted by cell key.
+    std::vector<Hit> hits_;
+    std::vector<std::pair<int, int> > dueByLevel_; ///< Entry indices of the due triggers, sorted by the power of two above their threshold.
+};
@@ -116,6 +116,7 @@ EC_Script::EC_Script(Scene* scene):
     runMode(this, "Run mode", RM_Both),
     applicationName(this, "Script application name"),
     className(this, "Script class name"),
+    sharedEngine(this, "Shared engine", false),
     scriptInstance_(0),
     isClient_(false),
     isServer_(false)
@@ -195,6 +196,12 @@ void EC_Script::HandleAttributeChanged(IAttribute* attribute, AttributeChange::T
     {
         emit ClassNameChanged(className.Get());
     }
+    else if (attribute == &sharedEngine)
+    {
+        // Recreate the script instance in the requested kind of engine, if the scripts have been loaded.
+        if (!scriptAssets.empty())
+            OnScriptAssetLoaded(AssetPtr());
+    }
     else if (attribute == &runMode)
     {
         // If we had not loaded script assets previously because of runmode not allowing, load them now
@@ -42,6 +42,9 @@ may optionally define a destructor called OnScriptObjectDestroyed
 <div>Name for the script application.</div>
 <li>QString: className
 <div>The script class to instantiate from within an existing application. Syntax: ApplicationName.ClassName</div>
+<li>bool: sharedEngine
+<div>Whether the scripts are run in a script engine shared with other script applications, which saves memory and startup time.
+Only the applications from the same trust level share an engine.</div>
 </ul>
 
 <b>Exposes the following scriptable functions:</b>
@@ -99,6 +102,10 @@ public:
     /// The script class to instantiate from within an existing application. Syntax: applicationName.className
     Q_PROPERTY(QString className READ getclassName WRITE setclassName);
     DEFINE_QPROPERTY_ATTRIBUTE(QString, className);
+
+    /// Whether the scripts are run in a script engine shared with other script applications
+    Q_PROPERTY(bool sharedEngine READ getsharedEngine WRITE setsharedEngine);
+    DEFINE_QPROPERTY_ATTRIBUTE(bool, sharedEngine);
     
     /// Sets new script instance.
     /** Unloads and deletes possible already existing script instance.
@@ -3,6 +3,7 @@
 #include <boost/regex.hpp>
 #include <QList>
 #include <QDir>
+#include <QCryptographicHash>
 #include "MemoryLeakCheck.h"
 
 #include "ScriptAsset.h"
@@ -16,6 +17,7 @@ ScriptAsset::~ScriptAsset()
 void ScriptAsset::DoUnload()
 {
     scriptContent = "";
+    contentHash.clear();
     references.clear();
 }
 
@@ -23,12 +25,18 @@ bool ScriptAsset::DeserializeFromData(const u8 *data, size_t numBytes, const boo
 {
     QByteArray arr((const char *)data, numBytes);
     scriptContent = arr;
+    contentHash = ContentHash(scriptContent);
 
     ParseReferences();
     assetAPI->AssetLoadCompleted(Name());
     return true;
 }
 
+QByteArray ScriptAsset::ContentHash(const QString &content)
+{
+    return QCryptographicHash::hash(content.toUtf8(), QCryptographicHash::Md5);
+}
+
 bool ScriptAsset::SerializeTo(std::vector<u8> &dst, const QString &serializationParameters) const
 {
     QByteArray arr(scriptContent.toStdString().c_str());
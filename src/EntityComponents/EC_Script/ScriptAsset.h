@@ -35,6 +35,12 @@ public:
 
     QString scriptContent;
 
+    /// Hash of the scriptContent, computed on load. Identifies the content in the compiled program cache of the script engines.
+    QByteArray contentHash;
+
+    /// Returns the hash that identifies the given script content. Also used by the script engines for the content that is not loaded from assets.
+    static QByteArray ContentHash(const QString &content);
+
     bool IsLoaded() const;
 
 private slots: